@@ -84,6 +84,7 @@
 #include <math.h>
 #include "builtin_functions.h"
 #include "util/hash_table.h"
+#include "util/set.h"
 
 #ifndef M_PIf
 #define M_PIf   ((float) M_PI)
@@ -990,18 +991,40 @@ public:
    ir_function_signature *find(_mesa_glsl_parse_state *state,
                                const char *name, exec_list *actual_parameters);
 
+   /**
+    * Look up a built-in function or intrinsic, creating it on first use.
+    */
+   ir_function *get_function(const char *name);
+
    /**
     * A shader to hold all the built-in signatures; created by this module.
     *
     * This includes signatures for every built-in, regardless of version or
     * enabled extensions.  The availability predicate associated with each
     * signature allows matching_signature() to filter out the irrelevant ones.
+    *
+    * Built-ins are only added to it when they are first looked up with
+    * get_function().
     */
    gl_shader *shader;
 
 private:
    void *mem_ctx;
 
+   /**
+    * Names of the built-ins which weren't created yet.
+    *
+    * Most shaders use a handful of the thousands of built-in signatures, so
+    * initialize() only runs create_intrinsics() and create_builtins() to
+    * collect the names.  get_function() runs them again for each built-in
+    * it creates, with \c creating set to its name, which has add_function()
+    * skip building the signatures of all the others.
+    */
+   struct set *pending;
+   const char *creating;
+
+   bool wants_function(const char *name);
+
    void create_shader();
    void create_intrinsics();
    void create_builtins();
@@ -1384,6 +1407,8 @@ builtin_builder::builtin_builder()
    : shader(NULL)
 {
    mem_ctx = NULL;
+   pending = NULL;
+   creating = NULL;
 }
 
 builtin_builder::~builtin_builder()
@@ -1412,7 +1437,7 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
     */
    state->uses_builtin_functions = true;
 
-   ir_function *f = shader->symbols->get_function(name);
+   ir_function *f = get_function(name);
    if (f == NULL)
       return NULL;
 
@@ -1435,15 +1460,54 @@ builtin_builder::initialize()
 
    mem_ctx = ralloc_context(NULL);
    create_shader();
+
+   pending = _mesa_set_create(mem_ctx, _mesa_hash_string,
+                              _mesa_key_string_equal);
+   creating = NULL;
    create_intrinsics();
    create_builtins();
 }
 
+ir_function *
+builtin_builder::get_function(const char *name)
+{
+   struct set_entry *entry = _mesa_set_search(pending, name);
+
+   if (entry != NULL) {
+      /* Creating a built-in may look up the intrinsics it calls. */
+      const char *outer = creating;
+
+      creating = (const char *) entry->key;
+      _mesa_set_remove(pending, entry);
+      create_intrinsics();
+      create_builtins();
+      creating = outer;
+   }
+
+   return shader->symbols->get_function(name);
+}
+
+/**
+ * Whether add_function() should create the function with the given name,
+ * see builtin_builder::pending.
+ */
+bool
+builtin_builder::wants_function(const char *name)
+{
+   if (creating == NULL) {
+      _mesa_set_add(pending, name);
+      return false;
+   }
+
+   return strcmp(name, creating) == 0;
+}
+
 void
 builtin_builder::release()
 {
    ralloc_free(mem_ctx);
    mem_ctx = NULL;
+   pending = NULL;
 
    ralloc_free(shader);
    shader = NULL;
@@ -1464,6 +1528,15 @@ builtin_builder::create_shader()
 
 /** @} */
 
+/* Only evaluate the signatures of the functions wants_function() asks for,
+ * in create_intrinsics() and create_builtins().
+ */
+#define add_function(NAME, ...)                 \
+   do {                                         \
+      if (wants_function(NAME))                 \
+         add_function(NAME, __VA_ARGS__);       \
+   } while (0)
+
 /**
  * Create ir_function and ir_function_signature objects for each
  * intrinsic.
@@ -5425,6 +5498,8 @@ builtin_builder::create_builtins()
 #undef FIU2_MIXED
 }
 
+#undef add_function
+
 void
 builtin_builder::add_function(const char *name, ...)
 {
@@ -5495,6 +5570,9 @@ builtin_builder::add_image_function(const char *name,
       glsl_type::uimage2DMSArray_type
    };
 
+   if (!wants_function(name))
+      return;
+
    ir_function *f = new(mem_ctx) ir_function(name);
 
    for (unsigned i = 0; i < ARRAY_SIZE(types); ++i) {
@@ -7108,7 +7186,7 @@ builtin_builder::_is_sparse_texels_resident(void)
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
    ir_function *f =
-      shader->symbols->get_function("__intrinsic_is_sparse_texels_resident");
+      get_function("__intrinsic_is_sparse_texels_resident");
 
    body.emit(call(f, retval, sig->parameters));
    body.emit(ret(retval));
@@ -7965,7 +8043,7 @@ builtin_builder::_atomic_counter_op(const char *intrinsic,
    MAKE_SIG(glsl_type::uint_type, avail, 1, counter);
 
    ir_variable *retval = body.make_temp(glsl_type::uint_type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -7996,7 +8074,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
       parameters.push_tail(new(mem_ctx) ir_dereference_variable(neg_data));
 
       ir_function *const func =
-         shader->symbols->get_function("__intrinsic_atomic_add");
+         get_function("__intrinsic_atomic_add");
       ir_instruction *const c = call(func, retval, parameters);
 
       assert(c != NULL);
@@ -8004,7 +8082,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
 
       body.emit(c);
    } else {
-      body.emit(call(shader->symbols->get_function(intrinsic), retval,
+      body.emit(call(get_function(intrinsic), retval,
                      sig->parameters));
    }
 
@@ -8022,7 +8100,7 @@ builtin_builder::_atomic_counter_op2(const char *intrinsic,
    MAKE_SIG(glsl_type::uint_type, avail, 3, counter, compare, data);
 
    ir_variable *retval = body.make_temp(glsl_type::uint_type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8040,7 +8118,7 @@ builtin_builder::_atomic_op2(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8059,7 +8137,7 @@ builtin_builder::_atomic_op3(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8274,7 +8352,7 @@ builtin_builder::_image(image_prototype_ctr prototype,
 
    if (flags & IMAGE_FUNCTION_EMIT_STUB) {
       ir_factory body(&sig->body, mem_ctx);
-      ir_function *f = shader->symbols->get_function(intrinsic_name);
+      ir_function *f = get_function(intrinsic_name);
 
       if (flags & IMAGE_FUNCTION_RETURNS_VOID) {
          body.emit(call(f, NULL, sig->parameters));
@@ -8326,7 +8404,7 @@ builtin_builder::_memory_barrier(const char *intrinsic_name,
                                  builtin_available_predicate avail)
 {
    MAKE_SIG(glsl_type::void_type, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -8348,7 +8426,7 @@ builtin_builder::_ballot()
    MAKE_SIG(glsl_type::uint64_t_type, shader_ballot, 1, value);
    ir_variable *retval = body.make_temp(glsl_type::uint64_t_type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_ballot"),
+   body.emit(call(get_function("__intrinsic_ballot"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8371,7 +8449,7 @@ builtin_builder::_read_first_invocation(const glsl_type *type)
    MAKE_SIG(type, shader_ballot, 1, value);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_first_invocation"),
+   body.emit(call(get_function("__intrinsic_read_first_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8396,7 +8474,7 @@ builtin_builder::_read_invocation(const glsl_type *type)
    MAKE_SIG(type, shader_ballot, 2, value, invocation);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_invocation"),
+   body.emit(call(get_function("__intrinsic_read_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8415,7 +8493,7 @@ builtin_builder::_invocation_interlock(const char *intrinsic_name,
                                        builtin_available_predicate avail)
 {
    MAKE_SIG(glsl_type::void_type, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -8436,7 +8514,7 @@ builtin_builder::_shader_clock(builtin_available_predicate avail,
 
    ir_variable *retval = body.make_temp(glsl_type::uvec2_type, "clock_retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shader_clock"),
+   body.emit(call(get_function("__intrinsic_shader_clock"),
                   retval, sig->parameters));
 
    if (type == glsl_type::uint64_t_type) {
@@ -8467,7 +8545,7 @@ builtin_builder::_vote(const char *intrinsic_name,
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
 
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8488,7 +8566,7 @@ builtin_builder::_helper_invocation()
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_helper_invocation"),
+   body.emit(call(get_function("__intrinsic_helper_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
 
@@ -8544,7 +8622,7 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    ir_function *f;
    bool ret = false;
    mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   f = builtins.get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
          if (sig->is_builtin_available(state)) {
@@ -8558,10 +8636,15 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    return ret;
 }
 
-gl_shader *
-_mesa_glsl_get_builtin_function_shader()
+ir_function *
+_mesa_glsl_get_builtin_function(const char *name)
 {
-   return builtins.shader;
+   ir_function *f;
+   mtx_lock(&builtins_lock);
+   f = builtins.get_function(name);
+   mtx_unlock(&builtins_lock);
+
+   return f;
 }
 
 
@@ -24,8 +24,6 @@
 #ifndef BULITIN_FUNCTIONS_H
 #define BULITIN_FUNCTIONS_H
 
-struct gl_shader;
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,8 +46,12 @@ extern bool
 _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state,
                                 const char *name);
 
-extern gl_shader *
-_mesa_glsl_get_builtin_function_shader(void);
+/**
+ * Look up a built-in function by name, whether or not any of its signatures
+ * is available to the shader being compiled.
+ */
+extern ir_function *
+_mesa_glsl_get_builtin_function(const char *name);
 
 extern ir_function_signature *
 _mesa_get_main_function_signature(glsl_symbol_table *symbols);
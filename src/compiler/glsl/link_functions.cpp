@@ -111,7 +111,7 @@ public:
        */
       ir_function *f = linked->symbols->get_function(name);
       if (f == NULL) {
-	 f = new(linked) ir_function(name);
+	 f = new(linked->ir) ir_function(name);
 
 	 /* Add the new function to the linked IR.  Put it at the end
           * so that it comes after any global variable declarations
@@ -124,7 +124,7 @@ public:
       ir_function_signature *linked_sig =
 	 f->exact_matching_signature(NULL, &callee->parameters);
       if (linked_sig == NULL) {
-	 linked_sig = new(linked) ir_function_signature(callee->return_type);
+	 linked_sig = new(linked->ir) ir_function_signature(callee->return_type);
 	 f->add_signature(linked_sig);
       }
 
@@ -153,7 +153,7 @@ public:
       foreach_in_list(const ir_instruction, original, &sig->parameters) {
          assert(const_cast<ir_instruction *>(original)->as_variable());
 
-         ir_instruction *copy = original->clone(linked, ht);
+         ir_instruction *copy = original->clone(linked->ir, ht);
          formal_parameters.push_tail(copy);
       }
 
@@ -163,7 +163,7 @@ public:
 
       if (sig->is_defined) {
          foreach_in_list(const ir_instruction, original, &sig->body) {
-            ir_instruction *copy = original->clone(linked, ht);
+            ir_instruction *copy = original->clone(linked->ir, ht);
             linked_sig->body.push_tail(copy);
          }
 
@@ -228,7 +228,7 @@ public:
 	    /* Clone the ir_variable that the dereference already has and add
 	     * it to the linked shader.
 	     */
-	    var = ir->var->clone(linked, NULL);
+	    var = ir->var->clone(linked->ir, NULL);
 	    linked->symbols->add_variable(var);
 	    linked->ir->push_head(var);
 	 } else {
@@ -1355,7 +1355,7 @@ remap_variables(ir_instruction *inst, struct gl_linked_shader *target,
          if (existing != NULL)
             ir->var = existing;
          else {
-            ir_variable *copy = ir->var->clone(this->target, NULL);
+            ir_variable *copy = ir->var->clone(this->instructions, NULL);
 
             this->symbols->add_variable(copy);
             this->instructions->push_head(copy);
@@ -1422,7 +1422,7 @@ move_non_declarations(exec_list *instructions, exec_node *last,
              || ((var != NULL) && (var->data.mode == ir_var_temporary)));
 
       if (make_copies) {
-         inst = inst->clone(target, NULL);
+         inst = inst->clone(target->ir, NULL);
 
          if (var != NULL)
             _mesa_hash_table_insert(temps, var, inst);
@@ -2292,7 +2292,7 @@ link_output_variables(struct gl_linked_shader *linked_shader,
 
          if (var->data.mode == ir_var_shader_out &&
                !symbols->get_variable(var->name)) {
-            var = var->clone(linked_shader, NULL);
+            var = var->clone(linked_shader->ir, NULL);
             symbols->add_variable(var);
             linked_shader->ir->push_head(var);
          }
@@ -2421,8 +2421,12 @@ link_intrastage_shaders(void *mem_ctx,
    /* Don't use _mesa_reference_program() just take ownership */
    linked->Program = gl_prog;
 
-   linked->ir = new(linked) exec_list;
-   clone_ir_list(mem_ctx, linked->ir, main->ir);
+   /* The linked IR is thrown away as a whole once it's converted to NIR, so
+    * carve it from an arena rather than allocating each node on its own.
+    */
+   linked->ir = (exec_list *) ralloc_arena_size(linked, sizeof(exec_list));
+   linked->ir->make_empty();
+   clone_ir_list(linked->ir, linked->ir, main->ir);
 
    link_fs_inout_layout_qualifiers(prog, linked, shader_list, num_shaders);
    link_tcs_out_layout_qualifiers(prog, gl_prog, shader_list, num_shaders);
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+#include <gtest/gtest.h>
+#include <chrono>
+#include "standalone_scaffolding.h"
+#include "main/mtypes.h"
+#include "ir.h"
+#include "glsl_parser_extras.h"
+#include "builtin_functions.h"
+
+class builtin_functions : public ::testing::Test {
+public:
+   virtual void SetUp();
+   virtual void TearDown();
+
+   struct _mesa_glsl_parse_state *state;
+   struct gl_shader *shader;
+   void *mem_ctx;
+   gl_context ctx;
+};
+
+void
+builtin_functions::SetUp()
+{
+   glsl_type_singleton_init_or_ref();
+   _mesa_glsl_builtin_functions_init_or_ref();
+
+   this->mem_ctx = ralloc_context(NULL);
+
+   initialize_context_to_defaults(&this->ctx, API_OPENGL_COMPAT);
+
+   this->shader = rzalloc(this->mem_ctx, gl_shader);
+   this->shader->Type = GL_VERTEX_SHADER;
+   this->shader->Stage = MESA_SHADER_VERTEX;
+
+   this->state =
+      new(mem_ctx) _mesa_glsl_parse_state(&this->ctx, this->shader->Stage,
+                                          this->shader);
+}
+
+void
+builtin_functions::TearDown()
+{
+   ralloc_free(this->mem_ctx);
+   this->mem_ctx = NULL;
+
+   _mesa_glsl_builtin_functions_decref();
+   glsl_type_singleton_decref();
+}
+
+TEST_F(builtin_functions, created_once)
+{
+   exec_list params;
+   params.push_tail(new(mem_ctx) ir_constant(1.0f));
+
+   ir_function_signature *sig =
+      _mesa_glsl_find_builtin_function(state, "sin", &params);
+   ASSERT_NE(sig, nullptr);
+   EXPECT_TRUE(sig->is_builtin());
+   EXPECT_STREQ(sig->function_name(), "sin");
+
+   EXPECT_EQ(_mesa_glsl_find_builtin_function(state, "sin", &params), sig);
+   EXPECT_EQ(_mesa_glsl_get_builtin_function("sin"), sig->function());
+}
+
+TEST_F(builtin_functions, unknown_name)
+{
+   exec_list params;
+
+   EXPECT_EQ(_mesa_glsl_find_builtin_function(state, "not_a_builtin", &params),
+             nullptr);
+   EXPECT_FALSE(_mesa_glsl_has_builtin_function(state, "not_a_builtin"));
+   EXPECT_TRUE(_mesa_glsl_has_builtin_function(state, "dot"));
+}
+
+TEST_F(builtin_functions, calls_intrinsic)
+{
+   /* Creating the built-in creates the intrinsic it calls as well. */
+   ir_function *f = _mesa_glsl_get_builtin_function("atomicCounterIncrement");
+   ASSERT_NE(f, nullptr);
+
+   ir_function_signature *sig =
+      (ir_function_signature *) f->signatures.get_head();
+   ir_call *call = NULL;
+   foreach_in_list(ir_instruction, ir, &sig->body) {
+      call = ir->as_call();
+      if (call)
+         break;
+   }
+   ASSERT_NE(call, nullptr);
+
+   EXPECT_EQ(call->callee->function(),
+             _mesa_glsl_get_builtin_function("__intrinsic_atomic_increment"));
+   EXPECT_TRUE(call->callee->is_intrinsic());
+}
+
+/* Time it takes to have the built-ins a typical shader uses, starting with
+ * the first reference to the module.  Run with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST_F(builtin_functions, DISABLED_first_shader_benchmark)
+{
+   static const char *const names[] = {
+      "texture", "texture2D", "dot", "normalize", "max", "min", "clamp",
+      "mix", "pow", "reflect", "length", "fract",
+   };
+
+   /* Drop the reference of SetUp() to start from scratch. */
+   _mesa_glsl_builtin_functions_decref();
+
+   auto start = std::chrono::steady_clock::now();
+
+   _mesa_glsl_builtin_functions_init_or_ref();
+   for (unsigned i = 0; i < ARRAY_SIZE(names); i++)
+      EXPECT_NE(_mesa_glsl_get_builtin_function(names[i]), nullptr);
+
+   auto end = std::chrono::steady_clock::now();
+
+   printf("built-ins of a first shader: %.2f ms\n",
+          std::chrono::duration<double, std::milli>(end - start).count());
+}
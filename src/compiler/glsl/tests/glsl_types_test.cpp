@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "glsl_types.h"
+
+class glsl_types_interning : public ::testing::Test {
+public:
+   virtual void SetUp()
+   {
+      glsl_type_singleton_init_or_ref();
+   }
+
+   virtual void TearDown()
+   {
+      glsl_type_singleton_decref();
+   }
+};
+
+static const glsl_type *
+struct_type(unsigned i)
+{
+   glsl_struct_field fields[2] = {
+      glsl_struct_field(glsl_type::vec4_type, "a"),
+      glsl_struct_field(glsl_type::get_array_instance(glsl_type::float_type,
+                                                      i + 1), "b"),
+   };
+   return glsl_type::get_struct_instance(fields, 2, "s");
+}
+
+TEST_F(glsl_types_interning, same_instance_across_threads)
+{
+   const unsigned num_threads = 8, num_types = 500;
+   std::vector<std::vector<const glsl_type *>> results(num_threads);
+   std::vector<std::thread> threads;
+
+   for (unsigned t = 0; t < num_threads; t++) {
+      threads.emplace_back([&results, t]() {
+         for (unsigned i = 0; i < num_types; i++) {
+            /* Start at different types to have threads insert concurrently. */
+            unsigned n = (i + t * 61) % num_types;
+            results[t].push_back(
+               glsl_type::get_array_instance(glsl_type::vec4_type, n + 1));
+            results[t].push_back(struct_type(n));
+         }
+      });
+   }
+   for (auto &thread : threads)
+      thread.join();
+
+   for (unsigned i = 0; i < num_types; i++) {
+      const glsl_type *array =
+         glsl_type::get_array_instance(glsl_type::vec4_type, i + 1);
+      EXPECT_EQ(array->length, i + 1);
+      EXPECT_EQ(array->fields.array, glsl_type::vec4_type);
+
+      const glsl_type *s = struct_type(i);
+      EXPECT_EQ(s->fields.structure[1].type->length, i + 1);
+
+      for (unsigned t = 0; t < num_threads; t++) {
+         unsigned j = (i + num_types - t * 61 % num_types) % num_types;
+         EXPECT_EQ(results[t][j * 2], array);
+         EXPECT_EQ(results[t][j * 2 + 1], s);
+      }
+   }
+}
+
+TEST_F(glsl_types_interning, distinct_keys)
+{
+   const glsl_type *a = glsl_type::get_array_instance(glsl_type::float_type, 4);
+
+   EXPECT_NE(a, glsl_type::get_array_instance(glsl_type::float_type, 5));
+   EXPECT_NE(a, glsl_type::get_array_instance(glsl_type::int_type, 4));
+   EXPECT_NE(a, glsl_type::get_array_instance(glsl_type::float_type, 4, 16));
+   EXPECT_EQ(a, glsl_type::get_array_instance(glsl_type::float_type, 4));
+
+   const glsl_type *m = glsl_type::get_instance(GLSL_TYPE_FLOAT, 4, 4, 16);
+   EXPECT_EQ(m->explicit_stride, 16u);
+   EXPECT_EQ(m, glsl_type::get_instance(GLSL_TYPE_FLOAT, 4, 4, 16));
+   EXPECT_NE(m, glsl_type::get_instance(GLSL_TYPE_FLOAT, 4, 4, 16, true));
+}
+
+/* Type lookups of threads compiling shaders at once, which mostly find
+ * types that already exist.  This only times the lookups, not whole
+ * compiles, so it shows the contention on the type tables but not how much
+ * of a compile it is.
+ */
+static double
+lookups_per_second(unsigned num_threads)
+{
+   const unsigned iterations = 200000;
+   std::vector<std::thread> threads;
+
+   auto start = std::chrono::steady_clock::now();
+
+   for (unsigned t = 0; t < num_threads; t++) {
+      threads.emplace_back([]() {
+         for (unsigned i = 0; i < iterations; i++) {
+            glsl_type::get_array_instance(glsl_type::vec4_type, i % 64 + 1);
+            glsl_type::get_instance(GLSL_TYPE_FLOAT, 4, 4, 16);
+         }
+      });
+   }
+   for (auto &thread : threads)
+      thread.join();
+
+   auto end = std::chrono::steady_clock::now();
+   double sec = std::chrono::duration<double>(end - start).count();
+   return num_threads * iterations * 2 / sec;
+}
+
+/* Run with --gtest_also_run_disabled_tests. */
+TEST_F(glsl_types_interning, DISABLED_benchmark)
+{
+   for (unsigned num_threads = 1; num_threads <= 8; num_threads *= 2) {
+      printf("%u threads: %12.0f lookups/s\n", num_threads,
+             lookups_per_second(num_threads));
+   }
+}
@@ -26,16 +26,145 @@
 #include "compiler/glsl/glsl_parser_extras.h"
 #include "glsl_types.h"
 #include "util/hash_table.h"
+#include "util/u_atomic.h"
 #include "util/u_string.h"
 
 
 mtx_t glsl_type::hash_mutex = _MTX_INITIALIZER_NP;
-hash_table *glsl_type::explicit_matrix_types = NULL;
-hash_table *glsl_type::array_types = NULL;
-hash_table *glsl_type::struct_types = NULL;
-hash_table *glsl_type::interface_types = NULL;
-hash_table *glsl_type::function_types = NULL;
-hash_table *glsl_type::subroutine_types = NULL;
+
+/**
+ * Insert-only table of derived types, which can be searched without holding
+ * glsl_type::hash_mutex.
+ *
+ * Types are only inserted with the mutex held, and each slot is published
+ * with a release store of its type pointer, so a search racing with an
+ * insertion sees either an empty slot or a fully constructed type.  Searches
+ * which miss take the mutex and search again before creating the type.
+ *
+ * Growing the table publishes a new array of slots the same way.  The old
+ * one is kept until the types are released, since searches may still be
+ * walking it.
+ */
+struct glsl_type_slot {
+   uint32_t hash;
+   const glsl_type *type;
+};
+
+struct glsl_type_slots {
+   uint32_t size;
+   struct glsl_type_slots *prev;
+   struct glsl_type_slot *entries;
+};
+
+struct glsl_type_table {
+   struct glsl_type_slots *slots;
+   unsigned count;
+};
+
+typedef bool (*glsl_type_key_equals)(const void *key, const void *type);
+
+static const glsl_type *
+glsl_type_table_search(const glsl_type_table *table, const void *key,
+                       uint32_t hash, glsl_type_key_equals equals)
+{
+   struct glsl_type_slots *slots = p_atomic_read(&table->slots);
+   if (slots == NULL)
+      return NULL;
+
+   /* Tables are at most half full, so this ends at an empty slot. */
+   const uint32_t mask = slots->size - 1;
+   for (uint32_t i = hash & mask, step = 1; ; i = (i + step++) & mask) {
+      const glsl_type *type = p_atomic_read(&slots->entries[i].type);
+      if (type == NULL)
+         return NULL;
+
+      if (slots->entries[i].hash == hash && equals(key, type))
+         return type;
+   }
+}
+
+static void
+glsl_type_slots_add(struct glsl_type_slots *slots, const glsl_type *type,
+                    uint32_t hash)
+{
+   const uint32_t mask = slots->size - 1;
+   uint32_t i = hash & mask;
+   for (uint32_t step = 1; slots->entries[i].type != NULL; step++)
+      i = (i + step) & mask;
+
+   slots->entries[i].hash = hash;
+   p_atomic_set(&slots->entries[i].type, type);
+}
+
+/** Adds a type which isn't in the table yet, with hash_mutex held. */
+static void
+glsl_type_table_insert(glsl_type_table *table, const glsl_type *type,
+                       uint32_t hash)
+{
+   struct glsl_type_slots *old = table->slots;
+
+   if (old == NULL || (table->count + 1) * 2 > old->size) {
+      const uint32_t size = old ? old->size * 2 : 64;
+      struct glsl_type_slots *slots = (struct glsl_type_slots *)
+         calloc(1, sizeof(*slots) + size * sizeof(*slots->entries));
+
+      slots->size = size;
+      slots->prev = old;
+      slots->entries = (struct glsl_type_slot *) (slots + 1);
+
+      if (old != NULL) {
+         for (uint32_t i = 0; i < old->size; i++) {
+            if (old->entries[i].type != NULL) {
+               glsl_type_slots_add(slots, old->entries[i].type,
+                                   old->entries[i].hash);
+            }
+         }
+      }
+
+      p_atomic_set(&table->slots, slots);
+   }
+
+   glsl_type_slots_add(table->slots, type, hash);
+   table->count++;
+}
+
+static void
+glsl_type_table_destroy(glsl_type_table *table)
+{
+   struct glsl_type_slots *slots = table->slots;
+
+   if (slots != NULL) {
+      for (uint32_t i = 0; i < slots->size; i++)
+         delete slots->entries[i].type;
+   }
+
+   while (slots != NULL) {
+      struct glsl_type_slots *prev = slots->prev;
+      free(slots);
+      slots = prev;
+   }
+
+   table->slots = NULL;
+   table->count = 0;
+}
+
+/** Known explicit matrix and vector types, keyed by name. */
+static glsl_type_table explicit_matrix_types;
+
+/** Known array types. */
+static glsl_type_table array_types;
+
+/** Known struct types. */
+static glsl_type_table struct_types;
+
+/** Known interface types. */
+static glsl_type_table interface_types;
+
+/** Known function types. */
+static glsl_type_table function_types;
+
+/** Known subroutine types. */
+static glsl_type_table subroutine_types;
 
 /* There might be multiple users for types (e.g. application using OpenGL
  * and Vulkan simultaneously or app using multiple Vulkan instances). Counter
@@ -505,17 +634,6 @@ const glsl_type *glsl_type::get_uint16_type() const
                        this->interface_row_major);
 }
 
-static void
-hash_free_type_function(struct hash_entry *entry)
-{
-   glsl_type *type = (glsl_type *) entry->data;
-
-   if (type->is_array())
-      free((void*)entry->key);
-
-   delete type;
-}
-
 void
 glsl_type_singleton_init_or_ref()
 {
@@ -536,36 +654,12 @@ glsl_type_singleton_decref()
       return;
    }
 
-   if (glsl_type::explicit_matrix_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::explicit_matrix_types,
-                               hash_free_type_function);
-      glsl_type::explicit_matrix_types = NULL;
-   }
-
-   if (glsl_type::array_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::array_types, hash_free_type_function);
-      glsl_type::array_types = NULL;
-   }
-
-   if (glsl_type::struct_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::struct_types, hash_free_type_function);
-      glsl_type::struct_types = NULL;
-   }
-
-   if (glsl_type::interface_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::interface_types, hash_free_type_function);
-      glsl_type::interface_types = NULL;
-   }
-
-   if (glsl_type::function_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::function_types, hash_free_type_function);
-      glsl_type::function_types = NULL;
-   }
-
-   if (glsl_type::subroutine_types != NULL) {
-      _mesa_hash_table_destroy(glsl_type::subroutine_types, hash_free_type_function);
-      glsl_type::subroutine_types = NULL;
-   }
+   glsl_type_table_destroy(&explicit_matrix_types);
+   glsl_type_table_destroy(&array_types);
+   glsl_type_table_destroy(&struct_types);
+   glsl_type_table_destroy(&interface_types);
+   glsl_type_table_destroy(&function_types);
+   glsl_type_table_destroy(&subroutine_types);
 
    mtx_unlock(&glsl_type::hash_mutex);
 }
@@ -660,6 +754,12 @@ VECN(components, uint16_t, u16vec)
 VECN(components, int8_t, i8vec)
 VECN(components, uint8_t, u8vec)
 
+static bool
+explicit_matrix_key_equals(const void *key, const void *type)
+{
+   return strcmp(((const glsl_type *) type)->name, (const char *) key) == 0;
+}
+
 const glsl_type *
 glsl_type::get_instance(unsigned base_type, unsigned rows, unsigned columns,
                         unsigned explicit_stride, bool row_major,
@@ -687,37 +787,31 @@ glsl_type::get_instance(unsigned base_type, unsigned rows, unsigned columns,
       snprintf(name, sizeof(name), "%sx%ua%uB%s", bare_type->name,
                explicit_stride, explicit_alignment, row_major ? "RM" : "");
 
-      mtx_lock(&glsl_type::hash_mutex);
-      assert(glsl_type_users > 0);
-
-      if (explicit_matrix_types == NULL) {
-         explicit_matrix_types =
-            _mesa_hash_table_create(NULL, _mesa_hash_string,
-                                    _mesa_key_string_equal);
-      }
-
-      const struct hash_entry *entry =
-         _mesa_hash_table_search(explicit_matrix_types, name);
-      if (entry == NULL) {
-         const glsl_type *t = new glsl_type(bare_type->gl_type,
-                                            (glsl_base_type)base_type,
-                                            rows, columns, name,
-                                            explicit_stride, row_major,
-                                            explicit_alignment);
+      const uint32_t hash = _mesa_hash_string(name);
+      const glsl_type *t =
+         glsl_type_table_search(&explicit_matrix_types, name, hash,
+                                explicit_matrix_key_equals);
+      if (t == NULL) {
+         mtx_lock(&glsl_type::hash_mutex);
+         assert(glsl_type_users > 0);
+
+         t = glsl_type_table_search(&explicit_matrix_types, name, hash,
+                                    explicit_matrix_key_equals);
+         if (t == NULL) {
+            t = new glsl_type(bare_type->gl_type, (glsl_base_type)base_type,
+                              rows, columns, name, explicit_stride,
+                              row_major, explicit_alignment);
+            glsl_type_table_insert(&explicit_matrix_types, t, hash);
+         }
 
-         entry = _mesa_hash_table_insert(explicit_matrix_types,
-                                         t->name, (void *)t);
+         mtx_unlock(&glsl_type::hash_mutex);
       }
 
-      assert(((glsl_type *) entry->data)->base_type == base_type);
-      assert(((glsl_type *) entry->data)->vector_elements == rows);
-      assert(((glsl_type *) entry->data)->matrix_columns == columns);
-      assert(((glsl_type *) entry->data)->explicit_stride == explicit_stride);
-      assert(((glsl_type *) entry->data)->explicit_alignment == explicit_alignment);
-
-      const glsl_type *t = (const glsl_type *) entry->data;
-
-      mtx_unlock(&glsl_type::hash_mutex);
+      assert(t->base_type == base_type);
+      assert(t->vector_elements == rows);
+      assert(t->matrix_columns == columns);
+      assert(t->explicit_stride == explicit_stride);
+      assert(t->explicit_alignment == explicit_alignment);
 
       return t;
    }
@@ -1227,44 +1321,52 @@ glsl_type::get_image_instance(enum glsl_sampler_dim dim,
    unreachable("switch statement above should be complete");
 }
 
+/* Array types are keyed on the base type pointer rather than its name,
+ * since the name of the base type may not be unique across shaders.  For
+ * example, two shaders may have different record types named 'foo'.
+ */
+struct array_key {
+   const glsl_type *base;
+   unsigned array_size;
+   unsigned explicit_stride;
+};
+
+static bool
+array_key_equals(const void *key, const void *type)
+{
+   const struct array_key *k = (const struct array_key *) key;
+   const glsl_type *t = (const glsl_type *) type;
+
+   return t->fields.array == k->base && t->length == k->array_size &&
+          t->explicit_stride == k->explicit_stride;
+}
+
 const glsl_type *
 glsl_type::get_array_instance(const glsl_type *base,
                               unsigned array_size,
                               unsigned explicit_stride)
 {
-   /* Generate a name using the base type pointer in the key.  This is
-    * done because the name of the base type may not be unique across
-    * shaders.  For example, two shaders may have different record types
-    * named 'foo'.
-    */
-   char key[128];
-   snprintf(key, sizeof(key), "%p[%u]x%uB", (void *) base, array_size,
-            explicit_stride);
+   const struct array_key key = { base, array_size, explicit_stride };
+   const uint32_t hash = _mesa_hash_data(&key, sizeof(key));
 
-   mtx_lock(&glsl_type::hash_mutex);
-   assert(glsl_type_users > 0);
-
-   if (array_types == NULL) {
-      array_types = _mesa_hash_table_create(NULL, _mesa_hash_string,
-                                            _mesa_key_string_equal);
-   }
+   const glsl_type *t =
+      glsl_type_table_search(&array_types, &key, hash, array_key_equals);
+   if (t == NULL) {
+      mtx_lock(&glsl_type::hash_mutex);
+      assert(glsl_type_users > 0);
 
-   const struct hash_entry *entry = _mesa_hash_table_search(array_types, key);
-   if (entry == NULL) {
-      const glsl_type *t = new glsl_type(base, array_size, explicit_stride);
+      t = glsl_type_table_search(&array_types, &key, hash, array_key_equals);
+      if (t == NULL) {
+         t = new glsl_type(base, array_size, explicit_stride);
+         glsl_type_table_insert(&array_types, t, hash);
+      }
 
-      entry = _mesa_hash_table_insert(array_types,
-                                      strdup(key),
-                                      (void *) t);
+      mtx_unlock(&glsl_type::hash_mutex);
    }
 
-   assert(((glsl_type *) entry->data)->base_type == GLSL_TYPE_ARRAY);
-   assert(((glsl_type *) entry->data)->length == array_size);
-   assert(((glsl_type *) entry->data)->fields.array == base);
-
-   glsl_type *t = (glsl_type *) entry->data;
-
-   mtx_unlock(&glsl_type::hash_mutex);
+   assert(t->base_type == GLSL_TYPE_ARRAY);
+   assert(t->length == array_size);
+   assert(t->fields.array == base);
 
    return t;
 }
@@ -1452,33 +1554,30 @@ glsl_type::get_struct_instance(const glsl_struct_field *fields,
                                bool packed, unsigned explicit_alignment)
 {
    const glsl_type key(fields, num_fields, name, packed, explicit_alignment);
+   const uint32_t hash = record_key_hash(&key);
 
-   mtx_lock(&glsl_type::hash_mutex);
-   assert(glsl_type_users > 0);
-
-   if (struct_types == NULL) {
-      struct_types = _mesa_hash_table_create(NULL, record_key_hash,
-                                             record_key_compare);
-   }
+   const glsl_type *t =
+      glsl_type_table_search(&struct_types, &key, hash, record_key_compare);
+   if (t == NULL) {
+      mtx_lock(&glsl_type::hash_mutex);
+      assert(glsl_type_users > 0);
 
-   const struct hash_entry *entry = _mesa_hash_table_search(struct_types,
-                                                            &key);
-   if (entry == NULL) {
-      const glsl_type *t = new glsl_type(fields, num_fields, name, packed,
-                                         explicit_alignment);
+      t = glsl_type_table_search(&struct_types, &key, hash,
+                                 record_key_compare);
+      if (t == NULL) {
+         t = new glsl_type(fields, num_fields, name, packed,
+                           explicit_alignment);
+         glsl_type_table_insert(&struct_types, t, hash);
+      }
 
-      entry = _mesa_hash_table_insert(struct_types, t, (void *) t);
+      mtx_unlock(&glsl_type::hash_mutex);
    }
 
-   assert(((glsl_type *) entry->data)->base_type == GLSL_TYPE_STRUCT);
-   assert(((glsl_type *) entry->data)->length == num_fields);
-   assert(strcmp(((glsl_type *) entry->data)->name, name) == 0);
-   assert(((glsl_type *) entry->data)->packed == packed);
-   assert(((glsl_type *) entry->data)->explicit_alignment == explicit_alignment);
-
-   glsl_type *t = (glsl_type *) entry->data;
-
-   mtx_unlock(&glsl_type::hash_mutex);
+   assert(t->base_type == GLSL_TYPE_STRUCT);
+   assert(t->length == num_fields);
+   assert(strcmp(t->name, name) == 0);
+   assert(t->packed == packed);
+   assert(t->explicit_alignment == explicit_alignment);
 
    return t;
 }
@@ -1492,31 +1591,27 @@ glsl_type::get_interface_instance(const glsl_struct_field *fields,
                                   const char *block_name)
 {
    const glsl_type key(fields, num_fields, packing, row_major, block_name);
+   const uint32_t hash = record_key_hash(&key);
 
-   mtx_lock(&glsl_type::hash_mutex);
-   assert(glsl_type_users > 0);
-
-   if (interface_types == NULL) {
-      interface_types = _mesa_hash_table_create(NULL, record_key_hash,
-                                                record_key_compare);
-   }
+   const glsl_type *t =
+      glsl_type_table_search(&interface_types, &key, hash, record_key_compare);
+   if (t == NULL) {
+      mtx_lock(&glsl_type::hash_mutex);
+      assert(glsl_type_users > 0);
 
-   const struct hash_entry *entry = _mesa_hash_table_search(interface_types,
-                                                            &key);
-   if (entry == NULL) {
-      const glsl_type *t = new glsl_type(fields, num_fields,
-                                         packing, row_major, block_name);
+      t = glsl_type_table_search(&interface_types, &key, hash,
+                                 record_key_compare);
+      if (t == NULL) {
+         t = new glsl_type(fields, num_fields, packing, row_major, block_name);
+         glsl_type_table_insert(&interface_types, t, hash);
+      }
 
-      entry = _mesa_hash_table_insert(interface_types, t, (void *) t);
+      mtx_unlock(&glsl_type::hash_mutex);
    }
 
-   assert(((glsl_type *) entry->data)->base_type == GLSL_TYPE_INTERFACE);
-   assert(((glsl_type *) entry->data)->length == num_fields);
-   assert(strcmp(((glsl_type *) entry->data)->name, block_name) == 0);
-
-   glsl_type *t = (glsl_type *) entry->data;
-
-   mtx_unlock(&glsl_type::hash_mutex);
+   assert(t->base_type == GLSL_TYPE_INTERFACE);
+   assert(t->length == num_fields);
+   assert(strcmp(t->name, block_name) == 0);
 
    return t;
 }
@@ -1525,29 +1620,27 @@ const glsl_type *
 glsl_type::get_subroutine_instance(const char *subroutine_name)
 {
    const glsl_type key(subroutine_name);
+   const uint32_t hash = record_key_hash(&key);
 
-   mtx_lock(&glsl_type::hash_mutex);
-   assert(glsl_type_users > 0);
-
-   if (subroutine_types == NULL) {
-      subroutine_types = _mesa_hash_table_create(NULL, record_key_hash,
-                                                 record_key_compare);
-   }
+   const glsl_type *t =
+      glsl_type_table_search(&subroutine_types, &key, hash,
+                             record_key_compare);
+   if (t == NULL) {
+      mtx_lock(&glsl_type::hash_mutex);
+      assert(glsl_type_users > 0);
 
-   const struct hash_entry *entry = _mesa_hash_table_search(subroutine_types,
-                                                            &key);
-   if (entry == NULL) {
-      const glsl_type *t = new glsl_type(subroutine_name);
+      t = glsl_type_table_search(&subroutine_types, &key, hash,
+                                 record_key_compare);
+      if (t == NULL) {
+         t = new glsl_type(subroutine_name);
+         glsl_type_table_insert(&subroutine_types, t, hash);
+      }
 
-      entry = _mesa_hash_table_insert(subroutine_types, t, (void *) t);
+      mtx_unlock(&glsl_type::hash_mutex);
    }
 
-   assert(((glsl_type *) entry->data)->base_type == GLSL_TYPE_SUBROUTINE);
-   assert(strcmp(((glsl_type *) entry->data)->name, subroutine_name) == 0);
-
-   glsl_type *t = (glsl_type *) entry->data;
-
-   mtx_unlock(&glsl_type::hash_mutex);
+   assert(t->base_type == GLSL_TYPE_SUBROUTINE);
+   assert(strcmp(t->name, subroutine_name) == 0);
 
    return t;
 }
@@ -1581,29 +1674,28 @@ glsl_type::get_function_instance(const glsl_type *return_type,
                                  unsigned num_params)
 {
    const glsl_type key(return_type, params, num_params);
+   const uint32_t hash = function_key_hash(&key);
 
-   mtx_lock(&glsl_type::hash_mutex);
-   assert(glsl_type_users > 0);
-
-   if (function_types == NULL) {
-      function_types = _mesa_hash_table_create(NULL, function_key_hash,
-                                               function_key_compare);
-   }
+   const glsl_type *t =
+      glsl_type_table_search(&function_types, &key, hash,
+                             function_key_compare);
+   if (t == NULL) {
+      mtx_lock(&glsl_type::hash_mutex);
+      assert(glsl_type_users > 0);
 
-   struct hash_entry *entry = _mesa_hash_table_search(function_types, &key);
-   if (entry == NULL) {
-      const glsl_type *t = new glsl_type(return_type, params, num_params);
+      t = glsl_type_table_search(&function_types, &key, hash,
+                                 function_key_compare);
+      if (t == NULL) {
+         t = new glsl_type(return_type, params, num_params);
+         glsl_type_table_insert(&function_types, t, hash);
+      }
 
-      entry = _mesa_hash_table_insert(function_types, t, (void *) t);
+      mtx_unlock(&glsl_type::hash_mutex);
    }
 
-   const glsl_type *t = (const glsl_type *)entry->data;
-
    assert(t->base_type == GLSL_TYPE_FUNCTION);
    assert(t->length == num_params);
 
-   mtx_unlock(&glsl_type::hash_mutex);
-
    return t;
 }
 
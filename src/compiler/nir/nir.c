@@ -87,6 +87,8 @@ static const struct debug_named_value nir_debug_control[] = {
      "Dump resulting kernel shader after each successful lowering/optimization call" },
    { "print_consts", NIR_DEBUG_PRINT_CONSTS,
      "Print const value near each use of const SSA variable" },
+   { "algebraic_interp", NIR_DEBUG_ALGEBRAIC_INTERP,
+     "Match algebraic transforms with the nir_search interpreter instead of the generated matchers" },
    { NULL }
 };
 
@@ -308,7 +308,8 @@ class Variable(Value):
       assert self.var_name != 'False'
 
       self.is_constant = m.group('const') is not None
-      self.cond_index = get_cond_index(algebraic_pass.variable_cond, m.group('cond'))
+      self.cond = m.group('cond')
+      self.cond_index = get_cond_index(algebraic_pass.variable_cond, self.cond)
       self.required_type = m.group('type')
       self._bit_size = int(m.group('bits')) if m.group('bits') else None
       self.swiz = m.group('swiz')
@@ -798,6 +799,166 @@ class SearchAndReplace(object):
 
       BitSizeValidator(varset).validate(self.search, self.replace)
 
+class Matcher(object):
+   """Generates the C code matching a search expression.
+
+   The code does what match_expression() in nir_search.c does when it
+   interprets the expression: it tries every combination of commutative
+   sources and checks opcodes, bit sizes, conditions, constants and
+   variables in the same order, leaving the same match_state behind.  What
+   the interpreter looks up in the tables at run time is known here, so the
+   checks are compiled in and the walk over the expression is unrolled.
+
+   Search expressions with more commutative expressions than the interpreter
+   flips are left to the interpreter.
+   """
+
+   def __init__(self, search):
+      self.search = search
+      self.lines = []
+      self.temps = itertools.count()
+      self.seen = set()
+
+   @staticmethod
+   def can_generate(search):
+      if search.comm_exprs > nir_search_max_comm_ops:
+         return False
+
+      def sources_ok(expr):
+         if not isinstance(expr, Expression):
+            return True
+         if expr.opcode not in conv_opcode_types and \
+            len(expr.sources) != opcodes[expr.opcode].num_inputs:
+            return False
+         return all(sources_ok(src) for src in expr.sources)
+
+      return sources_ok(search)
+
+   def _emit(self, line):
+      self.lines.append(line)
+
+   def _fail_if(self, cond):
+      self._emit('if ({})'.format(cond))
+      self._emit('   continue;')
+
+   def _temp(self, prefix):
+      return '{}{}'.format(prefix, next(self.temps))
+
+   def _expression(self, expr, instr, num_components, swizzle):
+      """Emits the checks of an expression against instr, whose value is read
+      with num_components and swizzle.  A swizzle of None is the identity.
+      """
+      if expr.opcode in conv_opcode_types:
+         self._fail_if('nir_search_op_for_nir_op({}->op) != {}'.format(
+                       instr, expr.c_opcode()))
+         output_size = 0
+         input_sizes = [0]
+      else:
+         self._fail_if('{}->op != {}'.format(instr, expr.c_opcode()))
+         output_size = opcodes[expr.opcode].output_size
+         input_sizes = opcodes[expr.opcode].input_sizes
+
+      if expr.c_bit_size > 0:
+         self._fail_if('{}->dest.dest.ssa.bit_size != {}'.format(
+                       instr, expr.c_bit_size))
+
+      if expr.cond:
+         self._fail_if('!{}({})'.format(expr.cond, instr))
+
+      if expr.inexact:
+         self._emit('state->inexact_match = true;')
+      if not expr.ignore_exact:
+         self._emit('state->has_exact_alu = state->has_exact_alu || '
+                    '{}->exact;'.format(instr))
+      if expr.inexact or not expr.ignore_exact:
+         self._fail_if('state->inexact_match && state->has_exact_alu')
+
+      if output_size != 0 and swizzle is not None:
+         self._fail_if('!nir_search_swizzle_is_identity({}, {})'.format(
+                       swizzle, num_components))
+
+      flip = None
+      if 0 <= expr.comm_expr_idx < nir_search_max_comm_ops:
+         flip = self._temp('flip')
+         self._emit('const unsigned {} = (comb >> {}) & 1;'.format(
+                    flip, expr.comm_expr_idx))
+
+      for i, src in enumerate(expr.sources):
+         if flip is None or i >= 2:
+            src_idx = str(i)
+         else:
+            src_idx = flip if i == 0 else flip + ' ^ 1'
+
+         if input_sizes[i] != 0:
+            self._value(src, instr, src_idx, str(input_sizes[i]), None)
+         else:
+            self._value(src, instr, src_idx, num_components, swizzle)
+
+   def _value(self, val, instr, src_idx, num_components, swizzle):
+      alu_src = '{}->src[{}]'.format(instr, src_idx)
+
+      if swizzle is None:
+         new_swizzle = alu_src + '.swizzle'
+      else:
+         new_swizzle = self._temp('swizzle')
+         self._emit('uint8_t {}[NIR_MAX_VEC_COMPONENTS] = {{ 0 }};'.format(
+                    new_swizzle))
+         self._emit('nir_search_compose_swizzle({}, &{}, {}, {});'.format(
+                    new_swizzle, alu_src, num_components, swizzle))
+
+      if isinstance(val, Expression):
+         # The bit size is checked on the destination of the source.
+         src_instr = self._temp('instr')
+         self._emit('nir_alu_instr *{} = nir_src_as_alu_instr({}.src);'.format(
+                    src_instr, alu_src))
+         self._fail_if('{} == NULL'.format(src_instr))
+         self._expression(val, src_instr, num_components, new_swizzle)
+         return
+
+      if val.c_bit_size > 0:
+         self._fail_if('nir_src_bit_size({}.src) != {}'.format(
+                       alu_src, val.c_bit_size))
+
+      if isinstance(val, Constant):
+         self._fail_if('!nir_search_src_is_constant({}.src, {}, {}, {}, '
+                       '(uint64_t)({}))'.format(alu_src, num_components,
+                                                new_swizzle, val.type(),
+                                                val.hex()))
+      elif val.index in self.seen:
+         self._fail_if('!nir_search_variable_matches(state, {}, &{}, {}, '
+                       '{})'.format(val.index, alu_src, num_components,
+                                    new_swizzle))
+      else:
+         self.seen.add(val.index)
+         if val.is_constant:
+            self._fail_if('!nir_src_is_const({}.src)'.format(alu_src))
+         if val.cond:
+            self._fail_if('!{}(state->range_ht, {}, {}, {}, {})'.format(
+                          val.cond, instr, src_idx, num_components,
+                          new_swizzle))
+         if val.type():
+            self._fail_if('!nir_search_src_is_type({}.src, {})'.format(
+                          alu_src, val.type()))
+         self._emit('nir_search_bind_variable(state, {}, &{}, {}, {});'.format(
+                    val.index, alu_src, num_components, new_swizzle))
+
+   def body(self):
+      """Returns the statements of the matcher, which gets the instruction
+      as instr and the match_state as state.
+      """
+      self._emit('state->variables_seen = 0;')
+      self._expression(self.search, 'instr', 'num_components', None)
+      self._emit('return true;')
+
+      loop = ['for (unsigned comb = 0; comb < {}; comb++) {{'.format(
+              1 << self.search.comm_exprs)]
+      loop += ['   ' + l for l in self.lines]
+      loop += ['}', 'return false;']
+      if any('num_components' in l for l in self.lines):
+         loop.insert(0, 'const unsigned num_components = '
+                        'instr->dest.dest.ssa.num_components;')
+      return '\n'.join('   ' + l for l in loop)
+
 class TreeAutomaton(object):
    """This class calculates a bottom-up tree automaton to quickly search for
    the left-hand sides of tranforms. Tree automatons are a generalization of
@@ -1104,10 +1265,18 @@ static const nir_search_variable_cond ${pass_name}_variable_cond[] = {
 };
 % endif
 
+% for name, body in matchers:
+static bool
+${name}(nir_alu_instr *instr, struct match_state *state)
+{
+${body}
+}
+
+% endfor
 static const struct transform ${pass_name}_transforms[] = {
 % for i in automaton.state_patterns:
 % if i is not None:
-   { ${xforms[i].search.array_index}, ${xforms[i].replace.array_index}, ${xforms[i].condition_index} },
+   { ${xforms[i].search.array_index}, ${xforms[i].replace.array_index}, ${xforms[i].condition_index}, ${xform_matchers[i]} },
 % else:
    { ~0, ~0, ~0 }, /* Sentinel */
 
@@ -1187,8 +1356,9 @@ ${pass_name}(nir_shader *shader)
 
 
 class AlgebraicPass(object):
-   def __init__(self, pass_name, transforms):
+   def __init__(self, pass_name, transforms, generate_matchers=False):
       self.xforms = []
+      self.generate_matchers = generate_matchers
       self.opcode_xforms = defaultdict(lambda : [])
       self.pass_name = pass_name
       self.expression_cond = {}
@@ -1249,9 +1419,31 @@ class AlgebraicPass(object):
          sys.exit(1)
 
 
+   def _matchers(self):
+      """Returns the generated matchers as (name, body) pairs and the name
+      of the matcher of each transform, NULL if it is interpreted.  Transforms
+      with the same search expression share a matcher.
+      """
+      matchers = {}
+      xform_matchers = []
+      for xform in self.xforms:
+         if not self.generate_matchers or not Matcher.can_generate(xform.search):
+            xform_matchers.append('NULL')
+            continue
+
+         body = Matcher(xform.search).body()
+         if body not in matchers:
+            matchers[body] = '{}_match{}'.format(self.pass_name, len(matchers))
+         xform_matchers.append(matchers[body])
+
+      return [(name, body) for body, name in matchers.items()], xform_matchers
+
    def render(self):
+      matchers, xform_matchers = self._matchers()
       return _algebraic_pass_template.render(pass_name=self.pass_name,
                                              xforms=self.xforms,
+                                             matchers=matchers,
+                                             xform_matchers=xform_matchers,
                                              opcode_xforms=self.opcode_xforms,
                                              condition_list=condition_list,
                                              automaton=self.automaton,
@@ -27,6 +27,7 @@
 from collections import OrderedDict
 import nir_algebraic
 from nir_opcodes import type_sizes
+import argparse
 import itertools
 import struct
 from math import pi
@@ -3005,10 +3006,18 @@ distribute_src_mods = [
    (('fabs', ('fsign(is_used_once)', a)), ('fsign', ('fabs', a))),
 ]
 
-print(nir_algebraic.AlgebraicPass("nir_opt_algebraic", optimizations).render())
+parser = argparse.ArgumentParser()
+parser.add_argument('--generate-matchers', action='store_true',
+                    help='Emit specialized C matchers for nir_opt_algebraic '
+                         'and nir_opt_algebraic_late')
+args = parser.parse_args()
+
+print(nir_algebraic.AlgebraicPass("nir_opt_algebraic", optimizations,
+                                  args.generate_matchers).render())
 print(nir_algebraic.AlgebraicPass("nir_opt_algebraic_before_ffma",
                                   before_ffma_optimizations).render())
 print(nir_algebraic.AlgebraicPass("nir_opt_algebraic_late",
-                                  late_optimizations).render())
+                                  late_optimizations,
+                                  args.generate_matchers).render())
 print(nir_algebraic.AlgebraicPass("nir_opt_algebraic_distribute_src_mods",
                                   distribute_src_mods).render())
@@ -34,21 +34,6 @@
 /* This should be the same as nir_search_max_comm_ops in nir_algebraic.py. */
 #define NIR_SEARCH_MAX_COMM_OPS 8
 
-struct match_state {
-   bool inexact_match;
-   bool has_exact_alu;
-   uint8_t comm_op_direction;
-   unsigned variables_seen;
-
-   /* Used for running the automaton on newly-constructed instructions. */
-   struct util_dynarray *states;
-   const struct per_op_table *pass_op_table;
-   const nir_algebraic_table *table;
-
-   nir_alu_src variables[NIR_SEARCH_MAX_VARIABLES];
-   struct hash_table *range_ht;
-};
-
 static bool
 match_expression(const nir_algebraic_table *table, const nir_search_expression *expr, nir_alu_instr *instr,
                  unsigned num_components, const uint8_t *swizzle,
@@ -70,8 +55,8 @@ static const uint8_t identity_swizzle[NIR_MAX_VEC_COMPONENTS] =
  *
  * Used for satisfying 'a@type' constraints.
  */
-static bool
-src_is_type(nir_src src, nir_alu_type type)
+bool
+nir_search_src_is_type(nir_src src, nir_alu_type type)
 {
    assert(type != nir_type_invalid);
 
@@ -87,10 +72,10 @@ src_is_type(nir_src src, nir_alu_type type)
          case nir_op_iand:
          case nir_op_ior:
          case nir_op_ixor:
-            return src_is_type(src_alu->src[0].src, nir_type_bool) &&
-                   src_is_type(src_alu->src[1].src, nir_type_bool);
+            return nir_search_src_is_type(src_alu->src[0].src, nir_type_bool) &&
+                   nir_search_src_is_type(src_alu->src[1].src, nir_type_bool);
          case nir_op_inot:
-            return src_is_type(src_alu->src[0].src, nir_type_bool);
+            return nir_search_src_is_type(src_alu->src[0].src, nir_type_bool);
          default:
             break;
          }
@@ -110,6 +95,62 @@ src_is_type(nir_src src, nir_alu_type type)
    return false;
 }
 
+/**
+ * Check if a source is a constant with the given value in all the components
+ * read.
+ *
+ * The value is that of nir_search_constant::data, reinterpreted as a double
+ * for floats.
+ */
+bool
+nir_search_src_is_constant(nir_src src, unsigned num_components,
+                           const uint8_t *swizzle, nir_alu_type type,
+                           uint64_t value)
+{
+   if (!nir_src_is_const(src))
+      return false;
+
+   switch (type) {
+   case nir_type_float: {
+      nir_load_const_instr *const load =
+         nir_instr_as_load_const(src.ssa->parent_instr);
+
+      /* There are 8-bit and 1-bit integer types, but there are no 8-bit or
+       * 1-bit float types.  This prevents potential assertion failures in
+       * nir_src_comp_as_float.
+       */
+      if (load->def.bit_size < 16)
+         return false;
+
+      double d;
+      memcpy(&d, &value, sizeof(d));
+
+      for (unsigned i = 0; i < num_components; ++i) {
+         double val = nir_src_comp_as_float(src, swizzle[i]);
+         if (val != d)
+            return false;
+      }
+      return true;
+   }
+
+   case nir_type_int:
+   case nir_type_uint:
+   case nir_type_bool: {
+      unsigned bit_size = nir_src_bit_size(src);
+      uint64_t mask = u_uintN_max(bit_size);
+      for (unsigned i = 0; i < num_components; ++i) {
+         uint64_t val = nir_src_comp_as_uint(src, swizzle[i]);
+         if ((val & mask) != (value & mask))
+            return false;
+      }
+      return true;
+   }
+
+   default:
+      unreachable("Invalid alu source type");
+   }
+}
+
 static bool
 nir_op_matches_search_op(nir_op nop, uint16_t sop)
 {
@@ -277,8 +318,8 @@ match_value(const nir_algebraic_table *table,
       swizzle = identity_swizzle;
    }
 
-   for (unsigned i = 0; i < num_components; ++i)
-      new_swizzle[i] = instr->src[src].swizzle[swizzle[i]];
+   nir_search_compose_swizzle(new_swizzle, &instr->src[src], num_components,
+                              swizzle);
 
    /* If the value has a specific bit size and it doesn't match, bail */
    if (value->bit_size > 0 &&
@@ -299,17 +340,9 @@ match_value(const nir_algebraic_table *table,
       assert(var->variable < NIR_SEARCH_MAX_VARIABLES);
 
       if (state->variables_seen & (1 << var->variable)) {
-         if (state->variables[var->variable].src.ssa != instr->src[src].src.ssa)
-            return false;
-
-         assert(!instr->src[src].abs && !instr->src[src].negate);
-
-         for (unsigned i = 0; i < num_components; ++i) {
-            if (state->variables[var->variable].swizzle[i] != new_swizzle[i])
-               return false;
-         }
-
-         return true;
+         return nir_search_variable_matches(state, var->variable,
+                                            &instr->src[src], num_components,
+                                            new_swizzle);
       } else {
          if (var->is_constant &&
              instr->src[src].src.ssa->parent_instr->type != nir_instr_type_load_const)
@@ -320,69 +353,20 @@ match_value(const nir_algebraic_table *table,
             return false;
 
          if (var->type != nir_type_invalid &&
-             !src_is_type(instr->src[src].src, var->type))
+             !nir_search_src_is_type(instr->src[src].src, var->type))
             return false;
 
-         state->variables_seen |= (1 << var->variable);
-         state->variables[var->variable].src = instr->src[src].src;
-         state->variables[var->variable].abs = false;
-         state->variables[var->variable].negate = false;
-
-         for (unsigned i = 0; i < NIR_MAX_VEC_COMPONENTS; ++i) {
-            if (i < num_components)
-               state->variables[var->variable].swizzle[i] = new_swizzle[i];
-            else
-               state->variables[var->variable].swizzle[i] = 0;
-         }
-
+         nir_search_bind_variable(state, var->variable, &instr->src[src],
+                                  num_components, new_swizzle);
          return true;
       }
    }
 
    case nir_search_value_constant: {
       nir_search_constant *const_val = nir_search_value_as_constant(value);
-
-      if (!nir_src_is_const(instr->src[src].src))
-         return false;
-
-      switch (const_val->type) {
-      case nir_type_float: {
-         nir_load_const_instr *const load =
-            nir_instr_as_load_const(instr->src[src].src.ssa->parent_instr);
-
-         /* There are 8-bit and 1-bit integer types, but there are no 8-bit or
-          * 1-bit float types.  This prevents potential assertion failures in
-          * nir_src_comp_as_float.
-          */
-         if (load->def.bit_size < 16)
-            return false;
-
-         for (unsigned i = 0; i < num_components; ++i) {
-            double val = nir_src_comp_as_float(instr->src[src].src,
-                                               new_swizzle[i]);
-            if (val != const_val->data.d)
-               return false;
-         }
-         return true;
-      }
-
-      case nir_type_int:
-      case nir_type_uint:
-      case nir_type_bool: {
-         unsigned bit_size = nir_src_bit_size(instr->src[src].src);
-         uint64_t mask = u_uintN_max(bit_size);
-         for (unsigned i = 0; i < num_components; ++i) {
-            uint64_t val = nir_src_comp_as_uint(instr->src[src].src,
-                                                new_swizzle[i]);
-            if ((val & mask) != (const_val->data.u & mask))
-               return false;
-         }
-         return true;
-      }
-
-      default:
-         unreachable("Invalid alu source type");
-      }
+      return nir_search_src_is_constant(instr->src[src].src, num_components,
+                                        new_swizzle, const_val->type,
+                                        const_val->data.u);
    }
 
    default:
@@ -421,12 +405,9 @@ match_expression(const nir_algebraic_table *table, const nir_search_expression *
     * swizzle through.  We can only properly propagate swizzles if the
     * instruction is vectorized.
     */
-   if (nir_op_infos[instr->op].output_size != 0) {
-      for (unsigned i = 0; i < num_components; i++) {
-         if (swizzle[i] != i)
-            return false;
-      }
-   }
+   if (nir_op_infos[instr->op].output_size != 0 &&
+       !nir_search_swizzle_is_identity(swizzle, num_components))
+      return false;
 
    /* If this is a commutative expression and it's one of the first few, look
     * up its direction for the current search operation.  We'll use that value
@@ -692,14 +673,10 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
                   const nir_algebraic_table *table,
                   const nir_search_expression *search,
                   const nir_search_value *replace,
+                  nir_search_match_func match,
                   nir_instr_worklist *algebraic_worklist,
                   struct exec_list *dead_instrs)
 {
-   uint8_t swizzle[NIR_MAX_VEC_COMPONENTS] = { 0 };
-
-   for (unsigned i = 0; i < instr->dest.dest.ssa.num_components; ++i)
-      swizzle[i] = i;
-
    assert(instr->dest.dest.is_ssa);
 
    struct match_state state;
@@ -711,22 +688,31 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
 
    STATIC_ASSERT(sizeof(state.comm_op_direction) * 8 >= NIR_SEARCH_MAX_COMM_OPS);
 
-   unsigned comm_expr_combinations =
-      1 << MIN2(search->comm_exprs, NIR_SEARCH_MAX_COMM_OPS);
-
    bool found = false;
-   for (unsigned comb = 0; comb < comm_expr_combinations; comb++) {
-      /* The bitfield of directions is just the current iteration.  Hooray for
-       * binary.
-       */
-      state.comm_op_direction = comb;
-      state.variables_seen = 0;
+   if (match != NULL && !NIR_DEBUG(ALGEBRAIC_INTERP)) {
+      found = match(instr, &state);
+   } else {
+      uint8_t swizzle[NIR_MAX_VEC_COMPONENTS] = { 0 };
 
-      if (match_expression(table, search, instr,
-                           instr->dest.dest.ssa.num_components,
-                           swizzle, &state)) {
-         found = true;
-         break;
+      for (unsigned i = 0; i < instr->dest.dest.ssa.num_components; ++i)
+         swizzle[i] = i;
+
+      unsigned comm_expr_combinations =
+         1 << MIN2(search->comm_exprs, NIR_SEARCH_MAX_COMM_OPS);
+
+      for (unsigned comb = 0; comb < comm_expr_combinations; comb++) {
+         /* The bitfield of directions is just the current iteration.  Hooray
+          * for binary.
+          */
+         state.comm_op_direction = comb;
+         state.variables_seen = 0;
+
+         if (match_expression(table, search, instr,
+                              instr->dest.dest.ssa.num_components,
+                              swizzle, &state)) {
+            found = true;
+            break;
+         }
       }
    }
    if (!found)
@@ -896,7 +882,8 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
           !(table->values[xform->search].expression.inexact && ignore_inexact) &&
           nir_replace_instr(build, alu, range_ht, states, table,
                             &table->values[xform->search].expression,
-                            &table->values[xform->replace].value, worklist, dead_instrs)) {
+                            &table->values[xform->replace].value, xform->match,
+                            worklist, dead_instrs)) {
          _mesa_hash_table_clear(range_ht, NULL);
          return true;
       }
@@ -178,10 +178,23 @@ struct per_op_table {
    const uint16_t *table;
 };
 
+struct match_state;
+
+/**
+ * Matcher generated by nir_algebraic.py for the search expression of a
+ * transform.  It does what match_expression() in nir_search.c does for the
+ * expression, trying all combinations of commutative sources, but with the
+ * opcodes, bit sizes and constants of the pattern compiled in.
+ */
+typedef bool (*nir_search_match_func)(nir_alu_instr *instr,
+                                      struct match_state *state);
+
 struct transform {
    uint16_t search; /* Index in table->values[] for the search expression. */
    uint16_t replace; /* Index in table->values[] for the replace value. */
    unsigned condition_offset;
+   /* Generated matcher for the search expression, NULL to interpret it. */
+   nir_search_match_func match;
 };
 
 typedef union {
@@ -220,6 +233,85 @@ typedef struct {
    const nir_search_variable_cond *variable_cond;
 } nir_algebraic_table;
 
+struct match_state {
+   bool inexact_match;
+   bool has_exact_alu;
+   uint8_t comm_op_direction;
+   unsigned variables_seen;
+
+   /* Used for running the automaton on newly-constructed instructions. */
+   struct util_dynarray *states;
+   const struct per_op_table *pass_op_table;
+   const nir_algebraic_table *table;
+
+   nir_alu_src variables[NIR_SEARCH_MAX_VARIABLES];
+   struct hash_table *range_ht;
+};
+
+bool nir_search_src_is_type(nir_src src, nir_alu_type type);
+
+bool nir_search_src_is_constant(nir_src src, unsigned num_components,
+                                const uint8_t *swizzle, nir_alu_type type,
+                                uint64_t value);
+
+/* Composes the swizzle of an ALU source with the swizzle the instruction is
+ * read with.
+ */
+static inline void
+nir_search_compose_swizzle(uint8_t *new_swizzle, const nir_alu_src *src,
+                           unsigned num_components, const uint8_t *swizzle)
+{
+   for (unsigned i = 0; i < num_components; ++i)
+      new_swizzle[i] = src->swizzle[swizzle[i]];
+}
+
+static inline bool
+nir_search_swizzle_is_identity(const uint8_t *swizzle, unsigned num_components)
+{
+   for (unsigned i = 0; i < num_components; i++) {
+      if (swizzle[i] != i)
+         return false;
+   }
+   return true;
+}
+
+/* Checks a source against a variable the match already saw. */
+static inline bool
+nir_search_variable_matches(const struct match_state *state, unsigned variable,
+                            const nir_alu_src *src, unsigned num_components,
+                            const uint8_t *swizzle)
+{
+   if (state->variables[variable].src.ssa != src->src.ssa)
+      return false;
+
+   assert(!src->abs && !src->negate);
+
+   for (unsigned i = 0; i < num_components; ++i) {
+      if (state->variables[variable].swizzle[i] != swizzle[i])
+         return false;
+   }
+
+   return true;
+}
+
+static inline void
+nir_search_bind_variable(struct match_state *state, unsigned variable,
+                         const nir_alu_src *src, unsigned num_components,
+                         const uint8_t *swizzle)
+{
+   state->variables_seen |= (1 << variable);
+   state->variables[variable].src = src->src;
+   state->variables[variable].abs = false;
+   state->variables[variable].negate = false;
+
+   for (unsigned i = 0; i < NIR_MAX_VEC_COMPONENTS; ++i) {
+      if (i < num_components)
+         state->variables[variable].swizzle[i] = swizzle[i];
+      else
+         state->variables[variable].swizzle[i] = 0;
+   }
+}
+
 /* Note: these must match the start states created in
  * TreeAutomaton._build_table()
  */
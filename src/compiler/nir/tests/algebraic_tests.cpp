@@ -24,8 +24,13 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <string>
+#include <vector>
+
 #include "nir.h"
 #include "nir_builder.h"
+#include "util/memstream.h"
 
 namespace {
 
@@ -183,4 +188,336 @@ TEST_F(nir_opt_idiv_const_test, irem)
    }
 }
 
+/* Shaders of random ALU expressions made of the operations, constants and
+ * swizzles the algebraic passes have patterns for, standing in for a corpus
+ * of real shaders.
+ */
+class nir_algebraic_corpus_test : public ::testing::Test {
+protected:
+   nir_algebraic_corpus_test();
+   ~nir_algebraic_corpus_test();
+
+   nir_shader *build_shader(unsigned seed);
+   bool optimize(nir_shader *shader);
+   std::string print(nir_shader *shader);
+
+   uint32_t random();
+   nir_ssa_def *pick(std::vector<nir_ssa_def *> &values);
+   nir_ssa_def *maybe_swizzle(nir_builder *b, nir_ssa_def *def);
+
+   uint32_t rand_state;
+};
+
+nir_algebraic_corpus_test::nir_algebraic_corpus_test()
+{
+   glsl_type_singleton_init_or_ref();
+}
+
+nir_algebraic_corpus_test::~nir_algebraic_corpus_test()
+{
+   glsl_type_singleton_decref();
+}
+
+uint32_t
+nir_algebraic_corpus_test::random()
+{
+   /* xorshift32 */
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+nir_ssa_def *
+nir_algebraic_corpus_test::pick(std::vector<nir_ssa_def *> &values)
+{
+   /* Prefer recent values to build deep expressions. */
+   unsigned n = values.size();
+   if (n > 6 && random() % 4 != 0)
+      return values[n - 1 - random() % 6];
+   return values[random() % n];
+}
+
+nir_ssa_def *
+nir_algebraic_corpus_test::maybe_swizzle(nir_builder *b, nir_ssa_def *def)
+{
+   if (random() % 4 != 0)
+      return def;
+
+   unsigned swiz[4];
+   for (unsigned i = 0; i < 4; i++)
+      swiz[i] = random() % 4;
+   return nir_swizzle(b, def, swiz, 4);
+}
+
+nir_shader *
+nir_algebraic_corpus_test::build_shader(unsigned seed)
+{
+   static const nir_shader_compiler_options options = {
+      .lower_flrp32 = true,
+      .lower_fpow = true,
+   };
+   nir_builder _b =
+      nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT, &options,
+                                     "algebraic corpus %u", seed);
+   nir_builder *b = &_b;
+
+   static const nir_op float_ops[] = {
+      nir_op_fadd, nir_op_fadd, nir_op_fmul, nir_op_fmul, nir_op_fneg,
+      nir_op_fabs, nir_op_fsat, nir_op_fmin, nir_op_fmax, nir_op_ffma,
+      nir_op_flrp, nir_op_frcp, nir_op_fsqrt, nir_op_frsq, nir_op_fexp2,
+      nir_op_flog2, nir_op_fpow, nir_op_ffloor, nir_op_ffract, nir_op_fsign,
+      nir_op_fsub, nir_op_fdiv, nir_op_fceil, nir_op_ftrunc,
+   };
+   static const nir_op int_ops[] = {
+      nir_op_iadd, nir_op_iadd, nir_op_imul, nir_op_ineg, nir_op_iabs,
+      nir_op_iand, nir_op_ior, nir_op_ixor, nir_op_inot, nir_op_ishl,
+      nir_op_ishr, nir_op_ushr, nir_op_imin, nir_op_imax, nir_op_umin,
+      nir_op_umax, nir_op_isub, nir_op_imul_high, nir_op_ubfe,
+   };
+   static const nir_op float_cmp_ops[] = {
+      nir_op_flt, nir_op_fge, nir_op_feq, nir_op_fneu,
+   };
+   static const nir_op int_cmp_ops[] = {
+      nir_op_ilt, nir_op_ige, nir_op_ieq, nir_op_ine, nir_op_ult, nir_op_uge,
+   };
+   static const float float_consts[] = {
+      0.0f, 1.0f, -1.0f, 2.0f, 0.5f, 3.0f, -0.0f, 0.25f,
+   };
+   static const int int_consts[] = {
+      0, 1, -1, 2, 4, 16, 31, 0xff, 0xffff, 8,
+   };
+
+   rand_state = seed * 2654435761u + 1;
+
+   std::vector<nir_ssa_def *> floats, ints, bools;
+
+   nir_variable *in_f = nir_variable_create(b->shader, nir_var_shader_in,
+                                            glsl_vec4_type(), "in_f");
+   nir_variable *in_i = nir_variable_create(b->shader, nir_var_shader_in,
+                                            glsl_ivec4_type(), "in_i");
+   floats.push_back(nir_load_var(b, in_f));
+   ints.push_back(nir_load_var(b, in_i));
+   bools.push_back(nir_flt(b, floats[0], nir_imm_float(b, 0.0f)));
+
+   for (unsigned i = 0; i < 200; i++) {
+      switch (random() % 10) {
+      case 0: {
+         float c = float_consts[random() % ARRAY_SIZE(float_consts)];
+         floats.push_back(nir_imm_vec4(b, c, c, c, c));
+         int d = int_consts[random() % ARRAY_SIZE(int_consts)];
+         ints.push_back(nir_imm_ivec4(b, d, d, d, d));
+         break;
+      }
+
+      case 1:
+      case 2:
+      case 3:
+      case 4: {
+         nir_op op = float_ops[random() % ARRAY_SIZE(float_ops)];
+         nir_ssa_def *srcs[3];
+         for (unsigned s = 0; s < 3; s++)
+            srcs[s] = maybe_swizzle(b, pick(floats));
+         floats.push_back(nir_build_alu(b, op, srcs[0],
+                          nir_op_infos[op].num_inputs > 1 ? srcs[1] : NULL,
+                          nir_op_infos[op].num_inputs > 2 ? srcs[2] : NULL,
+                          NULL));
+         break;
+      }
+
+      case 5:
+      case 6: {
+         nir_op op = int_ops[random() % ARRAY_SIZE(int_ops)];
+         nir_ssa_def *srcs[3];
+         for (unsigned s = 0; s < 3; s++)
+            srcs[s] = maybe_swizzle(b, pick(ints));
+         ints.push_back(nir_build_alu(b, op, srcs[0],
+                        nir_op_infos[op].num_inputs > 1 ? srcs[1] : NULL,
+                        nir_op_infos[op].num_inputs > 2 ? srcs[2] : NULL,
+                        NULL));
+         break;
+      }
+
+      case 7:
+         if (random() % 2) {
+            nir_op op = float_cmp_ops[random() % ARRAY_SIZE(float_cmp_ops)];
+            bools.push_back(nir_build_alu(b, op, pick(floats),
+                                          maybe_swizzle(b, pick(floats)),
+                                          NULL, NULL));
+         } else {
+            nir_op op = int_cmp_ops[random() % ARRAY_SIZE(int_cmp_ops)];
+            bools.push_back(nir_build_alu(b, op, pick(ints),
+                                          maybe_swizzle(b, pick(ints)),
+                                          NULL, NULL));
+         }
+         break;
+
+      case 8:
+         switch (random() % 6) {
+         case 0:
+            floats.push_back(nir_bcsel(b, pick(bools), pick(floats),
+                                       pick(floats)));
+            break;
+         case 1:
+            ints.push_back(nir_bcsel(b, pick(bools), pick(ints), pick(ints)));
+            break;
+         case 2:
+            bools.push_back(random() % 2 ?
+                            nir_iand(b, pick(bools), pick(bools)) :
+                            nir_ior(b, pick(bools), pick(bools)));
+            break;
+         case 3:
+            bools.push_back(nir_inot(b, pick(bools)));
+            break;
+         case 4:
+            floats.push_back(nir_b2f32(b, pick(bools)));
+            break;
+         default:
+            ints.push_back(nir_b2i32(b, pick(bools)));
+            break;
+         }
+         break;
+
+      default:
+         switch (random() % 3) {
+         case 0:
+            floats.push_back(nir_i2f32(b, pick(ints)));
+            break;
+         case 1:
+            ints.push_back(nir_f2i32(b, pick(floats)));
+            break;
+         default: {
+            static const unsigned xxxx[4] = { 0, 0, 0, 0 };
+            nir_ssa_def *dot = nir_fdot4(b, pick(floats), pick(floats));
+            floats.push_back(nir_swizzle(b, dot, xxxx, 4));
+            break;
+         }
+         }
+         break;
+      }
+   }
+
+   nir_variable *out_f = nir_variable_create(b->shader, nir_var_shader_out,
+                                             glsl_vec4_type(), "out_f");
+   nir_variable *out_i = nir_variable_create(b->shader, nir_var_shader_out,
+                                             glsl_ivec4_type(), "out_i");
+   nir_ssa_def *f = floats.back(), *i = ints.back();
+   for (unsigned n = 0; n < 8; n++) {
+      f = nir_fadd(b, f, pick(floats));
+      i = nir_iadd(b, i, nir_bcsel(b, pick(bools), pick(ints), pick(ints)));
+   }
+   nir_store_var(b, out_f, f, 0xf);
+   nir_store_var(b, out_i, i, 0xf);
+
+   return b->shader;
+}
+
+bool
+nir_algebraic_corpus_test::optimize(nir_shader *shader)
+{
+   bool progress, any_progress = false;
+   do {
+      progress = false;
+      progress |= nir_opt_algebraic(shader);
+      progress |= nir_opt_constant_folding(shader);
+      progress |= nir_copy_prop(shader);
+      progress |= nir_opt_dce(shader);
+      any_progress |= progress;
+   } while (progress);
+
+   while (nir_opt_algebraic_late(shader)) {
+      nir_opt_constant_folding(shader);
+      nir_copy_prop(shader);
+      nir_opt_dce(shader);
+   }
+
+   return any_progress;
+}
+
+std::string
+nir_algebraic_corpus_test::print(nir_shader *shader)
+{
+   char *buf = NULL;
+   size_t size = 0;
+   struct u_memstream mem;
+   if (!u_memstream_open(&mem, &buf, &size))
+      return "";
+
+   nir_print_shader(shader, u_memstream_get(&mem));
+   u_memstream_close(&mem);
+
+   std::string str(buf, size);
+   free(buf);
+   return str;
+}
+
+TEST_F(nir_algebraic_corpus_test, generated_matchers_match_interpreter)
+{
+#ifndef NIR_ALGEBRAIC_MATCHERS
+   GTEST_SKIP() << "built without -Dnir-algebraic-matchers=true";
+#endif
+#ifdef NDEBUG
+   GTEST_SKIP() << "NIR_DEBUG is not available in release builds";
+#endif
+   uint32_t saved_debug = nir_debug;
+
+   for (unsigned seed = 0; seed < 100; seed++) {
+      nir_shader *generated = build_shader(seed);
+      nir_shader *interpreted = build_shader(seed);
+
+      nir_debug = saved_debug & ~NIR_DEBUG_ALGEBRAIC_INTERP;
+      ASSERT_TRUE(optimize(generated));
+      nir_validate_shader(generated, "after generated matchers");
+
+      nir_debug = saved_debug | NIR_DEBUG_ALGEBRAIC_INTERP;
+      optimize(interpreted);
+
+      ASSERT_EQ(print(generated), print(interpreted)) << "seed " << seed;
+
+      ralloc_free(generated);
+      ralloc_free(interpreted);
+   }
+
+   nir_debug = saved_debug;
+}
+
+/* Time spent in nir_opt_algebraic and nir_opt_algebraic_late over the
+ * corpus, with and without the generated matchers.  Only meaningful with
+ * -Dnir-algebraic-matchers=true; run with --gtest_also_run_disabled_tests.
+ */
+TEST_F(nir_algebraic_corpus_test, DISABLED_benchmark)
+{
+#ifdef NDEBUG
+   GTEST_SKIP() << "NIR_DEBUG is not available in release builds";
+#endif
+   uint32_t saved_debug = nir_debug;
+   double ms[2] = { 0, 0 };
+
+   for (unsigned run = 0; run < 3; run++) {
+      for (unsigned interp = 0; interp < 2; interp++) {
+         nir_debug = interp ? (saved_debug | NIR_DEBUG_ALGEBRAIC_INTERP) :
+                              (saved_debug & ~NIR_DEBUG_ALGEBRAIC_INTERP);
+
+         for (unsigned seed = 0; seed < 200; seed++) {
+            nir_shader *shader = build_shader(seed);
+
+            auto start = std::chrono::steady_clock::now();
+            nir_opt_algebraic(shader);
+            nir_opt_algebraic_late(shader);
+            auto end = std::chrono::steady_clock::now();
+            ms[interp] +=
+               std::chrono::duration<double, std::milli>(end - start).count();
+
+            ralloc_free(shader);
+         }
+      }
+   }
+
+   nir_debug = saved_debug;
+
+   printf("nir_opt_algebraic + late over 3 x 200 shaders:\n");
+   printf("  generated matchers: %8.2f ms\n", ms[0]);
+   printf("  nir_search interp:  %8.2f ms\n", ms[1]);
+}
+
 }
@@ -383,10 +383,12 @@ draw_set_disk_cache_callbacks(struct draw_context *draw,
                               void *data_cookie,
                               void (*find_shader)(void *cookie,
                                                   struct lp_cached_code *cache,
-                                                  unsigned char ir_sha1_cache_key[20]),
+                                                  unsigned char ir_sha1_cache_key[20],
+                                                  void *code_cache_data),
                               void (*insert_shader)(void *cookie,
                                                     struct lp_cached_code *cache,
-                                                    unsigned char ir_sha1_cache_key[20]));
+                                                    unsigned char ir_sha1_cache_key[20],
+                                                    void *code_cache_data));
 
 
 #endif /* DRAW_CONTEXT_H */
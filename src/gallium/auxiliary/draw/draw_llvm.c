@@ -891,36 +891,44 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
 
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
-                                         ir_sha1_cache_key);
+                                         ir_sha1_cache_key,
+                                         shader->base.state.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (variant->gallivm) {
+      variant->jit_func = (draw_jit_vert_func)
+         gallivm_cached_function(variant->gallivm, "draw_llvm_vs_variant");
+   } else {
+      variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
-   create_jit_types(variant);
+      create_jit_types(variant);
 
-   if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
-      if (llvm->draw->vs.vertex_shader->state.type == PIPE_SHADER_IR_TGSI)
-         tgsi_dump(llvm->draw->vs.vertex_shader->state.tokens, 0);
-      else
-         nir_print_shader(llvm->draw->vs.vertex_shader->state.ir.nir, stderr);
-      draw_llvm_dump_variant_key(&variant->key);
-   }
+      if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
+         if (llvm->draw->vs.vertex_shader->state.type == PIPE_SHADER_IR_TGSI)
+            tgsi_dump(llvm->draw->vs.vertex_shader->state.tokens, 0);
+         else
+            nir_print_shader(llvm->draw->vs.vertex_shader->state.ir.nir, stderr);
+         draw_llvm_dump_variant_key(&variant->key);
+      }
 
-   variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_inputs);
-   variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
+      variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_inputs);
+      variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
 
-   draw_llvm_generate(llvm, variant);
+      draw_llvm_generate(llvm, variant);
 
-   gallivm_compile_module(variant->gallivm);
+      gallivm_compile_module(variant->gallivm);
 
-   variant->jit_func = (draw_jit_vert_func)
-         gallivm_jit_function(variant->gallivm, variant->function);
+      variant->jit_func = (draw_jit_vert_func)
+            gallivm_jit_function(variant->gallivm, variant->function);
+   }
 
    if (needs_caching)
       llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
                                            &cached,
-                                           ir_sha1_cache_key);
+                                           ir_sha1_cache_key,
+                                           shader->base.state.code_cache_data);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -2953,28 +2961,36 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
 
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
-                                         ir_sha1_cache_key);
+                                         ir_sha1_cache_key,
+                                         shader->base.state.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (variant->gallivm) {
+      variant->jit_func = (draw_gs_jit_func)
+         gallivm_cached_function(variant->gallivm, "draw_llvm_gs_variant");
+   } else {
+      variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
-   create_gs_jit_types(variant);
+      create_gs_jit_types(variant);
 
-   variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_outputs);
-   variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
+      variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_outputs);
+      variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
 
-   draw_gs_llvm_generate(llvm, variant);
+      draw_gs_llvm_generate(llvm, variant);
 
-   gallivm_compile_module(variant->gallivm);
+      gallivm_compile_module(variant->gallivm);
 
-   variant->jit_func = (draw_gs_jit_func)
-         gallivm_jit_function(variant->gallivm, variant->function);
+      variant->jit_func = (draw_gs_jit_func)
+            gallivm_jit_function(variant->gallivm, variant->function);
+   }
 
    if (needs_caching)
       llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
                                            &cached,
-                                           ir_sha1_cache_key);
+                                           ir_sha1_cache_key,
+                                           shader->base.state.code_cache_data);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -3615,31 +3631,39 @@ draw_tcs_llvm_create_variant(struct draw_llvm *llvm,
 
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
-                                         ir_sha1_cache_key);
+                                         ir_sha1_cache_key,
+                                         shader->base.state.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
 
-   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (variant->gallivm) {
+      variant->jit_func = (draw_tcs_jit_func)
+         gallivm_cached_function(variant->gallivm, "draw_llvm_tcs_variant");
+   } else {
+      variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
-   create_tcs_jit_types(variant);
+      create_tcs_jit_types(variant);
 
-   if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
-      nir_print_shader(llvm->draw->tcs.tess_ctrl_shader->state.ir.nir, stderr);
-      draw_tcs_llvm_dump_variant_key(&variant->key);
-   }
+      if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
+         nir_print_shader(llvm->draw->tcs.tess_ctrl_shader->state.ir.nir, stderr);
+         draw_tcs_llvm_dump_variant_key(&variant->key);
+      }
 
-   draw_tcs_llvm_generate(llvm, variant);
+      draw_tcs_llvm_generate(llvm, variant);
 
-   gallivm_compile_module(variant->gallivm);
+      gallivm_compile_module(variant->gallivm);
 
-   variant->jit_func = (draw_tcs_jit_func)
-      gallivm_jit_function(variant->gallivm, variant->function);
+      variant->jit_func = (draw_tcs_jit_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+   }
 
    if (needs_caching)
       llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
                                            &cached,
-                                           ir_sha1_cache_key);
+                                           ir_sha1_cache_key,
+                                           shader->base.state.code_cache_data);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -4147,33 +4171,41 @@ draw_tes_llvm_create_variant(struct draw_llvm *llvm,
 
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
-                                         ir_sha1_cache_key);
+                                         ir_sha1_cache_key,
+                                         shader->base.state.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (variant->gallivm) {
+      variant->jit_func = (draw_tes_jit_func)
+         gallivm_cached_function(variant->gallivm, "draw_llvm_tes_variant");
+   } else {
+      variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
-   create_tes_jit_types(variant);
+      create_tes_jit_types(variant);
 
-   variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_outputs);
-   variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
+      variant->vertex_header_type = create_jit_vertex_header(variant->gallivm, num_outputs);
+      variant->vertex_header_ptr_type = LLVMPointerType(variant->vertex_header_type, 0);
 
-   if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
-      nir_print_shader(llvm->draw->tes.tess_eval_shader->state.ir.nir, stderr);
-      draw_tes_llvm_dump_variant_key(&variant->key);
-   }
+      if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
+         nir_print_shader(llvm->draw->tes.tess_eval_shader->state.ir.nir, stderr);
+         draw_tes_llvm_dump_variant_key(&variant->key);
+      }
 
-   draw_tes_llvm_generate(llvm, variant);
+      draw_tes_llvm_generate(llvm, variant);
 
-   gallivm_compile_module(variant->gallivm);
+      gallivm_compile_module(variant->gallivm);
 
-   variant->jit_func = (draw_tes_jit_func)
-      gallivm_jit_function(variant->gallivm, variant->function);
+      variant->jit_func = (draw_tes_jit_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+   }
 
    if (needs_caching)
       llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
                                            &cached,
-                                           ir_sha1_cache_key);
+                                           ir_sha1_cache_key,
+                                           shader->base.state.code_cache_data);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -422,10 +422,12 @@ struct draw_context
    void *disk_cache_cookie;
    void (*disk_cache_find_shader)(void *cookie,
                                   struct lp_cached_code *cache,
-                                  unsigned char ir_sha1_cache_key[20]);
+                                  unsigned char ir_sha1_cache_key[20],
+                                  void *code_cache_data);
    void (*disk_cache_insert_shader)(void *cookie,
                                     struct lp_cached_code *cache,
-                                    unsigned char ir_sha1_cache_key[20]);
+                                    unsigned char ir_sha1_cache_key[20],
+                                    void *code_cache_data);
 
    void *driver_private;
 };
@@ -119,6 +119,7 @@ draw_create_vs_llvm(struct draw_context *draw,
 
    vs->base.state.type = state->type;
    vs->base.state.stream_output = state->stream_output;
+   vs->base.state.code_cache_data = state->code_cache_data;
    vs->base.draw = draw;
    vs->base.prepare = vs_llvm_prepare;
    vs->base.run_linear = vs_llvm_run_linear;
@@ -164,6 +164,16 @@ void lp_build_coro_add_malloc_hooks(struct gallivm_state *gallivm)
    LLVMAddGlobalMapping(gallivm->engine, gallivm->coro_free_hook, coro_free);
 }
 
+/* Address of the malloc hooks, for objects loaded from the shader cache. */
+void *lp_build_coro_resolve_hook(const char *name)
+{
+   if (strcmp(name, "coro_malloc") == 0)
+      return (void *)coro_malloc;
+   if (strcmp(name, "coro_free") == 0)
+      return (void *)coro_free;
+   return NULL;
+}
+
 void lp_build_coro_declare_malloc_hooks(struct gallivm_state *gallivm)
 {
    LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
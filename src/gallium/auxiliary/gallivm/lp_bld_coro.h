@@ -74,6 +74,7 @@ void lp_build_coro_suspend_switch(struct gallivm_state *gallivm,
 
 void lp_build_coro_add_malloc_hooks(struct gallivm_state *gallivm);
 void lp_build_coro_declare_malloc_hooks(struct gallivm_state *gallivm);
+void *lp_build_coro_resolve_hook(const char *name);
 
 static inline void lp_build_coro_add_presplit(LLVMValueRef coro)
 {
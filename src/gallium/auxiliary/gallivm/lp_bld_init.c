@@ -64,6 +64,7 @@ static const struct debug_named_value lp_bld_perf_flags[] = {
    { "no_quad_lod", GALLIVM_PERF_NO_QUAD_LOD, "disable quad_lod optimization" },
    { "no_aos_sampling", GALLIVM_PERF_NO_AOS_SAMPLING, "disable aos sampling optimization" },
    { "nopt",   GALLIVM_PERF_NO_OPT, "disable optimization passes to speed up shader compilation" },
+   { "no_obj_load", GALLIVM_PERF_NO_OBJ_LOAD, "build IR and an execution engine even on shader cache hits" },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -149,7 +150,7 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddCoroElidePass(gallivm->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if (!gallivm->no_opt) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -258,6 +259,8 @@ gallivm_free_code(struct gallivm_state *gallivm)
 {
    assert(!gallivm->module);
    assert(!gallivm->engine);
+   lp_free_cached_object(gallivm->object);
+   gallivm->object = NULL;
    lp_free_generated_code(gallivm->code);
    gallivm->code = NULL;
    lp_free_memory_manager(gallivm->memorymgr);
@@ -273,7 +276,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if (gallivm->no_opt) {
          optlevel = None;
       }
       else {
@@ -328,7 +331,8 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context, struct lp_cached_code *cache)
+                   LLVMContextRef context, struct lp_cached_code *cache,
+                   boolean no_opt)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -338,6 +342,7 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
 
    gallivm->context = context;
    gallivm->cache = cache;
+   gallivm->no_opt = no_opt || (gallivm_perf & GALLIVM_PERF_NO_OPT);
    if (!gallivm->context)
       goto fail;
 
@@ -487,7 +492,7 @@ gallivm_create(const char *name, LLVMContextRef context,
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context, cache)) {
+      if (!init_gallivm_state(gallivm, name, context, cache, FALSE)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -498,6 +503,96 @@ gallivm_create(const char *name, LLVMContextRef context,
 }
 
 
+/**
+ * Create a new gallivm_state object whose module is compiled without any
+ * optimization passes and with the fastest code generator, as with
+ * GALLIVM_PERF=nopt.  Compiles much faster, runs slower; meant for code
+ * which is only used until an optimized version is available.  Never
+ * cached.
+ */
+struct gallivm_state *
+gallivm_create_unoptimized(const char *name, LLVMContextRef context)
+{
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      if (!init_gallivm_state(gallivm, name, context, NULL, TRUE)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   assert(gallivm != NULL);
+   return gallivm;
+}
+
+
+static void *
+resolve_hook(const char *name)
+{
+   if (strcmp(name, "debug_printf") == 0)
+      return (void *)debug_printf;
+   if (strcmp(name, "get_time_hook") == 0)
+      return (void *)os_time_get_nano;
+   return lp_build_coro_resolve_hook(name);
+}
+
+
+/**
+ * Create a gallivm_state object from the cached object code of an earlier
+ * compilation of the same module.  No LLVM module, IR or execution engine
+ * is created; functions must be looked up by name with
+ * gallivm_cached_function().
+ *
+ * Returns NULL on failure (or when IR dumps are requested), in which case
+ * the caller should fall back to gallivm_create().  The cached data is
+ * released by gallivm_free_ir() either way.
+ */
+struct gallivm_state *
+gallivm_create_from_cache(const char *name, struct lp_cached_code *cache)
+{
+   struct gallivm_state *gallivm;
+   int64_t time_begin = 0;
+
+   if (!cache || !cache->data_size)
+      return NULL;
+
+   if ((gallivm_perf & GALLIVM_PERF_NO_OBJ_LOAD) ||
+       (gallivm_debug & (GALLIVM_DEBUG_IR | GALLIVM_DEBUG_ASM |
+                         GALLIVM_DEBUG_DUMP_BC)))
+      return NULL;
+
+   if (!lp_build_init())
+      return NULL;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (!gallivm)
+      return NULL;
+
+   if (gallivm_debug & GALLIVM_DEBUG_PERF)
+      time_begin = os_time_get();
+
+   gallivm->object = lp_build_load_cached_object(cache, resolve_hook);
+   if (!gallivm->object) {
+      FREE(gallivm);
+      return NULL;
+   }
+
+   if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+      int64_t time_end = os_time_get();
+      int time_msec = (int)((time_end - time_begin) / 1000);
+      debug_printf("loading cached module %s took %d msec\n",
+                   name, time_msec);
+   }
+
+   gallivm->cache = cache;
+   gallivm->compiled = 1;
+
+   return gallivm;
+}
+
+
 /**
  * Destroy a gallivm_state object.
  */
@@ -578,10 +673,10 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       LLVMWriteBitcodeToFile(gallivm->module, filename);
       debug_printf("%s written\n", filename);
       debug_printf("Invoke as \"opt %s %s | llc -O%d %s%s\"\n",
-                   gallivm_perf & GALLIVM_PERF_NO_OPT ? "-mem2reg" :
+                   gallivm->no_opt ? "-mem2reg" :
                    "-sroa -early-cse -simplifycfg -reassociate "
                    "-mem2reg -constprop -instcombine -gvn",
-                   filename, gallivm_perf & GALLIVM_PERF_NO_OPT ? 0 : 2,
+                   filename, gallivm->no_opt ? 0 : 2,
                    "[-mcpu=<-mcpu option>] ",
                    "[-mattr=<-mattr option(s)>]");
    }
@@ -602,7 +697,7 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
    LLVMRunPasses(gallivm->module, passes, LLVMGetExecutionEngineTargetMachine(gallivm->engine), opts);
 
-   if (!(gallivm_perf & GALLIVM_PERF_NO_OPT))
+   if (!gallivm->no_opt)
       strcpy(passes, "sroa,early-cse,simplifycfg,reassociate,mem2reg,instsimplify,instcombine");
    else
       strcpy(passes, "mem2reg");
@@ -733,6 +828,20 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    return jit_func;
 }
 
+/**
+ * Look up a function of a gallivm_state created with
+ * gallivm_create_from_cache().  Returns NULL if the object doesn't define
+ * it.
+ */
+func_pointer
+gallivm_cached_function(struct gallivm_state *gallivm,
+                        const char *name)
+{
+   assert(gallivm->object);
+
+   return pointer_to_func(lp_cached_object_get_symbol(gallivm->object, name));
+}
+
 unsigned gallivm_get_perf_flags(void)
 {
    return gallivm_perf;
@@ -40,6 +40,7 @@ extern "C" {
 #endif
 
 struct lp_cached_code;
+struct lp_cached_object;
 struct gallivm_state
 {
    char *module_name;
@@ -57,7 +58,13 @@ struct gallivm_state
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
    struct lp_cached_code *cache;
+   /* Set instead of module/engine when created with
+    * gallivm_create_from_cache().
+    */
+   struct lp_cached_object *object;
    unsigned compiled;
+   /* No optimization passes, fast instruction selection. */
+   boolean no_opt;
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
    LLVMValueRef debug_printf_hook;
@@ -77,6 +84,12 @@ struct gallivm_state *
 gallivm_create(const char *name, LLVMContextRef context,
                struct lp_cached_code *cache);
 
+struct gallivm_state *
+gallivm_create_unoptimized(const char *name, LLVMContextRef context);
+
+struct gallivm_state *
+gallivm_create_from_cache(const char *name, struct lp_cached_code *cache);
+
 void
 gallivm_destroy(struct gallivm_state *gallivm);
 
@@ -94,6 +107,10 @@ func_pointer
 gallivm_jit_function(struct gallivm_state *gallivm,
                      LLVMValueRef func);
 
+func_pointer
+gallivm_cached_function(struct gallivm_state *gallivm,
+                        const char *name);
+
 unsigned gallivm_get_perf_flags(void);
 
 void lp_init_clock_hook(struct gallivm_state *gallivm);
@@ -63,6 +63,8 @@
 #include <llvm/Support/Host.h>
 #include <llvm/Support/PrettyStackTrace.h>
 #include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/TargetSelect.h>
 #if LLVM_VERSION_MAJOR >= 15
 #include <llvm/Support/MemoryBuffer.h>
@@ -323,6 +325,117 @@ public:
 
 };
 
+/*
+ * Memory manager for objects loaded straight from the shader cache.
+ *
+ * Besides owning the sections it also resolves the external symbols of the
+ * object: the hooks gallivm maps with LLVMAddGlobalMapping() when going
+ * through MCJIT are looked up with the callback, anything else (libm,
+ * compiler runtime) in the process.
+ */
+class CachedObjectMemoryManager : public llvm::SectionMemoryManager {
+private:
+   void *(*resolve)(const char *name);
+public:
+   CachedObjectMemoryManager(void *(*resolve_hook)(const char *name)) :
+      resolve(resolve_hook) {}
+
+   uint64_t getSymbolAddress(const std::string &Name) override {
+      const char *name = Name.c_str();
+#if DETECT_OS_APPLE
+      if (name[0] == '_')
+         name++;
+#endif
+      void *addr = resolve ? resolve(name) : NULL;
+      if (addr)
+         return (uint64_t)(uintptr_t)addr;
+      return llvm::RTDyldMemoryManager::getSymbolAddress(Name);
+   }
+};
+
+struct lp_cached_object {
+   CachedObjectMemoryManager *MM;
+   llvm::RuntimeDyld *Dyld;
+};
+
+
+/**
+ * Link a relocatable object produced by an earlier MCJIT compilation (see
+ * LPObjectCache) into executable memory, without creating a module or an
+ * execution engine.  Returns NULL if the object can't be loaded, in which
+ * case the caller should go through the regular compilation path.
+ */
+extern "C"
+struct lp_cached_object *
+lp_build_load_cached_object(const struct lp_cached_code *cache,
+                            void *(*resolve)(const char *name))
+{
+   std::unique_ptr<llvm::MemoryBuffer> buffer =
+      llvm::MemoryBuffer::getMemBuffer(
+         llvm::StringRef((const char *)cache->data, cache->data_size),
+         "", false);
+
+   auto object = llvm::object::ObjectFile::createObjectFile(buffer->getMemBufferRef());
+   if (!object) {
+      llvm::consumeError(object.takeError());
+      return NULL;
+   }
+
+   CachedObjectMemoryManager *MM = new CachedObjectMemoryManager(resolve);
+   llvm::RuntimeDyld *Dyld = new llvm::RuntimeDyld(*MM, *MM);
+
+   Dyld->loadObject(*object.get());
+   if (!Dyld->hasError()) {
+      Dyld->resolveRelocations();
+      Dyld->registerEHFrames();
+   }
+
+   std::string error;
+   if (Dyld->hasError() || MM->finalizeMemory(&error)) {
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         debug_printf("failed to load cached object: %s\n",
+                      Dyld->hasError() ? Dyld->getErrorString().str().c_str()
+                                       : error.c_str());
+      }
+      Dyld->deregisterEHFrames();
+      delete Dyld;
+      delete MM;
+      return NULL;
+   }
+
+   struct lp_cached_object *obj = new lp_cached_object;
+   obj->MM = MM;
+   obj->Dyld = Dyld;
+   return obj;
+}
+
+
+extern "C"
+void *
+lp_cached_object_get_symbol(struct lp_cached_object *obj, const char *name)
+{
+#if DETECT_OS_APPLE
+   std::string mangled = std::string("_") + name;
+   return (void *)(uintptr_t)obj->Dyld->getSymbol(mangled).getAddress();
+#else
+   return (void *)(uintptr_t)obj->Dyld->getSymbol(name).getAddress();
+#endif
+}
+
+
+extern "C"
+void
+lp_free_cached_object(struct lp_cached_object *obj)
+{
+   if (!obj)
+      return;
+   obj->Dyld->deregisterEHFrames();
+   delete obj->Dyld;
+   delete obj->MM;
+   delete obj;
+}
+
+
 /**
  * Same as LLVMCreateJITCompilerForModule, but:
  * - allows using MCJIT and enabling AVX feature where available.
@@ -51,9 +51,12 @@ struct lp_cached_code {
    size_t data_size;
    bool dont_cache;
    void *jit_obj_cache;
+   /* IR instructions the code was built from, for the variant eviction */
+   unsigned nr_instrs;
 };
 
 struct lp_generated_code;
+struct lp_cached_object;
 
 extern LLVMTargetLibraryInfoRef
 gallivm_create_target_library_info(const char *triple);
@@ -92,6 +95,16 @@ lp_is_function(LLVMValueRef v);
 void
 lp_free_objcache(void *objcache);
 
+struct lp_cached_object *
+lp_build_load_cached_object(const struct lp_cached_code *cache,
+                            void *(*resolve)(const char *name));
+
+void *
+lp_cached_object_get_symbol(struct lp_cached_object *obj, const char *name);
+
+void
+lp_free_cached_object(struct lp_cached_object *obj);
+
 void
 lp_set_module_stack_alignment_override(LLVMModuleRef M, unsigned align);
 #ifdef __cplusplus
@@ -449,6 +449,10 @@ lp_build_count_ir_module(LLVMModuleRef module)
    LLVMValueRef func;
    unsigned num_instrs = 0;
 
+   /* modules loaded from the shader cache have no IR */
+   if (!module)
+      return 0;
+
    func = LLVMGetFirstFunction(module);
    while (func) {
       num_instrs += lp_build_count_instructions(func);
@@ -177,20 +177,24 @@ llvmpipe_texture_barrier(struct pipe_context *pipe, unsigned flags)
 static void
 lp_draw_disk_cache_find_shader(void *cookie,
                                struct lp_cached_code *cache,
-                               unsigned char ir_sha1_cache_key[20])
+                               unsigned char ir_sha1_cache_key[20],
+                               void *code_cache_data)
 {
    struct llvmpipe_screen *screen = cookie;
-   lp_disk_cache_find_shader(screen, cache, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, cache, ir_sha1_cache_key,
+                             code_cache_data);
 }
 
 
 static void
 lp_draw_disk_cache_insert_shader(void *cookie,
                                  struct lp_cached_code *cache,
-                                 unsigned char ir_sha1_cache_key[20])
+                                 unsigned char ir_sha1_cache_key[20],
+                                 void *code_cache_data)
 {
    struct llvmpipe_screen *screen = cookie;
-   lp_disk_cache_insert_shader(screen, cache, ir_sha1_cache_key);
+   lp_disk_cache_insert_shader(screen, cache, ir_sha1_cache_key,
+                               code_cache_data);
 }
 
 
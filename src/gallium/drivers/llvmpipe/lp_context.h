@@ -159,6 +159,10 @@ struct llvmpipe_context {
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** Bound variant if it is an unoptimized one, see LP_ASYNC_COMPILE */
+   struct lp_fragment_shader_variant *fs_fallback;
+   uint64_t nr_fs_fallback_draws;
+
    boolean permit_linear_rasterizer;
    boolean single_vp;
 
@@ -30,52 +30,190 @@
 
 #include "util/u_thread.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/os_time.h"
 #include "lp_cs_tpool.h"
+#include "lp_screen.h"
+
+/* Workers grow or shrink the number of iterations they claim at once so
+ * that each chunk takes roughly this long, which keeps the cost of the
+ * range CAS negligible for tiny workgroups while still leaving enough
+ * granularity to balance expensive ones.
+ */
+#define LP_CS_TPOOL_CHUNK_NS 50000
+#define LP_CS_TPOOL_MAX_CHUNK 256
+
+static inline uint64_t
+range_pack(unsigned start, unsigned end)
+{
+   return start | ((uint64_t)end << 32);
+}
+
+static inline unsigned
+range_start(uint64_t range)
+{
+   return (unsigned)range;
+}
+
+static inline unsigned
+range_end(uint64_t range)
+{
+   return (unsigned)(range >> 32);
+}
+
+/**
+ * Take up to chunk iterations off the front of the given range.
+ */
+static bool
+range_claim_front(uint64_t *range, unsigned chunk,
+                  unsigned *start, unsigned *count)
+{
+   uint64_t old = p_atomic_read(range);
+
+   for (;;) {
+      unsigned s = range_start(old), e = range_end(old);
+      if (s >= e)
+         return false;
+
+      unsigned n = MIN2(chunk, e - s);
+      uint64_t prev = p_atomic_cmpxchg(range, old, range_pack(s + n, e));
+      if (prev == old) {
+         *start = s;
+         *count = n;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+/**
+ * Steal the back half of the range (or its last iteration).
+ */
+static bool
+range_steal_back(uint64_t *range, unsigned *start, unsigned *count)
+{
+   uint64_t old = p_atomic_read(range);
+
+   for (;;) {
+      unsigned s = range_start(old), e = range_end(old);
+      if (s >= e)
+         return false;
+
+      unsigned n = MAX2((e - s) / 2, 1);
+      uint64_t prev = p_atomic_cmpxchg(range, old, range_pack(s, e - n));
+      if (prev == old) {
+         *start = e - n;
+         *count = n;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+/**
+ * Run iterations of a task until neither our own range nor any other
+ * worker's range has anything left.
+ */
+static void
+lp_cs_tpool_run_task(struct lp_cs_tpool *pool, struct lp_cs_tpool_task *task,
+                     unsigned idx, struct lp_cs_local_mem *lmem)
+{
+   uint64_t *own = &task->ranges[idx];
+   unsigned chunk = 1;
+
+   for (;;) {
+      unsigned start, count;
+
+      if (!range_claim_front(own, chunk, &start, &count)) {
+         bool stolen = false;
+
+         for (unsigned i = 1; i < pool->num_threads && !stolen; i++) {
+            unsigned victim = (idx + i) % pool->num_threads;
+            stolen = range_steal_back(&task->ranges[victim], &start, &count);
+         }
+         if (!stolen)
+            break;
+
+         /* Make the stolen iterations our own range again, so that
+          * others can steal from us in turn, and continue from there.
+          * Our slot is empty, so no one else can be updating it.
+          */
+         p_atomic_set(own, range_pack(start, start + count));
+         continue;
+      }
+
+      int64_t t0 = os_time_get_nano();
+      for (unsigned i = 0; i < count; i++)
+         task->work(task->data, start + i, lmem);
+      int64_t elapsed = os_time_get_nano() - t0;
+
+      if (count == chunk) {
+         if (elapsed < LP_CS_TPOOL_CHUNK_NS / 2)
+            chunk = MIN2(chunk * 2, LP_CS_TPOOL_MAX_CHUNK);
+         else if (elapsed > LP_CS_TPOOL_CHUNK_NS * 2 && chunk > 1)
+            chunk /= 2;
+      }
+
+      p_atomic_add(&task->iter_finished, count);
+   }
+}
+
+/**
+ * Pick the queued task with undistributed work and the fewest workers
+ * on it, so concurrent dispatches share the threads.  Called with the
+ * pool mutex held.
+ */
+static struct lp_cs_tpool_task *
+lp_cs_tpool_pick_task(struct lp_cs_tpool *pool)
+{
+   struct lp_cs_tpool_task *best = NULL;
+
+   list_for_each_entry(struct lp_cs_tpool_task, task, &pool->workqueue, list) {
+      if (task->drained)
+         continue;
+      if (!best || task->active_workers < best->active_workers)
+         best = task;
+   }
+   return best;
+}
 
 static int
 lp_cs_tpool_worker(void *data)
 {
-   struct lp_cs_tpool *pool = data;
+   struct lp_cs_tpool_thread *thread = data;
+   struct lp_cs_tpool *pool = thread->pool;
    struct lp_cs_local_mem lmem;
 
    memset(&lmem, 0, sizeof(lmem));
    mtx_lock(&pool->m);
 
+   /* num_threads is final once we get the mutex */
+   lp_thread_pin_to_L3(thread->index, pool->num_threads);
+
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
 
-      while (list_is_empty(&pool->workqueue) && !pool->shutdown)
+      while (!(task = lp_cs_tpool_pick_task(pool)) && !pool->shutdown)
          cnd_wait(&pool->new_work, &pool->m);
 
       if (pool->shutdown)
          break;
 
-      task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
-                              list);
-
-      unsigned this_iter = task->iter_start;
-
-      iter_per_thread = task->iter_per_thread;
-
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
-      }
-
-      task->iter_start += iter_per_thread;
-
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
-
+      task->active_workers++;
       mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
+
+      lp_cs_tpool_run_task(pool, task, thread->index, &lmem);
 
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
+      /* Every range of this task is empty now, nothing more to hand out. */
+      task->drained = true;
+      if (task->queued) {
+         list_del(&task->list);
+         task->queued = false;
+      }
+      task->active_workers--;
+      if (task->active_workers == 0 &&
+          p_atomic_read(&task->iter_finished) == task->iter_total)
          cnd_broadcast(&task->finish);
    }
    mtx_unlock(&pool->m);
@@ -95,14 +233,31 @@ lp_cs_tpool_create(unsigned num_threads)
    cnd_init(&pool->new_work);
 
    list_inithead(&pool->workqueue);
-   assert (num_threads <= LP_MAX_THREADS);
+
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(*pool->threads));
+      if (!pool->threads) {
+         cnd_destroy(&pool->new_work);
+         mtx_destroy(&pool->m);
+         FREE(pool);
+         return NULL;
+      }
+   }
+
+   /* Publish the final thread count before any worker can look at it. */
+   mtx_lock(&pool->m);
    for (unsigned i = 0; i < num_threads; i++) {
-      if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker, pool)) {
+      pool->threads[i].pool = pool;
+      pool->threads[i].index = i;
+      if (thrd_success != u_thread_create(&pool->threads[i].thread,
+                                          lp_cs_tpool_worker,
+                                          &pool->threads[i])) {
          num_threads = i;  /* previous thread is max */
          break;
       }
    }
    pool->num_threads = num_threads;
+   mtx_unlock(&pool->m);
    return pool;
 }
 
@@ -118,11 +273,12 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
    mtx_unlock(&pool->m);
 
    for (unsigned i = 0; i < pool->num_threads; i++) {
-      thrd_join(pool->threads[i], NULL);
+      thrd_join(pool->threads[i].thread, NULL);
    }
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -132,7 +288,7 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
 {
    struct lp_cs_tpool_task *task;
 
-   if (pool->num_threads == 0) {
+   if (pool->num_threads == 0 || num_iters <= 0) {
       struct lp_cs_local_mem lmem;
 
       memset(&lmem, 0, sizeof(lmem));
@@ -147,18 +303,31 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
       return NULL;
    }
 
+   task->ranges = CALLOC(pool->num_threads, sizeof(*task->ranges));
+   if (!task->ranges) {
+      FREE(task);
+      return NULL;
+   }
+
    task->work = work;
    task->data = data;
    task->iter_total = num_iters;
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
+   /* Initial even split of the iterations, one contiguous range per
+    * worker; imbalance is fixed up by stealing.
+    */
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      unsigned start = (uint64_t)num_iters * i / pool->num_threads;
+      unsigned end = (uint64_t)num_iters * (i + 1) / pool->num_threads;
+      task->ranges[i] = range_pack(start, end);
+   }
 
    cnd_init(&task->finish);
 
    mtx_lock(&pool->m);
 
    list_addtail(&task->list, &pool->workqueue);
+   task->queued = true;
 
    cnd_broadcast(&pool->new_work);
    mtx_unlock(&pool->m);
@@ -175,11 +344,13 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
       return;
 
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
+   while (task->active_workers ||
+          p_atomic_read(&task->iter_finished) < task->iter_total)
       cnd_wait(&task->finish, &pool->m);
    mtx_unlock(&pool->m);
 
    cnd_destroy(&task->finish);
+   FREE(task->ranges);
    FREE(task);
    *task_handle = NULL;
 }
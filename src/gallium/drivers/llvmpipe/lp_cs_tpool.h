@@ -30,6 +30,13 @@
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ *
+ * The iteration space of a task is split into one contiguous range per
+ * worker thread.  Workers take chunks off the front of their own range
+ * and, once it is empty, steal the back half of another worker's range,
+ * all with lock-free compare-and-swap on the packed range bounds.  The
+ * pool mutex is only taken to queue/retire tasks and to sleep, so several
+ * dispatches may be in flight at once and workers spread across them.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
@@ -41,11 +48,19 @@
 
 #include "lp_limits.h"
 
+struct lp_cs_tpool;
+
+struct lp_cs_tpool_thread {
+   struct lp_cs_tpool *pool;
+   unsigned index;
+   thrd_t thread;
+};
+
 struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   struct lp_cs_tpool_thread *threads;
    unsigned num_threads;
    struct list_head workqueue;
    bool shutdown;
@@ -64,10 +79,17 @@ struct lp_cs_tpool_task {
    struct list_head list;
    cnd_t finish;
    unsigned iter_total;
-   unsigned iter_start;
-   unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   unsigned iter_finished;      /* atomic */
+
+   /* Per worker thread [start, end) of unclaimed iterations, packed as
+    * start | (uint64_t)end << 32 so that both can be updated by one CAS.
+    */
+   uint64_t *ranges;
+
+   /* protected by lp_cs_tpool::m */
+   unsigned active_workers;
+   bool queued;
+   bool drained;
 };
 
 struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
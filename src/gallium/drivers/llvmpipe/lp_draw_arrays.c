@@ -73,9 +73,17 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
       return;
    }
 
+   /* Switch to the optimized fragment shader variant once it's ready. */
+   if (lp->fs_fallback &&
+       util_queue_fence_is_signalled(&lp->fs_fallback->compile_job->fence))
+      lp->dirty |= LP_NEW_FS_VARIANT;
+
    if (lp->dirty)
       llvmpipe_update_derived(lp);
 
+   if (lp->fs_fallback)
+      lp->nr_fs_fallback_draws++;
+
    /*
     * Map vertex buffers
     */
@@ -28,8 +28,10 @@
 
 #include "pipe/p_screen.h"
 #include "util/u_memory.h"
+#include "util/os_time.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
+#include "lp_perf.h"
 
 
 #include "util/timespec.h"
@@ -123,8 +125,13 @@ lp_fence_wait(struct lp_fence *f)
 
    mtx_lock(&f->mutex);
    assert(f->issued);
-   while (f->count < f->rank) {
-      cnd_wait(&f->signalled, &f->mutex);
+   if (f->count < f->rank) {
+      int64_t t0 = os_time_get();
+      while (f->count < f->rank) {
+         cnd_wait(&f->signalled, &f->mutex);
+      }
+      LP_COUNT(nr_fence_stalls);
+      LP_COUNT_ADD(fence_stall_time, os_time_get() - t0);
    }
    mtx_unlock(&f->mutex);
 }
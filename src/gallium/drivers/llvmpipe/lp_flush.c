@@ -118,29 +118,44 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
                         boolean do_not_block,
                         const char *reason)
 {
-   unsigned referenced = 0;
+   const unsigned conflict = read_only ? LP_REFERENCED_FOR_WRITE :
+      (LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE);
+   unsigned referenced = 0, referenced_by_others = 0;
    struct llvmpipe_screen *lp_screen = llvmpipe_screen(pipe->screen);
 
    mtx_lock(&lp_screen->ctx_mutex);
    list_for_each_entry(struct llvmpipe_context, ctx, &lp_screen->ctx_list, list) {
-      referenced |=
+      unsigned ref =
          llvmpipe_is_resource_referenced((struct pipe_context *)ctx,
                                          resource, level);
+      referenced |= ref;
+      if (&ctx->pipe != pipe)
+         referenced_by_others |= ref;
    }
    mtx_unlock(&lp_screen->ctx_mutex);
 
-   if ((referenced & LP_REFERENCED_FOR_WRITE) ||
-       ((referenced & LP_REFERENCED_FOR_READ) && !read_only)) {
+   if (referenced & conflict) {
 
       if (cpu_access)
          if (do_not_block)
             return FALSE;
 
-      /*
-       * Flush and wait.
-       * Finish so VS can use FS results.
-       */
-      llvmpipe_finish(pipe, reason);
+      if (referenced_by_others & conflict) {
+         /*
+          * We can't look into the other contexts' scenes safely, so flush
+          * and wait for everything queued so far.
+          * Finish so VS can use FS results.
+          */
+         llvmpipe_finish(pipe, reason);
+      } else {
+         /*
+          * Flush, then only wait for the scenes which actually conflict
+          * with this access, letting unrelated ones run on.
+          */
+         llvmpipe_flush(pipe, NULL, reason);
+         lp_setup_wait_resource(llvmpipe_context(pipe)->setup,
+                                resource, read_only);
+      }
    }
 
    return TRUE;
@@ -39,6 +39,13 @@
 #define TILE_ORDER 6
 #define TILE_SIZE (1 << TILE_ORDER)
 
+/**
+ * Range of bin sizes a scene may pick, see lp_scene_begin_binning().
+ * The rasterizer still walks bins in TILE_SIZE blocks.
+ */
+#define LP_MIN_TILE_ORDER 5
+#define LP_MAX_TILE_ORDER 7
+
 
 /**
  * Max texture sizes
@@ -66,8 +73,6 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 32
-
 
 /**
  * Max number of shader variants (for all shaders combined,
@@ -331,7 +331,7 @@ lp_linear_check_variant(struct lp_fragment_shader_variant *variant)
 
    /* Check shader.  May not have been jitted.
     */
-   if (variant->linear_function == NULL) {
+   if (variant->jit_linear_llvm == NULL) {
       if (LP_DEBUG & DEBUG_LINEAR)
          debug_printf("  -- no linear shader\n");
       goto fail;
@@ -88,6 +88,11 @@ lp_print_counters(void)
       debug_printf("llvmpipe:   nr_partially_covered_16x16: %9u (%3.0f%% of %u)\n", lp_count.nr_partially_covered_16, p3, total_16);
       debug_printf("llvmpipe:   nr_empty_16x16:             %9u (%3.0f%% of %u)\n", lp_count.nr_empty_16, p1, total_16);
 
+      p4 = 100.0 * (float) lp_count.nr_hiz_culled_16 / (float) total_16;
+
+      debug_printf("llvmpipe: nr_hiz_culled_tiles:          %9u\n", lp_count.nr_hiz_culled_tiles);
+      debug_printf("llvmpipe: nr_hiz_culled_16x16:          %9u (%3.0f%% of %u)\n", lp_count.nr_hiz_culled_16, p4, total_16);
+
       total_4 = (lp_count.nr_empty_4 +
                  lp_count.nr_fully_covered_4 +
                  lp_count.nr_partially_covered_4);
@@ -122,5 +127,8 @@ lp_print_counters(void)
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
 
+      debug_printf("llvmpipe: nr_fence_stalls:              %u\n", lp_count.nr_fence_stalls);
+      debug_printf("llvmpipe: total fence stall time:       %.2f sec\n", lp_count.fence_stall_time / 1000000.0);
+
    }
 }
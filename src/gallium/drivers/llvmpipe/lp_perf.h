@@ -34,6 +34,7 @@
 #define LP_PERF_H
 
 #include "pipe/p_compiler.h"
+#include "util/u_atomic.h"
 
 /**
  * Various counters
@@ -56,6 +57,8 @@ struct lp_counters
    unsigned nr_empty_16;
    unsigned nr_fully_covered_16;
    unsigned nr_partially_covered_16;
+   unsigned nr_hiz_culled_tiles;
+   unsigned nr_hiz_culled_16;
    unsigned nr_empty_4;
    unsigned nr_fully_covered_4;
    unsigned nr_partially_covered_4;
@@ -64,6 +67,8 @@ struct lp_counters
    unsigned nr_non_empty_4;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
+   unsigned nr_fence_stalls;
+   int64_t fence_stall_time;   /**< total, in microseconds */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
@@ -74,10 +79,12 @@ struct lp_counters
 extern struct lp_counters lp_count;
 
 
-/** Increment the named counter (only for debug builds) */
+/** Increment the named counter (only for debug builds).
+ * Atomic, as binning and rasterization may run on several threads.
+ */
 #ifdef DEBUG
-#define LP_COUNT(counter) lp_count.counter++
-#define LP_COUNT_ADD(counter, incr)  lp_count.counter += (incr)
+#define LP_COUNT(counter) p_atomic_inc(&lp_count.counter)
+#define LP_COUNT_ADD(counter, incr)  p_atomic_add(&lp_count.counter, (incr))
 #define LP_COUNT_GET(counter) (lp_count.counter)
 #else
 #define LP_COUNT(counter) do {} while (0)
@@ -55,12 +55,20 @@ llvmpipe_create_query(struct pipe_context *pipe,
                       unsigned type,
                       unsigned index)
 {
-   assert(type < PIPE_QUERY_TYPES);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   unsigned num_threads = MAX2(1, screen->num_threads);
 
-   struct llvmpipe_query *pq = CALLOC_STRUCT(llvmpipe_query);
+   assert(type < PIPE_QUERY_TYPES || type == LP_QUERY_FS_FALLBACK_DRAWS);
+
+   /* The per-thread counters live right after the query itself. */
+   struct llvmpipe_query *pq =
+      CALLOC(1, sizeof(*pq) + 2 * num_threads * sizeof(uint64_t));
    if (pq) {
       pq->type = type;
       pq->index = index;
+      pq->num_threads = num_threads;
+      pq->start = (uint64_t *)(pq + 1);
+      pq->end = pq->start + num_threads;
    }
 
    return (struct pipe_query *) pq;
@@ -180,6 +188,9 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
       stats->primitives_storage_needed = pq->num_primitives_generated[0];
    }
       break;
+   case LP_QUERY_FS_FALLBACK_DRAWS:
+      *result = pq->end[0] - pq->start[0];
+      break;
    case PIPE_QUERY_PIPELINE_STATISTICS: {
       struct pipe_query_data_pipeline_statistics *stats =
          (struct pipe_query_data_pipeline_statistics *)vresult;
@@ -291,6 +302,9 @@ llvmpipe_get_query_result_resource(struct pipe_context *pipe,
       case PIPE_QUERY_SO_OVERFLOW_PREDICATE:
          value = !!(pq->num_primitives_generated[0] > pq->num_primitives_written[0]);
          break;
+      case LP_QUERY_FS_FALLBACK_DRAWS:
+         value = pq->end[0] - pq->start[0];
+         break;
       case PIPE_QUERY_PIPELINE_STATISTICS:
          switch ((enum pipe_statistics_query_index)index) {
          case PIPE_STAT_QUERY_IA_VERTICES:
@@ -392,8 +406,8 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe_finish(pipe, __FUNCTION__);
    }
 
-   memset(pq->start, 0, sizeof(pq->start));
-   memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->start, 0, pq->num_threads * sizeof(*pq->start));
+   memset(pq->end, 0, pq->num_threads * sizeof(*pq->end));
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -433,6 +447,9 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->active_occlusion_queries++;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
       break;
+   case LP_QUERY_FS_FALLBACK_DRAWS:
+      pq->start[0] = llvmpipe->nr_fs_fallback_draws;
+      break;
    default:
       break;
    }
@@ -512,6 +529,9 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->active_occlusion_queries--;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
       break;
+   case LP_QUERY_FS_FALLBACK_DRAWS:
+      pq->end[0] = llvmpipe->nr_fs_fallback_draws;
+      break;
    default:
       break;
    }
@@ -557,6 +577,28 @@ llvmpipe_set_active_query_state(struct pipe_context *pipe, bool enable)
 }
 
 
+int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+   static const struct pipe_driver_query_info queries[] = {
+      { "fs-fallback-draws", LP_QUERY_FS_FALLBACK_DRAWS, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_UINT64,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+   };
+
+   if (!info)
+      return ARRAY_SIZE(queries);
+
+   if (index >= ARRAY_SIZE(queries))
+      return 0;
+
+   *info = queries[index];
+   return 1;
+}
+
+
 void
 llvmpipe_init_query_funcs(struct llvmpipe_context *llvmpipe)
 {
@@ -39,11 +39,18 @@
 
 
 struct llvmpipe_context;
+struct pipe_screen;
+struct pipe_driver_query_info;
+
+
+/** Draws made with an unoptimized fragment shader variant */
+#define LP_QUERY_FS_FALLBACK_DRAWS (PIPE_QUERY_DRIVER_SPECIFIC + 0)
 
 
 struct llvmpipe_query {
-   uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
-   uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   uint64_t *start;                 /* start count value for each thread */
+   uint64_t *end;                   /* end count value for each thread */
+   unsigned num_threads;            /* size of the start/end arrays */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    unsigned type;                   /* PIPE_QUERY_* */
    unsigned index;
@@ -58,4 +65,8 @@ extern void llvmpipe_init_query_funcs(struct llvmpipe_context * );
 
 extern boolean llvmpipe_check_render_cond(struct llvmpipe_context *);
 
+extern int llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                                          unsigned index,
+                                          struct pipe_driver_query_info *info);
+
 #endif /* LP_QUERY_H */
@@ -78,7 +78,7 @@ lp_rast_begin(struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization(scene);
-   lp_scene_bin_iter_begin(scene);
+   lp_scene_bin_iter_begin(scene, rast->num_threads);
 }
 
 
@@ -89,6 +89,90 @@ lp_rast_end(struct lp_rasterizer *rast)
 }
 
 
+/**
+ * Forget all hierarchical Z bounds of the current tile.
+ */
+static void
+lp_rast_hiz_reset(struct lp_rasterizer_task *task)
+{
+   for (unsigned i = 0; i < LP_HIZ_BLOCKS; i++)
+      task->hiz_zmax[i] = LP_HIZ_UNKNOWN;
+   task->hiz_tile_zmax = LP_HIZ_UNKNOWN;
+   task->hiz_dirty = FALSE;
+}
+
+
+/**
+ * Recompute the bound of the whole tile after some of its 16x16 blocks
+ * were lowered.
+ */
+void
+lp_rast_hiz_update_tile(struct lp_rasterizer_task *task)
+{
+   const unsigned nx = DIV_ROUND_UP(task->width, 16);
+   const unsigned ny = DIV_ROUND_UP(task->height, 16);
+   float zmax = 0.0f;
+
+   for (unsigned by = 0; by < ny; by++) {
+      for (unsigned bx = 0; bx < nx; bx++)
+         zmax = MAX2(zmax, task->hiz_zmax[by * LP_HIZ_STRIDE + bx]);
+   }
+
+   task->hiz_tile_zmax = zmax;
+   task->hiz_dirty = FALSE;
+}
+
+
+/**
+ * Depth clears set the bounds of the whole tile.
+ */
+static void
+lp_rast_hiz_clear(struct lp_rasterizer_task *task,
+                  uint64_t clear_value, uint64_t clear_mask)
+{
+   const enum pipe_format format = task->scene->fb.zsbuf->format;
+   const uint64_t depth_mask = util_pack64_mask_z(format, 0xffffffff);
+
+   if (!(clear_mask & depth_mask))
+      return;
+
+   if ((clear_mask & depth_mask) != depth_mask) {
+      lp_rast_hiz_reset(task);
+      return;
+   }
+
+   /* Unpack the clear value the way it is stored in the depth buffer */
+   union {
+      uint16_t us;
+      uint32_t ui;
+      uint64_t ul;
+   } packed;
+   float depth;
+
+   switch (util_format_get_blocksize(format)) {
+   case 2:
+      packed.us = (uint16_t) clear_value;
+      break;
+   case 4:
+      packed.ui = (uint32_t) clear_value;
+      break;
+   case 8:
+      packed.ul = clear_value;
+      break;
+   default:
+      lp_rast_hiz_reset(task);
+      return;
+   }
+
+   util_format_unpack_z_float(format, &depth, &packed, 1);
+
+   for (unsigned i = 0; i < LP_HIZ_BLOCKS; i++)
+      task->hiz_zmax[i] = depth;
+   task->hiz_tile_zmax = depth;
+   task->hiz_dirty = FALSE;
+}
+
+
 /**
  * Beginning rasterization of a tile.
  * \param x  window X position of the tile, in pixels
@@ -104,16 +188,25 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    LP_DBG(DEBUG_RAST, "%s %d,%d\n", __FUNCTION__, x, y);
 
    task->bin = bin;
-   task->x = x * TILE_SIZE;
-   task->y = y * TILE_SIZE;
-   task->width = TILE_SIZE + x * TILE_SIZE > scene->fb.width ?
-                    scene->fb.width - x * TILE_SIZE : TILE_SIZE;
-   task->height = TILE_SIZE + y * TILE_SIZE > scene->fb.height ?
-                    scene->fb.height - y * TILE_SIZE : TILE_SIZE;
+   task->x = x << scene->tile_order;
+   task->y = y << scene->tile_order;
+   task->width = MIN2(scene->tile_size, scene->fb.width - task->x);
+   task->height = MIN2(scene->tile_size, scene->fb.height - task->y);
 
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
 
+   /* The bounds are only tracked for a single layer and only within the
+    * bin, as nothing tells us what happened to the depth buffer between
+    * scenes.
+    */
+   task->hiz_enabled = scene->fb.zsbuf && scene->fb_max_layer == 0 &&
+                       !(LP_PERF & PERF_NO_HIZ);
+   task->hiz_cull = FALSE;
+   task->hiz_update = FALSE;
+   if (task->hiz_enabled)
+      lp_rast_hiz_reset(task);
+
    for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
          task->color_tiles[i] = scene->cbufs[i].map +
@@ -285,6 +378,9 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
             dst_layer += scene->zsbuf.layer_stride;
          }
       }
+
+      if (task->hiz_enabled)
+         lp_rast_hiz_clear(task, arg.clear_zstencil.value, clear_mask64);
    }
 }
 
@@ -317,9 +413,39 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
 
    const struct lp_fragment_shader_variant *variant = state->variant;
 
-   /* render the whole 64x64 tile in 4x4 chunks */
+   /* 16x16 blocks (one bit per hierarchical Z block) the tile is occluded in */
+   uint64_t hiz_culled = 0;
+   if (task->hiz_cull) {
+      float zmin, zmax;
+
+      lp_rast_hiz_zrange(inputs, tile_x, tile_y, scene->tile_size,
+                         &zmin, &zmax);
+      if (zmin > task->hiz_tile_zmax) {
+         LP_COUNT(nr_hiz_culled_tiles);
+         return;
+      }
+
+      for (unsigned y = 0; y < task->height; y += 16) {
+         for (unsigned x = 0; x < task->width; x += 16) {
+            const unsigned i = lp_rast_hiz_index(task, tile_x + x, tile_y + y);
+
+            lp_rast_hiz_zrange(inputs, tile_x + x, tile_y + y, 16,
+                               &zmin, &zmax);
+            if (zmin > task->hiz_zmax[i]) {
+               hiz_culled |= (uint64_t)1 << i;
+               LP_COUNT(nr_hiz_culled_16);
+            }
+         }
+      }
+   }
+
+   /* render the whole tile in 4x4 chunks */
    for (unsigned y = 0; y < task->height; y += 4){
       for (unsigned x = 0; x < task->width; x += 4) {
+         if (hiz_culled &&
+             (hiz_culled >> lp_rast_hiz_index(task, tile_x + x, tile_y + y)) & 1)
+            continue;
+
          /* color buffer */
          uint8_t *color[PIPE_MAX_COLOR_BUFS];
          unsigned stride[PIPE_MAX_COLOR_BUFS];
@@ -377,6 +503,14 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          END_JIT_CALL();
       }
    }
+
+   if (task->hiz_update) {
+      for (unsigned y = 0; y < task->height; y += 16) {
+         for (unsigned x = 0; x < task->width; x += 16)
+            lp_rast_hiz_update_16(task, inputs, tile_x + x, tile_y + y);
+      }
+      lp_rast_hiz_update_tile(task);
+   }
 }
 
 
@@ -419,8 +553,8 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    assert(state);
 
    /* Sanity checks */
-   assert(x < scene->tiles_x * TILE_SIZE);
-   assert(y < scene->tiles_y * TILE_SIZE);
+   assert(x < scene->tiles_x << scene->tile_order);
+   assert(y < scene->tiles_y << scene->tile_order);
    assert(x % TILE_VECTOR_WIDTH == 0);
    assert(y % TILE_VECTOR_HEIGHT == 0);
 
@@ -460,7 +594,7 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if (x - task->x < task->width && y - task->y < task->height) {
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
       task->thread_data.raster_state.view_index = inputs->view_index;
@@ -683,6 +817,19 @@ lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    task->state = arg.set_state;
+
+   if (task->hiz_enabled) {
+      const struct lp_fragment_shader_variant *variant =
+         task->state->variant;
+
+      /* Depth writes which may raise the stored values void the bounds */
+      if (variant->hiz_invalidate)
+         lp_rast_hiz_reset(task);
+
+      task->hiz_cull = variant->hiz_cull;
+      task->hiz_update = variant->hiz_update &&
+                         task->scene->zsbuf.nr_samples == 1;
+   }
 }
 
 
@@ -1054,15 +1201,18 @@ rasterize_scene(struct lp_rasterizer_task *task,
 #endif
 
    if (!task->rast->no_rast) {
-      /* loop over scene bins, rasterize each */
+      /* loop over the non-empty scene bins, rasterize each */
       {
-         struct cmd_bin *bin;
-         int i, j;
+         unsigned first, count;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-            if (!is_empty_bin(bin))
-               rasterize_bin(task, bin, i, j);
+         while ((count = lp_scene_bin_iter_next(scene, &first))) {
+            for (unsigned k = first; k < first + count; k++) {
+               int i, j;
+               struct cmd_bin *bin = lp_scene_bin_iter_get(scene, k, &i, &j);
+               if (!is_empty_bin(bin))
+                  rasterize_bin(task, bin, i, j);
+            }
          }
       }
    }
@@ -1171,6 +1321,8 @@ thread_function(void *init_data)
    snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
 
+   lp_thread_pin_to_L3(task->thread_index, rast->num_threads);
+
    /* Make sure that denorms are treated like zeros. This is
     * the behavior required by D3D10. OpenGL doesn't care.
     */
@@ -1264,6 +1416,18 @@ lp_rast_create(unsigned num_threads)
       goto no_rast;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads) {
+      rast->threads = CALLOC(num_threads, sizeof(*rast->threads));
+      if (!rast->threads) {
+         goto no_threads;
+      }
+   }
+
    rast->full_scenes = lp_scene_queue_create();
    if (!rast->full_scenes) {
       goto no_full_scenes;
@@ -1304,6 +1468,10 @@ no_thread_data_cache:
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
+   FREE(rast->threads);
+no_threads:
+   FREE(rast->tasks);
+no_tasks:
    FREE(rast);
 no_rast:
    return NULL;
@@ -1360,6 +1528,8 @@ lp_rast_destroy(struct lp_rasterizer *rast)
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
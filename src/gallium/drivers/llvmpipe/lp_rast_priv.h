@@ -28,6 +28,7 @@
 #ifndef LP_RAST_PRIV_H
 #define LP_RAST_PRIV_H
 
+#include <float.h>
 #include "util/format/u_format.h"
 #include "util/u_thread.h"
 #include "gallivm/lp_bld_debug.h"
@@ -76,6 +77,25 @@ extern const struct lp_rasterizer_task *jit_task;
 struct lp_rasterizer;
 struct cmd_bin;
 
+/**
+ * Hierarchical Z.
+ *
+ * While rasterizing a bin each task keeps a conservative upper bound of
+ * the depth values in every 16x16 block of the tile, so that primitives
+ * lying entirely behind it can skip the block.  The bounds start out
+ * unknown in every bin and are established by depth clears and by fully
+ * covered blocks of depth writing primitives.  Only the LESS and LEQUAL
+ * depth functions take advantage of them.
+ */
+#define LP_HIZ_BLOCK_ORDER 4
+#define LP_HIZ_STRIDE (1 << (LP_MAX_TILE_ORDER - LP_HIZ_BLOCK_ORDER))
+#define LP_HIZ_BLOCKS (LP_HIZ_STRIDE * LP_HIZ_STRIDE)
+#define LP_HIZ_UNKNOWN FLT_MAX
+
+/** Slack for depth buffer quantization */
+#define LP_HIZ_EPSILON (1.0f / 32768.0f)
+
+
 /**
  * Per-thread rasterization state
  */
@@ -100,6 +120,14 @@ struct lp_rasterizer_task
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
+   /** Hierarchical Z state of the current tile */
+   boolean hiz_enabled;  /**< depth bounds are maintained for this bin */
+   boolean hiz_cull;     /**< current state may skip occluded blocks */
+   boolean hiz_update;   /**< current state lowers bounds of full blocks */
+   boolean hiz_dirty;    /**< hiz_tile_zmax needs recomputing */
+   float hiz_tile_zmax;
+   float hiz_zmax[LP_HIZ_BLOCKS];
+
    pipe_semaphore work_ready;
    pipe_semaphore work_done;
 };
@@ -108,7 +136,7 @@ struct lp_rasterizer_task
 /**
  * This is the state required while rasterizing tiles.
  * Note that this contains per-thread information too.
- * The tile size is TILE_SIZE x TILE_SIZE pixels.
+ * The tile size is picked per scene, see lp_scene::tile_size.
  */
 struct lp_rasterizer
 {
@@ -121,11 +149,11 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread (at least one) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -148,7 +176,7 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
 
 
 /**
- * Get the pointer to a 4x4 color block (within a 64x64 tile).
+ * Get the pointer to a 4x4 color block (within the current tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
@@ -156,8 +184,8 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
                                 unsigned buf, unsigned x, unsigned y,
                                 unsigned layer)
 {
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
    assert(buf < task->scene->fb.nr_cbufs);
@@ -166,10 +194,10 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
    /*
     * We don't actually benefit from having per tile cbuf/zsbuf pointers,
     * it's just extra work - the mul/add would be exactly the same anyway.
-    * Fortunately the extra work (modulo) here is very cheap at least...
+    * Fortunately the extra work (subtraction) here is very cheap at least...
     */
-   unsigned px = x % TILE_SIZE;
-   unsigned py = y % TILE_SIZE;
+   unsigned px = x - task->x;
+   unsigned py = y - task->y;
 
    unsigned pixel_offset = px * task->scene->cbufs[buf].format_bytes +
                            py * task->scene->cbufs[buf].stride;
@@ -186,21 +214,21 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
 
 
 /**
- * Get the pointer to a 4x4 depth block (within a 64x64 tile).
+ * Get the pointer to a 4x4 depth block (within the current tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
 lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
                                 unsigned x, unsigned y, unsigned layer)
 {
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
    assert(task->depth_tile);
 
-   unsigned px = x % TILE_SIZE;
-   unsigned py = y % TILE_SIZE;
+   unsigned px = x - task->x;
+   unsigned py = y - task->y;
 
    unsigned pixel_offset = px * task->scene->zsbuf.format_bytes +
                            py * task->scene->zsbuf.stride;
@@ -215,6 +243,110 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Index of the 16x16 hierarchical Z block containing x, y.
+ * \param x, y location in window coords
+ */
+static inline unsigned
+lp_rast_hiz_index(const struct lp_rasterizer_task *task, int x, int y)
+{
+   const unsigned bx = (unsigned)(x - task->x) >> LP_HIZ_BLOCK_ORDER;
+   const unsigned by = (unsigned)(y - task->y) >> LP_HIZ_BLOCK_ORDER;
+
+   assert(bx < LP_HIZ_STRIDE && by < LP_HIZ_STRIDE);
+   return by * LP_HIZ_STRIDE + bx;
+}
+
+
+/**
+ * Conservative range of the depth values a primitive can produce in the
+ * size x size pixel block at x, y.
+ * \param x, y location of the block in window coords
+ */
+static inline void
+lp_rast_hiz_zrange(const struct lp_rast_shader_inputs *inputs,
+                   int x, int y, unsigned size,
+                   float *zmin, float *zmax)
+{
+   /* First coefficient is position */
+   const float z0 = GET_A0(inputs)[0][2];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+
+   /* Pad the block by a pixel to cover any pixel center convention and
+    * the sample positions.
+    */
+   const float zx0 = dzdx * (float)(x - 1);
+   const float zx1 = dzdx * (float)(x + (int)size + 1);
+   const float zy0 = dzdy * (float)(y - 1);
+   const float zy1 = dzdy * (float)(y + (int)size + 1);
+
+   /* The shader evaluates the plane in a different order, allow for the
+    * rounding differences on top of the depth buffer quantization.
+    */
+   const float eps = LP_HIZ_EPSILON +
+      (fabsf(z0) + MAX2(fabsf(zx0), fabsf(zx1)) +
+       MAX2(fabsf(zy0), fabsf(zy1))) * (1.0f / (1 << 18));
+
+   /* Depth values are clamped to [0, 1] when converted to unorm formats */
+   *zmin = MIN2(z0 + MIN2(zx0, zx1) + MIN2(zy0, zy1) - eps, 1.0f);
+   *zmax = MAX2(z0 + MAX2(zx0, zx1) + MAX2(zy0, zy1) + eps, 0.0f);
+}
+
+
+/**
+ * Return the 16x16 blocks of the 64x64 block at x, y set in candidates
+ * (one bit per block, in row order) which the primitive cannot pass the
+ * depth test in.
+ */
+static inline unsigned
+lp_rast_hiz_cull_mask_64(const struct lp_rasterizer_task *task,
+                         const struct lp_rast_shader_inputs *inputs,
+                         int x, int y, unsigned candidates)
+{
+   unsigned culled = 0;
+
+   while (candidates) {
+      const int i = ffs(candidates) - 1;
+      const int bx = x + (i & 3) * 16;
+      const int by = y + (i >> 2) * 16;
+      float zmin, zmax;
+
+      candidates &= ~(1 << i);
+
+      lp_rast_hiz_zrange(inputs, bx, by, 16, &zmin, &zmax);
+      if (zmin > task->hiz_zmax[lp_rast_hiz_index(task, bx, by)])
+         culled |= 1 << i;
+   }
+
+   return culled;
+}
+
+
+/**
+ * Lower the depth bound of the 16x16 block at x, y after it has been
+ * fully covered by a primitive.  Only valid if task->hiz_update is set.
+ */
+static inline void
+lp_rast_hiz_update_16(struct lp_rasterizer_task *task,
+                      const struct lp_rast_shader_inputs *inputs,
+                      int x, int y)
+{
+   float *bound = &task->hiz_zmax[lp_rast_hiz_index(task, x, y)];
+   float zmin, zmax;
+
+   lp_rast_hiz_zrange(inputs, x, y, 16, &zmin, &zmax);
+   if (zmax < *bound) {
+      *bound = zmax;
+      task->hiz_dirty = TRUE;
+   }
+}
+
+
+void
+lp_rast_hiz_update_tile(struct lp_rasterizer_task *task);
+
+
 /**
  * Shade all pixels in a 4x4 block.  The fragment code omits the
  * triangle in/out tests.
@@ -263,7 +395,7 @@ lp_rast_shade_quads_all(struct lp_rasterizer_task *task,
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if (x - task->x < task->width && y - task->y < task->height) {
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
       task->thread_data.raster_state.view_index = inputs->view_index;
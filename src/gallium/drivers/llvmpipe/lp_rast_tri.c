@@ -743,6 +743,62 @@ lp_rast_triangle_32_3_4(struct lp_rasterizer_task *task,
 #define BUILD_MASK_LINEAR(c, dcdx, dcdy) build_mask_linear(c, dcdx, dcdy)
 #endif
 
+
+/**
+ * Mask of the 16x16 chunks of a 64x64 block which lie outside a
+ * tile_size x tile_size tile at its top-left corner.
+ */
+static inline unsigned
+block_64_skipmask(unsigned tile_size)
+{
+   const unsigned n = tile_size / 16;
+   unsigned inside = 0;
+
+   for (unsigned i = 0; i < n; i++)
+      inside |= ((1 << n) - 1) << (i * 4);
+
+   return 0xffff & ~inside;
+}
+
+
+/**
+ * Classify the planes of a triangle against the 64x64 block at x, y of a
+ * bin larger than TILE_SIZE, the same way setup does for whole tiles.
+ * Planes which trivially accept the block are replaced by one which is
+ * inside everywhere, as the block rasterizers only have the precision for
+ * planes crossing the block.
+ * \return FALSE if the block is trivially rejected
+ */
+static inline boolean
+classify_block_64(const struct lp_rast_plane *plane,
+                  struct lp_rast_plane *block_plane,
+                  unsigned nr_planes,
+                  int x, int y)
+{
+   for (unsigned j = 0; j < nr_planes; j++) {
+      const int64_t c = plane[j].c +
+                        IMUL64(plane[j].dcdy, y) -
+                        IMUL64(plane[j].dcdx, x);
+      const int64_t eo = (int64_t)plane[j].eo << TILE_ORDER;
+      const int64_t ei = ((int64_t)plane[j].dcdy -
+                          (int64_t)plane[j].dcdx -
+                          (int64_t)plane[j].eo) << TILE_ORDER;
+
+      if (c + eo < 0)
+         return FALSE;
+
+      if (c + ei - 1 < 0) {
+         block_plane[j] = plane[j];
+      } else {
+         memset(&block_plane[j], 0, sizeof block_plane[j]);
+         block_plane[j].c = 1 << 30;
+      }
+   }
+
+   return TRUE;
+}
+
+
 #define RASTER_64 1
 
 #define TAG(x) x##_1
@@ -189,34 +189,25 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
 
 
 /**
- * Scan the tile in chunks and figure out which pixels to rasterize
- * for this triangle.
+ * Scan a 64x64 block of the tile in 16x16 chunks and figure out which
+ * pixels to rasterize for this triangle.  The chunks set in skipmask lie
+ * outside the tile and are left alone.
  */
-void
-TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
-                      const union lp_rast_cmd_arg arg)
+static void
+TAG(do_block_64)(struct lp_rasterizer_task *task,
+                 const struct lp_rast_triangle *tri,
+                 const struct lp_rast_plane *plane,
+                 int x, int y,
+                 unsigned skipmask)
 {
-   const struct lp_rast_triangle *tri = arg.triangle.tri;
-   unsigned plane_mask = arg.triangle.plane_mask;
-   const struct lp_rast_plane *tri_plane = GET_PLANES(tri);
-   const int x = task->x, y = task->y;
-   struct lp_rast_plane plane[NR_PLANES];
    int64_t c[NR_PLANES];
    unsigned outmask, inmask, partmask, partial_mask;
-   unsigned j = 0;
+   unsigned j;
 
-   if (tri->inputs.disable) {
-      /* This triangle was partially binned and has been disabled */
-      return;
-   }
+   outmask = skipmask;          /* outside one or more trivial reject planes */
+   partmask = skipmask;         /* outside one or more trivial accept planes */
 
-   outmask = 0;                 /* outside one or more trivial reject planes */
-   partmask = 0;                /* outside one or more trivial accept planes */
-
-   while (plane_mask) {
-      int i = ffs(plane_mask) - 1;
-      plane[j] = tri_plane[i];
-      plane_mask &= ~(1 << i);
+   for (j = 0; j < NR_PLANES; j++) {
       c[j] = plane[j].c + IMUL64(plane[j].dcdy, y) - IMUL64(plane[j].dcdx, x);
 
       {
@@ -285,8 +276,6 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
                      &outmask,   /* sign bits from c[i][0..15] + cox */
                      &partmask); /* sign bits from c[i][0..15] + cio */
       }
-
-      j++;
    }
 
    if (outmask == 0xffff)
@@ -305,6 +294,16 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
    LP_COUNT_ADD(nr_empty_16, util_bitcount(0xffff & ~(partial_mask | inmask)));
 
+   if (task->hiz_cull) {
+      const unsigned culled =
+         lp_rast_hiz_cull_mask_64(task, &tri->inputs, x, y,
+                                  partial_mask | inmask);
+
+      LP_COUNT_ADD(nr_hiz_culled_16, util_bitcount(culled));
+      partial_mask &= ~culled;
+      inmask &= ~culled;
+   }
+
    /* Iterate over partials:
     */
    while (partial_mask) {
@@ -339,7 +338,74 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
+
+      if (task->hiz_update)
+         lp_rast_hiz_update_16(task, &tri->inputs, px, py);
+   }
+}
+
+
+/**
+ * Scan the tile in chunks and figure out which pixels to rasterize
+ * for this triangle.
+ */
+void
+TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
+                      const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_triangle *tri = arg.triangle.tri;
+   unsigned plane_mask = arg.triangle.plane_mask;
+   const struct lp_rast_plane *tri_plane = GET_PLANES(tri);
+   const unsigned tile_size = task->scene->tile_size;
+   struct lp_rast_plane plane[NR_PLANES];
+   unsigned j = 0;
+
+   if (tri->inputs.disable) {
+      /* This triangle was partially binned and has been disabled */
+      return;
+   }
+
+   if (task->hiz_cull) {
+      float zmin, zmax;
+
+      lp_rast_hiz_zrange(&tri->inputs, task->x, task->y, tile_size,
+                         &zmin, &zmax);
+      if (zmin > task->hiz_tile_zmax) {
+         LP_COUNT(nr_hiz_culled_tiles);
+         return;
+      }
    }
+
+   while (plane_mask) {
+      int i = ffs(plane_mask) - 1;
+      plane[j++] = tri_plane[i];
+      plane_mask &= ~(1 << i);
+   }
+
+   if (tile_size == TILE_SIZE) {
+      TAG(do_block_64)(task, tri, plane, task->x, task->y, 0);
+   } else if (tile_size < TILE_SIZE) {
+      TAG(do_block_64)(task, tri, plane, task->x, task->y,
+                       block_64_skipmask(tile_size));
+   } else {
+      /* The planes were only classified against the whole bin, redo
+       * that for each 64x64 block like setup does for TILE_SIZE bins.
+       */
+      for (unsigned iy = 0; iy < task->height; iy += TILE_SIZE) {
+         for (unsigned ix = 0; ix < task->width; ix += TILE_SIZE) {
+            const int x = task->x + ix, y = task->y + iy;
+            struct lp_rast_plane block_plane[NR_PLANES];
+
+            if (classify_block_64(plane, block_plane, NR_PLANES, x, y))
+               TAG(do_block_64)(task, tri, block_plane, x, y, 0);
+            else
+               LP_COUNT(nr_empty_64);
+         }
+      }
+   }
+
+   if (task->hiz_dirty)
+      lp_rast_hiz_update_tile(task);
 }
 
 
@@ -356,17 +422,18 @@ TRI_16(struct lp_rasterizer_task *task,
    const struct lp_rast_plane *plane = GET_PLANES(tri);
    unsigned mask = arg.triangle.plane_mask;
    __m128i cstep4[NR_PLANES][4];
+   const int tile_size = task->scene->tile_size;
    int x = (mask & 0xff);
    int y = (mask >> 8);
    unsigned outmask = 0;    /* outside one or more trivial reject planes */
 
-   if (x + 12 >= 64) {
-      int i = ((x + 12) - 64) / 4;
+   if (x + 12 >= tile_size) {
+      int i = ((x + 12) - tile_size) / 4;
       outmask |= right_mask_tab[i];
    }
 
-   if (y + 12 >= 64) {
-      int i = ((y + 12) - 64) / 4;
+   if (y + 12 >= tile_size) {
+      int i = ((y + 12) - tile_size) / 4;
       outmask |= bottom_mask_tab[i];
    }
 
@@ -30,6 +30,7 @@
 #include "util/u_memory.h"
 #include "util/reallocarray.h"
 #include "util/u_inlines.h"
+#include "util/u_atomic.h"
 #include "util/format/u_format.h"
 #include "lp_scene.h"
 #include "lp_fence.h"
@@ -73,8 +74,6 @@ lp_scene_create(struct lp_setup_context *setup)
    scene->setup = setup;
    scene->data.head = &scene->data.first;
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
-
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
    {
@@ -101,8 +100,9 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_scene_end_rasterization(scene);
-   mtx_destroy(&scene->mutex);
    free(scene->tiles);
+   free(scene->bin_order);
+   free(scene->active_bins);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -147,6 +147,7 @@ lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
    struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
 
    bin->last_state = NULL;
+   bin->reset = TRUE;
    bin->head = bin->tail;
    if (bin->tail) {
       bin->tail->next = NULL;
@@ -533,60 +534,139 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Fill scene->bin_order with the indices of all bins of the current
+ * tiles_x * tiles_y grid, in Morton order.  Codes are walked over the
+ * enclosing power-of-two square and those falling outside the grid are
+ * skipped, so the order stays spatially coherent for any aspect ratio.
+ */
+static void
+build_bin_order(struct lp_scene *scene)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
+   unsigned dim = util_next_power_of_two(MAX2(scene->tiles_x,
+                                              scene->tiles_y));
+   unsigned n = 0;
+
+   for (unsigned code = 0; code < dim * dim; code++) {
+      unsigned x = 0, y = 0;
+
+      /* de-interleave the even/odd bits of the code */
+      for (unsigned b = 0; (1u << (2 * b)) <= code; b++) {
+         x |= ((code >> (2 * b)) & 1) << b;
+         y |= ((code >> (2 * b + 1)) & 1) << b;
+      }
+
+      if (x < scene->tiles_x && y < scene->tiles_y)
+         scene->bin_order[n++] = y * scene->tiles_x + x;
    }
-   return TRUE;
+
+   assert(n == scene->tiles_x * scene->tiles_y);
+   scene->bin_order_x = scene->tiles_x;
+   scene->bin_order_y = scene->tiles_y;
 }
 
 
+/**
+ * Prepare for rasterizer threads to pull bins out of the scene.
+ * Called once per scene, before any thread calls lp_scene_bin_iter_next().
+ * Empty bins are dropped here so they never get dispatched at all.
+ */
 void
-lp_scene_bin_iter_begin(struct lp_scene *scene)
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_threads)
 {
-   scene->curr_x = scene->curr_y = -1;
+   unsigned n = 0;
+
+   for (unsigned i = 0; i < scene->tiles_x * scene->tiles_y; i++) {
+      unsigned idx = scene->bin_order[i];
+      if (scene->tiles[idx].head)
+         scene->active_bins[n++] = idx;
+   }
+
+   scene->num_active_bins = n;
+   scene->curr_bin = 0;
+
+   /* Hand out 2x2 quads of tiles (consecutive in Morton order) when there
+    * is plenty of work for every thread, single tiles otherwise so that
+    * small scenes still balance across threads.
+    */
+   scene->bin_group_size = n >= MAX2(num_threads, 1) * 16 ? 4 : 1;
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Claim the next group of bins to be rendered.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work to do; this is lock-free, a single atomic add on curr_bin.
+ * \param first  returns the dispatch index of the first claimed bin,
+ *               see lp_scene_bin_iter_get()
+ * \return number of bins claimed, zero once the scene is exhausted
  */
-struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene , int *x, int *y)
+unsigned
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned *first)
 {
-   struct cmd_bin *bin = NULL;
+   const unsigned group = scene->bin_group_size;
+   unsigned start;
+
+   if (scene->curr_bin >= scene->num_active_bins)
+      return 0;
 
-   mtx_lock(&scene->mutex);
+   start = p_atomic_fetch_add(&scene->curr_bin, group);
+   if (start >= scene->num_active_bins)
+      return 0;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   } else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+   *first = start;
+   return MIN2(group, scene->num_active_bins - start);
+}
+
+
+/* Below this many TILE_SIZE bins per rasterizer thread, bin at half size.
+ */
+#define LP_FINE_BINS_PER_THREAD 4
+
+/* Above this many TILE_SIZE bins (a bit more than 4K UHD), bin at double
+ * size as long as there are still LP_COARSE_BINS_PER_THREAD of those per
+ * thread.
+ */
+#define LP_COARSE_BINS 4096
+#define LP_COARSE_BINS_PER_THREAD 16
+
+DEBUG_GET_ONCE_NUM_OPTION(tile_size, "LP_TILE_SIZE", 0)
+
+
+/**
+ * Pick the bin size for a scene.
+ *
+ * Small render targets (shadow maps, small offscreen passes) don't have
+ * enough TILE_SIZE bins to keep all rasterizer threads busy, so they get
+ * smaller bins.  Huge ones spend much of the binning time on per-bin
+ * overhead, so they get bigger ones.
+ */
+static unsigned
+choose_tile_order(const struct lp_scene *scene,
+                  const struct pipe_framebuffer_state *fb)
+{
+   const unsigned num_threads = MAX2(scene->setup->num_threads, 1);
+   const unsigned bins = DIV_ROUND_UP(fb->width, TILE_SIZE) *
+                         DIV_ROUND_UP(fb->height, TILE_SIZE);
+   const long forced = debug_get_option_tile_size();
+   unsigned order = TILE_ORDER;
+
+   if (forced > 0) {
+      order = CLAMP(util_logbase2(forced),
+                    LP_MIN_TILE_ORDER, LP_MAX_TILE_ORDER);
+   } else if (num_threads > 1 &&
+              bins < num_threads * LP_FINE_BINS_PER_THREAD) {
+      order = TILE_ORDER - 1;
+   } else if (bins >= LP_COARSE_BINS &&
+              bins / 4 >= num_threads * LP_COARSE_BINS_PER_THREAD) {
+      order = TILE_ORDER + 1;
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   /* The linear rasterizer works on rows of at most TILE_SIZE pixels. */
+   if (scene->permit_linear_rasterizer)
+      order = MIN2(order, TILE_ORDER);
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return order;
 }
 
 
@@ -598,10 +678,12 @@ lp_scene_begin_binning(struct lp_scene *scene,
 
    util_copy_framebuffer_state(&scene->fb, fb);
 
-   scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
-   scene->tiles_y = align(fb->height, TILE_SIZE) / TILE_SIZE;
-   assert(scene->tiles_x <= TILES_X);
-   assert(scene->tiles_y <= TILES_Y);
+   scene->tile_order = choose_tile_order(scene, fb);
+   scene->tile_size = 1 << scene->tile_order;
+   scene->tiles_x = align(fb->width, scene->tile_size) >> scene->tile_order;
+   scene->tiles_y = align(fb->height, scene->tile_size) >> scene->tile_order;
+   assert(scene->tiles_x <= LP_MAX_WIDTH >> LP_MIN_TILE_ORDER);
+   assert(scene->tiles_y <= LP_MAX_HEIGHT >> LP_MIN_TILE_ORDER);
 
    unsigned num_required_tiles = scene->tiles_x * scene->tiles_y;
    if (scene->num_alloced_tiles < num_required_tiles) {
@@ -610,9 +692,31 @@ lp_scene_begin_binning(struct lp_scene *scene,
       if (!scene->tiles)
          return;
       memset(scene->tiles, 0, sizeof(struct cmd_bin) * num_required_tiles);
+
+      free(scene->bin_order);
+      free(scene->active_bins);
+      scene->bin_order = malloc(num_required_tiles * sizeof(unsigned));
+      scene->active_bins = malloc(num_required_tiles * sizeof(unsigned));
+      if (!scene->bin_order || !scene->active_bins) {
+         free(scene->tiles);
+         free(scene->bin_order);
+         free(scene->active_bins);
+         scene->tiles = NULL;
+         scene->bin_order = NULL;
+         scene->active_bins = NULL;
+         scene->num_alloced_tiles = 0;
+         scene->bin_order_x = scene->bin_order_y = 0;
+         return;
+      }
+
       scene->num_alloced_tiles = num_required_tiles;
+      scene->bin_order_x = scene->bin_order_y = 0;
    }
 
+   if (scene->bin_order_x != scene->tiles_x ||
+       scene->bin_order_y != scene->tiles_y)
+      build_bin_order(scene);
+
    /*
     * Determine how many layers the fb has (used for clamping layer value).
     * OpenGL (but not d3d10) permits different amount of layers per rt,
@@ -648,6 +752,132 @@ lp_scene_begin_binning(struct lp_scene *scene,
 }
 
 
+/**
+ * Prepare an auxiliary scene for binning a slice of the primitives of
+ * the given scene on another thread.
+ *
+ * The auxiliary scene shares the framebuffer layout of the real scene
+ * but has its own bins and data blocks, so it can be filled without any
+ * locking.  Its data allocations are limited to max_size bytes.  It must
+ * be followed by either lp_scene_merge_sub() or lp_scene_discard_sub().
+ */
+boolean
+lp_scene_begin_sub_binning(struct lp_scene *sub,
+                           const struct lp_scene *scene,
+                           unsigned max_size)
+{
+   unsigned num_tiles = scene->tiles_x * scene->tiles_y;
+
+   assert(sub->data.head == NULL);
+
+   if (sub->num_alloced_tiles < num_tiles) {
+      struct cmd_bin *tiles = reallocarray(sub->tiles, num_tiles,
+                                           sizeof(struct cmd_bin));
+      if (!tiles)
+         return FALSE;
+      sub->tiles = tiles;
+      sub->num_alloced_tiles = num_tiles;
+   }
+   memset(sub->tiles, 0, sizeof(struct cmd_bin) * num_tiles);
+
+   sub->pipe = scene->pipe;
+   sub->setup = scene->setup;
+   sub->fb = scene->fb;   /* not referenced, never outlives the scene */
+   sub->fb_max_layer = scene->fb_max_layer;
+   sub->fb_max_samples = scene->fb_max_samples;
+   memcpy(sub->fixed_sample_pos, scene->fixed_sample_pos,
+          sizeof(sub->fixed_sample_pos));
+   sub->had_queries = scene->had_queries;
+   sub->permit_linear_rasterizer = scene->permit_linear_rasterizer;
+   sub->tile_order = scene->tile_order;
+   sub->tile_size = scene->tile_size;
+   sub->tiles_x = scene->tiles_x;
+   sub->tiles_y = scene->tiles_y;
+   sub->alloc_failed = FALSE;
+
+   /* The embedded first block of the auxiliary scene is never used, as
+    * all blocks get handed over to the real scene afterwards.
+    */
+   sub->scene_size = LP_SCENE_MAX_SIZE - MIN2(max_size, LP_SCENE_MAX_SIZE);
+   sub->data.head = NULL;
+   return lp_scene_new_data_block(sub) != NULL;
+}
+
+
+/**
+ * Append the commands of every bin of an auxiliary scene to the
+ * corresponding bins of the real scene, after everything already binned
+ * there unless the auxiliary bin was reset, and hand its data blocks over.
+ */
+void
+lp_scene_merge_sub(struct lp_scene *scene, struct lp_scene *sub)
+{
+   unsigned num_tiles = scene->tiles_x * scene->tiles_y;
+
+   for (unsigned i = 0; i < num_tiles; i++) {
+      struct cmd_bin *src = &sub->tiles[i];
+      struct cmd_bin *dst = &scene->tiles[i];
+
+      /* The bin was reset for an opaque tile in the auxiliary scene, which
+       * overwrites whatever got binned before it in the real scene too.
+       */
+      if (src->reset) {
+         dst->head = NULL;
+         dst->tail = NULL;
+         dst->last_state = NULL;
+      }
+
+      if (!src->head)
+         continue;
+
+      if (dst->tail)
+         dst->tail->next = src->head;
+      else
+         dst->head = src->head;
+      dst->tail = src->tail;
+      dst->last_state = src->last_state;
+   }
+
+   struct data_block *last = sub->data.head;
+   scene->scene_size += sizeof *last;
+   while (last->next) {
+      last = last->next;
+      scene->scene_size += sizeof *last;
+   }
+
+   /* Keep allocating from the real scene's current block. */
+   last->next = scene->data.head->next;
+   scene->data.head->next = sub->data.head;
+
+   sub->data.head = NULL;
+}
+
+
+/**
+ * Throw away everything binned into an auxiliary scene.
+ */
+void
+lp_scene_discard_sub(struct lp_scene *sub)
+{
+   struct data_block *block, *tmp;
+
+   for (block = sub->data.head; block; block = tmp) {
+      tmp = block->next;
+      FREE(block);
+   }
+   sub->data.head = NULL;
+}
+
+
+void
+lp_scene_destroy_sub(struct lp_scene *sub)
+{
+   lp_scene_discard_sub(sub);
+   free(sub->tiles);
+   FREE(sub);
+}
+
+
 void
 lp_scene_end_binning(struct lp_scene *scene)
 {
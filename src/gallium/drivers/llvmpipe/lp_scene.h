@@ -98,6 +98,7 @@ struct cmd_bin {
    const struct lp_rast_state *last_state;  /* most recent state set in bin */
    struct cmd_block *head;
    struct cmd_block *tail;
+   boolean reset;  /* reset since binning began, see lp_scene_merge_sub() */
 };
 
 
@@ -189,17 +190,39 @@ struct lp_scene {
    boolean alloc_failed;
    boolean permit_linear_rasterizer;
 
+   /**
+    * Size of the bins of this scene, 1 << tile_order pixels square.
+    * Picked per scene from the framebuffer size and thread count, see
+    * lp_scene_begin_binning().
+    */
+   unsigned tile_order;
+   unsigned tile_size;
+
    /**
     * Number of active tiles in each dimension.
     * This basically the framebuffer size divided by tile size
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
-
    unsigned num_alloced_tiles;
    struct cmd_bin *tiles;
+
+   /**
+    * Bin dispatch.  bin_order holds every bin index of the current
+    * tiles_x * tiles_y grid in Morton (Z) order and is only rebuilt when
+    * the grid dimensions change.  active_bins is the subset of those that
+    * actually contain commands, gathered once per scene before the
+    * rasterizer threads start.  Threads claim groups of bin_group_size
+    * consecutive entries by atomically advancing curr_bin, so neighbouring
+    * tiles tend to be rasterized by the same thread.
+    */
+   unsigned *bin_order;
+   unsigned bin_order_x, bin_order_y;
+   unsigned *active_bins;
+   unsigned num_active_bins;
+   unsigned bin_group_size;
+   unsigned curr_bin;
+
    struct data_block_list data;
 };
 
@@ -396,10 +419,27 @@ lp_scene_get_num_bins(const struct lp_scene *scene)
 
 
 void
-lp_scene_bin_iter_begin(struct lp_scene *scene);
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_threads);
 
-struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene, int *x, int *y);
+unsigned
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned *first);
+
+
+/**
+ * Return the i'th bin of the dispatch order set up by
+ * lp_scene_bin_iter_begin(), along with its tile coordinates.
+ */
+static inline struct cmd_bin *
+lp_scene_bin_iter_get(struct lp_scene *scene, unsigned i, int *x, int *y)
+{
+   unsigned idx = scene->active_bins[i];
+
+   assert(i < scene->num_active_bins);
+
+   *x = idx % scene->tiles_x;
+   *y = idx / scene->tiles_x;
+   return &scene->tiles[idx];
+}
 
 
 
@@ -413,6 +453,24 @@ void
 lp_scene_end_binning(struct lp_scene *scene);
 
 
+/* Auxiliary scenes used to bin part of a draw on another thread, whose
+ * bins and data are then appended to the real scene.
+ */
+boolean
+lp_scene_begin_sub_binning(struct lp_scene *sub,
+                           const struct lp_scene *scene,
+                           unsigned max_size);
+
+void
+lp_scene_merge_sub(struct lp_scene *scene, struct lp_scene *sub);
+
+void
+lp_scene_discard_sub(struct lp_scene *sub);
+
+void
+lp_scene_destroy_sub(struct lp_scene *sub);
+
+
 /* Begin/end rasterization of a scene
  */
 void
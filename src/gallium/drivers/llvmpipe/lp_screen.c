@@ -29,6 +29,7 @@
 #include "util/u_memory.h"
 #include "util/u_math.h"
 #include "util/u_cpu_detect.h"
+#include "util/u_thread.h"
 #include "util/format/u_format.h"
 #include "util/u_screen.h"
 #include "util/u_string.h"
@@ -52,6 +53,7 @@
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
 #include "lp_flush.h"
+#include "lp_query.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -97,6 +99,7 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
    { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    { "no_shade",       PERF_NO_SHADE, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -860,6 +863,9 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
+   if (util_queue_is_initialized(&screen->compile_queue))
+      util_queue_destroy(&screen->compile_queue);
+
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
@@ -950,6 +956,8 @@ lp_disk_cache_create(struct llvmpipe_screen *screen)
    _mesa_sha1_update(&ctx, &gallivm_perf, sizeof(gallivm_perf));
    update_cache_sha1_cpu(&ctx);
    _mesa_sha1_final(&ctx, sha1);
+   memcpy(screen->cache_id, sha1, sizeof(screen->cache_id));
+   screen->has_cache_id = true;
    disk_cache_format_hex_id(cache_id, sha1, 20 * 2);
 
    screen->disk_shader_cache = disk_cache_create("llvmpipe", cache_id, 0);
@@ -965,13 +973,82 @@ lp_get_disk_shader_cache(struct pipe_screen *_screen)
 }
 
 
+static void
+lp_set_shader_code_cache(struct pipe_screen *_screen,
+                         const struct pipe_shader_code_cache *cache)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+
+   if (cache)
+      screen->code_cache = *cache;
+   else
+      memset(&screen->code_cache, 0, sizeof(screen->code_cache));
+}
+
+
+/**
+ * Key for the frontend code cache.  Unlike the disk cache, which mixes in
+ * its own id, this has to identify the code generator itself.
+ */
+static void
+lp_code_cache_key(struct llvmpipe_screen *screen,
+                  const unsigned char ir_sha1_cache_key[20],
+                  unsigned char key[20])
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, screen->cache_id, sizeof(screen->cache_id));
+   _mesa_sha1_update(&ctx, ir_sha1_cache_key, 20);
+   _mesa_sha1_final(&ctx, key);
+}
+
+
+/**
+ * Cache entries are the object code followed by the number of IR
+ * instructions it was built from, which variants loaded from the cache
+ * can't count themselves.
+ */
+static bool
+lp_cached_code_unpack(struct lp_cached_code *cache, void *data, size_t size)
+{
+   uint32_t nr_instrs;
+
+   if (size <= sizeof(nr_instrs)) {
+      free(data);
+      return false;
+   }
+
+   size -= sizeof(nr_instrs);
+   memcpy(&nr_instrs, (uint8_t *)data + size, sizeof(nr_instrs));
+   cache->data = data;
+   cache->data_size = size;
+   cache->nr_instrs = nr_instrs;
+   return true;
+}
+
+
 void
 lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                           struct lp_cached_code *cache,
-                          unsigned char ir_sha1_cache_key[20])
+                          unsigned char ir_sha1_cache_key[20],
+                          void *code_cache_data)
 {
    unsigned char sha1[CACHE_KEY_SIZE];
 
+   if (code_cache_data && screen->code_cache.find && screen->has_cache_id) {
+      unsigned char key[20];
+      size_t size = 0;
+
+      lp_code_cache_key(screen, ir_sha1_cache_key, key);
+      void *code = screen->code_cache.find(screen->code_cache.data,
+                                           code_cache_data, key, &size);
+      if (code && lp_cached_code_unpack(cache, code, size)) {
+         p_atomic_inc(&screen->num_disk_shader_cache_hits);
+         return;
+      }
+   }
+
    if (!screen->disk_shader_cache)
       return;
    disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key,
@@ -985,8 +1062,21 @@ lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
       p_atomic_inc(&screen->num_disk_shader_cache_misses);
       return;
    }
-   cache->data_size = binary_size;
-   cache->data = buffer;
+
+   /* Let the frontend cache see code we only found on disk. */
+   if (code_cache_data && screen->code_cache.insert && screen->has_cache_id) {
+      unsigned char key[20];
+
+      lp_code_cache_key(screen, ir_sha1_cache_key, key);
+      screen->code_cache.insert(screen->code_cache.data, code_cache_data,
+                                key, buffer, binary_size);
+   }
+
+   if (!lp_cached_code_unpack(cache, buffer, binary_size)) {
+      cache->data_size = 0;
+      p_atomic_inc(&screen->num_disk_shader_cache_misses);
+      return;
+   }
    p_atomic_inc(&screen->num_disk_shader_cache_hits);
 }
 
@@ -994,16 +1084,69 @@ lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
 void
 lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                             struct lp_cached_code *cache,
-                            unsigned char ir_sha1_cache_key[20])
+                            unsigned char ir_sha1_cache_key[20],
+                            void *code_cache_data)
 {
    unsigned char sha1[CACHE_KEY_SIZE];
 
-   if (!screen->disk_shader_cache || !cache->data_size || cache->dont_cache)
+   if (!cache->data_size || cache->dont_cache)
       return;
-   disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key,
-                          20, sha1);
-   disk_cache_put(screen->disk_shader_cache, sha1, cache->data,
-                  cache->data_size, NULL);
+
+   bool use_code_cache = code_cache_data && screen->code_cache.insert &&
+                         screen->has_cache_id;
+   if (!screen->disk_shader_cache && !use_code_cache)
+      return;
+
+   /* See lp_cached_code_unpack() */
+   uint32_t nr_instrs = cache->nr_instrs;
+   size_t size = cache->data_size + sizeof(nr_instrs);
+   uint8_t *data = malloc(size);
+   if (!data)
+      return;
+   memcpy(data, cache->data, cache->data_size);
+   memcpy(data + cache->data_size, &nr_instrs, sizeof(nr_instrs));
+
+   if (use_code_cache) {
+      unsigned char key[20];
+
+      lp_code_cache_key(screen, ir_sha1_cache_key, key);
+      screen->code_cache.insert(screen->code_cache.data, code_cache_data,
+                                key, data, size);
+   }
+
+   if (screen->disk_shader_cache) {
+      disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key,
+                             20, sha1);
+      disk_cache_put(screen->disk_shader_cache, sha1, data, size, NULL);
+   }
+
+   free(data);
+}
+
+
+DEBUG_GET_ONCE_BOOL_OPTION(lp_pin_threads, "LP_PIN_THREADS", TRUE)
+
+
+/**
+ * Pin the calling worker thread, number thread_index out of num_threads,
+ * to the CPUs sharing one L3 cache.  Consecutive thread indices are packed
+ * onto the same L3 (and so the same NUMA node on multi-socket machines) and
+ * the threads are spread evenly over all of them.  Memory the thread then
+ * touches first, such as its texture cache and its stack, ends up local to
+ * that node.  This is a no-op when the L3 topology is unknown.
+ */
+void
+lp_thread_pin_to_L3(unsigned thread_index, unsigned num_threads)
+{
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+
+   if (caps->num_L3_caches <= 1 || !debug_get_option_lp_pin_threads())
+      return;
+
+   unsigned L3 = (uint64_t)thread_index * caps->num_L3_caches /
+                 MAX2(num_threads, 1);
+   util_set_current_thread_affinity(caps->L3_affinity_mask[L3], NULL,
+                                    caps->num_cpu_mask_bits);
 }
 
 
@@ -1029,6 +1172,17 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
       goto out;
    }
 
+   /* Background compilation of optimized fragment shader variants.  Use
+    * low priority threads so as to not compete with rasterization.
+    */
+   if (screen->async_compile &&
+       !util_queue_init(&screen->compile_queue, "lpfs", 64,
+                        MAX2(1, screen->num_threads / 2),
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL)) {
+      screen->async_compile = false;
+   }
+
    lp_disk_cache_create(screen);
    screen->late_init_done = true;
 out:
@@ -1083,6 +1237,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.fence_finish = llvmpipe_fence_finish;
 
    screen->base.get_timestamp = u_default_get_timestamp;
+   screen->base.get_driver_query_info = llvmpipe_get_driver_query_info;
 
    screen->base.get_driver_uuid = llvmpipe_get_driver_uuid;
    screen->base.get_device_uuid = llvmpipe_get_device_uuid;
@@ -1090,6 +1245,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.finalize_nir = llvmpipe_finalize_nir;
 
    screen->base.get_disk_shader_cache = lp_get_disk_shader_cache;
+   screen->base.set_shader_code_cache = lp_set_shader_code_cache;
    llvmpipe_init_screen_resource_funcs(&screen->base);
 
    screen->allow_cl = !!getenv("LP_CL");
@@ -1101,7 +1257,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 #endif
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS",
                                               screen->num_threads);
-   screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+   screen->async_compile = debug_get_bool_option("LP_ASYNC_COMPILE", false);
 
    lp_build_init(); /* get lp_native_vector_width initialised */
 
@@ -38,6 +38,7 @@
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
 #include "util/list.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
 
@@ -62,6 +63,12 @@ struct llvmpipe_screen
    struct lp_cs_tpool *cs_tpool;
    mtx_t cs_mutex;
 
+   /* Optimized fragment shader variants are compiled here when
+    * LP_ASYNC_COMPILE is set.
+    */
+   bool async_compile;
+   struct util_queue compile_queue;
+
    bool use_tgsi;
    bool allow_cl;
 
@@ -76,24 +83,37 @@ struct llvmpipe_screen
    struct disk_cache *disk_shader_cache;
    unsigned num_disk_shader_cache_hits;
    unsigned num_disk_shader_cache_misses;
+
+   /* Identifies the code we generate, valid if has_cache_id */
+   unsigned char cache_id[20];
+   bool has_cache_id;
+
+   /* See pipe_screen::set_shader_code_cache */
+   struct pipe_shader_code_cache code_cache;
 };
 
 
 void
 lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                           struct lp_cached_code *cache,
-                          unsigned char ir_sha1_cache_key[20]);
+                          unsigned char ir_sha1_cache_key[20],
+                          void *code_cache_data);
 
 
 void
 lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                             struct lp_cached_code *cache,
-                            unsigned char ir_sha1_cache_key[20]);
+                            unsigned char ir_sha1_cache_key[20],
+                            void *code_cache_data);
 
 bool
 llvmpipe_screen_late_init(struct llvmpipe_screen *screen);
 
 
+void
+lp_thread_pin_to_L3(unsigned thread_index, unsigned num_threads);
+
+
 static inline struct llvmpipe_screen *
 llvmpipe_screen(struct pipe_screen *pipe)
 {
@@ -68,14 +68,25 @@ try_update_scene_state(struct lp_setup_context *setup);
 static unsigned
 lp_setup_wait_empty_scene(struct lp_setup_context *setup)
 {
-   /* just use the first scene if we run out */
-   if (setup->scenes[0]->fence) {
+   /* Wait for the oldest scene if we run out.  Scenes are rasterized in
+    * the order they were queued, so that is the one which becomes free
+    * first.
+    */
+   unsigned oldest = 0;
+   for (unsigned i = 1; i < setup->num_active_scenes; i++) {
+      const struct lp_fence *fence = setup->scenes[i]->fence;
+      const struct lp_fence *oldest_fence = setup->scenes[oldest]->fence;
+      if (fence && (!oldest_fence || (int)(fence->id - oldest_fence->id) < 0))
+         oldest = i;
+   }
+
+   if (setup->scenes[oldest]->fence) {
       debug_printf("%s: wait for scene %d\n",
-                   __FUNCTION__, setup->scenes[0]->fence->id);
-      lp_fence_wait(setup->scenes[0]->fence);
-      lp_scene_end_rasterization(setup->scenes[0]);
+                   __FUNCTION__, setup->scenes[oldest]->fence->id);
+      lp_fence_wait(setup->scenes[oldest]->fence);
+      lp_scene_end_rasterization(setup->scenes[oldest]);
    }
-   return 0;
+   return oldest;
 }
 
 
@@ -97,11 +108,14 @@ lp_setup_get_empty_scene(struct lp_setup_context *setup)
       }
    }
 
-   if (setup->num_active_scenes + 1 > MAX_SCENES) {
-      i = lp_setup_wait_empty_scene(setup);
-   } else if (i == setup->num_active_scenes) {
+   /* only block when every scene is in flight and no more can be made */
+   if (i == setup->num_active_scenes) {
+      struct lp_scene *scene = NULL;
+
       /* allocate a new scene */
-      struct lp_scene *scene = lp_scene_create(setup);
+      if (setup->num_active_scenes < MAX_SCENES)
+         scene = lp_scene_create(setup);
+
       if (!scene) {
          /* block and reuse scenes */
          i = lp_setup_wait_empty_scene(setup);
@@ -1096,6 +1110,29 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
 }
 
 
+/**
+ * How does the given scene access the texture, either as a render target
+ * or through the resources referenced by its commands?
+ * Returns bitmask of LP_REFERENCED_FOR_READ/WRITE bits.
+ */
+static unsigned
+scene_resource_usage(const struct lp_scene *scene,
+                     const struct pipe_resource *texture)
+{
+   /* check the render targets */
+   for (unsigned j = 0; j < scene->fb.nr_cbufs; j++) {
+      if (scene->fb.cbufs[j] && scene->fb.cbufs[j]->texture == texture)
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+   if (scene->fb.zsbuf && scene->fb.zsbuf->texture == texture) {
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+
+   /* check resources referenced by the scene */
+   return lp_scene_is_resource_referenced(scene, texture);
+}
+
+
 /**
  * Is the given texture referenced by any scene?
  * Note: we have to check all scenes including any scenes currently
@@ -1116,18 +1153,7 @@ lp_setup_is_resource_referenced(const struct lp_setup_context *setup,
 
    /* check resources referenced by active scenes */
    for (unsigned i = 0; i < setup->num_active_scenes; i++) {
-      struct lp_scene *scene = setup->scenes[i];
-      /* check the render targets */
-      for (unsigned j = 0; j < scene->fb.nr_cbufs; j++) {
-         if (scene->fb.cbufs[j] && scene->fb.cbufs[j]->texture == texture)
-            return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
-      }
-      if (scene->fb.zsbuf && scene->fb.zsbuf->texture == texture) {
-         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
-      }
-
-      /* check resources referenced by the scene */
-      unsigned ref = lp_scene_is_resource_referenced(scene, texture);
+      unsigned ref = scene_resource_usage(setup->scenes[i], texture);
       if (ref)
          return ref;
    }
@@ -1136,6 +1162,35 @@ lp_setup_is_resource_referenced(const struct lp_setup_context *setup,
 }
 
 
+/**
+ * Wait for the queued scenes which conflict with an access to the given
+ * texture: every scene referencing it if the access writes, only the
+ * scenes writing it otherwise.  Scenes which don't touch the texture
+ * keep rasterizing in the background.
+ * The scene currently being built is not waited for, so it needs to be
+ * flushed first if it references the texture.
+ */
+void
+lp_setup_wait_resource(struct lp_setup_context *setup,
+                       const struct pipe_resource *texture,
+                       boolean read_only)
+{
+   const unsigned conflict = read_only ? LP_REFERENCED_FOR_WRITE :
+      (LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE);
+
+   for (unsigned i = 0; i < setup->num_active_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+
+      if (scene == setup->scene || !scene->fence ||
+          !lp_fence_issued(scene->fence))
+         continue;
+
+      if (scene_resource_usage(scene, texture) & conflict)
+         lp_fence_wait(scene->fence);
+   }
+}
+
+
 /**
  * Called by vbuf code when we're about to draw something.
  *
@@ -1531,6 +1586,11 @@ lp_setup_destroy(struct lp_setup_context *setup)
       lp_scene_destroy(scene);
    }
 
+   for (unsigned i = 0; i < ARRAY_SIZE(setup->bin_scenes); i++) {
+      if (setup->bin_scenes[i])
+         lp_scene_destroy_sub(setup->bin_scenes[i]);
+   }
+
    LP_DBG(DEBUG_SETUP, "number of scenes used: %d\n", setup->num_active_scenes);
    slab_destroy(&setup->scene_slab);
 
@@ -1553,13 +1613,15 @@ lp_setup_create(struct pipe_context *pipe,
       goto no_setup;
    }
 
+   setup->num_threads = screen->num_threads;
+   setup->parallel_binning = setup->num_threads > 1 &&
+      debug_get_bool_option("LP_PARALLEL_BINNING", FALSE);
+
    lp_setup_init_vbuf(setup);
 
    /* Used only in update_state():
     */
    setup->pipe = pipe;
-
-   setup->num_threads = screen->num_threads;
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -130,6 +130,11 @@ unsigned
 lp_setup_is_resource_referenced(const struct lp_setup_context *setup,
                                 const struct pipe_resource *texture);
 
+void
+lp_setup_wait_resource(struct lp_setup_context *setup,
+                       const struct pipe_resource *texture,
+                       boolean read_only);
+
 void
 lp_setup_set_sample_mask(struct lp_setup_context *setup,
                          uint32_t sample_mask);
@@ -59,6 +59,11 @@ struct lp_setup_variant;
 #define INITIAL_SCENES 4
 #define MAX_SCENES 64
 
+/* Max number of jobs a draw's triangles are split into for parallel
+ * binning (LP_PARALLEL_BINNING).
+ */
+#define LP_MAX_BIN_JOBS 16
+
 
 
 /**
@@ -96,6 +101,9 @@ struct lp_setup_context
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
+   /** auxiliary scenes the parallel binning jobs bin into */
+   struct lp_scene *bin_scenes[LP_MAX_BIN_JOBS];
+
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned active_binned_queries;
 
@@ -109,6 +117,7 @@ struct lp_setup_context
    unsigned permit_linear_rasterizer:1;
    unsigned multisample:1;
    unsigned rectangular_lines:1;
+   unsigned parallel_binning:1;
    unsigned cullmode:2; /**< PIPE_FACE_x */
    unsigned bottom_edge_rule;
    float pixel_offset;
@@ -244,6 +253,7 @@ lp_setup_flush_and_restart(struct lp_setup_context *setup);
 
 boolean
 lp_setup_whole_tile(struct lp_setup_context *setup,
+                    struct lp_scene *scene,
                     const struct lp_rast_shader_inputs *inputs,
                     int tx, int ty, boolean opaque);
 
@@ -276,6 +286,13 @@ lp_setup_triangle_ccw(struct lp_setup_context *setup,
                       const float (*v2)[4],
                       boolean front);
 
+boolean
+lp_setup_bin_triangle_into(struct lp_setup_context *setup,
+                           struct lp_scene *scene,
+                           const float (*v0)[4],
+                           const float (*v1)[4],
+                           const float (*v2)[4]);
+
 struct lp_rast_triangle *
 lp_setup_alloc_triangle(struct lp_scene *scene,
                         unsigned num_inputs,
@@ -294,6 +311,7 @@ lp_setup_analyse_triangles(struct lp_setup_context *setup,
 
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_scene *scene,
                       struct lp_rast_triangle *tri,
                       boolean use_32bits,
                       boolean opaque,
@@ -303,8 +321,19 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
 
 boolean
 lp_setup_bin_rectangle(struct lp_setup_context *setup,
+                       struct lp_scene *scene,
                        struct lp_rast_rectangle *rect,
                        boolean opaque);
 
+boolean
+lp_setup_bin_rect_into(struct lp_setup_context *setup,
+                       struct lp_scene *scene,
+                       const float (*v0)[4],
+                       const float (*v1)[4],
+                       const float (*v2)[4],
+                       const float (*v3)[4],
+                       const float (*v4)[4],
+                       const float (*v5)[4]);
+
 
 #endif
@@ -542,7 +542,7 @@ try_setup_point(struct lp_setup_context *setup,
                         (bbox.y1 - (bbox.y0 & ~3)));
       boolean use_32bits = max_szorig <= MAX_FIXED_LENGTH32;
 
-      return lp_setup_bin_triangle(setup, point, use_32bits,
+      return lp_setup_bin_triangle(setup, setup->scene, point, use_32bits,
                                    setup->fs.current.variant->opaque,
                                    &bbox, nr_planes, viewport_index);
 
@@ -591,7 +591,7 @@ try_setup_point(struct lp_setup_context *setup,
       point->inputs.viewport_index = viewport_index;
       point->inputs.view_index = setup->view_index;
 
-      return lp_setup_bin_rectangle(setup, point,
+      return lp_setup_bin_rectangle(setup, setup->scene, point,
                                     setup->fs.current.variant->opaque);
    }
 }
@@ -82,11 +82,10 @@ lp_setup_alloc_rectangle(struct lp_scene *scene, unsigned nr_inputs)
  */
 boolean
 lp_setup_whole_tile(struct lp_setup_context *setup,
+                    struct lp_scene *scene,
                     const struct lp_rast_shader_inputs *inputs,
                     int tx, int ty, boolean opaque)
 {
-   struct lp_scene *scene = setup->scene;
-
    LP_COUNT(nr_fully_covered_64);
 
    /* if variant is opaque and scissor doesn't effect the tile */
@@ -194,21 +193,23 @@ lp_setup_is_blit(const struct lp_setup_context *setup,
 
 static inline void
 partial(struct lp_setup_context *setup,
+        struct lp_scene *scene,
         const struct lp_rast_rectangle *rect,
         boolean opaque,
         unsigned ix, unsigned iy,
         unsigned mask) // RECT_PLANE_x bits
 {
    if (mask == 0) {
-      assert(rect->box.x0 <= ix * TILE_SIZE);
-      assert(rect->box.y0 <= iy * TILE_SIZE);
-      assert(rect->box.x1 >= (ix+1) * TILE_SIZE - 1);
-      assert(rect->box.y1 >= (iy+1) * TILE_SIZE - 1);
+      ASSERTED const int tile_size = scene->tile_size;
+      assert(rect->box.x0 <= ix * tile_size);
+      assert(rect->box.y0 <= iy * tile_size);
+      assert(rect->box.x1 >= (ix+1) * tile_size - 1);
+      assert(rect->box.y1 >= (iy+1) * tile_size - 1);
 
-      lp_setup_whole_tile(setup, &rect->inputs, ix, iy, opaque);
+      lp_setup_whole_tile(setup, scene, &rect->inputs, ix, iy, opaque);
    } else {
       LP_COUNT(nr_partially_covered_64);
-      lp_scene_bin_cmd_with_state(setup->scene,
+      lp_scene_bin_cmd_with_state(scene,
                                   ix, iy,
                                   setup->fs.stored,
                                   LP_RAST_OP_RECTANGLE,
@@ -234,6 +235,7 @@ partial(struct lp_setup_context *setup,
  */
 static boolean
 try_rect_cw(struct lp_setup_context *setup,
+            struct lp_scene *scene,
             const float (*v0)[4],
             const float (*v1)[4],
             const float (*v2)[4],
@@ -242,7 +244,6 @@ try_rect_cw(struct lp_setup_context *setup,
    const struct lp_fragment_shader_variant *variant =
       setup->fs.current.variant;
    const struct lp_setup_variant_key *key = &setup->setup.variant->key;
-   struct lp_scene *scene = setup->scene;
 
    /* x/y positions in fixed point */
    int x0 = subpixel_snap(v0[0][0] - setup->pixel_offset);
@@ -345,16 +346,16 @@ try_rect_cw(struct lp_setup_context *setup,
    rect->inputs.viewport_index = viewport_index;
    rect->inputs.view_index = setup->view_index;
 
-   return lp_setup_bin_rectangle(setup, rect, variant->opaque);
+   return lp_setup_bin_rectangle(setup, scene, rect, variant->opaque);
 }
 
 
 boolean
 lp_setup_bin_rectangle(struct lp_setup_context *setup,
+                       struct lp_scene *scene,
                        struct lp_rast_rectangle *rect,
                        boolean opaque)
 {
-   struct lp_scene *scene = setup->scene;
    unsigned left_mask = 0;
    unsigned right_mask = 0;
    unsigned top_mask = 0;
@@ -367,10 +368,12 @@ lp_setup_bin_rectangle(struct lp_setup_context *setup,
 
    /* Convert to inclusive tile coordinates:
     */
-   const unsigned ix0 = rect->box.x0 / TILE_SIZE;
-   const unsigned iy0 = rect->box.y0 / TILE_SIZE;
-   const unsigned ix1 = rect->box.x1 / TILE_SIZE;
-   const unsigned iy1 = rect->box.y1 / TILE_SIZE;
+   const unsigned tile_order = scene->tile_order;
+   const unsigned tile_size = scene->tile_size;
+   const unsigned ix0 = rect->box.x0 >> tile_order;
+   const unsigned iy0 = rect->box.y0 >> tile_order;
+   const unsigned ix1 = rect->box.x1 >> tile_order;
+   const unsigned iy1 = rect->box.y1 >> tile_order;
 
    /*
     * Clamp to framebuffer size
@@ -380,60 +383,60 @@ lp_setup_bin_rectangle(struct lp_setup_context *setup,
    assert(ix1 == MIN2(ix1, scene->tiles_x - 1));
    assert(iy1 == MIN2(iy1, scene->tiles_y - 1));
 
-   if (ix0 * TILE_SIZE != rect->box.x0)
+   if (ix0 * tile_size != rect->box.x0)
       left_mask = RECT_PLANE_LEFT;
 
-   if (ix1 * TILE_SIZE + TILE_SIZE - 1 != rect->box.x1)
+   if (ix1 * tile_size + tile_size - 1 != rect->box.x1)
       right_mask  = RECT_PLANE_RIGHT;
 
-   if (iy0 * TILE_SIZE != rect->box.y0)
+   if (iy0 * tile_size != rect->box.y0)
       top_mask    = RECT_PLANE_TOP;
 
-   if (iy1 * TILE_SIZE + TILE_SIZE - 1 != rect->box.y1)
+   if (iy1 * tile_size + tile_size - 1 != rect->box.y1)
       bottom_mask = RECT_PLANE_BOTTOM;
 
    /* Determine which tile(s) intersect the rectangle's bounding box
     */
    if (iy0 == iy1 && ix0 == ix1) {
-      partial(setup, rect, opaque, ix0, iy0,
+      partial(setup, scene, rect, opaque, ix0, iy0,
               (left_mask | right_mask | top_mask | bottom_mask));
    } else if (ix0 == ix1) {
       unsigned mask = left_mask | right_mask;
-      partial(setup, rect, opaque, ix0, iy0, mask | top_mask);
+      partial(setup, scene, rect, opaque, ix0, iy0, mask | top_mask);
       for (unsigned i = iy0 + 1; i < iy1; i++)
-         partial(setup, rect, opaque, ix0, i, mask);
-      partial(setup, rect, opaque, ix0, iy1, mask | bottom_mask);
+         partial(setup, scene, rect, opaque, ix0, i, mask);
+      partial(setup, scene, rect, opaque, ix0, iy1, mask | bottom_mask);
    } else if (iy0 == iy1) {
       unsigned mask = top_mask | bottom_mask;
-      partial(setup, rect, opaque, ix0, iy0, mask | left_mask);
+      partial(setup, scene, rect, opaque, ix0, iy0, mask | left_mask);
       for (unsigned i = ix0 + 1; i < ix1; i++)
-         partial(setup, rect, opaque, i, iy0, mask);
-      partial(setup, rect, opaque, ix1, iy0, mask | right_mask);
+         partial(setup, scene, rect, opaque, i, iy0, mask);
+      partial(setup, scene, rect, opaque, ix1, iy0, mask | right_mask);
    } else {
-      partial(setup, rect, opaque, ix0, iy0, left_mask  | top_mask);
-      partial(setup, rect, opaque, ix0, iy1, left_mask  | bottom_mask);
-      partial(setup, rect, opaque, ix1, iy0, right_mask | top_mask);
-      partial(setup, rect, opaque, ix1, iy1, right_mask | bottom_mask);
+      partial(setup, scene, rect, opaque, ix0, iy0, left_mask  | top_mask);
+      partial(setup, scene, rect, opaque, ix0, iy1, left_mask  | bottom_mask);
+      partial(setup, scene, rect, opaque, ix1, iy0, right_mask | top_mask);
+      partial(setup, scene, rect, opaque, ix1, iy1, right_mask | bottom_mask);
 
       /* Top/Bottom fringes
        */
       for (unsigned i = ix0 + 1; i < ix1; i++) {
-         partial(setup, rect, opaque, i, iy0, top_mask);
-         partial(setup, rect, opaque, i, iy1, bottom_mask);
+         partial(setup, scene, rect, opaque, i, iy0, top_mask);
+         partial(setup, scene, rect, opaque, i, iy1, bottom_mask);
       }
 
       /* Left/Right fringes
        */
       for (unsigned i = iy0 + 1; i < iy1; i++) {
-         partial(setup, rect, opaque, ix0, i, left_mask);
-         partial(setup, rect, opaque, ix1, i, right_mask);
+         partial(setup, scene, rect, opaque, ix0, i, left_mask);
+         partial(setup, scene, rect, opaque, ix1, i, right_mask);
       }
 
       /* Full interior tiles
        */
       for (unsigned j = iy0 + 1; j < iy1; j++) {
          for (unsigned i = ix0 + 1; i < ix1; i++) {
-            lp_setup_whole_tile(setup, &rect->inputs, i, j, opaque);
+            lp_setup_whole_tile(setup, scene, &rect->inputs, i, j, opaque);
          }
       }
    }
@@ -460,16 +463,51 @@ lp_rect_cw(struct lp_setup_context *setup,
            const float (*v2)[4],
            boolean frontfacing)
 {
-   if (!try_rect_cw(setup, v0, v1, v2, frontfacing)) {
+   if (!try_rect_cw(setup, setup->scene, v0, v1, v2, frontfacing)) {
       if (!lp_setup_flush_and_restart(setup))
          return;
 
-      if (!try_rect_cw(setup, v0, v1, v2, frontfacing))
+      if (!try_rect_cw(setup, setup->scene, v0, v1, v2, frontfacing))
          return;
    }
 }
 
 
+/**
+ * Bin a rect or a triangle into the given scene, which may be an
+ * auxiliary scene filled by a parallel binning job, without flushing.
+ * Running out of memory is recorded in the scene.  If scene is NULL they
+ * are binned into the current scene the usual way instead.
+ */
+static void
+bin_rect_cw(struct lp_setup_context *setup,
+            struct lp_scene *scene,
+            const float (*v0)[4],
+            const float (*v1)[4],
+            const float (*v2)[4],
+            boolean frontfacing)
+{
+   if (!scene)
+      lp_rect_cw(setup, v0, v1, v2, frontfacing);
+   else if (!try_rect_cw(setup, scene, v0, v1, v2, frontfacing))
+      scene->alloc_failed = TRUE;
+}
+
+
+static void
+bin_triangle(struct lp_setup_context *setup,
+             struct lp_scene *scene,
+             const float (*v0)[4],
+             const float (*v1)[4],
+             const float (*v2)[4])
+{
+   if (!scene)
+      setup->triangle(setup, v0, v1, v2);
+   else if (!lp_setup_bin_triangle_into(setup, scene, v0, v1, v2))
+      scene->alloc_failed = TRUE;
+}
+
+
 /**
  * Take the six vertices for two triangles and try to determine if they
  * form a screen-aligned quad/rectangle.  If so, draw the rect directly
@@ -477,6 +515,7 @@ lp_rect_cw(struct lp_setup_context *setup,
  */
 static bool
 do_rect_ccw(struct lp_setup_context *setup,
+            struct lp_scene *scene,
             const float (*v0)[4],
             const float (*v1)[4],
             const float (*v2)[4],
@@ -710,7 +749,7 @@ do_rect_ccw(struct lp_setup_context *setup,
        * lp_rect_cw to expect/operate on ccw rects.  Note that
        * function was previously misnamed.
        */
-      lp_rect_cw(setup, rv0, rv2, rv1, front);
+      bin_rect_cw(setup, scene, rv0, rv2, rv1, front);
       return true;
    } else {
       /* setup->quad(setup, rv0, rv1, rv2, rv3); */
@@ -750,33 +789,69 @@ winding(const float (*v0)[4],
 }
 
 
+/**
+ * Bin two triangles as a rect if they form one.  keep is the winding of
+ * the triangles which aren't culled, or WINDING_NONE if neither winding
+ * is culled.  Return false if the caller needs to bin them as triangles.
+ */
 static boolean
-setup_rect_cw(struct lp_setup_context *setup,
-              const float (*v0)[4],
-              const float (*v1)[4],
-              const float (*v2)[4],
-              const float (*v3)[4],
-              const float (*v4)[4],
-              const float (*v5)[4])
+setup_rect(struct lp_setup_context *setup,
+           struct lp_scene *scene,
+           enum winding keep,
+           const float (*v0)[4],
+           const float (*v1)[4],
+           const float (*v2)[4],
+           const float (*v3)[4],
+           const float (*v4)[4],
+           const float (*v5)[4])
 {
    enum winding winding0 = winding(v0, v1, v2);
    enum winding winding1 = winding(v3, v4, v5);
 
-   if (winding0 == WINDING_CW &&
-       winding1 == WINDING_CW) {
-      return do_rect_ccw(setup, v0, v2, v1, v3, v5, v4, !setup->ccw_is_frontface);
-   } else if (winding0 == WINDING_CW) {
-      setup->triangle(setup, v0, v1, v2);
-      return TRUE;
-   } else if (winding1 == WINDING_CW) {
-      setup->triangle(setup, v3, v4, v5);
+   if (keep == WINDING_NONE) {
+      if (winding0 != winding1) {
+         /* If we knew that the "front" parameter wasn't going to be
+          * referenced, could rearrange one of the two triangles such
+          * that they were both CCW.  Aero actually does send mixed
+          * CW/CCW rectangles under some circumstances, but we catch them
+          * explicitly.
+          */
+         return FALSE;
+      }
+      keep = winding0;
+   } else if (winding0 != keep || winding1 != keep) {
+      if (winding0 == keep)
+         bin_triangle(setup, scene, v0, v1, v2);
+      else if (winding1 == keep)
+         bin_triangle(setup, scene, v3, v4, v5);
       return TRUE;
+   }
+
+   if (keep == WINDING_CCW) {
+      return do_rect_ccw(setup, scene, v0, v1, v2, v3, v4, v5,
+                         setup->ccw_is_frontface);
+   } else if (keep == WINDING_CW) {
+      return do_rect_ccw(setup, scene, v0, v2, v1, v3, v5, v4,
+                         !setup->ccw_is_frontface);
    } else {
       return TRUE;
    }
 }
 
 
+static boolean
+setup_rect_cw(struct lp_setup_context *setup,
+              const float (*v0)[4],
+              const float (*v1)[4],
+              const float (*v2)[4],
+              const float (*v3)[4],
+              const float (*v4)[4],
+              const float (*v5)[4])
+{
+   return setup_rect(setup, NULL, WINDING_CW, v0, v1, v2, v3, v4, v5);
+}
+
+
 static boolean
 setup_rect_ccw(struct lp_setup_context *setup,
                const float (*v0)[4],
@@ -786,22 +861,7 @@ setup_rect_ccw(struct lp_setup_context *setup,
                const float (*v4)[4],
                const float (*v5)[4])
 {
-   enum winding winding0 = winding(v0, v1, v2);
-   enum winding winding1 = winding(v3, v4, v5);
-
-   if (winding0 == WINDING_CCW &&
-       winding1 == WINDING_CCW) {
-      return do_rect_ccw(setup, v0, v1, v2, v3, v4, v5, setup->ccw_is_frontface);
-   } else if (winding0 == WINDING_CCW) {
-      setup->triangle(setup, v0, v1, v2);
-      return TRUE;
-   } else if (winding1 == WINDING_CCW) {
-      return FALSE;
-      setup->triangle(setup, v3, v4, v5);
-      return TRUE;
-   } else {
-      return TRUE;
-   }
+   return setup_rect(setup, NULL, WINDING_CCW, v0, v1, v2, v3, v4, v5);
 }
 
 
@@ -831,24 +891,48 @@ setup_rect_both(struct lp_setup_context *setup,
                 const float (*v4)[4],
                 const float (*v5)[4])
 {
-   enum winding winding0 = winding(v0, v1, v2);
-   enum winding winding1 = winding(v3, v4, v5);
+   return setup_rect(setup, NULL, WINDING_NONE, v0, v1, v2, v3, v4, v5);
+}
 
-   if (winding0 != winding1) {
-      /* If we knew that the "front" parameter wasn't going to be
-       * referenced, could rearrange one of the two triangles such
-       * that they were both CCW.  Aero actually does send mixed
-       * CW/CCW rectangles under some circumstances, but we catch them
-       * explicitly.
-       */
-      return FALSE;
-   } else if (winding0 == WINDING_CCW) {
-      return do_rect_ccw(setup, v0, v1, v2, v3, v4, v5, setup->ccw_is_frontface);
-   } else if (winding0 == WINDING_CW) {
-      return do_rect_ccw(setup, v0, v2, v1, v3, v5, v4, !setup->ccw_is_frontface);
-   } else {
+
+/**
+ * Bin two triangles as a rect into the given scene, which may be an
+ * auxiliary scene filled by a parallel binning job, if they form one.
+ * This does the same as the function selected by lp_setup_choose_rect(),
+ * except that it never flushes: running out of memory is left for the
+ * caller to check with lp_scene_is_oom().  Return false if the caller
+ * needs to bin them as triangles.
+ */
+boolean
+lp_setup_bin_rect_into(struct lp_setup_context *setup,
+                       struct lp_scene *scene,
+                       const float (*v0)[4],
+                       const float (*v1)[4],
+                       const float (*v2)[4],
+                       const float (*v3)[4],
+                       const float (*v4)[4],
+                       const float (*v5)[4])
+{
+   enum winding keep;
+
+   if (setup->rasterizer_discard)
+      return TRUE;
+
+   switch (setup->cullmode) {
+   case PIPE_FACE_NONE:
+      keep = WINDING_NONE;
+      break;
+   case PIPE_FACE_BACK:
+      keep = setup->ccw_is_frontface ? WINDING_CCW : WINDING_CW;
+      break;
+   case PIPE_FACE_FRONT:
+      keep = setup->ccw_is_frontface ? WINDING_CW : WINDING_CCW;
+      break;
+   default:
       return TRUE;
    }
+
+   return setup_rect(setup, scene, keep, v0, v1, v2, v3, v4, v5);
 }
 
 
@@ -264,14 +264,13 @@ check_opaque(const struct lp_setup_context *setup,
  */
 static boolean
 do_triangle_ccw(struct lp_setup_context *setup,
+                struct lp_scene *scene,
                 struct fixed_position *position,
                 const float (*v0)[4],
                 const float (*v1)[4],
                 const float (*v2)[4],
                 boolean frontfacing)
 {
-   struct lp_scene *scene = setup->scene;
-
    if (0)
       lp_setup_print_triangle(setup, v0, v1, v2);
 
@@ -737,7 +736,7 @@ do_triangle_ccw(struct lp_setup_context *setup,
                                   s_planes, setup->multisample);
    }
 
-   return lp_setup_bin_triangle(setup, tri, use_32bits,
+   return lp_setup_bin_triangle(setup, scene, tri, use_32bits,
                                 check_opaque(setup, v0, v1, v2),
                                 &bbox, nr_planes, viewport_index);
 }
@@ -772,6 +771,7 @@ floor_pot(uint32_t n)
 
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_scene *scene,
                       struct lp_rast_triangle *tri,
                       boolean use_32bits,
                       boolean opaque,
@@ -779,7 +779,6 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       int nr_planes,
                       unsigned viewport_index)
 {
-   struct lp_scene *scene = setup->scene;
    unsigned cmd;
 
    /* What is the largest power-of-two boundary this triangle crosses:
@@ -810,23 +809,26 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
    u_rect_find_intersection(&setup->draw_regions[viewport_index],
                             &trimmed_box);
 
+   const unsigned tile_order = scene->tile_order;
+   const int tile_size = scene->tile_size;
+
    /* Determine which tile(s) intersect the triangle's bounding box
     */
-   if (dx < TILE_SIZE) {
-      const int ix0 = bbox->x0 / TILE_SIZE;
-      const int iy0 = bbox->y0 / TILE_SIZE;
-      unsigned px = bbox->x0 & 63 & ~3;
-      unsigned py = bbox->y0 & 63 & ~3;
+   if (dx < tile_size) {
+      const int ix0 = bbox->x0 >> tile_order;
+      const int iy0 = bbox->y0 >> tile_order;
+      unsigned px = bbox->x0 & (tile_size - 1) & ~3;
+      unsigned py = bbox->y0 & (tile_size - 1) & ~3;
 
-      assert(iy0 == bbox->y1 / TILE_SIZE &&
-             ix0 == bbox->x1 / TILE_SIZE);
+      assert(iy0 == bbox->y1 >> tile_order &&
+             ix0 == bbox->x1 >> tile_order);
 
       if (nr_planes == 3) {
          if (sz < 4) {
             /* Triangle is contained in a single 4x4 stamp:
              */
-            assert(px + 4 <= TILE_SIZE);
-            assert(py + 4 <= TILE_SIZE);
+            assert(px + 4 <= tile_size);
+            assert(py + 4 <= tile_size);
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_4;
             else
@@ -845,11 +847,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
              * dimensions if the triangle is 16 pixels in one dimension but 4
              * in the other. So budge the 16x16 back inside the tile.
              */
-            px = MIN2(px, TILE_SIZE - 16);
-            py = MIN2(py, TILE_SIZE - 16);
+            px = MIN2(px, tile_size - 16);
+            py = MIN2(py, tile_size - 16);
 
-            assert(px + 16 <= TILE_SIZE);
-            assert(py + 16 <= TILE_SIZE);
+            assert(px + 16 <= tile_size);
+            assert(py + 16 <= tile_size);
 
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_16;
@@ -860,11 +862,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                                                lp_rast_arg_triangle_contained(tri, px, py));
          }
       } else if (nr_planes == 4 && sz < 16) {
-         px = MIN2(px, TILE_SIZE - 16);
-         py = MIN2(py, TILE_SIZE - 16);
+         px = MIN2(px, tile_size - 16);
+         py = MIN2(py, tile_size - 16);
 
-         assert(px + 16 <= TILE_SIZE);
-         assert(py + 16 <= TILE_SIZE);
+         assert(px + 16 <= tile_size);
+         assert(py + 16 <= tile_size);
 
          if (setup->multisample)
             cmd = LP_RAST_OP_MS_TRIANGLE_4_16;
@@ -894,23 +896,23 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       int64_t xstep[MAX_PLANES];
       int64_t ystep[MAX_PLANES];
 
-      const int ix0 = trimmed_box.x0 / TILE_SIZE;
-      const int iy0 = trimmed_box.y0 / TILE_SIZE;
-      const int ix1 = trimmed_box.x1 / TILE_SIZE;
-      const int iy1 = trimmed_box.y1 / TILE_SIZE;
+      const int ix0 = trimmed_box.x0 >> tile_order;
+      const int iy0 = trimmed_box.y0 >> tile_order;
+      const int ix1 = trimmed_box.x1 >> tile_order;
+      const int iy1 = trimmed_box.y1 >> tile_order;
 
       for (int i = 0; i < nr_planes; i++) {
          c[i] = (plane[i].c +
-                 IMUL64(plane[i].dcdy, iy0) * TILE_SIZE -
-                 IMUL64(plane[i].dcdx, ix0) * TILE_SIZE);
+                 IMUL64(plane[i].dcdy, iy0) * tile_size -
+                 IMUL64(plane[i].dcdx, ix0) * tile_size);
 
          ei[i] = (plane[i].dcdy -
                   plane[i].dcdx -
-                  (int64_t)plane[i].eo) << TILE_ORDER;
+                  (int64_t)plane[i].eo) << tile_order;
 
-         eo[i] = (int64_t)plane[i].eo << TILE_ORDER;
-         xstep[i] = -(((int64_t)plane[i].dcdx) << TILE_ORDER);
-         ystep[i] = ((int64_t)plane[i].dcdy) << TILE_ORDER;
+         eo[i] = (int64_t)plane[i].eo << tile_order;
+         xstep[i] = -(((int64_t)plane[i].dcdx) << tile_order);
+         ystep[i] = ((int64_t)plane[i].dcdy) << tile_order;
       }
 
       tri->inputs.is_blit = lp_setup_is_blit(setup, &tri->inputs);
@@ -963,7 +965,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                /* triangle covers the whole tile- shade whole tile */
                LP_COUNT(nr_fully_covered_64);
                in = TRUE;
-               if (!lp_setup_whole_tile(setup, &tri->inputs, x, y, opaque))
+               if (!lp_setup_whole_tile(setup, scene, &tri->inputs,
+                                        x, y, opaque))
                   goto fail;
             }
 
@@ -1001,11 +1004,11 @@ retry_triangle_ccw(struct lp_setup_context *setup,
                    const float (*v2)[4],
                    boolean front)
 {
-   if (!do_triangle_ccw(setup, position, v0, v1, v2, front)) {
+   if (!do_triangle_ccw(setup, setup->scene, position, v0, v1, v2, front)) {
       if (!lp_setup_flush_and_restart(setup))
          return;
 
-      if (!do_triangle_ccw(setup, position, v0, v1, v2, front))
+      if (!do_triangle_ccw(setup, setup->scene, position, v0, v1, v2, front))
          return;
    }
 }
@@ -1236,6 +1239,49 @@ triangle_noop(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Cull and bin a triangle into the given scene, which may be an auxiliary
+ * scene filled by a parallel binning job.  This does the same as the
+ * function selected by lp_setup_choose_triangle(), except that it never
+ * flushes: it returns FALSE when the scene runs out of memory, so the
+ * caller can bin the triangle again once the scene has been restarted.
+ */
+boolean
+lp_setup_bin_triangle_into(struct lp_setup_context *setup,
+                           struct lp_scene *scene,
+                           const float (*v0)[4],
+                           const float (*v1)[4],
+                           const float (*v2)[4])
+{
+   alignas(16) struct fixed_position position;
+
+   if (setup->rasterizer_discard ||
+       setup->cullmode == PIPE_FACE_FRONT_AND_BACK)
+      return TRUE;
+
+   int8_t area_sign = calc_fixed_position(setup, &position, v0, v1, v2);
+   if (area_sign == 0)
+      return TRUE;
+
+   /* CCW (positive area) triangles face front iff ccw_is_frontface */
+   boolean front = (area_sign > 0) == !!setup->ccw_is_frontface;
+   if ((setup->cullmode == PIPE_FACE_BACK && !front) ||
+       (setup->cullmode == PIPE_FACE_FRONT && front))
+      return TRUE;
+
+   if (area_sign > 0)
+      return do_triangle_ccw(setup, scene, &position, v0, v1, v2, front);
+
+   if (setup->flatshade_first) {
+      rotate_fixed_position_12(&position);
+      return do_triangle_ccw(setup, scene, &position, v0, v2, v1, front);
+   } else {
+      rotate_fixed_position_01(&position);
+      return do_triangle_ccw(setup, scene, &position, v1, v0, v2, front);
+   }
+}
+
+
 void
 lp_setup_choose_triangle(struct lp_setup_context *setup)
 {
@@ -44,6 +44,9 @@
 #include "util/u_math.h"
 #include "lp_state_fs.h"
 #include "lp_perf.h"
+#include "lp_scene.h"
+#include "lp_screen.h"
+#include "lp_cs_tpool.h"
 
 
 /* It should be a multiple of both 6 and 4 (in other words, a multiple of 12)
@@ -53,6 +56,15 @@
 
 #define LP_MAX_VBUF_SIZE    4096
 
+/* With parallel binning, let the draw module hand us much bigger batches
+ * so that there is enough work to split between threads.
+ */
+#define LP_MAX_VBUF_INDEXES_PARALLEL 16380
+#define LP_MAX_VBUF_SIZE_PARALLEL    (256 * 1024)
+
+/* Don't bother splitting off jobs with fewer triangles than this. */
+#define LP_MIN_TRIS_PER_BIN_JOB 128
+
 
 
 /** cast wrapper */
@@ -165,6 +177,259 @@ rect(struct lp_setup_context *setup,
 }
 
 
+struct lp_bin_job_info {
+   struct lp_setup_context *setup;
+   const void *vertex_buffer;
+   unsigned stride;
+   const ushort *indices;    /**< NULL for non-indexed draws */
+   enum pipe_prim_type prim;
+   boolean rects;            /**< try binning triangle pairs as rects */
+   unsigned nr_tris;
+   unsigned num_jobs;
+   boolean failed[LP_MAX_BIN_JOBS];
+};
+
+
+/**
+ * Fetch the vertices of the t'th triangle of a triangle list, strip or
+ * fan, in the same order as the serial loops in lp_setup_draw_elements().
+ */
+static inline void
+get_bin_job_tri(const struct lp_bin_job_info *info, unsigned t,
+                const_float4_ptr v[3])
+{
+   const unsigned i = t + 2;
+   unsigned idx[3];
+
+   switch (info->prim) {
+   case PIPE_PRIM_TRIANGLES:
+      idx[0] = 3 * t;
+      idx[1] = 3 * t + 1;
+      idx[2] = 3 * t + 2;
+      break;
+   case PIPE_PRIM_TRIANGLE_STRIP:
+      if (info->setup->flatshade_first) {
+         idx[0] = i - 2;
+         idx[1] = i + (i & 1) - 1;
+         idx[2] = i - (i & 1);
+      } else {
+         idx[0] = i + (i & 1) - 2;
+         idx[1] = i - (i & 1) - 1;
+         idx[2] = i;
+      }
+      break;
+   case PIPE_PRIM_TRIANGLE_FAN:
+   default:
+      if (info->setup->flatshade_first) {
+         idx[0] = i - 1;
+         idx[1] = i;
+         idx[2] = 0;
+      } else {
+         idx[0] = 0;
+         idx[1] = i - 1;
+         idx[2] = i;
+      }
+      break;
+   }
+
+   for (unsigned k = 0; k < 3; k++) {
+      unsigned vert = info->indices ? info->indices[idx[k]] : idx[k];
+      v[k] = get_vert(info->vertex_buffer, vert, info->stride);
+   }
+}
+
+
+/**
+ * With rect detection the slices are split between triangle pairs, so
+ * that the same pairs are tried as in the serial rect() loops.
+ */
+static inline unsigned
+bin_job_first_tri(const struct lp_bin_job_info *info, unsigned job)
+{
+   if (info->rects)
+      return (uint64_t)(info->nr_tris / 2) * job / info->num_jobs * 2;
+
+   return (uint64_t)info->nr_tris * job / info->num_jobs;
+}
+
+
+/**
+ * Bin the t'th triangle, or the t'th and the next one as a rect, into the
+ * given auxiliary scene.  Returns the number of triangles consumed, or
+ * zero if the scene ran out of memory.
+ */
+static unsigned
+bin_job_tris_into(struct lp_bin_job_info *info, struct lp_scene *scene,
+                  unsigned t)
+{
+   struct lp_setup_context *setup = info->setup;
+   const_float4_ptr v[3];
+
+   get_bin_job_tri(info, t, v);
+
+   if (info->rects) {
+      const_float4_ptr w[3];
+
+      get_bin_job_tri(info, t + 1, w);
+      if (!lp_setup_bin_rect_into(setup, scene, v[0], v[1], v[2],
+                                  w[0], w[1], w[2])) {
+         if (!lp_setup_bin_triangle_into(setup, scene, v[0], v[1], v[2]) ||
+             !lp_setup_bin_triangle_into(setup, scene, w[0], w[1], w[2]))
+            return 0;
+      }
+      return lp_scene_is_oom(scene) ? 0 : 2;
+   }
+
+   return lp_setup_bin_triangle_into(setup, scene, v[0], v[1], v[2]) ? 1 : 0;
+}
+
+
+/**
+ * Thread pool callback: set up and bin one contiguous slice of the
+ * triangles into the job's own auxiliary scene.
+ */
+static void
+bin_triangles_job(void *data, int job, struct lp_cs_local_mem *lmem)
+{
+   struct lp_bin_job_info *info = data;
+   struct lp_scene *scene = info->setup->bin_scenes[job];
+   const unsigned end = bin_job_first_tri(info, job + 1);
+
+   for (unsigned t = bin_job_first_tri(info, job); t < end; ) {
+      unsigned n = bin_job_tris_into(info, scene, t);
+      if (!n) {
+         info->failed[job] = TRUE;
+         return;
+      }
+      t += n;
+   }
+}
+
+
+/**
+ * Parallel binning of a batch of triangles.
+ *
+ * The triangles are split into contiguous slices which are set up and
+ * binned concurrently on the compute thread pool, each into an auxiliary
+ * scene with its own bins and data blocks.  Those are then appended to
+ * the current scene's bins in slice order, which preserves the
+ * submission order of the commands within every bin.  A slice that runs
+ * out of scene memory is thrown away and, together with all following
+ * slices, binned again on this thread the usual way (which may flush).
+ *
+ * Returns FALSE, having done nothing, if the batch isn't suitable.
+ */
+static boolean
+lp_setup_bin_triangles_parallel(struct lp_setup_context *setup,
+                                const void *vertex_buffer,
+                                unsigned stride,
+                                const ushort *indices,
+                                unsigned nr)
+{
+   struct llvmpipe_context *lp_context = llvmpipe_context(setup->pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   struct lp_scene *scene = setup->scene;
+   struct lp_bin_job_info info;
+   unsigned nr_tris;
+
+   if (!setup->parallel_binning ||
+       /* triangle setup counts these, which isn't thread safe */
+       lp_context->active_statistics_queries)
+      return FALSE;
+
+   /* Look for rects where the serial paths do. */
+   const boolean try_rects = setup->permit_linear_rasterizer &&
+      !setup->setup.variant->key.uses_constant_interp;
+   boolean rects = FALSE;
+
+   switch (setup->prim) {
+   case PIPE_PRIM_TRIANGLES:
+      nr_tris = nr / 3;
+      rects = try_rects && nr % 6 == 0;
+      break;
+   case PIPE_PRIM_TRIANGLE_STRIP:
+      /* Strips are paired up as they come, so slicing them would give
+       * different rects than the serial path.
+       */
+      if (try_rects && !indices && setup->flatshade_first)
+         return FALSE;
+      FALLTHROUGH;
+   case PIPE_PRIM_TRIANGLE_FAN:
+      nr_tris = nr >= 3 ? nr - 2 : 0;
+      break;
+   default:
+      return FALSE;
+   }
+
+   unsigned num_jobs = MIN3(nr_tris / LP_MIN_TRIS_PER_BIN_JOB,
+                            screen->num_threads, LP_MAX_BIN_JOBS);
+   if (num_jobs < 2)
+      return FALSE;
+
+   /* Share what is left of the scene's memory budget between the jobs. */
+   unsigned job_size = (LP_SCENE_MAX_SIZE - scene->scene_size) / num_jobs;
+   if (job_size < 2 * DATA_BLOCK_SIZE)
+      return FALSE;
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      if (!setup->bin_scenes[i]) {
+         setup->bin_scenes[i] = CALLOC_STRUCT(lp_scene);
+         if (!setup->bin_scenes[i])
+            num_jobs = i;
+      }
+      if (i < num_jobs &&
+          !lp_scene_begin_sub_binning(setup->bin_scenes[i], scene, job_size)) {
+         lp_scene_discard_sub(setup->bin_scenes[i]);
+         num_jobs = i;
+      }
+   }
+   if (num_jobs < 2) {
+      for (unsigned i = 0; i < num_jobs; i++)
+         lp_scene_discard_sub(setup->bin_scenes[i]);
+      return FALSE;
+   }
+
+   memset(&info, 0, sizeof(info));
+   info.setup = setup;
+   info.vertex_buffer = vertex_buffer;
+   info.stride = stride;
+   info.indices = indices;
+   info.prim = setup->prim;
+   info.rects = rects;
+   info.nr_tris = nr_tris;
+   info.num_jobs = num_jobs;
+
+   struct lp_cs_tpool_task *task =
+      lp_cs_tpool_queue_task(screen->cs_tpool, bin_triangles_job,
+                             &info, num_jobs);
+   lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+
+   unsigned job = 0;
+   for (; job < num_jobs && !info.failed[job]; job++)
+      lp_scene_merge_sub(scene, setup->bin_scenes[job]);
+
+   if (job < num_jobs) {
+      for (unsigned i = job; i < num_jobs; i++)
+         lp_scene_discard_sub(setup->bin_scenes[i]);
+
+      for (unsigned t = bin_job_first_tri(&info, job); t < nr_tris;
+           t += rects ? 2 : 1) {
+         const_float4_ptr v[3];
+         get_bin_job_tri(&info, t, v);
+         if (rects) {
+            const_float4_ptr w[3];
+            get_bin_job_tri(&info, t + 1, w);
+            rect(setup, v[0], v[1], v[2], w[0], w[1], w[2]);
+         } else {
+            setup->triangle(setup, v[0], v[1], v[2]);
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+
 /**
  * draw elements / indexed primitives
  */
@@ -182,6 +447,10 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_bin_triangles_parallel(setup, vertex_buffer, stride,
+                                       indices, nr))
+      return;
+
    const bool uses_constant_interp =
       setup->setup.variant->key.uses_constant_interp;
 
@@ -390,6 +659,10 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_bin_triangles_parallel(setup, vertex_buffer, stride,
+                                       NULL, nr))
+      return;
+
    const bool uses_constant_interp =
       setup->setup.variant->key.uses_constant_interp;
 
@@ -705,8 +978,13 @@ lp_setup_pipeline_statistics(
 void
 lp_setup_init_vbuf(struct lp_setup_context *setup)
 {
-   setup->base.max_indices = LP_MAX_VBUF_INDEXES;
-   setup->base.max_vertex_buffer_bytes = LP_MAX_VBUF_SIZE;
+   if (setup->parallel_binning) {
+      setup->base.max_indices = LP_MAX_VBUF_INDEXES_PARALLEL;
+      setup->base.max_vertex_buffer_bytes = LP_MAX_VBUF_SIZE_PARALLEL;
+   } else {
+      setup->base.max_indices = LP_MAX_VBUF_INDEXES;
+      setup->base.max_vertex_buffer_bytes = LP_MAX_VBUF_SIZE;
+   }
 
    setup->base.get_vertex_info = lp_setup_get_vertex_info;
    setup->base.allocate_vertices = lp_setup_allocate_vertices;
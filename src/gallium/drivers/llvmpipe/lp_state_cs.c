@@ -498,6 +498,7 @@ llvmpipe_create_compute_state(struct pipe_context *pipe,
    shader->no = cs_no++;
 
    shader->base.type = templ->ir_type;
+   shader->base.code_cache_data = templ->code_cache_data;
    shader->req_local_mem = templ->req_local_mem;
    if (templ->ir_type == PIPE_SHADER_IR_NIR_SERIALIZED) {
       struct blob_reader reader;
@@ -804,12 +805,15 @@ generate_variant(struct llvmpipe_context *lp,
    if (shader->base.ir.nir) {
       lp_cs_get_ir_cache_key(variant, ir_sha1_cache_key);
 
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key,
+                                shader->base.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
 
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (!variant->gallivm)
+      variant->gallivm = gallivm_create(module_name, lp->context, &cached);
    if (!variant->gallivm) {
       FREE(variant);
       return NULL;
@@ -823,19 +827,47 @@ generate_variant(struct llvmpipe_context *lp,
       lp_debug_cs_variant(variant);
    }
 
-   lp_jit_init_cs_types(variant);
+   if (variant->gallivm->object) {
+      variant->jit_function = (lp_jit_cs_func)
+         gallivm_cached_function(variant->gallivm, "cs_variant");
+      if (variant->jit_function) {
+         variant->nr_instrs += cached.nr_instrs;
+      } else {
+         /* A stale or broken cache entry, build the IR after all and
+          * replace the entry.
+          */
+         if (gallivm_debug & GALLIVM_DEBUG_PERF)
+            debug_printf("cached %s lacks cs_variant, rebuilding\n",
+                         module_name);
 
-   generate_compute(lp, shader, variant);
+         gallivm_destroy(variant->gallivm);
+         memset(&cached, 0, sizeof(cached));
+         needs_caching = true;
+         variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+         if (!variant->gallivm) {
+            FREE(variant);
+            return NULL;
+         }
+      }
+   }
+
+   if (!variant->gallivm->object) {
+      lp_jit_init_cs_types(variant);
 
-   gallivm_compile_module(variant->gallivm);
+      generate_compute(lp, shader, variant);
 
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+      gallivm_compile_module(variant->gallivm);
 
-   variant->jit_function = (lp_jit_cs_func)
-      gallivm_jit_function(variant->gallivm, variant->function);
+      variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+      variant->jit_function = (lp_jit_cs_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+   }
 
    if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+      cached.nr_instrs = variant->nr_instrs;
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key,
+                                  shader->base.code_cache_data);
    }
    gallivm_free_ir(variant->gallivm);
    return variant;
@@ -278,6 +278,7 @@ llvmpipe_update_derived(struct llvmpipe_context *llvmpipe)
       compute_vertex_info(llvmpipe);
 
    if (llvmpipe->dirty & (LP_NEW_FS |
+                          LP_NEW_FS_VARIANT |
                           LP_NEW_FRAMEBUFFER |
                           LP_NEW_BLEND |
                           LP_NEW_SCISSOR |
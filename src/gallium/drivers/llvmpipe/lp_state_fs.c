@@ -3673,6 +3673,8 @@ lp_debug_fs_kind(enum lp_fs_kind kind)
       return "AERO_MINIFICATION";
    case LP_FS_KIND_LLVM_LINEAR:
       return "LLVM_LINEAR";
+   case LP_FS_KIND_BLIT_RGBA_MODULATE:
+      return "BLIT_RGBA_MODULATE";
    default:
       return "unknown";
    }
@@ -3692,6 +3694,8 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
    debug_printf("variant->opaque = %u\n", variant->opaque);
    debug_printf("variant->potentially_opaque = %u\n", variant->potentially_opaque);
    debug_printf("variant->blit = %u\n", variant->blit);
+   debug_printf("variant->hiz_cull = %u\n", variant->hiz_cull);
+   debug_printf("variant->hiz_update = %u\n", variant->hiz_update);
    debug_printf("shader->kind = %s\n", lp_debug_fs_kind(variant->shader->kind));
    debug_printf("\n");
 }
@@ -3720,14 +3724,57 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
 }
 
 
+/**
+ * Look the functions of a variant loaded from the shader cache up.
+ * Returns FALSE if the cached object lacks any of them.
+ */
+static boolean
+lookup_cached_functions(struct lp_fragment_shader_variant *variant,
+                        boolean need_edge_test, boolean need_whole,
+                        boolean need_linear)
+{
+   if (need_edge_test) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+         gallivm_cached_function(variant->gallivm, "fs_variant_partial");
+      if (!variant->jit_function[RAST_EDGE_TEST])
+         return FALSE;
+   }
+
+   if (need_whole) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+         gallivm_cached_function(variant->gallivm, "fs_variant_whole");
+      if (!variant->jit_function[RAST_WHOLE])
+         return FALSE;
+   }
+
+   if (need_linear) {
+      variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
+         gallivm_cached_function(variant->gallivm, "fs_variant_linear2");
+      if (!variant->jit_linear_llvm)
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * With \p unoptimized the code is compiled as fast as possible unless it
+ * is found in the shader cache.  Such variants aren't cached and can be
+ * told apart by variant->gallivm->no_opt.
+ *
+ * Also called from the compile queue's threads, with an LLVM context
+ * private to the calling thread, so nothing mutable in \p lp may be used.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
+                 LLVMContextRef context,
                  struct lp_fragment_shader *shader,
-                 const struct lp_fragment_shader_variant_key *key)
+                 const struct lp_fragment_shader_variant_key *key,
+                 boolean unoptimized)
 {
    struct lp_fragment_shader_variant *variant =
       MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
@@ -3748,23 +3795,38 @@ generate_variant(struct llvmpipe_context *lp,
    if (shader->base.ir.nir) {
       lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
 
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key,
+                                shader->base.code_cache_data);
       if (!cached.data_size)
          needs_caching = true;
    }
 
+   variant->no = p_atomic_inc_return(&shader->variants_created) - 1;
+
    char module_name[64];
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-            shader->no, shader->variants_created);
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+            shader->no, variant->no);
+   /* On cache hits link the cached object directly instead of building
+    * the IR and an execution engine just to throw them away.
+    */
+   variant->gallivm = gallivm_create_from_cache(module_name, &cached);
+   if (!variant->gallivm) {
+      if (unoptimized && !cached.data_size) {
+         variant->gallivm = gallivm_create_unoptimized(module_name, context);
+         needs_caching = false;
+      } else {
+         variant->gallivm = gallivm_create(module_name, context, &cached);
+      }
+   }
    if (!variant->gallivm) {
       FREE(variant);
       return NULL;
    }
 
+   boolean precompiled = variant->gallivm->object != NULL;
+
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
-   variant->no = shader->variants_created++;
 
    /*
     * Determine whether we are touching all channels in the color buffer.
@@ -3851,6 +3913,46 @@ generate_variant(struct llvmpipe_context *lp,
       }
    }
 
+   /* Hierarchical Z.  Skipping occluded blocks must not be observable,
+    * so the depth test alone has to decide about the fate of fragments
+    * and failing it must have no side effects.  Lowering the bounds after
+    * fully covered blocks additionally requires every fragment to either
+    * write its interpolated depth or to fail the depth test.
+    */
+   const boolean hiz_func =
+         key->depth.enabled &&
+         (key->depth.func == PIPE_FUNC_LESS ||
+          key->depth.func == PIPE_FUNC_LEQUAL);
+   const boolean stencil_writes =
+         (key->stencil[0].enabled && key->stencil[0].writemask) ||
+         (key->stencil[1].enabled && key->stencil[1].writemask);
+
+   variant->hiz_cull =
+         hiz_func &&
+         !key->depth_clamp &&
+         !stencil_writes &&
+         !shader->info.base.writes_z &&
+         (!shader->info.base.writes_memory ||
+          shader->info.base.properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL]);
+
+   variant->hiz_update =
+         variant->hiz_cull &&
+         key->depth.writemask &&
+         !key->stencil[0].enabled &&
+         !key->alpha.enabled &&
+         !key->multisample &&
+         !key->blend.alpha_to_coverage &&
+         !shader->info.base.uses_kill &&
+         !shader->info.base.writes_samplemask;
+
+   variant->hiz_invalidate =
+         key->depth.enabled &&
+         key->depth.writemask &&
+         key->depth.func != PIPE_FUNC_NEVER &&
+         key->depth.func != PIPE_FUNC_LESS &&
+         key->depth.func != PIPE_FUNC_EQUAL &&
+         key->depth.func != PIPE_FUNC_LEQUAL;
+
    /* Determine whether this shader + pipeline state is a candidate for
     * the linear path.
     */
@@ -3870,17 +3972,14 @@ generate_variant(struct llvmpipe_context *lp,
 
    llvmpipe_fs_variant_fastpath(variant);
 
-   lp_jit_init_types(variant);
-
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
-
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
-      }
-   }
+   /* Which functions exist is fully determined by the key, so for
+    * precompiled variants the same decisions are taken below, only the
+    * functions are looked up by name instead of generated.
+    */
+   const boolean need_edge_test = variant->jit_function[RAST_EDGE_TEST] == NULL;
+   const boolean need_whole = variant->jit_function[RAST_WHOLE] == NULL &&
+                              variant->opaque;
+   boolean need_linear = FALSE;
 
    if (linear_pipeline) {
       /* Currently keeping both the old fastpaths and new linear path
@@ -3901,8 +4000,9 @@ generate_variant(struct llvmpipe_context *lp,
       if (variant->jit_linear == NULL) {
          if (shader->kind == LP_FS_KIND_BLIT_RGBA ||
              shader->kind == LP_FS_KIND_BLIT_RGB1 ||
+             shader->kind == LP_FS_KIND_BLIT_RGBA_MODULATE ||
              shader->kind == LP_FS_KIND_LLVM_LINEAR) {
-            llvmpipe_fs_variant_linear_llvm(lp, shader, variant);
+            need_linear = TRUE;
          }
       }
    } else {
@@ -3912,35 +4012,84 @@ generate_variant(struct llvmpipe_context *lp,
       }
    }
 
-   /*
-    * Compile everything
-    */
+   if (precompiled) {
+      if (lookup_cached_functions(variant, need_edge_test, need_whole,
+                                  need_linear)) {
+         variant->nr_instrs += cached.nr_instrs;
+      } else {
+         /* A stale or broken cache entry, build the IR after all and
+          * replace the entry.
+          */
+         if (gallivm_debug & GALLIVM_DEBUG_PERF)
+            debug_printf("cached %s lacks functions, rebuilding\n",
+                         module_name);
+
+         if (need_edge_test)
+            variant->jit_function[RAST_EDGE_TEST] = NULL;
+         if (need_whole)
+            variant->jit_function[RAST_WHOLE] = NULL;
+         variant->jit_linear_llvm = NULL;
+
+         gallivm_destroy(variant->gallivm);
+         memset(&cached, 0, sizeof(cached));
+         needs_caching = !unoptimized;
+         variant->gallivm = unoptimized ?
+            gallivm_create_unoptimized(module_name, context) :
+            gallivm_create(module_name, context, &cached);
+         if (!variant->gallivm) {
+            FREE(variant);
+            return NULL;
+         }
+         precompiled = FALSE;
+      }
+   }
 
-   gallivm_compile_module(variant->gallivm);
+   if (!precompiled) {
+      lp_jit_init_types(variant);
 
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+      if (need_edge_test)
+         generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
 
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+      if (need_whole) {
+         /* Specialized shader, which doesn't need to read the color buffer. */
+         generate_fragment(lp, shader, variant, RAST_WHOLE);
+      }
+
+      if (need_linear)
+         llvmpipe_fs_variant_linear_llvm(lp, shader, variant);
+
+      /*
+       * Compile everything
+       */
+
+      gallivm_compile_module(variant->gallivm);
+
+      variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+      if (variant->function[RAST_EDGE_TEST]) {
+         variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+               gallivm_jit_function(variant->gallivm,
+                                    variant->function[RAST_EDGE_TEST]);
+      }
+
+      if (variant->function[RAST_WHOLE]) {
+         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
             gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST]);
+                                 variant->function[RAST_WHOLE]);
+      }
+
+      if (variant->linear_function) {
+         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
+            gallivm_jit_function(variant->gallivm, variant->linear_function);
+      }
    }
 
-   if (variant->function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-         gallivm_jit_function(variant->gallivm,
-                              variant->function[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
+   if (!variant->jit_function[RAST_WHOLE]) {
       variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
          variant->jit_function[RAST_EDGE_TEST];
    }
 
    if (linear_pipeline) {
-      if (variant->linear_function) {
-         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
-            gallivm_jit_function(variant->gallivm, variant->linear_function);
-      }
-
       /*
        * This must be done after LLVM compilation, as it will call the JIT'ed
        * code to determine active inputs.
@@ -3949,7 +4098,9 @@ generate_variant(struct llvmpipe_context *lp,
    }
 
    if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+      cached.nr_instrs = variant->nr_instrs;
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key,
+                                  shader->base.code_cache_data);
    }
 
    gallivm_free_ir(variant->gallivm);
@@ -3973,6 +4124,7 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    list_inithead(&shader->variants.list);
 
    shader->base.type = templ->type;
+   shader->base.code_cache_data = templ->code_cache_data;
    if (templ->type == PIPE_SHADER_IR_TGSI) {
       /* get/save the summary info for this shader */
       lp_build_tgsi_info(templ->tokens, &shader->info);
@@ -4116,6 +4268,19 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant)
 {
+   struct lp_fs_compile_job *job = variant->compile_job;
+   if (job) {
+      struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+      /* Don't bother compiling what will be thrown away. */
+      util_queue_drop_job(&screen->compile_queue, &job->fence);
+      util_queue_fence_wait(&job->fence);
+      if (job->variant)
+         lp_fs_variant_reference(lp, &job->variant, NULL);
+      util_queue_fence_destroy(&job->fence);
+      FREE(job);
+   }
+
    gallivm_destroy(variant->gallivm);
    lp_fs_reference(lp, &variant->shader, NULL);
    FREE(variant);
@@ -4144,6 +4309,9 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    struct lp_fragment_shader *shader = fs;
    struct lp_fs_variant_list_item *li, *next;
 
+   if (llvmpipe->fs_fallback && llvmpipe->fs_fallback->shader == shader)
+      llvmpipe->fs_fallback = NULL;
+
    /* Delete all the variants */
    LIST_FOR_EACH_ENTRY_SAFE(li, next, &shader->variants.list, list) {
       struct lp_fragment_shader_variant *variant;
@@ -4588,13 +4756,110 @@ make_variant_key(struct llvmpipe_context *lp,
 }
 
 
+static void
+add_shader_variant(struct llvmpipe_context *lp,
+                   struct lp_fragment_shader_variant *variant)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+
+   list_add(&variant->list_item_local.list, &shader->variants.list);
+   list_add(&variant->list_item_global.list, &lp->fs_variants_list.list);
+   lp->nr_fs_variants++;
+   lp->nr_fs_instrs += variant->nr_instrs;
+   shader->variants_cached++;
+}
+
+
+/**
+ * Compile the optimized variant on the screen's compile queue.
+ */
+static void
+compile_variant_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+   struct lp_fragment_shader_variant *fallback = job->fallback;
+
+   LLVMContextRef context = LLVMContextCreate();
+   if (!context)
+      return;
+
+#if LLVM_VERSION_MAJOR >= 15
+   LLVMContextSetOpaquePointers(context, false);
+#endif
+
+   job->variant = generate_variant(job->lp, context, fallback->shader,
+                                   &fallback->key, FALSE);
+
+   /* All the IR is gone by now, only the code is left. */
+   LLVMContextDispose(context);
+}
+
+
+static void
+compile_variant_async(struct llvmpipe_context *lp,
+                      struct lp_fragment_shader_variant *fallback)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fs_compile_job *job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job)
+      return;
+
+   util_queue_fence_init(&job->fence);
+   job->lp = lp;
+   job->fallback = fallback;
+   fallback->compile_job = job;
+
+   util_queue_add_job(&screen->compile_queue, job, &job->fence,
+                      compile_variant_execute, NULL, 0);
+}
+
+
+/**
+ * Replace an unoptimized variant with the optimized one, once compiled.
+ * Scenes still referencing the fallback keep it alive.
+ */
+static struct lp_fragment_shader_variant *
+finish_async_variant(struct llvmpipe_context *lp,
+                     struct lp_fragment_shader_variant *fallback)
+{
+   struct lp_fs_compile_job *job = fallback->compile_job;
+   struct lp_fragment_shader_variant *variant = job->variant;
+
+   if (!variant) {
+      /* Out of memory, stick with what we have. */
+      util_queue_fence_destroy(&job->fence);
+      FREE(job);
+      fallback->compile_job = NULL;
+      return fallback;
+   }
+
+   job->variant = NULL;
+
+   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_PERF)) {
+      debug_printf("llvmpipe: fs #%u var %u: optimized variant ready\n",
+                   fallback->shader->no, fallback->no);
+   }
+
+   llvmpipe_remove_shader_variant(lp, fallback);
+   add_shader_variant(lp, variant);
+   lp_fs_variant_reference(lp, &fallback, NULL);
+
+   return variant;
+}
+
+
 /**
  * Update fragment shader state.  This is called just prior to drawing
  * something when some fragment-related state has changed.
+ *
+ * With LP_ASYNC_COMPILE, missing variants are compiled without
+ * optimizations first, and the optimized ones are compiled in the
+ * background and swapped in when they are ready (LP_NEW_FS_VARIANT).
  */
 void
 llvmpipe_update_fs(struct llvmpipe_context *lp)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_fragment_shader *shader = lp->fs;
 
    char store[LP_FS_MAX_VARIANT_KEY_SIZE];
@@ -4612,6 +4877,11 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
    }
 
    if (variant) {
+      if (variant->compile_job &&
+          util_queue_fence_is_signalled(&variant->compile_job->fence)) {
+         variant = finish_async_variant(lp, variant);
+      }
+
       /* Move this variant to the head of the list to implement LRU
        * deletion of shader's when we have too many.
        */
@@ -4670,8 +4940,10 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       /*
        * Generate the new variant.
        */
+      const boolean async = screen->async_compile &&
+         !(gallivm_get_perf_flags() & GALLIVM_PERF_NO_OPT);
       int64_t t0 = os_time_get();
-      variant = generate_variant(lp, shader, key);
+      variant = generate_variant(lp, lp->context, shader, key, async);
       int64_t t1 = os_time_get();
       int64_t dt = t1 - t0;
       LP_COUNT_ADD(llvm_compile_time, dt);
@@ -4679,14 +4951,15 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 
       /* Put the new variant into the list */
       if (variant) {
-         list_add(&variant->list_item_local.list, &shader->variants.list);
-         list_add(&variant->list_item_global.list, &lp->fs_variants_list.list);
-         lp->nr_fs_variants++;
-         lp->nr_fs_instrs += variant->nr_instrs;
-         shader->variants_cached++;
+         add_shader_variant(lp, variant);
+
+         if (async && variant->gallivm->no_opt)
+            compile_variant_async(lp, variant);
       }
    }
 
+   lp->fs_fallback = variant && variant->compile_job ? variant : NULL;
+
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
 }
@@ -38,6 +38,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct tgsi_token;
@@ -55,7 +56,8 @@ enum lp_fs_kind
    LP_FS_KIND_BLIT_RGBA,
    LP_FS_KIND_BLIT_RGB1,
    LP_FS_KIND_AERO_MINIFICATION,
-   LP_FS_KIND_LLVM_LINEAR
+   LP_FS_KIND_LLVM_LINEAR,
+   LP_FS_KIND_BLIT_RGBA_MODULATE
 };
 
 
@@ -159,6 +161,21 @@ struct lp_fs_variant_list_item
 };
 
 
+/**
+ * Optimized compilation of a variant on the screen's compile queue, see
+ * LP_ASYNC_COMPILE.  Owned by the fallback variant used in the meantime.
+ */
+struct lp_fs_compile_job
+{
+   struct util_queue_fence fence;
+   struct llvmpipe_context *lp;
+   struct lp_fragment_shader_variant *fallback;
+
+   /* The optimized variant, NULL until the fence signals or on failure */
+   struct lp_fragment_shader_variant *variant;
+};
+
+
 struct lp_fragment_shader_variant
 {
    /*
@@ -168,6 +185,16 @@ struct lp_fragment_shader_variant
 
    unsigned opaque:1;
    unsigned blit:1;
+
+   /*
+    * Hierarchical Z, see lp_rast_hiz_*():
+    * hiz_cull - blocks entirely behind the depth bounds may be skipped
+    * hiz_update - fully covered blocks lower the depth bounds
+    * hiz_invalidate - depth writes may raise stored depth values
+    */
+   unsigned hiz_cull:1;
+   unsigned hiz_update:1;
+   unsigned hiz_invalidate:1;
    unsigned linear_input_mask:16;
    struct pipe_reference reference;
 
@@ -204,6 +231,11 @@ struct lp_fragment_shader_variant
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
+   /* Set for unoptimized variants only used until the optimized one is
+    * compiled.
+    */
+   struct lp_fs_compile_job *compile_job;
+
    /* For debugging/profiling purposes */
    unsigned no;
 
@@ -223,6 +255,11 @@ struct lp_fragment_shader
    /* Analysis results */
    enum lp_fs_kind kind;
 
+   /* LP_FS_KIND_BLIT_RGBA_MODULATE: index of the float in constant
+    * buffer 0 each (RGBA) channel of the texel is multiplied with.
+    */
+   uint8_t modulate_const[4];
+
    struct lp_fs_variant_list_item variants;
 
    struct draw_fragment_shader *draw_data;
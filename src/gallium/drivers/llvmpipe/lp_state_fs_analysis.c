@@ -445,6 +445,156 @@ llvmpipe_nir_is_linear_compat(struct nir_shader *shader,
 }
 
 
+/*
+ * Return the texture instruction producing the given value, or NULL.
+ */
+static nir_tex_instr *
+get_tex_parent(const nir_src *src)
+{
+   if (!src->is_ssa ||
+       src->ssa->parent_instr->type != nir_instr_type_tex)
+      return NULL;
+   return nir_instr_as_tex(src->ssa->parent_instr);
+}
+
+
+/*
+ * Check whether the given ALU source is a load_ubo from the default
+ * constant buffer at a constant offset, and if so return the index of the
+ * float each of the four channels reads.
+ */
+static bool
+get_ubo_modulate_consts(const nir_alu_src *src, uint8_t consts[4])
+{
+   if (!src->src.is_ssa ||
+       src->src.ssa->parent_instr->type != nir_instr_type_intrinsic)
+      return false;
+
+   nir_intrinsic_instr *load =
+      nir_instr_as_intrinsic(src->src.ssa->parent_instr);
+   if (load->intrinsic != nir_intrinsic_load_ubo ||
+       load->dest.ssa.bit_size != 32 ||
+       !nir_src_is_const(load->src[0]) ||
+       nir_src_as_uint(load->src[0]) != 0 ||
+       !nir_src_is_const(load->src[1]))
+      return false;
+
+   uint64_t offset = nir_src_as_uint(load->src[1]);
+   if (offset % 4 != 0)
+      return false;
+
+   for (unsigned c = 0; c < 4; c++) {
+      uint64_t index = offset / 4 + src->swizzle[c];
+      if (index > UINT8_MAX)
+         return false;
+      consts[c] = index;
+   }
+   return true;
+}
+
+
+/*
+ * Match the linear shaders the hand written fastpaths in
+ * lp_state_fs_linear.c implement, ie. a single texture lookup with the
+ * coordinates taken straight from the first input, either written out
+ * unchanged (BLIT_RGBA), with alpha forced to one (BLIT_RGB1), or
+ * multiplied by a uniform (BLIT_RGBA_MODULATE).
+ *
+ * Only called on shaders which already passed the linear compat checks.
+ */
+static enum lp_fs_kind
+llvmpipe_nir_match_blit(struct lp_fragment_shader *shader)
+{
+   const struct lp_tgsi_info *info = &shader->info;
+   const struct lp_tgsi_texture_info *tex_info = &info->tex[0];
+   struct nir_shader *nir = shader->base.ir.nir;
+   nir_intrinsic_instr *store = NULL;
+
+   if (info->num_texs != 1 ||
+       info->base.num_inputs != 1 ||
+       tex_info->texture_unit != 0 ||
+       tex_info->sampler_unit != 0 ||
+       tex_info->coord[0].u.index != 0 ||
+       tex_info->coord[0].swizzle != 0 ||
+       tex_info->coord[1].u.index != 0 ||
+       tex_info->coord[1].swizzle != 1)
+      return LP_FS_KIND_LLVM_LINEAR;
+
+   nir_foreach_function(function, nir) {
+      if (!function->impl)
+         continue;
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block) {
+            if (instr->type != nir_instr_type_intrinsic)
+               continue;
+            nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+            if (intrin->intrinsic != nir_intrinsic_store_deref)
+               continue;
+            if (store)
+               return LP_FS_KIND_LLVM_LINEAR;
+            store = intrin;
+         }
+      }
+   }
+
+   if (!store ||
+       nir_intrinsic_write_mask(store) != 0xf ||
+       !store->src[1].is_ssa ||
+       store->src[1].ssa->num_components != 4)
+      return LP_FS_KIND_LLVM_LINEAR;
+
+   nir_tex_instr *tex = get_tex_parent(&store->src[1]);
+   if (tex) {
+      return tex->num_srcs == 1 ? LP_FS_KIND_BLIT_RGBA
+                                : LP_FS_KIND_LLVM_LINEAR;
+   }
+
+   if (store->src[1].ssa->parent_instr->type != nir_instr_type_alu)
+      return LP_FS_KIND_LLVM_LINEAR;
+
+   const nir_alu_instr *alu =
+      nir_instr_as_alu(store->src[1].ssa->parent_instr);
+
+   if (alu->op == nir_op_vec4) {
+      /* vec4(t.x, t.y, t.z, 1.0) */
+      for (unsigned c = 0; c < 3; c++) {
+         nir_tex_instr *t = get_tex_parent(&alu->src[c].src);
+         if (!t || (tex && t != tex) || alu->src[c].swizzle[0] != c)
+            return LP_FS_KIND_LLVM_LINEAR;
+         tex = t;
+      }
+      if (!nir_src_is_const(alu->src[3].src))
+         return LP_FS_KIND_LLVM_LINEAR;
+      nir_load_const_instr *one =
+         nir_instr_as_load_const(alu->src[3].src.ssa->parent_instr);
+      if (one->def.bit_size != 32 ||
+          one->value[alu->src[3].swizzle[0]].f32 != 1.0f)
+         return LP_FS_KIND_LLVM_LINEAR;
+      return tex->num_srcs == 1 ? LP_FS_KIND_BLIT_RGB1
+                                : LP_FS_KIND_LLVM_LINEAR;
+   }
+
+   if (alu->op == nir_op_fmul) {
+      /* t * u, in either order */
+      for (unsigned s = 0; s < 2; s++) {
+         const nir_alu_src *tex_src = &alu->src[s];
+         const nir_alu_src *ubo_src = &alu->src[1 - s];
+
+         tex = get_tex_parent(&tex_src->src);
+         if (!tex || tex->num_srcs != 1)
+            continue;
+         if (tex_src->swizzle[0] != 0 || tex_src->swizzle[1] != 1 ||
+             tex_src->swizzle[2] != 2 || tex_src->swizzle[3] != 3)
+            continue;
+         if (get_ubo_modulate_consts(ubo_src, shader->modulate_const))
+            return LP_FS_KIND_BLIT_RGBA_MODULATE;
+      }
+   }
+
+   return LP_FS_KIND_LLVM_LINEAR;
+}
+
+
 /*
  * Analyze the given NIR fragment shader and set its shader->kind field
  * to LP_FS_KIND_x.
@@ -458,7 +608,7 @@ llvmpipe_fs_analyse_nir(struct lp_fragment_shader *shader)
        !shader->info.sampler_texture_units_different &&
        shader->info.num_texs <= LP_MAX_LINEAR_TEXTURES &&
        llvmpipe_nir_is_linear_compat(shader->base.ir.nir, &shader->info)) {
-      shader->kind = LP_FS_KIND_LLVM_LINEAR;
+      shader->kind = llvmpipe_nir_match_blit(shader);
    } else {
       shader->kind = LP_FS_KIND_GENERAL;
    }
@@ -339,6 +339,38 @@ shade_rgb1(struct shader *shader)
 }
 
 
+/* Multiply each channel by the 0..255 factor in the matching lane of
+ * shader->const0, rounding the result like the unorm8 conversion does.
+ */
+static const uint32_t *
+shade_modulate(struct shader *shader)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i bias = _mm_set1_epi16(128);
+   const __m128i factor = shader->const0;
+   const uint32_t *src0 = shader->src0;
+   uint32_t *dst = shader->out0;
+   int width = shader->width;
+   int i;
+
+   for (i = 0; i + 3 < width; i += 4) {
+      __m128i s = *(const __m128i *)&src0[i];
+      __m128i lo = _mm_unpacklo_epi8(s, zero);
+      __m128i hi = _mm_unpackhi_epi8(s, zero);
+
+      /* x * f / 255, exact for x, f in [0, 255] */
+      lo = _mm_add_epi16(_mm_mullo_epi16(lo, factor), bias);
+      hi = _mm_add_epi16(_mm_mullo_epi16(hi, factor), bias);
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+      *(__m128i *)&dst[i] = _mm_packus_epi16(lo, hi);
+   }
+
+   return shader->out0;
+}
+
+
 static void
 init_shader(struct shader *shader,
            int x, int y, int width, int height)
@@ -582,6 +614,98 @@ blit_rgba_blend_premul(const struct lp_rast_state *state,
 }
 
 
+/* Linear shader variant implementing the BLIT_RGBA, BLIT_RGB1 and
+ * BLIT_RGBA_MODULATE shaders on top of the generic linear samplers, ie.
+ * with nearest or bilinear filtering and arbitrary (affine) scaling.
+ * Blending is either disabled or one/inv_src_alpha.
+ */
+static boolean
+blit_sampled(const struct lp_rast_state *state,
+             unsigned x, unsigned y,
+             unsigned width, unsigned height,
+             const float (*a0)[4],
+             const float (*dadx)[4],
+             const float (*dady)[4],
+             uint8_t *color,
+             unsigned stride)
+{
+   const struct lp_fragment_shader_variant *variant = state->variant;
+   const struct lp_fragment_shader *fs = variant->shader;
+   const struct lp_jit_context *context = &state->jit_context;
+   struct lp_linear_sampler samp;
+   struct color_blend blend;
+   struct shader shader;
+   boolean premul;
+
+   LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
+
+   /* Require constant w:
+    */
+   if (dadx[0][3] != 0.0f ||
+       dady[0][3] != 0.0f)
+      return FALSE;
+
+   if (fs->kind == LP_FS_KIND_BLIT_RGBA_MODULATE) {
+      const struct lp_jit_buffer *consts = &context->constants[0];
+      uint8_t f[4];
+
+      for (unsigned c = 0; c < 4; c++) {
+         const unsigned idx = fs->modulate_const[c];
+         float val;
+
+         if (idx >= consts->num_elements)
+            return FALSE;
+
+         val = consts->f[idx];
+         if (!(val >= 0.0f && val <= 1.0f))
+            return FALSE;
+
+         f[c] = float_to_ubyte(val);
+      }
+
+      /* BGRA order, for two pixels */
+      shader.const0 = _mm_setr_epi16(f[2], f[1], f[0], f[3],
+                                     f[2], f[1], f[0], f[3]);
+   }
+
+   if (!lp_linear_init_sampler(&samp,
+                               &fs->info.tex[0],
+                               lp_fs_variant_key_sampler_idx(&variant->key, 0),
+                               &context->textures[0],
+                               x, y, width, height,
+                               a0, dadx, dady))
+      return FALSE;
+
+   init_blend(&blend, x, y, width, height, color, stride);
+
+   init_shader(&shader, x, y, width, height);
+
+   /* With alpha forced to one premultiplied blending is a plain write.
+    */
+   premul = !variant->opaque && fs->kind != LP_FS_KIND_BLIT_RGB1;
+
+   /* Rasterize the rectangle and run the shader:
+    */
+   for (y = 0; y < height; y++) {
+      const uint32_t *src = samp.base.fetch(&samp.base);
+
+      shader.src0 = src;
+      if (fs->kind == LP_FS_KIND_BLIT_RGB1)
+         src = shade_rgb1(&shader);
+      else if (fs->kind == LP_FS_KIND_BLIT_RGBA_MODULATE)
+         src = shade_modulate(&shader);
+
+      blend.src = src;
+      if (premul)
+         blend_premul(&blend);
+      else
+         blend_noop(&blend);
+   }
+
+   return TRUE;
+}
+
+
 /* Linear shader which always emits red.  Used for debugging.
  */
 static boolean
@@ -686,6 +810,20 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
       return;
    }
 
+   /* Everything else (bilinear filtering, scaling, RGB1 and modulate with
+    * blending) goes through the generic linear samplers.
+    */
+   if ((variant->shader->kind == LP_FS_KIND_BLIT_RGBA ||
+        variant->shader->kind == LP_FS_KIND_BLIT_RGB1 ||
+        variant->shader->kind == LP_FS_KIND_BLIT_RGBA_MODULATE) &&
+       lp_linear_check_sampler(samp0, &variant->shader->info.tex[0]) &&
+       (variant->opaque ||
+        (is_one_inv_src_alpha_blend(variant) &&
+         util_get_cpu_caps()->has_sse2))) {
+      variant->jit_linear = blit_sampled;
+      return;
+   }
+
    if (0) {
       variant->jit_linear = linear_no_op;
       return;
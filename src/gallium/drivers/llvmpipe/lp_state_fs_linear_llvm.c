@@ -248,6 +248,7 @@ llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
 {
    assert(shader->kind == LP_FS_KIND_BLIT_RGBA ||
           shader->kind == LP_FS_KIND_BLIT_RGB1 ||
+          shader->kind == LP_FS_KIND_BLIT_RGBA_MODULATE ||
           shader->kind == LP_FS_KIND_LLVM_LINEAR);
 
    struct gallivm_state *gallivm = variant->gallivm;
@@ -0,0 +1,521 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+
+/**
+ * @file
+ * Parallel binning (LP_PARALLEL_BINNING) test.
+ *
+ * Renders the same draws with a context binning serially and a context
+ * binning on several threads, and checks that both produce the very same
+ * pixels.  The draws are large enough to be split between jobs:
+ * - a grid of screen-aligned quads as triangle pairs, which take the
+ *   rect fast path,
+ * - many overlapping triangles, where any reordering within a bin would
+ *   show,
+ * - the same triangles, indexed, and as strips and fans,
+ * each with and without culling.  In debug builds the rect and triangle
+ * counters must match as well.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_test.h"
+#include "lp_perf.h"
+#include "lp_public.h"
+#include "lp_screen.h"
+
+
+#define WIDTH 256
+#define HEIGHT 256
+
+/*
+ * The draws must fit in a single batch of the serial context's vbuf
+ * (LP_MAX_VBUF_INDEXES), as the parallel one takes bigger batches and the
+ * serial paths only look for rects within a batch.  They still need to be
+ * large enough to be split between at least two binning jobs.
+ */
+#define MAX_BATCH 1020
+
+/* Grid of quads, in pixels */
+#define QUAD_SIZE 16
+#define QUADS_X 13
+#define QUADS_Y 13
+
+#define NUM_TRIS (MAX_BATCH / 3)
+
+/* Twice the largest draw, for the indexed copies */
+#define MAX_VERTICES (2 * MAX_BATCH)
+
+
+struct binning_vertex
+{
+   float pos[4];
+   float color[4];
+};
+
+
+struct binning_test_draw
+{
+   const char *name;
+   enum pipe_prim_type mode;
+   boolean indexed;
+   unsigned cull_face;          /* PIPE_FACE_x */
+};
+
+
+struct binning_test_result
+{
+   uint32_t *pixels;
+   unsigned nr_rects;
+   unsigned nr_tris;
+};
+
+
+static const struct binning_test_draw draws[] = {
+   { "quads",              PIPE_PRIM_TRIANGLES,      FALSE, PIPE_FACE_NONE },
+   { "quads, culled",      PIPE_PRIM_TRIANGLES,      FALSE, PIPE_FACE_BACK },
+   { "indexed quads",      PIPE_PRIM_TRIANGLES,      TRUE,  PIPE_FACE_NONE },
+   { "triangles",          PIPE_PRIM_TRIANGLES,      FALSE, PIPE_FACE_NONE },
+   { "triangles, culled",  PIPE_PRIM_TRIANGLES,      FALSE, PIPE_FACE_FRONT },
+   { "indexed triangles",  PIPE_PRIM_TRIANGLES,      TRUE,  PIPE_FACE_NONE },
+   { "strip",              PIPE_PRIM_TRIANGLE_STRIP, FALSE, PIPE_FACE_NONE },
+   { "indexed strip",      PIPE_PRIM_TRIANGLE_STRIP, TRUE,  PIPE_FACE_BACK },
+   { "fan",                PIPE_PRIM_TRIANGLE_FAN,   FALSE, PIPE_FACE_NONE },
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "draw\n");
+
+   fflush(fp);
+}
+
+
+static void
+set_env(const char *name, const char *value, boolean overwrite)
+{
+#ifdef _WIN32
+   if (overwrite || !getenv(name))
+      _putenv_s(name, value);
+#else
+   setenv(name, value, overwrite);
+#endif
+}
+
+
+static float
+next_random(uint32_t *seed)
+{
+   *seed = *seed * 1103515245 + 12345;
+   return (*seed >> 8) / (float)(1 << 24);
+}
+
+
+static void
+set_vertex(struct binning_vertex *v, float x, float y,
+           const float color[4])
+{
+   /* pixels to clip space */
+   v->pos[0] = x * (2.0f / WIDTH) - 1.0f;
+   v->pos[1] = y * (2.0f / HEIGHT) - 1.0f;
+   v->pos[2] = 0.0f;
+   v->pos[3] = 1.0f;
+   memcpy(v->color, color, sizeof v->color);
+}
+
+
+/**
+ * Fill in the vertices of a draw, returns the number of vertices.
+ * Quads are emitted as two triangles sharing a diagonal, with the winding
+ * alternating like a checkerboard, everything else gets random positions
+ * and colors.
+ */
+static unsigned
+make_vertices(const struct binning_test_draw *draw,
+              struct binning_vertex *verts)
+{
+   uint32_t seed = 0x1234;
+   unsigned n = 0;
+
+   if (strstr(draw->name, "quads")) {
+      for (unsigned y = 0; y < QUADS_Y; y++) {
+         for (unsigned x = 0; x < QUADS_X; x++) {
+            const float x0 = x * QUAD_SIZE, x1 = x0 + QUAD_SIZE;
+            const float y0 = y * QUAD_SIZE, y1 = y0 + QUAD_SIZE;
+            float color[4];
+
+            for (unsigned c = 0; c < 4; c++)
+               color[c] = next_random(&seed);
+
+            if ((x ^ y) & 1) {
+               set_vertex(&verts[n++], x1, y1, color);
+               set_vertex(&verts[n++], x1, y0, color);
+               set_vertex(&verts[n++], x0, y0, color);
+               set_vertex(&verts[n++], x0, y1, color);
+               set_vertex(&verts[n++], x1, y1, color);
+               set_vertex(&verts[n++], x0, y0, color);
+            } else {
+               set_vertex(&verts[n++], x0, y0, color);
+               set_vertex(&verts[n++], x1, y0, color);
+               set_vertex(&verts[n++], x1, y1, color);
+               set_vertex(&verts[n++], x0, y0, color);
+               set_vertex(&verts[n++], x1, y1, color);
+               set_vertex(&verts[n++], x0, y1, color);
+            }
+         }
+      }
+      return n;
+   }
+
+   const unsigned nr = draw->mode == PIPE_PRIM_TRIANGLES ?
+      3 * NUM_TRIS : NUM_TRIS + 2;
+
+   for (n = 0; n < nr; n++) {
+      float color[4];
+
+      for (unsigned c = 0; c < 4; c++)
+         color[c] = next_random(&seed);
+
+      if (draw->mode == PIPE_PRIM_TRIANGLE_FAN && n == 0) {
+         set_vertex(&verts[n], WIDTH / 2, HEIGHT / 2, color);
+      } else {
+         set_vertex(&verts[n],
+                    next_random(&seed) * WIDTH,
+                    next_random(&seed) * HEIGHT,
+                    color);
+      }
+   }
+
+   return n;
+}
+
+
+/**
+ * Render all the draws, each into a cleared framebuffer, with a new
+ * context and the given LP_PARALLEL_BINNING setting.
+ */
+static boolean
+render(struct pipe_screen *screen, boolean parallel,
+       struct binning_test_result *results)
+{
+   struct binning_vertex *verts;
+   ushort *indices;
+   boolean success = TRUE;
+
+   set_env("LP_PARALLEL_BINNING", parallel ? "true" : "false", TRUE);
+
+   struct pipe_context *pipe = screen->context_create(screen, NULL, 0);
+   if (!pipe) {
+      printf("failed to create context\n");
+      return FALSE;
+   }
+
+   verts = MALLOC(MAX_VERTICES * sizeof *verts);
+   indices = MALLOC(MAX_VERTICES * sizeof *indices);
+
+   struct pipe_resource templ;
+   memset(&templ, 0, sizeof templ);
+   templ.target = PIPE_TEXTURE_2D;
+   /* permits the linear rasterizer, hence rects */
+   templ.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   templ.width0 = WIDTH;
+   templ.height0 = HEIGHT;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.bind = PIPE_BIND_RENDER_TARGET;
+   struct pipe_resource *tex = screen->resource_create(screen, &templ);
+
+   struct pipe_surface surf_templ;
+   memset(&surf_templ, 0, sizeof surf_templ);
+   surf_templ.format = templ.format;
+   struct pipe_surface *surf = pipe->create_surface(pipe, tex, &surf_templ);
+
+   struct pipe_framebuffer_state fb;
+   memset(&fb, 0, sizeof fb);
+   fb.width = WIDTH;
+   fb.height = HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = surf;
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   struct pipe_blend_state blend;
+   memset(&blend, 0, sizeof blend);
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   void *blend_cso = pipe->create_blend_state(pipe, &blend);
+   pipe->bind_blend_state(pipe, blend_cso);
+
+   struct pipe_depth_stencil_alpha_state dsa;
+   memset(&dsa, 0, sizeof dsa);
+   void *dsa_cso = pipe->create_depth_stencil_alpha_state(pipe, &dsa);
+   pipe->bind_depth_stencil_alpha_state(pipe, dsa_cso);
+
+   struct pipe_viewport_state vp;
+   vp.scale[0] = WIDTH / 2.0f;
+   vp.scale[1] = HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = WIDTH / 2.0f;
+   vp.translate[1] = HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   vp.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+   vp.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+   vp.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+   vp.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+   pipe->set_viewport_states(pipe, 0, 1, &vp);
+
+   const enum tgsi_semantic semantic_names[] = {
+      TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR
+   };
+   const uint semantic_indexes[] = { 0, 0 };
+   void *vs = util_make_vertex_passthrough_shader(pipe, 2, semantic_names,
+                                                  semantic_indexes, FALSE);
+   void *fs = util_make_fragment_passthrough_shader(pipe, TGSI_SEMANTIC_COLOR,
+                                                    TGSI_INTERPOLATE_PERSPECTIVE,
+                                                    TRUE);
+   pipe->bind_vs_state(pipe, vs);
+   pipe->bind_fs_state(pipe, fs);
+
+   struct pipe_vertex_element ve[2];
+   memset(ve, 0, sizeof ve);
+   for (unsigned i = 0; i < 2; i++) {
+      ve[i].src_offset = i * 4 * sizeof(float);
+      ve[i].vertex_buffer_index = 0;
+      ve[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   }
+   void *velems = pipe->create_vertex_elements_state(pipe, 2, ve);
+   pipe->bind_vertex_elements_state(pipe, velems);
+
+   for (unsigned d = 0; d < ARRAY_SIZE(draws); d++) {
+      const struct binning_test_draw *draw = &draws[d];
+      unsigned count = make_vertices(draw, verts);
+
+      struct pipe_rasterizer_state rast;
+      memset(&rast, 0, sizeof rast);
+      rast.half_pixel_center = 1;
+      rast.bottom_edge_rule = 1;
+      rast.depth_clip_near = 1;
+      rast.depth_clip_far = 1;
+      rast.front_ccw = 1;
+      rast.cull_face = draw->cull_face;
+      void *rast_cso = pipe->create_rasterizer_state(pipe, &rast);
+      pipe->bind_rasterizer_state(pipe, rast_cso);
+
+      struct pipe_vertex_buffer vb;
+      memset(&vb, 0, sizeof vb);
+      vb.stride = sizeof *verts;
+      vb.is_user_buffer = TRUE;
+      vb.buffer.user = verts;
+
+      struct pipe_draw_info info;
+      memset(&info, 0, sizeof info);
+      info.mode = draw->mode;
+      info.instance_count = 1;
+      info.max_index = ~0;
+
+      struct pipe_draw_start_count_bias sc;
+      memset(&sc, 0, sizeof sc);
+      sc.count = count;
+
+      if (draw->indexed) {
+         /* the vertices backwards, and the indices reversing that */
+         struct binning_vertex *tmp = verts + count;
+         memcpy(tmp, verts, count * sizeof *verts);
+         for (unsigned i = 0; i < count; i++) {
+            verts[i] = tmp[count - 1 - i];
+            indices[i] = count - 1 - i;
+         }
+
+         info.index_size = 2;
+         info.has_user_indices = TRUE;
+         info.index.user = indices;
+         info.index_bounds_valid = TRUE;
+         info.min_index = 0;
+         info.max_index = count - 1;
+      }
+
+      pipe->set_vertex_buffers(pipe, 0, 1, 0, FALSE, &vb);
+
+      union pipe_color_union clear_color;
+      memset(&clear_color, 0, sizeof clear_color);
+      pipe->clear(pipe, PIPE_CLEAR_COLOR0, NULL, &clear_color, 0.0, 0);
+
+      const unsigned nr_rects = LP_COUNT_GET(nr_rects);
+      const unsigned nr_tris = LP_COUNT_GET(nr_tris);
+
+      pipe->draw_vbo(pipe, &info, 0, NULL, &sc, 1);
+      pipe->flush(pipe, NULL, 0);
+
+      results[d].nr_rects = LP_COUNT_GET(nr_rects) - nr_rects;
+      results[d].nr_tris = LP_COUNT_GET(nr_tris) - nr_tris;
+
+      struct pipe_transfer *transfer;
+      const uint8_t *map = pipe_texture_map(pipe, tex, 0, 0, PIPE_MAP_READ,
+                                            0, 0, WIDTH, HEIGHT, &transfer);
+      if (map) {
+         results[d].pixels = MALLOC(WIDTH * HEIGHT * 4);
+         for (unsigned y = 0; y < HEIGHT; y++)
+            memcpy(&results[d].pixels[y * WIDTH], map + y * transfer->stride,
+                   WIDTH * 4);
+         pipe_texture_unmap(pipe, transfer);
+      } else {
+         printf("failed to map the framebuffer\n");
+         success = FALSE;
+      }
+
+      pipe->bind_rasterizer_state(pipe, NULL);
+      pipe->delete_rasterizer_state(pipe, rast_cso);
+   }
+
+   pipe->bind_vertex_elements_state(pipe, NULL);
+   pipe->delete_vertex_elements_state(pipe, velems);
+   pipe->bind_vs_state(pipe, NULL);
+   pipe->delete_vs_state(pipe, vs);
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->delete_fs_state(pipe, fs);
+   pipe->bind_blend_state(pipe, NULL);
+   pipe->delete_blend_state(pipe, blend_cso);
+   pipe->bind_depth_stencil_alpha_state(pipe, NULL);
+   pipe->delete_depth_stencil_alpha_state(pipe, dsa_cso);
+
+   memset(&fb, 0, sizeof fb);
+   pipe->set_framebuffer_state(pipe, &fb);
+   pipe_surface_reference(&surf, NULL);
+   pipe_resource_reference(&tex, NULL);
+   pipe->destroy(pipe);
+
+   FREE(verts);
+   FREE(indices);
+
+   return success;
+}
+
+
+static boolean
+compare_results(unsigned verbose, const struct binning_test_draw *draw,
+                const struct binning_test_result *serial,
+                const struct binning_test_result *parallel)
+{
+   boolean success = TRUE;
+
+   if (!serial->pixels || !parallel->pixels)
+      return FALSE;
+
+   for (unsigned y = 0; y < HEIGHT; y++) {
+      for (unsigned x = 0; x < WIDTH; x++) {
+         const uint32_t s = serial->pixels[y * WIDTH + x];
+         const uint32_t p = parallel->pixels[y * WIDTH + x];
+         if (s != p) {
+            if (success || verbose)
+               printf("%s: pixel %u, %u: serial 0x%08x, parallel 0x%08x\n",
+                      draw->name, x, y, s, p);
+            success = FALSE;
+         }
+      }
+   }
+
+   if (serial->nr_rects != parallel->nr_rects ||
+       serial->nr_tris != parallel->nr_tris) {
+      printf("%s: serial binned %u rects and %u triangles, "
+             "parallel %u rects and %u triangles\n",
+             draw->name, serial->nr_rects, serial->nr_tris,
+             parallel->nr_rects, parallel->nr_tris);
+      success = FALSE;
+   }
+
+   return success;
+}
+
+
+static boolean
+test_binning(unsigned verbose, FILE *fp)
+{
+   struct binning_test_result serial[ARRAY_SIZE(draws)];
+   struct binning_test_result parallel[ARRAY_SIZE(draws)];
+   boolean success = TRUE;
+
+   /* Parallel binning needs more than one thread, also on single cores. */
+   set_env("LP_NUM_THREADS", "4", FALSE);
+
+   struct pipe_screen *screen = llvmpipe_create_screen(null_sw_create());
+   if (!screen) {
+      printf("failed to create screen\n");
+      return FALSE;
+   }
+
+   if (llvmpipe_screen(screen)->num_threads < 2) {
+      printf("parallel binning test skipped, LP_NUM_THREADS < 2\n");
+      screen->destroy(screen);
+      return TRUE;
+   }
+
+   memset(serial, 0, sizeof serial);
+   memset(parallel, 0, sizeof parallel);
+
+   if (!render(screen, FALSE, serial) ||
+       !render(screen, TRUE, parallel))
+      success = FALSE;
+
+   for (unsigned d = 0; d < ARRAY_SIZE(draws); d++) {
+      boolean ok = compare_results(verbose, &draws[d],
+                                   &serial[d], &parallel[d]);
+
+      if (verbose)
+         printf("%s: %s\n", draws[d].name, ok ? "pass" : "fail");
+
+      if (fp) {
+         fprintf(fp, "%s\t%s\n", ok ? "pass" : "fail", draws[d].name);
+         fflush(fp);
+      }
+
+      if (!ok)
+         success = FALSE;
+
+      FREE(serial[d].pixels);
+      FREE(parallel[d].pixels);
+   }
+
+   screen->destroy(screen);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_binning(verbose, fp);
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return TRUE;
+}
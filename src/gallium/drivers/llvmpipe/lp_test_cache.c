@@ -0,0 +1,280 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+
+/**
+ * @file
+ * Warm shader cache startup test.
+ *
+ * Compiles a small module once to get its object code, as the disk cache
+ * would hand it back, and then compares how long it takes to get a callable
+ * function out of that object by
+ * - building the IR and an MCJIT engine which picks up the cached object
+ *   (what variant creation did on cache hits before), and
+ * - loading the object directly with gallivm_create_from_cache().
+ *
+ * Both must produce the same results as the freshly compiled code.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/u_pointer.h"
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "util/os_time.h"
+
+#include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_arit.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_misc.h"
+#include "gallivm/lp_bld_type.h"
+
+#include "lp_test.h"
+
+
+#define NUM_ITERATIONS 32
+#define MAX_LENGTH 16
+
+
+typedef void (*cache_test_func_t)(float *out, const float *in);
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "ir_engine_usec\t"
+           "object_load_usec\n");
+
+   fflush(fp);
+}
+
+
+static LLVMValueRef
+build_cache_test_func(struct gallivm_state *gallivm, unsigned length)
+{
+   struct lp_type type = lp_type_float_vec(32, length * 32);
+   LLVMContextRef context = gallivm->context;
+   LLVMTypeRef vf32t = lp_build_vec_type(gallivm, type);
+   LLVMTypeRef args[2] = { LLVMPointerType(vf32t, 0), LLVMPointerType(vf32t, 0) };
+   LLVMValueRef func = LLVMAddFunction(gallivm->module, "test_cache",
+                                       LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                                        args, ARRAY_SIZE(args), 0));
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMBasicBlockRef block = LLVMAppendBasicBlockInContext(context, func, "entry");
+   struct lp_build_context bld;
+   LLVMValueRef x, res;
+
+   lp_build_context_init(&bld, gallivm, type);
+
+   LLVMSetFunctionCallConv(func, LLVMCCallConv);
+
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   /*
+    * Something with a few constant pool loads and a fair amount of code,
+    * so that the IR building and the codegen setup aren't trivially cheap.
+    */
+   x = LLVMBuildLoad2(builder, vf32t, LLVMGetParam(func, 1), "");
+   res = lp_build_sin(&bld, x);
+   res = lp_build_add(&bld, res, lp_build_cos(&bld, x));
+   res = lp_build_mul(&bld, res,
+                      lp_build_exp2(&bld, lp_build_mul(&bld, x,
+                                                       lp_build_const_vec(gallivm, type, 0.25))));
+   res = lp_build_add(&bld, res,
+                      lp_build_log2(&bld, lp_build_add(&bld, lp_build_abs(&bld, x),
+                                                       bld.one)));
+   LLVMBuildStore(builder, res, LLVMGetParam(func, 0));
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, func);
+
+   return func;
+}
+
+
+static void
+copy_cached_code(struct lp_cached_code *dst, const struct lp_cached_code *src)
+{
+   memset(dst, 0, sizeof *dst);
+   dst->data_size = src->data_size;
+   dst->data = malloc(src->data_size);
+   memcpy(dst->data, src->data, src->data_size);
+}
+
+
+static boolean
+compare_results(const float *ref, const float *out, unsigned length)
+{
+   return memcmp(ref, out, length * sizeof(float)) == 0;
+}
+
+
+PIPE_ALIGN_STACK
+static boolean
+test_cache(unsigned verbose, FILE *fp)
+{
+   unsigned length = lp_native_vector_width / 32;
+   struct lp_cached_code object;
+   struct lp_cached_code cached;
+   LLVMContextRef context;
+   struct gallivm_state *gallivm;
+   LLVMValueRef func;
+   cache_test_func_t test_func;
+   int64_t ir_engine_time = 0, object_load_time = 0;
+   boolean loaded = TRUE;
+   boolean success = TRUE;
+   float *in, *ref, *out;
+   unsigned i, j;
+
+   in = align_malloc(MAX_LENGTH * 4, MAX_LENGTH * 4);
+   ref = align_malloc(MAX_LENGTH * 4, MAX_LENGTH * 4);
+   out = align_malloc(MAX_LENGTH * 4, MAX_LENGTH * 4);
+
+   for (i = 0; i < length; i++)
+      in[i] = -4.0f + 0.75f * i;
+
+   /* Cold compile, fills in the object code like a disk cache miss would. */
+   memset(&cached, 0, sizeof cached);
+   context = LLVMContextCreate();
+#if LLVM_VERSION_MAJOR >= 15
+   LLVMContextSetOpaquePointers(context, false);
+#endif
+   gallivm = gallivm_create("test_cache", context, &cached);
+   func = build_cache_test_func(gallivm, length);
+   gallivm_compile_module(gallivm);
+   test_func = (cache_test_func_t) gallivm_jit_function(gallivm, func);
+
+   if (!cached.data_size) {
+      printf("no object code produced\n");
+      gallivm_destroy(gallivm);
+      LLVMContextDispose(context);
+      success = FALSE;
+      goto out;
+   }
+
+   copy_cached_code(&object, &cached);
+   gallivm_free_ir(gallivm);
+
+   test_func(ref, in);
+
+   gallivm_destroy(gallivm);
+   LLVMContextDispose(context);
+
+   for (i = 0; i < NUM_ITERATIONS; i++) {
+      int64_t start;
+
+      /* Warm cache hit, going through IR and MCJIT. */
+      copy_cached_code(&cached, &object);
+      start = os_time_get_nano();
+      context = LLVMContextCreate();
+#if LLVM_VERSION_MAJOR >= 15
+      LLVMContextSetOpaquePointers(context, false);
+#endif
+      gallivm = gallivm_create("test_cache", context, &cached);
+      func = build_cache_test_func(gallivm, length);
+      gallivm_compile_module(gallivm);
+      test_func = (cache_test_func_t) gallivm_jit_function(gallivm, func);
+      gallivm_free_ir(gallivm);
+      ir_engine_time += os_time_get_nano() - start;
+
+      memset(out, 0, MAX_LENGTH * 4);
+      test_func(out, in);
+      if (!compare_results(ref, out, length)) {
+         printf("cached module (IR + engine) gave different results\n");
+         success = FALSE;
+      }
+
+      gallivm_destroy(gallivm);
+      LLVMContextDispose(context);
+
+      /* Warm cache hit, loading the object directly. */
+      copy_cached_code(&cached, &object);
+      start = os_time_get_nano();
+      gallivm = gallivm_create_from_cache("test_cache", &cached);
+      if (!gallivm) {
+         /* Disabled by GALLIVM_PERF/GALLIVM_DEBUG, or unsupported. */
+         free(cached.data);
+         loaded = FALSE;
+         continue;
+      }
+      test_func = (cache_test_func_t) gallivm_cached_function(gallivm, "test_cache");
+      gallivm_free_ir(gallivm);
+      object_load_time += os_time_get_nano() - start;
+
+      if (!test_func) {
+         printf("test_cache not found in the cached object\n");
+         success = FALSE;
+      } else {
+         memset(out, 0, MAX_LENGTH * 4);
+         test_func(out, in);
+         if (!compare_results(ref, out, length)) {
+            printf("cached object gave different results\n");
+            if (verbose) {
+               for (j = 0; j < length; j++)
+                  printf("  %f: ref = %f, out = %f\n", in[j], ref[j], out[j]);
+            }
+            success = FALSE;
+         }
+      }
+
+      gallivm_destroy(gallivm);
+   }
+
+   free(object.data);
+
+   printf("warm cache variant creation (%u bytes of object code):\n",
+          (unsigned)object.data_size);
+   printf("  IR + engine:   %8.1f usec\n",
+          ir_engine_time / 1000.0 / NUM_ITERATIONS);
+   if (loaded)
+      printf("  object load:   %8.1f usec\n",
+             object_load_time / 1000.0 / NUM_ITERATIONS);
+   else
+      printf("  object load:   disabled\n");
+
+   if (fp) {
+      fprintf(fp, "%s\t%.1f\t%.1f\n", success ? "pass" : "fail",
+              ir_engine_time / 1000.0 / NUM_ITERATIONS,
+              loaded ? object_load_time / 1000.0 / NUM_ITERATIONS : 0.0);
+      fflush(fp);
+   }
+
+out:
+   align_free(in);
+   align_free(ref);
+   align_free(out);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_cache(verbose, fp);
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return TRUE;
+}
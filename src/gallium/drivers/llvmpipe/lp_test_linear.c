@@ -0,0 +1,1246 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+
+/**
+ * @file
+ * Unit tests for the hand written linear fastpaths.
+ *
+ * Each fastpath selected by llvmpipe_fs_variant_linear_fastpath() for the
+ * blit-like shader kinds is run over a tile and compared against a float
+ * model of what the general (SoA) path computes for the same shader:
+ * clamp-to-edge nearest or bilinear sampling, the shader arithmetic,
+ * conversion to unorm8 and either no blending or one/inv_src_alpha
+ * blending.
+ *
+ * The same cases are then drawn through a context, with NIR shaders which
+ * llvmpipe_nir_match_blit() has to recognize, once taking the fastpaths
+ * and once with the linear rasterizer disabled, and the two results are
+ * compared.  A few shaders which must not match are checked too.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_sampler.h"
+#include "util/u_simple_shaders.h"
+#include "sw/null/null_sw_winsys.h"
+#include "nir.h"
+#include "nir_builder.h"
+
+#include "lp_test.h"
+#include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_jit.h"
+#include "lp_public.h"
+#include "lp_rast.h"
+#include "lp_state_fs.h"
+
+
+#define TEX_SIZE 128
+#define DST_WIDTH 128
+#define DST_HEIGHT 64
+
+/* Tile which is shaded */
+#define TILE_X 16
+#define TILE_Y 8
+#define TILE_W 64
+#define TILE_H 32
+
+
+struct linear_test_case
+{
+   enum lp_fs_kind kind;
+   enum pipe_format tex_format;
+   unsigned filter;             /* PIPE_TEX_FILTER_x */
+   boolean premul;              /* one/inv_src_alpha blending */
+   float scale;                 /* texels per pixel */
+};
+
+
+static const enum lp_fs_kind kinds[] = {
+   LP_FS_KIND_BLIT_RGBA,
+   LP_FS_KIND_BLIT_RGB1,
+   LP_FS_KIND_BLIT_RGBA_MODULATE,
+};
+
+static const enum pipe_format tex_formats[] = {
+   PIPE_FORMAT_B8G8R8A8_UNORM,
+   PIPE_FORMAT_B8G8R8X8_UNORM,
+};
+
+static const unsigned filters[] = {
+   PIPE_TEX_FILTER_NEAREST,
+   PIPE_TEX_FILTER_LINEAR,
+};
+
+/* The texel offset is chosen so that nearest sampling never lands close
+ * to a texel boundary, where the fixed point interpolation of the fastpaths
+ * and the float model may legitimately disagree.
+ */
+static const float scales[] = {
+   0.5f, 1.0f, 1.5f, 2.0f, 3.0f
+};
+
+/* Scales drawn through the context.  One texel per pixel is left out, as
+ * nearest blits at that scale take the blit path whether the linear
+ * rasterizer is disabled or not.
+ */
+static const float render_scales[] = {
+   0.5f, 1.5f, 2.0f
+};
+
+static const float texel_offset = 0.3f;
+
+/* constant buffer 0, as seen by the modulate shader */
+static const float modulate_consts[8] = {
+   0.0f, 0.25f, 0.75f, 1.0f,
+   0.5f, 0.1f, 0.9f, 0.6f,
+};
+
+/* modulate_const[] indices, in RGBA order */
+static const uint8_t modulate_idx[4] = { 4, 5, 6, 7 };
+
+
+/*
+ * Fragment shaders for llvmpipe_nir_match_blit(), in the form the state
+ * tracker hands them over: the texture coordinates gathered from an input
+ * variable with a vec2, texture and sampler unit 0, constants in UBO 0.
+ */
+enum match_shader
+{
+   MATCH_TEX,              /* t */
+   MATCH_TEX_RGB1,         /* vec4(t.xyz, 1.0) */
+   MATCH_TEX_UBO,          /* t * ubo */
+   MATCH_UBO_TEX,          /* ubo * t */
+   MATCH_TEX_RGB_HALF,     /* vec4(t.xyz, 0.5) */
+   MATCH_TEX_YX,           /* t, sampled at coord.yx */
+   MATCH_TEX_COLOR,        /* t * a second input */
+};
+
+struct match_test_case
+{
+   const char *name;
+   enum match_shader shader;
+   enum lp_fs_kind kind;        /* expected */
+};
+
+static const struct match_test_case match_tests[] = {
+   { "t",                MATCH_TEX,          LP_FS_KIND_BLIT_RGBA },
+   { "vec4(t.xyz, 1.0)", MATCH_TEX_RGB1,     LP_FS_KIND_BLIT_RGB1 },
+   { "t * ubo",          MATCH_TEX_UBO,      LP_FS_KIND_BLIT_RGBA_MODULATE },
+   { "ubo * t",          MATCH_UBO_TEX,      LP_FS_KIND_BLIT_RGBA_MODULATE },
+   /* linear, but none of the blits */
+   { "vec4(t.xyz, 0.5)", MATCH_TEX_RGB_HALF, LP_FS_KIND_LLVM_LINEAR },
+   { "t(coord.yx)",      MATCH_TEX_YX,       LP_FS_KIND_LLVM_LINEAR },
+   { "t * color",        MATCH_TEX_COLOR,    LP_FS_KIND_LLVM_LINEAR },
+};
+
+
+/* Context the render and match tests draw with */
+struct linear_test_context
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   void *vs;
+   void *velems;
+   void *rast;
+   void *dsa;
+   void *fs[ARRAY_SIZE(kinds)];
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "test\t"
+           "kind\t"
+           "format\t"
+           "filter\t"
+           "blend\t"
+           "scale\n");
+
+   fflush(fp);
+}
+
+
+static void
+write_tsv_row(FILE *fp, const char *name,
+              const struct linear_test_case *test,
+              boolean success)
+{
+   fprintf(fp, "%s\t", success ? "pass" : "fail");
+   fprintf(fp, "%s\t", name);
+   fprintf(fp, "%s\t", lp_debug_fs_kind(test->kind));
+   fprintf(fp, "%s\t", util_format_name(test->tex_format));
+   fprintf(fp, "%s\t", test->filter == PIPE_TEX_FILTER_NEAREST ?
+           "nearest" : "linear");
+   fprintf(fp, "%s\t", test->premul ? "premul" : "none");
+   fprintf(fp, "%f\n", test->scale);
+
+   fflush(fp);
+}
+
+
+static void
+dump_test(const char *name, const struct linear_test_case *test)
+{
+   printf("%s: kind=%s format=%s filter=%s blend=%s scale=%f\n",
+          name,
+          lp_debug_fs_kind(test->kind),
+          util_format_short_name(test->tex_format),
+          test->filter == PIPE_TEX_FILTER_NEAREST ? "nearest" : "linear",
+          test->premul ? "premul" : "none",
+          test->scale);
+}
+
+
+/* Texel fetch with clamp-to-edge, returning RGBA floats in [0, 1].
+ */
+static void
+fetch_texel(const uint32_t *tex, enum pipe_format format,
+            int i, int j, float rgba[4])
+{
+   i = CLAMP(i, 0, TEX_SIZE - 1);
+   j = CLAMP(j, 0, TEX_SIZE - 1);
+
+   const uint32_t texel = tex[j * TEX_SIZE + i];
+
+   rgba[0] = ((texel >> 16) & 0xff) / 255.0f;
+   rgba[1] = ((texel >>  8) & 0xff) / 255.0f;
+   rgba[2] = ((texel >>  0) & 0xff) / 255.0f;
+   rgba[3] = format == PIPE_FORMAT_B8G8R8X8_UNORM ?
+             1.0f : ((texel >> 24) & 0xff) / 255.0f;
+}
+
+
+static void
+sample(const struct linear_test_case *test, const uint32_t *tex,
+       float u, float v, float rgba[4])
+{
+   if (test->filter == PIPE_TEX_FILTER_NEAREST) {
+      fetch_texel(tex, test->tex_format,
+                  (int)floorf(u), (int)floorf(v), rgba);
+   } else {
+      const float fu = u - 0.5f;
+      const float fv = v - 0.5f;
+      const int i0 = (int)floorf(fu);
+      const int j0 = (int)floorf(fv);
+      const float wu = fu - i0;
+      const float wv = fv - j0;
+      float t00[4], t10[4], t01[4], t11[4];
+
+      fetch_texel(tex, test->tex_format, i0,     j0,     t00);
+      fetch_texel(tex, test->tex_format, i0 + 1, j0,     t10);
+      fetch_texel(tex, test->tex_format, i0,     j0 + 1, t01);
+      fetch_texel(tex, test->tex_format, i0 + 1, j0 + 1, t11);
+
+      for (unsigned c = 0; c < 4; c++) {
+         const float top = t00[c] + wu * (t10[c] - t00[c]);
+         const float bot = t01[c] + wu * (t11[c] - t01[c]);
+         rgba[c] = top + wv * (bot - top);
+      }
+   }
+}
+
+
+/* Float model of the general path for the pixel at (x, y).
+ */
+static uint32_t
+reference_pixel(const struct linear_test_case *test,
+                const uint32_t *tex, uint32_t dst,
+                int x, int y)
+{
+   const float u = texel_offset + test->scale * x;
+   const float v = texel_offset + test->scale * y;
+   float rgba[4];
+   uint8_t res[4];
+
+   sample(test, tex, u, v, rgba);
+
+   switch (test->kind) {
+   case LP_FS_KIND_BLIT_RGB1:
+      rgba[3] = 1.0f;
+      break;
+   case LP_FS_KIND_BLIT_RGBA_MODULATE:
+      for (unsigned c = 0; c < 4; c++)
+         rgba[c] *= modulate_consts[modulate_idx[c]];
+      break;
+   default:
+      break;
+   }
+
+   if (test->premul) {
+      const float d[4] = {
+         ((dst >> 16) & 0xff) / 255.0f,
+         ((dst >>  8) & 0xff) / 255.0f,
+         ((dst >>  0) & 0xff) / 255.0f,
+         ((dst >> 24) & 0xff) / 255.0f,
+      };
+      const float inv_a = 1.0f - rgba[3];
+      for (unsigned c = 0; c < 4; c++)
+         rgba[c] = rgba[c] + d[c] * inv_a;
+   }
+
+   for (unsigned c = 0; c < 4; c++)
+      res[c] = float_to_ubyte(rgba[c]);
+
+   return (res[3] << 24) | (res[0] << 16) | (res[1] << 8) | res[2];
+}
+
+
+static unsigned
+tolerance(const struct linear_test_case *test)
+{
+   /* The fastpaths interpolate in fixed point, use 8 bit filter weights,
+    * quantize the modulation factors to unorm8 and approximate the
+    * division in the blend by a shift.
+    */
+   unsigned tol = 1;
+   if (test->filter == PIPE_TEX_FILTER_LINEAR)
+      tol += 3;
+   if (test->premul)
+      tol += 2;
+   if (test->kind == LP_FS_KIND_BLIT_RGBA_MODULATE)
+      tol += 1;
+   return tol;
+}
+
+
+/* Random premultiplied texels, as the blend mode expects.
+ */
+static void
+random_texels(uint32_t *tex, unsigned n)
+{
+   for (unsigned i = 0; i < n; i++) {
+      const unsigned a = rand() & 0xff;
+      const unsigned r = (rand() & 0xff) * a / 255;
+      const unsigned g = (rand() & 0xff) * a / 255;
+      const unsigned b = (rand() & 0xff) * a / 255;
+      tex[i] = (a << 24) | (r << 16) | (g << 8) | b;
+   }
+}
+
+
+static void
+random_pixels(uint32_t *dst, unsigned n)
+{
+   for (unsigned i = 0; i < n; i++)
+      dst[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+
+static boolean
+pixels_match(uint32_t a, uint32_t b, unsigned tol)
+{
+   for (unsigned c = 0; c < 4; c++) {
+      const int a_c = (a >> (8 * c)) & 0xff;
+      const int b_c = (b >> (8 * c)) & 0xff;
+      if (abs(a_c - b_c) > tol)
+         return FALSE;
+   }
+   return TRUE;
+}
+
+
+static boolean
+tile_contains(int x, int y)
+{
+   return x >= TILE_X && x < TILE_X + TILE_W &&
+          y >= TILE_Y && y < TILE_Y + TILE_H;
+}
+
+
+/**
+ * Run the fastpath directly and compare it against the float model.
+ */
+static boolean
+test_model(unsigned verbose, FILE *fp,
+           const struct linear_test_case *test)
+{
+   struct lp_fragment_shader *shader;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_sampler_static_state *samp;
+   struct lp_tgsi_texture_info *tex_info;
+   struct lp_rast_state *state;
+   uint32_t *tex, *dst, *orig;
+   float a0[2][4], dadx[2][4], dady[2][4];
+   boolean success = TRUE;
+
+   if (verbose >= 1)
+      dump_test("model", test);
+
+   shader = CALLOC_STRUCT(lp_fragment_shader);
+   variant = CALLOC(1, sizeof *variant + lp_fs_variant_key_size(1, 0) -
+                    sizeof variant->key);
+   state = CALLOC_STRUCT(lp_rast_state);
+   tex = align_malloc(TEX_SIZE * TEX_SIZE * 4, 16);
+   dst = align_malloc(DST_WIDTH * DST_HEIGHT * 4, 16);
+   orig = MALLOC(DST_WIDTH * DST_HEIGHT * 4);
+
+   /*
+    * Fake shader: a single 2D lookup with the coordinates coming straight
+    * from the first input.
+    */
+   shader->kind = test->kind;
+   memcpy(shader->modulate_const, modulate_idx, sizeof modulate_idx);
+   shader->info.num_texs = 1;
+   tex_info = &shader->info.tex[0];
+   tex_info->target = TGSI_TEXTURE_2D;
+   tex_info->modifier = LP_BLD_TEX_MODIFIER_NONE;
+   tex_info->sampler_unit = 0;
+   tex_info->texture_unit = 0;
+   for (unsigned c = 0; c < 2; c++) {
+      tex_info->coord[c].file = TGSI_FILE_INPUT;
+      tex_info->coord[c].u.index = 0;
+      tex_info->coord[c].swizzle = c;
+   }
+
+   /*
+    * Fake variant.
+    */
+   variant->shader = shader;
+   variant->key.nr_samplers = 1;
+   variant->key.nr_cbufs = 1;
+   variant->key.cbuf_format[0] = PIPE_FORMAT_B8G8R8A8_UNORM;
+   variant->key.blend.rt[0].colormask = PIPE_MASK_RGBA;
+   if (test->premul) {
+      variant->key.blend.rt[0].blend_enable = 1;
+      variant->key.blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+      variant->key.blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+      variant->key.blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+      variant->key.blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+      variant->key.blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+      variant->key.blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+   } else {
+      variant->opaque = 1;
+   }
+
+   samp = lp_fs_variant_key_sampler_idx(&variant->key, 0);
+   samp->texture_state.format = test->tex_format;
+   samp->texture_state.target = PIPE_TEXTURE_2D;
+   samp->texture_state.swizzle_r = PIPE_SWIZZLE_X;
+   samp->texture_state.swizzle_g = PIPE_SWIZZLE_Y;
+   samp->texture_state.swizzle_b = PIPE_SWIZZLE_Z;
+   samp->texture_state.swizzle_a = PIPE_SWIZZLE_W;
+   samp->texture_state.level_zero_only = 1;
+   samp->sampler_state.wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+   samp->sampler_state.wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+   samp->sampler_state.min_img_filter = test->filter;
+   samp->sampler_state.mag_img_filter = test->filter;
+   samp->sampler_state.min_mip_filter = PIPE_TEX_MIPFILTER_NONE;
+   samp->sampler_state.normalized_coords = 1;
+
+   llvmpipe_fs_variant_linear_fastpath(variant);
+   if (!variant->jit_linear) {
+      if (verbose >= 1 || !fp)
+         printf("  no fastpath\n");
+      success = FALSE;
+      goto out;
+   }
+
+   random_texels(tex, TEX_SIZE * TEX_SIZE);
+   random_pixels(orig, DST_WIDTH * DST_HEIGHT);
+   memcpy(dst, orig, DST_WIDTH * DST_HEIGHT * 4);
+
+   state->variant = variant;
+   state->jit_context.textures[0].width = TEX_SIZE;
+   state->jit_context.textures[0].height = TEX_SIZE;
+   state->jit_context.textures[0].depth = 1;
+   state->jit_context.textures[0].base = tex;
+   state->jit_context.textures[0].row_stride[0] = TEX_SIZE * 4;
+   state->jit_context.constants[0].f = modulate_consts;
+   state->jit_context.constants[0].num_elements = ARRAY_SIZE(modulate_consts);
+
+   /* position, w == 1 */
+   memset(a0, 0, sizeof a0);
+   memset(dadx, 0, sizeof dadx);
+   memset(dady, 0, sizeof dady);
+   a0[0][3] = 1.0f;
+
+   /* input 0 -- normalized texcoords */
+   a0[1][0] = texel_offset / TEX_SIZE;
+   a0[1][1] = texel_offset / TEX_SIZE;
+   dadx[1][0] = test->scale / TEX_SIZE;
+   dady[1][1] = test->scale / TEX_SIZE;
+
+   if (!variant->jit_linear(state,
+                            TILE_X, TILE_Y, TILE_W, TILE_H,
+                            (const float (*)[4])a0,
+                            (const float (*)[4])dadx,
+                            (const float (*)[4])dady,
+                            (uint8_t *)dst,
+                            DST_WIDTH * 4)) {
+      if (verbose >= 1 || !fp)
+         printf("  fastpath rejected the tile\n");
+      success = FALSE;
+      goto out;
+   }
+
+   /*
+    * Compare.  Pixels outside of the tile must be untouched.
+    */
+   const unsigned tol = tolerance(test);
+   unsigned nr_errors = 0;
+   for (int y = 0; y < DST_HEIGHT; y++) {
+      for (int x = 0; x < DST_WIDTH; x++) {
+         const uint32_t res = dst[y * DST_WIDTH + x];
+         const boolean inside = tile_contains(x, y);
+         const uint32_t ref = inside ?
+            reference_pixel(test, tex, orig[y * DST_WIDTH + x], x, y) :
+            orig[y * DST_WIDTH + x];
+
+         if (!pixels_match(res, ref, inside ? tol : 0)) {
+            if (nr_errors++ < 8 && (verbose >= 1 || !fp)) {
+               if (nr_errors == 1 && verbose < 1)
+                  dump_test("model", test);
+               printf("  (%d, %d): got 0x%08x, expected 0x%08x\n",
+                      x, y, res, ref);
+            }
+            success = FALSE;
+         }
+      }
+   }
+
+out:
+   if (fp)
+      write_tsv_row(fp, "model", test, success);
+
+   FREE(orig);
+   align_free(dst);
+   align_free(tex);
+   FREE(state);
+   FREE(variant);
+   FREE(shader);
+
+   return success;
+}
+
+
+/**
+ * Build one of the match_shader fragment shaders and create the CSO.
+ */
+static void *
+create_match_fs(struct pipe_context *pipe, enum match_shader which)
+{
+   struct pipe_screen *screen = pipe->screen;
+   const nir_shader_compiler_options *options =
+      screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                   PIPE_SHADER_FRAGMENT);
+   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT,
+                                                  options, "linear test");
+
+   nir_variable *coord_var = nir_variable_create(b.shader, nir_var_shader_in,
+                                                 glsl_vec4_type(), "coord");
+   coord_var->data.location = VARYING_SLOT_VAR0;
+   coord_var->data.driver_location = b.shader->num_inputs++;
+
+   nir_variable *out_var = nir_variable_create(b.shader, nir_var_shader_out,
+                                               glsl_vec4_type(), "color");
+   out_var->data.location = FRAG_RESULT_DATA0;
+   out_var->data.driver_location = b.shader->num_outputs++;
+
+   nir_ssa_def *in = nir_load_var(&b, coord_var);
+   nir_ssa_def *coord = which == MATCH_TEX_YX ?
+      nir_vec2(&b, nir_channel(&b, in, 1), nir_channel(&b, in, 0)) :
+      nir_vec2(&b, nir_channel(&b, in, 0), nir_channel(&b, in, 1));
+
+   nir_tex_instr *tex = nir_tex_instr_create(b.shader, 1);
+   tex->op = nir_texop_tex;
+   tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+   tex->dest_type = nir_type_float32;
+   tex->coord_components = 2;
+   tex->texture_index = 0;
+   tex->sampler_index = 0;
+   tex->src[0].src_type = nir_tex_src_coord;
+   tex->src[0].src = nir_src_for_ssa(coord);
+   nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+   nir_builder_instr_insert(&b, &tex->instr);
+   nir_ssa_def *t = &tex->dest.ssa;
+
+   /* modulate_consts[modulate_idx[0]] onwards */
+   nir_ssa_def *ubo = NULL;
+   if (which == MATCH_TEX_UBO || which == MATCH_UBO_TEX) {
+      ubo = nir_load_ubo(&b, 4, 32, nir_imm_int(&b, 0),
+                         nir_imm_int(&b, modulate_idx[0] * 4),
+                         .align_mul = 16, .range = ~0);
+   }
+
+   nir_ssa_def *color;
+   switch (which) {
+   case MATCH_TEX:
+   case MATCH_TEX_YX:
+   default:
+      color = t;
+      break;
+   case MATCH_TEX_RGB1:
+   case MATCH_TEX_RGB_HALF:
+      color = nir_vec4(&b, nir_channel(&b, t, 0), nir_channel(&b, t, 1),
+                       nir_channel(&b, t, 2),
+                       nir_imm_float(&b, which == MATCH_TEX_RGB1 ?
+                                     1.0f : 0.5f));
+      break;
+   case MATCH_TEX_UBO:
+      color = nir_fmul(&b, t, ubo);
+      break;
+   case MATCH_UBO_TEX:
+      color = nir_fmul(&b, ubo, t);
+      break;
+   case MATCH_TEX_COLOR: {
+      nir_variable *color_var =
+         nir_variable_create(b.shader, nir_var_shader_in,
+                             glsl_vec4_type(), "color");
+      color_var->data.location = VARYING_SLOT_VAR1;
+      color_var->data.driver_location = b.shader->num_inputs++;
+      color = nir_fmul(&b, t, nir_load_var(&b, color_var));
+      break;
+   }
+   }
+
+   nir_store_var(&b, out_var, color, 0xf);
+
+   /* What the state tracker does before handing the shader over */
+   NIR_PASS_V(b.shader, nir_copy_prop);
+   NIR_PASS_V(b.shader, nir_opt_dce);
+   nir_shader_gather_info(b.shader, nir_shader_get_entrypoint(b.shader));
+   BITSET_SET(b.shader->info.textures_used, 0);
+   BITSET_SET(b.shader->info.samplers_used, 0);
+   screen->finalize_nir(screen, b.shader);
+
+   struct pipe_shader_state state;
+   memset(&state, 0, sizeof state);
+   state.type = PIPE_SHADER_IR_NIR;
+   state.ir.nir = b.shader;
+
+   return pipe->create_fs_state(pipe, &state);
+}
+
+
+static void
+destroy_test_context(struct linear_test_context *ctx)
+{
+   struct pipe_context *pipe = ctx->pipe;
+
+   if (pipe) {
+      pipe->bind_fs_state(pipe, NULL);
+      for (unsigned k = 0; k < ARRAY_SIZE(ctx->fs); k++) {
+         if (ctx->fs[k])
+            pipe->delete_fs_state(pipe, ctx->fs[k]);
+      }
+      pipe->bind_vs_state(pipe, NULL);
+      if (ctx->vs)
+         pipe->delete_vs_state(pipe, ctx->vs);
+      pipe->bind_vertex_elements_state(pipe, NULL);
+      if (ctx->velems)
+         pipe->delete_vertex_elements_state(pipe, ctx->velems);
+      pipe->bind_rasterizer_state(pipe, NULL);
+      if (ctx->rast)
+         pipe->delete_rasterizer_state(pipe, ctx->rast);
+      pipe->bind_depth_stencil_alpha_state(pipe, NULL);
+      if (ctx->dsa)
+         pipe->delete_depth_stencil_alpha_state(pipe, ctx->dsa);
+      pipe->destroy(pipe);
+   }
+
+   if (ctx->screen)
+      ctx->screen->destroy(ctx->screen);
+
+   memset(ctx, 0, sizeof *ctx);
+}
+
+
+/**
+ * Create a context with the state all render tests share: a passthrough
+ * vertex shader and one fragment shader for each of the kinds.
+ */
+static boolean
+create_test_context(struct linear_test_context *ctx)
+{
+   memset(ctx, 0, sizeof *ctx);
+
+   ctx->screen = llvmpipe_create_screen(null_sw_create());
+   if (!ctx->screen)
+      return FALSE;
+
+   ctx->pipe = ctx->screen->context_create(ctx->screen, NULL, 0);
+   if (!ctx->pipe) {
+      destroy_test_context(ctx);
+      return FALSE;
+   }
+
+   struct pipe_context *pipe = ctx->pipe;
+
+   const enum tgsi_semantic semantic_names[] = {
+      TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC
+   };
+   const uint semantic_indexes[] = { 0, 0 };
+   ctx->vs = util_make_vertex_passthrough_shader(pipe, 2, semantic_names,
+                                                 semantic_indexes, FALSE);
+
+   struct pipe_vertex_element ve[2];
+   memset(ve, 0, sizeof ve);
+   for (unsigned i = 0; i < 2; i++) {
+      ve[i].src_offset = i * 4 * sizeof(float);
+      ve[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   }
+   ctx->velems = pipe->create_vertex_elements_state(pipe, 2, ve);
+
+   struct pipe_rasterizer_state rast;
+   memset(&rast, 0, sizeof rast);
+   rast.half_pixel_center = 1;
+   rast.bottom_edge_rule = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   ctx->rast = pipe->create_rasterizer_state(pipe, &rast);
+
+   struct pipe_depth_stencil_alpha_state dsa;
+   memset(&dsa, 0, sizeof dsa);
+   ctx->dsa = pipe->create_depth_stencil_alpha_state(pipe, &dsa);
+
+   static const enum match_shader kind_shaders[ARRAY_SIZE(kinds)] = {
+      MATCH_TEX, MATCH_TEX_RGB1, MATCH_TEX_UBO,
+   };
+   for (unsigned k = 0; k < ARRAY_SIZE(kinds); k++)
+      ctx->fs[k] = create_match_fs(pipe, kind_shaders[k]);
+
+   if (!ctx->vs || !ctx->velems || !ctx->rast || !ctx->dsa) {
+      destroy_test_context(ctx);
+      return FALSE;
+   }
+
+   pipe->bind_vs_state(pipe, ctx->vs);
+   pipe->bind_vertex_elements_state(pipe, ctx->velems);
+   pipe->bind_rasterizer_state(pipe, ctx->rast);
+   pipe->bind_depth_stencil_alpha_state(pipe, ctx->dsa);
+
+   struct pipe_viewport_state vp;
+   memset(&vp, 0, sizeof vp);
+   vp.scale[0] = DST_WIDTH / 2.0f;
+   vp.scale[1] = DST_HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = DST_WIDTH / 2.0f;
+   vp.translate[1] = DST_HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   vp.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+   vp.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+   vp.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+   vp.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+   pipe->set_viewport_states(pipe, 0, 1, &vp);
+
+   return TRUE;
+}
+
+
+/**
+ * Bind the fragment shader and return the llvmpipe shader behind it.  The
+ * CSO itself may belong to one of the draw module's wrapping stages.
+ */
+static const struct lp_fragment_shader *
+bind_fs(struct pipe_context *pipe, void *fs)
+{
+   pipe->bind_fs_state(pipe, fs);
+   return llvmpipe_context(pipe)->fs;
+}
+
+
+/**
+ * Check that llvmpipe_nir_match_blit() recognizes exactly the shaders the
+ * blit fastpaths implement.
+ */
+static boolean
+test_match(unsigned verbose, FILE *fp,
+           struct linear_test_context *ctx,
+           const struct match_test_case *test)
+{
+   struct pipe_context *pipe = ctx->pipe;
+   boolean success = TRUE;
+
+   void *fs = create_match_fs(pipe, test->shader);
+   if (!fs) {
+      printf("match %s: failed to create the shader\n", test->name);
+      return FALSE;
+   }
+
+   const struct lp_fragment_shader *shader = bind_fs(pipe, fs);
+   if (shader->kind != test->kind) {
+      printf("match %s: got %s, expected %s\n", test->name,
+             lp_debug_fs_kind(shader->kind), lp_debug_fs_kind(test->kind));
+      success = FALSE;
+   } else if (test->kind == LP_FS_KIND_BLIT_RGBA_MODULATE &&
+              memcmp(shader->modulate_const, modulate_idx,
+                     sizeof modulate_idx) != 0) {
+      printf("match %s: modulating by the wrong constants\n", test->name);
+      success = FALSE;
+   } else if (verbose >= 1) {
+      printf("match %s: %s\n", test->name, lp_debug_fs_kind(shader->kind));
+   }
+
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->delete_fs_state(pipe, fs);
+
+   if (fp) {
+      fprintf(fp, "%s\tmatch %s\t%s\t-\t-\t-\t-\n",
+              success ? "pass" : "fail", test->name,
+              lp_debug_fs_kind(test->kind));
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static struct pipe_resource *
+create_texture(struct pipe_screen *screen, enum pipe_format format,
+               unsigned width, unsigned height, unsigned bind)
+{
+   struct pipe_resource templ;
+
+   memset(&templ, 0, sizeof templ);
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = format;
+   templ.width0 = width;
+   templ.height0 = height;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.bind = bind;
+
+   return screen->resource_create(screen, &templ);
+}
+
+
+static void
+write_pixels(struct pipe_context *pipe, struct pipe_resource *res,
+             const uint32_t *pixels)
+{
+   struct pipe_box box;
+
+   u_box_2d(0, 0, res->width0, res->height0, &box);
+   pipe->texture_subdata(pipe, res, 0, PIPE_MAP_WRITE, &box,
+                         pixels, res->width0 * 4, 0);
+}
+
+
+static boolean
+read_pixels(struct pipe_context *pipe, struct pipe_resource *res,
+            uint32_t *pixels)
+{
+   struct pipe_transfer *transfer;
+   const uint8_t *map = pipe_texture_map(pipe, res, 0, 0, PIPE_MAP_READ,
+                                         0, 0, res->width0, res->height0,
+                                         &transfer);
+   if (!map)
+      return FALSE;
+
+   for (unsigned y = 0; y < res->height0; y++)
+      memcpy(&pixels[y * res->width0], map + y * transfer->stride,
+             res->width0 * 4);
+
+   pipe_texture_unmap(pipe, transfer);
+   return TRUE;
+}
+
+
+/**
+ * Draw a screen aligned quad over the tile with the blit shader of the
+ * test's kind, once through the linear rasterizer, hence the fastpath,
+ * and once through the general path, and compare the two.
+ */
+static boolean
+test_render(unsigned verbose, FILE *fp,
+            struct linear_test_context *ctx,
+            const struct linear_test_case *test)
+{
+   struct pipe_context *pipe = ctx->pipe;
+   struct pipe_screen *screen = ctx->screen;
+   uint32_t *tex_pixels, *orig, *res[2];
+   boolean success = TRUE;
+   void *fs = NULL;
+
+   if (verbose >= 1)
+      dump_test("render", test);
+
+   for (unsigned k = 0; k < ARRAY_SIZE(kinds); k++) {
+      if (kinds[k] == test->kind)
+         fs = ctx->fs[k];
+   }
+
+   const struct lp_fragment_shader *shader = fs ? bind_fs(pipe, fs) : NULL;
+   if (!shader || shader->kind != test->kind) {
+      if (verbose >= 1 || !fp)
+         printf("  shader not matched as %s\n", lp_debug_fs_kind(test->kind));
+      if (fp)
+         write_tsv_row(fp, "render", test, FALSE);
+      pipe->bind_fs_state(pipe, NULL);
+      return FALSE;
+   }
+
+   tex_pixels = MALLOC(TEX_SIZE * TEX_SIZE * 4);
+   orig = MALLOC(DST_WIDTH * DST_HEIGHT * 4);
+   res[0] = MALLOC(DST_WIDTH * DST_HEIGHT * 4);
+   res[1] = MALLOC(DST_WIDTH * DST_HEIGHT * 4);
+
+   random_texels(tex_pixels, TEX_SIZE * TEX_SIZE);
+   random_pixels(orig, DST_WIDTH * DST_HEIGHT);
+
+   struct pipe_resource *tex =
+      create_texture(screen, test->tex_format, TEX_SIZE, TEX_SIZE,
+                     PIPE_BIND_SAMPLER_VIEW);
+   struct pipe_resource *dst =
+      create_texture(screen, PIPE_FORMAT_B8G8R8A8_UNORM,
+                     DST_WIDTH, DST_HEIGHT, PIPE_BIND_RENDER_TARGET);
+   write_pixels(pipe, tex, tex_pixels);
+
+   struct pipe_surface surf_templ;
+   memset(&surf_templ, 0, sizeof surf_templ);
+   surf_templ.format = dst->format;
+   struct pipe_surface *surf = pipe->create_surface(pipe, dst, &surf_templ);
+
+   struct pipe_framebuffer_state fb;
+   memset(&fb, 0, sizeof fb);
+   fb.width = DST_WIDTH;
+   fb.height = DST_HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = surf;
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   struct pipe_sampler_view view_templ;
+   u_sampler_view_default_template(&view_templ, tex, tex->format);
+   struct pipe_sampler_view *view =
+      pipe->create_sampler_view(pipe, tex, &view_templ);
+   pipe->set_sampler_views(pipe, PIPE_SHADER_FRAGMENT, 0, 1, 0, false,
+                           &view);
+
+   struct pipe_sampler_state samp;
+   memset(&samp, 0, sizeof samp);
+   samp.wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+   samp.wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+   samp.wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+   samp.min_img_filter = test->filter;
+   samp.mag_img_filter = test->filter;
+   samp.min_mip_filter = PIPE_TEX_MIPFILTER_NONE;
+   void *samp_cso = pipe->create_sampler_state(pipe, &samp);
+   pipe->bind_sampler_states(pipe, PIPE_SHADER_FRAGMENT, 0, 1, &samp_cso);
+
+   struct pipe_blend_state blend;
+   memset(&blend, 0, sizeof blend);
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   if (test->premul) {
+      blend.rt[0].blend_enable = 1;
+      blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+      blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+      blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+      blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+      blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+      blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+   }
+   void *blend_cso = pipe->create_blend_state(pipe, &blend);
+   pipe->bind_blend_state(pipe, blend_cso);
+
+   struct pipe_constant_buffer cb;
+   memset(&cb, 0, sizeof cb);
+   cb.user_buffer = modulate_consts;
+   cb.buffer_size = sizeof modulate_consts;
+   pipe->set_constant_buffer(pipe, PIPE_SHADER_FRAGMENT, 0, false, &cb);
+
+   /*
+    * The quad covering the tile as two triangles, with the texcoords
+    * placing the pixel centers where the model samples.
+    */
+   static const unsigned corners[6][2] = {
+      { 0, 0 }, { 1, 0 }, { 1, 1 },
+      { 0, 0 }, { 1, 1 }, { 0, 1 },
+   };
+   float verts[6][2][4];
+   for (unsigned i = 0; i < 6; i++) {
+      const float x = TILE_X + corners[i][0] * TILE_W;
+      const float y = TILE_Y + corners[i][1] * TILE_H;
+
+      verts[i][0][0] = x * (2.0f / DST_WIDTH) - 1.0f;
+      verts[i][0][1] = y * (2.0f / DST_HEIGHT) - 1.0f;
+      verts[i][0][2] = 0.0f;
+      verts[i][0][3] = 1.0f;
+      verts[i][1][0] = (texel_offset + test->scale * (x - 0.5f)) / TEX_SIZE;
+      verts[i][1][1] = (texel_offset + test->scale * (y - 0.5f)) / TEX_SIZE;
+      verts[i][1][2] = 0.0f;
+      verts[i][1][3] = 1.0f;
+   }
+
+   struct pipe_vertex_buffer vb;
+   memset(&vb, 0, sizeof vb);
+   vb.stride = sizeof verts[0];
+   vb.is_user_buffer = TRUE;
+   vb.buffer.user = verts;
+   pipe->set_vertex_buffers(pipe, 0, 1, 0, FALSE, &vb);
+
+   struct pipe_draw_info info;
+   memset(&info, 0, sizeof info);
+   info.mode = PIPE_PRIM_TRIANGLES;
+   info.instance_count = 1;
+   info.max_index = ~0;
+
+   struct pipe_draw_start_count_bias sc;
+   memset(&sc, 0, sizeof sc);
+   sc.count = 6;
+
+   const int perf = LP_PERF;
+   for (unsigned i = 0; i < 2 && success; i++) {
+      write_pixels(pipe, dst, orig);
+
+      if (i == 1)
+         LP_PERF |= PERF_NO_RAST_LINEAR;
+
+      pipe->draw_vbo(pipe, &info, 0, NULL, &sc, 1);
+      pipe->flush(pipe, NULL, 0);
+
+      if (!read_pixels(pipe, dst, res[i])) {
+         printf("  failed to map the framebuffer\n");
+         success = FALSE;
+      }
+
+      LP_PERF = perf;
+
+      if (i == 0) {
+         struct lp_fs_variant_list_item *li =
+            list_first_entry(&llvmpipe_context(pipe)->fs_variants_list.list,
+                             struct lp_fs_variant_list_item, list);
+         if (!li->base->jit_linear) {
+            if (verbose >= 1 || !fp)
+               printf("  no fastpath\n");
+            success = FALSE;
+         }
+      }
+   }
+
+   /*
+    * Compare.  Pixels outside of the tile must be untouched by both.
+    */
+   const unsigned tol = tolerance(test);
+   unsigned nr_errors = 0;
+   for (int y = 0; y < DST_HEIGHT && success; y++) {
+      for (int x = 0; x < DST_WIDTH; x++) {
+         const unsigned i = y * DST_WIDTH + x;
+
+         if (tile_contains(x, y) ? !pixels_match(res[0][i], res[1][i], tol) :
+             res[0][i] != orig[i] || res[1][i] != orig[i]) {
+            if (nr_errors++ < 8 && (verbose >= 1 || !fp)) {
+               if (nr_errors == 1 && verbose < 1)
+                  dump_test("render", test);
+               printf("  (%d, %d): fastpath 0x%08x, general 0x%08x\n",
+                      x, y, res[0][i], res[1][i]);
+            }
+         }
+      }
+   }
+   if (nr_errors)
+      success = FALSE;
+
+   if (fp)
+      write_tsv_row(fp, "render", test, success);
+
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->bind_blend_state(pipe, NULL);
+   pipe->delete_blend_state(pipe, blend_cso);
+   void *null_samp = NULL;
+   pipe->bind_sampler_states(pipe, PIPE_SHADER_FRAGMENT, 0, 1, &null_samp);
+   pipe->delete_sampler_state(pipe, samp_cso);
+   pipe->set_sampler_views(pipe, PIPE_SHADER_FRAGMENT, 0, 0, 1, false, NULL);
+   pipe->set_constant_buffer(pipe, PIPE_SHADER_FRAGMENT, 0, false, NULL);
+   pipe->set_vertex_buffers(pipe, 0, 0, 1, FALSE, NULL);
+   pipe_sampler_view_reference(&view, NULL);
+
+   memset(&fb, 0, sizeof fb);
+   pipe->set_framebuffer_state(pipe, &fb);
+   pipe_surface_reference(&surf, NULL);
+   pipe_resource_reference(&dst, NULL);
+   pipe_resource_reference(&tex, NULL);
+
+   FREE(res[1]);
+   FREE(res[0]);
+   FREE(orig);
+   FREE(tex_pixels);
+
+   return success;
+}
+
+
+static boolean
+have_fastpaths(void)
+{
+#if defined(PIPE_ARCH_SSE)
+   return util_get_cpu_caps()->has_sse2;
+#else
+   return FALSE;
+#endif
+}
+
+
+static boolean
+test_matches(unsigned verbose, FILE *fp,
+             struct linear_test_context *ctx)
+{
+   boolean success = TRUE;
+
+   for (unsigned m = 0; m < ARRAY_SIZE(match_tests); m++) {
+      if (!test_match(verbose, fp, ctx, &match_tests[m]))
+         success = FALSE;
+   }
+
+   return success;
+}
+
+
+static boolean
+is_render_scale(float scale)
+{
+   for (unsigned s = 0; s < ARRAY_SIZE(render_scales); s++) {
+      if (render_scales[s] == scale)
+         return TRUE;
+   }
+   return FALSE;
+}
+
+
+/**
+ * Test the case against the float model and, at the scales it can be told
+ * apart from the blit path, against the general path.
+ */
+static boolean
+test_one(unsigned verbose, FILE *fp,
+         struct linear_test_context *ctx,
+         const struct linear_test_case *test)
+{
+   boolean success = test_model(verbose, fp, test);
+
+   if (is_render_scale(test->scale) && !test_render(verbose, fp, ctx, test))
+      success = FALSE;
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   struct linear_test_context ctx;
+   boolean success = TRUE;
+
+   if (!create_test_context(&ctx)) {
+      printf("failed to create a context\n");
+      return FALSE;
+   }
+
+   if (!test_matches(verbose, fp, &ctx))
+      success = FALSE;
+
+   if (!have_fastpaths()) {
+      printf("no linear fastpaths on this platform, skipping\n");
+      goto out;
+   }
+
+   for (unsigned k = 0; k < ARRAY_SIZE(kinds); k++) {
+      for (unsigned f = 0; f < ARRAY_SIZE(tex_formats); f++) {
+         for (unsigned i = 0; i < ARRAY_SIZE(filters); i++) {
+            for (unsigned b = 0; b < 2; b++) {
+               for (unsigned s = 0; s < ARRAY_SIZE(scales); s++) {
+                  struct linear_test_case test = {
+                     .kind = kinds[k],
+                     .tex_format = tex_formats[f],
+                     .filter = filters[i],
+                     .premul = b,
+                     .scale = scales[s],
+                  };
+
+                  if (!test_one(verbose, fp, &ctx, &test))
+                     success = FALSE;
+               }
+            }
+         }
+      }
+   }
+
+out:
+   destroy_test_context(&ctx);
+   return success;
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   struct linear_test_context ctx;
+   boolean success = TRUE;
+
+   if (!create_test_context(&ctx)) {
+      printf("failed to create a context\n");
+      return FALSE;
+   }
+
+   if (!test_matches(verbose, fp, &ctx))
+      success = FALSE;
+
+   if (!have_fastpaths()) {
+      printf("no linear fastpaths on this platform, skipping\n");
+      goto out;
+   }
+
+   for (unsigned long i = 0; i < n; i++) {
+      struct linear_test_case test = {
+         .kind = kinds[rand() % ARRAY_SIZE(kinds)],
+         .tex_format = tex_formats[rand() % ARRAY_SIZE(tex_formats)],
+         .filter = filters[rand() % ARRAY_SIZE(filters)],
+         .premul = rand() & 1,
+         .scale = scales[rand() % ARRAY_SIZE(scales)],
+      };
+
+      if (!test_one(verbose, fp, &ctx, &test))
+         success = FALSE;
+   }
+
+out:
+   destroy_test_context(&ctx);
+   return success;
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   struct linear_test_context ctx;
+   struct linear_test_case test = {
+      .kind = LP_FS_KIND_BLIT_RGBA_MODULATE,
+      .tex_format = PIPE_FORMAT_B8G8R8A8_UNORM,
+      .filter = PIPE_TEX_FILTER_LINEAR,
+      .premul = TRUE,
+      .scale = 1.5f,
+   };
+   boolean success;
+
+   if (!have_fastpaths()) {
+      printf("no linear fastpaths on this platform, skipping\n");
+      return TRUE;
+   }
+
+   if (!create_test_context(&ctx)) {
+      printf("failed to create a context\n");
+      return FALSE;
+   }
+
+   success = test_one(verbose, fp, &ctx, &test);
+
+   destroy_test_context(&ctx);
+   return success;
+}
@@ -2697,8 +2697,10 @@ current_not_ready:
    /* This must be done before the mutex is locked, because async GS
     * compilation calls this function too, and therefore must enter
     * the mutex first.
+    *
+    * Draws are blocked on this, so move the job ahead of the others.
     */
-   util_queue_fence_wait(&sel->ready);
+   util_queue_wait_job(&sscreen->shader_compiler_queue, &sel->ready);
 
    simple_mtx_lock(&sel->mutex);
 
@@ -28,10 +28,15 @@
 #include "vk_common_entrypoints.h"
 
 static void
-lvp_cmd_buffer_destroy(struct vk_command_buffer *cmd_buffer)
+lvp_cmd_buffer_destroy(struct vk_command_buffer *vk_cmd_buffer)
 {
-   vk_command_buffer_finish(cmd_buffer);
-   vk_free(&cmd_buffer->pool->alloc, cmd_buffer);
+   struct lvp_cmd_buffer *cmd_buffer =
+      container_of(vk_cmd_buffer, struct lvp_cmd_buffer, vk);
+
+   lvp_cmd_compiled_unref(cmd_buffer->compiled);
+   simple_mtx_destroy(&cmd_buffer->compile_lock);
+   vk_command_buffer_finish(vk_cmd_buffer);
+   vk_free(&vk_cmd_buffer->pool->alloc, cmd_buffer);
 }
 
 static VkResult
@@ -55,6 +60,10 @@ lvp_create_cmd_buffer(struct vk_command_pool *pool,
    }
 
    cmd_buffer->device = device;
+   cmd_buffer->compile = false;
+   cmd_buffer->compile_failed = false;
+   cmd_buffer->compiled = NULL;
+   simple_mtx_init(&cmd_buffer->compile_lock, mtx_plain);
 
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_INITIAL;
    *cmd_buffer_out = &cmd_buffer->vk;
@@ -71,6 +80,9 @@ lvp_reset_cmd_buffer(struct vk_command_buffer *vk_cmd_buffer,
 
    vk_command_buffer_reset(&cmd_buffer->vk);
 
+   lvp_cmd_compiled_unref(cmd_buffer->compiled);
+   cmd_buffer->compiled = NULL;
+   cmd_buffer->compile_failed = false;
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_INITIAL;
 }
 
@@ -88,6 +100,9 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
    if (cmd_buffer->status != LVP_CMD_BUFFER_STATUS_INITIAL)
       lvp_reset_cmd_buffer(&cmd_buffer->vk, 0);
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_RECORDING;
+   cmd_buffer->compile = cmd_buffer->device->compile_cmd_buffers &&
+      cmd_buffer->vk.level == VK_COMMAND_BUFFER_LEVEL_PRIMARY &&
+      !(pBeginInfo->flags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
    return VK_SUCCESS;
 }
 
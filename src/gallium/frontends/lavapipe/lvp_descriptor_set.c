@@ -25,6 +25,7 @@
 #include "vk_descriptors.h"
 #include "vk_util.h"
 #include "u_math.h"
+#include "util/u_atomic.h"
 
 VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDescriptorSetLayout(
     VkDevice                                    _device,
@@ -304,6 +305,17 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineLayout(
    return VK_SUCCESS;
 }
 
+/* Compiled command buffers that read the set are replayed only as long as
+ * its generation doesn't change, see lvp_execute.c.
+ */
+static void
+lvp_descriptor_set_changed(struct lvp_device *device,
+                           struct lvp_descriptor_set *set)
+{
+   p_atomic_set(&set->generation,
+                p_atomic_inc_return(&device->descriptor_generation));
+}
+
 VkResult
 lvp_descriptor_set_create(struct lvp_device *device,
                           struct lvp_descriptor_set_layout *layout,
@@ -346,6 +358,7 @@ lvp_descriptor_set_create(struct lvp_device *device,
       }
    }
 
+   lvp_descriptor_set_changed(device, set);
    *out_set = set;
 
    return VK_SUCCESS;
@@ -415,9 +428,12 @@ VKAPI_ATTR void VKAPI_CALL lvp_UpdateDescriptorSets(
     uint32_t                                    descriptorCopyCount,
     const VkCopyDescriptorSet*                  pDescriptorCopies)
 {
+   LVP_FROM_HANDLE(lvp_device, device, _device);
+
    for (uint32_t i = 0; i < descriptorWriteCount; i++) {
       const VkWriteDescriptorSet *write = &pDescriptorWrites[i];
       LVP_FROM_HANDLE(lvp_descriptor_set, set, write->dstSet);
+      lvp_descriptor_set_changed(device, set);
       const struct lvp_descriptor_set_binding_layout *bind_layout =
          &set->layout->binding[write->dstBinding];
       struct lvp_descriptor *desc =
@@ -554,6 +570,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_UpdateDescriptorSets(
       const VkCopyDescriptorSet *copy = &pDescriptorCopies[i];
       LVP_FROM_HANDLE(lvp_descriptor_set, src, copy->srcSet);
       LVP_FROM_HANDLE(lvp_descriptor_set, dst, copy->dstSet);
+      lvp_descriptor_set_changed(device, dst);
 
       const struct lvp_descriptor_set_binding_layout *src_layout =
          &src->layout->binding[copy->srcBinding];
@@ -711,10 +728,13 @@ VKAPI_ATTR void VKAPI_CALL lvp_UpdateDescriptorSetWithTemplate(VkDevice _device,
                                          VkDescriptorUpdateTemplate descriptorUpdateTemplate,
                                          const void *pData)
 {
+   LVP_FROM_HANDLE(lvp_device, device, _device);
    LVP_FROM_HANDLE(lvp_descriptor_set, set, descriptorSet);
    LVP_FROM_HANDLE(lvp_descriptor_update_template, templ, descriptorUpdateTemplate);
    uint32_t i, j;
 
+   lvp_descriptor_set_changed(device, set);
+
    for (i = 0; i < templ->entry_count; ++i) {
       VkDescriptorUpdateTemplateEntry *entry = &templ->entry[i];
       const uint8_t *pSrc = ((const uint8_t *) pData) + entry->offset;
@@ -388,6 +388,8 @@ lvp_physical_device_init(struct lvp_physical_device *device,
       goto fail;
    }
 
+   lvp_physical_device_init_code_cache(device);
+
    return VK_SUCCESS;
  fail:
    return result;
@@ -397,6 +399,7 @@ static void VKAPI_CALL
 lvp_physical_device_finish(struct lvp_physical_device *device)
 {
    lvp_finish_wsi(device);
+   lvp_physical_device_finish_code_cache(device);
    device->pscreen->destroy(device->pscreen);
    vk_physical_device_finish(&device->vk);
 }
@@ -1393,7 +1396,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceQueueFamilyProperties2(
          .queueFlags = VK_QUEUE_GRAPHICS_BIT |
          VK_QUEUE_COMPUTE_BIT |
          VK_QUEUE_TRANSFER_BIT,
-         .queueCount = 1,
+         .queueCount = LVP_MAX_QUEUES,
          .timestampValidBits = 64,
          .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
       };
@@ -1496,7 +1499,12 @@ destroy_pipelines(struct lvp_queue *queue)
 {
    simple_mtx_lock(&queue->pipeline_lock);
    while (util_dynarray_contains(&queue->pipeline_destroys, struct lvp_pipeline*)) {
-      lvp_pipeline_destroy(queue->device, util_dynarray_pop(&queue->pipeline_destroys, struct lvp_pipeline*));
+      struct lvp_pipeline *pipeline =
+         util_dynarray_pop(&queue->pipeline_destroys, struct lvp_pipeline*);
+
+      lvp_pipeline_destroy_queue_state(queue, pipeline);
+      if (p_atomic_dec_zero(&pipeline->destroy_refs))
+         lvp_pipeline_destroy(queue->device, pipeline);
    }
    simple_mtx_unlock(&queue->pipeline_lock);
 }
@@ -1513,6 +1521,7 @@ lvp_queue_submit(struct vk_queue *vk_queue,
    if (result != VK_SUCCESS)
       return result;
 
+   simple_mtx_lock(&queue->ctx_lock);
    for (uint32_t i = 0; i < submit->command_buffer_count; i++) {
       struct lvp_cmd_buffer *cmd_buffer =
          container_of(submit->command_buffers[i], struct lvp_cmd_buffer, vk);
@@ -1529,6 +1538,7 @@ lvp_queue_submit(struct vk_queue *vk_queue,
       lvp_pipe_sync_signal_with_fence(queue->device, sync, queue->last_fence);
    }
    destroy_pipelines(queue);
+   simple_mtx_unlock(&queue->ctx_lock);
 
    return VK_SUCCESS;
 }
@@ -1536,7 +1546,7 @@ lvp_queue_submit(struct vk_queue *vk_queue,
 static VkResult
 lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
                const VkDeviceQueueCreateInfo *create_info,
-               uint32_t index_in_family)
+               uint32_t index_in_family, void *state)
 {
    VkResult result = vk_queue_init(&queue->vk, &device->vk, create_info,
                                    index_in_family);
@@ -1550,6 +1560,8 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
    }
 
    queue->device = device;
+   queue->index = index_in_family;
+   queue->state = state;
 
    queue->ctx = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
    queue->cso = cso_create_context(queue->ctx, CSO_NO_VBUF);
@@ -1559,6 +1571,7 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
 
    simple_mtx_init(&queue->pipeline_lock, mtx_plain);
    util_dynarray_init(&queue->pipeline_destroys, NULL);
+   simple_mtx_init(&queue->ctx_lock, mtx_plain);
 
    return VK_SUCCESS;
 }
@@ -1569,8 +1582,11 @@ lvp_queue_finish(struct lvp_queue *queue)
    vk_queue_finish(&queue->vk);
 
    destroy_pipelines(queue);
+   if (queue->last_fence)
+      queue->device->pscreen->fence_reference(queue->device->pscreen, &queue->last_fence, NULL);
    simple_mtx_destroy(&queue->pipeline_lock);
    util_dynarray_fini(&queue->pipeline_destroys);
+   simple_mtx_destroy(&queue->ctx_lock);
 
    u_upload_destroy(queue->uploader);
    cso_destroy_context(queue->cso);
@@ -1589,15 +1605,21 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    assert(pCreateInfo->sType == VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO);
 
+   assert(pCreateInfo->queueCreateInfoCount == 1);
+   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
+   assert(pCreateInfo->pQueueCreateInfos[0].queueCount <= LVP_MAX_QUEUES);
+   unsigned queue_count = pCreateInfo->pQueueCreateInfos[0].queueCount;
+
+   /* one rendering state per queue */
    size_t state_size = lvp_get_rendering_state_size();
    device = vk_zalloc2(&physical_device->vk.instance->alloc, pAllocator,
-                       sizeof(*device) + state_size, 8,
+                       sizeof(*device) + state_size * queue_count, 8,
                        VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
    if (!device)
       return vk_error(instance, VK_ERROR_OUT_OF_HOST_MEMORY);
 
-   device->queue.state = device + 1;
    device->poison_mem = debug_get_bool_option("LVP_POISON_MEMORY", false);
+   device->compile_cmd_buffers = !debug_get_bool_option("LVP_NO_CMD_COMPILE", false);
 
    struct vk_device_dispatch_table dispatch_table;
    vk_device_dispatch_table_from_entrypoints(&dispatch_table,
@@ -1622,13 +1644,17 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    device->pscreen = physical_device->pscreen;
 
-   assert(pCreateInfo->queueCreateInfoCount == 1);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueCount == 1);
-   result = lvp_queue_init(device, &device->queue, pCreateInfo->pQueueCreateInfos, 0);
-   if (result != VK_SUCCESS) {
-      vk_free(&device->vk.alloc, device);
-      return result;
+   for (unsigned i = 0; i < queue_count; i++) {
+      result = lvp_queue_init(device, &device->queues[i], pCreateInfo->pQueueCreateInfos, i,
+                              (uint8_t *)(device + 1) + state_size * i);
+      if (result != VK_SUCCESS) {
+         for (unsigned j = 0; j < i; j++)
+            lvp_queue_finish(&device->queues[j]);
+         vk_device_finish(&device->vk);
+         vk_free(&device->vk.alloc, device);
+         return result;
+      }
+      device->queue_count++;
    }
 
    *pDevice = lvp_device_to_handle(device);
@@ -1643,9 +1669,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
 
-   if (device->queue.last_fence)
-      device->pscreen->fence_reference(device->pscreen, &device->queue.last_fence, NULL);
-   lvp_queue_finish(&device->queue);
+   for (unsigned i = 0; i < device->queue_count; i++)
+      lvp_queue_finish(&device->queues[i]);
    vk_device_finish(&device->vk);
    vk_free(&device->vk.alloc, device);
 }
@@ -44,6 +44,8 @@
 #include "util/u_prim_restart.h"
 #include "util/format/u_format_zs.h"
 #include "util/ptralloc.h"
+#include "util/set.h"
+#include "util/u_atomic.h"
 #include "tgsi/tgsi_from_mesa.h"
 
 #include "vk_cmd_enqueue_entrypoints.h"
@@ -72,6 +74,11 @@ struct rendering_state {
    struct pipe_context *pctx;
    struct u_upload_mgr *uploader;
    struct cso_context *cso;
+   struct lvp_queue *queue;
+   unsigned queue_index;
+
+   /* set while compiling the command buffer, see lvp_execute_cmds() */
+   struct lvp_cmd_recorder *rec;
 
    bool blend_dirty;
    bool rs_dirty;
@@ -223,6 +230,232 @@ static void finish_fence(struct rendering_state *state)
                                         &handle, NULL);
 }
 
+/* Command buffers that may be submitted more than once are compiled on
+ * their first execution into the list of gallium calls that execution
+ * made, minus the state changes that set what was already set.  Later
+ * submissions replay the list without going through the command handlers,
+ * see lvp_execute_cmds().
+ *
+ * Commands whose handlers don't just set state and draw (copies, clears,
+ * barriers, queries, rendering begin/end, ...) are kept as a pointer to
+ * the queue entry and run through lvp_execute_cmd() on replay.
+ */
+enum lvp_pkt_type {
+   /* state, dropped if equal to the last packet of the same type and stage */
+   LVP_PKT_SHADER,
+   LVP_PKT_BLEND,
+   LVP_PKT_RASTERIZER,
+   LVP_PKT_DSA,
+   LVP_PKT_SAMPLE_MASK,
+   LVP_PKT_MIN_SAMPLES,
+   LVP_PKT_BLEND_COLOR,
+   LVP_PKT_STENCIL_REF,
+   LVP_PKT_VERTEX_BUFFERS,
+   LVP_PKT_VERTEX_ELEMENTS,
+   LVP_PKT_CONSTANT_BUFFER,
+   LVP_PKT_UBO0,
+   LVP_PKT_SHADER_BUFFERS,
+   LVP_PKT_SHADER_IMAGES,
+   LVP_PKT_SAMPLER_VIEWS,
+   LVP_PKT_SAMPLERS,
+   LVP_PKT_VIEWPORTS,
+   LVP_PKT_SCISSORS,
+   LVP_PKT_NUM_STATE,
+
+   /* always kept */
+   LVP_PKT_FB_SAMPLES = LVP_PKT_NUM_STATE,
+   LVP_PKT_DRAW,
+   LVP_PKT_GRID,
+   LVP_PKT_CMD,
+};
+
+/* followed by size bytes of payload, packets are 8 byte aligned */
+struct lvp_pkt {
+   uint8_t type;
+   uint8_t sh;
+   uint32_t slot;
+   uint32_t size;
+};
+
+#define LVP_PKT_HEADER_SIZE ALIGN_POT(sizeof(struct lvp_pkt), 8)
+
+struct lvp_pkt_draw {
+   struct pipe_draw_info info;
+   struct pipe_draw_indirect_info indirect;
+   bool has_indirect;
+   uint8_t patch_vertices;
+   unsigned num_draws;
+   struct pipe_draw_start_count_bias draws[0];
+};
+
+struct lvp_cmd_recorder {
+   struct util_dynarray pkts;
+   /* descriptor sets whose contents were read */
+   struct set *sets;
+   /* offset + 1 of the last packet of each state type, 0 if none since the
+    * last CMD packet
+    */
+   uint32_t last[LVP_PKT_NUM_STATE][PIPE_SHADER_TYPES];
+   uint32_t last_cbuf[PIPE_SHADER_TYPES][PIPE_MAX_CONSTANT_BUFFERS];
+   bool failed;
+};
+
+struct lvp_compiled_set {
+   const struct lvp_descriptor_set *set;
+   uint64_t generation;
+};
+
+struct lvp_cmd_compiled {
+   uint32_t ref_cnt;
+   unsigned queue_index;
+   struct util_dynarray pkts;
+   unsigned num_sets;
+   struct lvp_compiled_set sets[0];
+};
+
+static void *
+rec_pkt(struct lvp_cmd_recorder *rec, enum lvp_pkt_type type,
+        unsigned sh, uint32_t slot, uint32_t size)
+{
+   struct lvp_pkt *pkt = util_dynarray_grow_bytes(&rec->pkts, 1,
+                                                  LVP_PKT_HEADER_SIZE + ALIGN_POT(size, 8));
+   if (!pkt) {
+      rec->failed = true;
+      return NULL;
+   }
+   pkt->type = type;
+   pkt->sh = sh;
+   pkt->slot = slot;
+   pkt->size = size;
+   return (uint8_t *)pkt + LVP_PKT_HEADER_SIZE;
+}
+
+/* Record a packet, state packets only if the last one of their kind
+ * differs.
+ */
+static void
+rec_state(struct rendering_state *state, enum lvp_pkt_type type,
+          unsigned sh, uint32_t slot, const void *data, uint32_t size)
+{
+   struct lvp_cmd_recorder *rec = state->rec;
+   if (!rec || rec->failed)
+      return;
+
+   uint32_t *last = NULL;
+   if (type == LVP_PKT_CONSTANT_BUFFER)
+      last = &rec->last_cbuf[sh][slot];
+   else if (type < LVP_PKT_NUM_STATE)
+      last = &rec->last[type][sh];
+   if (last && *last) {
+      const struct lvp_pkt *pkt = (const void *)((uint8_t *)rec->pkts.data + *last - 1);
+      if (pkt->slot == slot && pkt->size == size &&
+          !memcmp((const uint8_t *)pkt + LVP_PKT_HEADER_SIZE, data, size))
+         return;
+   }
+
+   uint32_t offset = rec->pkts.size;
+   void *payload = rec_pkt(rec, type, sh, slot, size);
+   if (!payload)
+      return;
+   if (size)
+      memcpy(payload, data, size);
+   if (last)
+      *last = offset + 1;
+}
+
+static void
+rec_draw(struct rendering_state *state,
+         const struct pipe_draw_indirect_info *indirect,
+         const struct pipe_draw_start_count_bias *draws, unsigned num_draws)
+{
+   struct lvp_cmd_recorder *rec = state->rec;
+   if (!rec || rec->failed)
+      return;
+
+   struct lvp_pkt_draw *draw = rec_pkt(rec, LVP_PKT_DRAW, 0, 0,
+                                       sizeof(*draw) + num_draws * sizeof(*draws));
+   if (!draw)
+      return;
+   draw->info = state->info;
+   draw->has_indirect = indirect != NULL;
+   if (indirect)
+      draw->indirect = *indirect;
+   draw->patch_vertices = state->patch_vertices;
+   draw->num_draws = num_draws;
+   memcpy(draw->draws, draws, num_draws * sizeof(*draws));
+}
+
+/* Record a command that is run as it is on replay. */
+static void
+rec_cmd(struct rendering_state *state, struct vk_cmd_queue_entry *cmd)
+{
+   struct lvp_cmd_recorder *rec = state->rec;
+   if (!rec || rec->failed)
+      return;
+
+   struct vk_cmd_queue_entry **entry = rec_pkt(rec, LVP_PKT_CMD, 0, 0, sizeof(cmd));
+   if (!entry)
+      return;
+   *entry = cmd;
+   /* the command may change any state behind our back */
+   memset(rec->last, 0, sizeof(rec->last));
+   memset(rec->last_cbuf, 0, sizeof(rec->last_cbuf));
+}
+
+/* Replay is only valid as long as the descriptor sets read while compiling
+ * aren't updated.
+ */
+static void
+rec_descriptor_set(struct rendering_state *state, const struct lvp_descriptor_set *set)
+{
+   if (state->rec && !state->rec->failed)
+      _mesa_set_add(state->rec->sets, set);
+}
+
+static void
+bind_shader(struct rendering_state *state, enum pipe_shader_type sh, void *cso)
+{
+   switch (sh) {
+   case PIPE_SHADER_VERTEX:
+      state->pctx->bind_vs_state(state->pctx, cso);
+      break;
+   case PIPE_SHADER_TESS_CTRL:
+      state->pctx->bind_tcs_state(state->pctx, cso);
+      break;
+   case PIPE_SHADER_TESS_EVAL:
+      state->pctx->bind_tes_state(state->pctx, cso);
+      break;
+   case PIPE_SHADER_GEOMETRY:
+      state->pctx->bind_gs_state(state->pctx, cso);
+      break;
+   case PIPE_SHADER_FRAGMENT:
+      state->pctx->bind_fs_state(state->pctx, cso);
+      break;
+   case PIPE_SHADER_COMPUTE:
+      state->pctx->bind_compute_state(state->pctx, cso);
+      break;
+   default: break;
+   }
+   rec_state(state, LVP_PKT_SHADER, sh, 0, &cso, sizeof(cso));
+}
+
+static void
+draw_vbo(struct rendering_state *state,
+         const struct pipe_draw_indirect_info *indirect,
+         const struct pipe_draw_start_count_bias *draws, unsigned num_draws)
+{
+   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
+   state->pctx->draw_vbo(state->pctx, &state->info, 0, indirect, draws, num_draws);
+   rec_draw(state, indirect, draws, num_draws);
+}
+
+static void
+launch_grid(struct rendering_state *state)
+{
+   state->pctx->launch_grid(state->pctx, &state->dispatch_info);
+   rec_state(state, LVP_PKT_GRID, 0, 0, &state->dispatch_info, sizeof(state->dispatch_info));
+}
+
 static unsigned
 get_pcbuf_size(struct rendering_state *state, enum pipe_shader_type pstage)
 {
@@ -267,10 +500,44 @@ update_pcbuf(struct rendering_state *state, enum pipe_shader_type pstage)
       u_upload_alloc(state->uploader, 0, size, 64, &cbuf.buffer_offset, &cbuf.buffer, (void**)&mem);
       fill_ubo0(state, mem, pstage);
       state->pctx->set_constant_buffer(state->pctx, pstage, 0, true, &cbuf);
+      rec_state(state, LVP_PKT_UBO0, pstage, 0, mem, size);
    }
    state->pcbuf_dirty[pstage] = false;
 }
 
+/* Only the first queue's CSOs are created with the pipeline. */
+static void *
+get_shader_cso(struct rendering_state *state, struct lvp_pipeline *pipeline,
+               enum pipe_shader_type sh)
+{
+   void **cso = &pipeline->shader_cso[state->queue_index][sh];
+   gl_shader_stage stage = tgsi_processor_to_shader_stage(sh);
+
+   if (!*cso && pipeline->pipeline_nir[stage])
+      *cso = lvp_pipeline_compile(pipeline, state->pctx,
+                                  nir_shader_clone(NULL, pipeline->pipeline_nir[stage]), false);
+   return *cso;
+}
+
+static void *
+get_tess_ccw_cso(struct rendering_state *state, struct lvp_pipeline *pipeline)
+{
+   void **cso = &pipeline->tess_ccw_cso[state->queue_index];
+
+   if (!*cso && pipeline->tess_ccw)
+      *cso = lvp_pipeline_compile(pipeline, state->pctx,
+                                  nir_shader_clone(NULL, pipeline->tess_ccw), false);
+   return *cso;
+}
+
+static uint32_t
+inlinable_slots(const struct rendering_state *state,
+                const struct lvp_pipeline *pipeline, gl_shader_stage stage)
+{
+   const struct lvp_inline_info *info = &pipeline->inlines[stage];
+   return info->failed[state->queue_index] ? 0 : info->can_inline;
+}
+
 static void
 update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type sh, bool pcbuf_dirty, bool constbuf_dirty)
 {
@@ -278,9 +545,9 @@ update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type
    uint32_t inline_uniforms[MAX_INLINABLE_UNIFORMS];
    unsigned stage = tgsi_processor_to_shader_stage(sh);
    state->inlines_dirty[sh] = false;
-   if (!state->pipeline[is_compute]->inlines[stage].can_inline)
-      return;
    struct lvp_pipeline *pipeline = state->pipeline[is_compute];
+   if (!inlinable_slots(state, pipeline, stage))
+      return;
    /* these buffers have already been flushed in llvmpipe, so they're safe to read */
    nir_shader *base_nir = pipeline->pipeline_nir[stage];
    if (stage == PIPE_SHADER_TESS_EVAL && state->tess_ccw)
@@ -311,7 +578,7 @@ update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type
    }
    if (constbuf_dirty) {
       struct pipe_box box = {0};
-      u_foreach_bit(slot, pipeline->inlines[stage].can_inline) {
+      u_foreach_bit(slot, inlinable_slots(state, pipeline, stage)) {
          unsigned count = pipeline->inlines[stage].count[slot];
          struct pipe_constant_buffer *cbuf = &state->const_buffer[sh][slot - 1];
          struct pipe_resource *pres = cbuf->buffer;
@@ -333,34 +600,16 @@ update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type
    if (ssa_alloc - impl->ssa_alloc < ssa_alloc / 2 &&
        !pipeline->inlines[stage].must_inline) {
       /* not enough change; don't inline further */
-      pipeline->inlines[stage].can_inline = 0;
+      pipeline->inlines[stage].failed[state->queue_index] = true;
       ralloc_free(nir);
-      pipeline->shader_cso[sh] = lvp_pipeline_compile(pipeline, nir_shader_clone(NULL, pipeline->pipeline_nir[stage]));
-      shader_state = pipeline->shader_cso[sh];
+      shader_state = get_shader_cso(state, pipeline, sh);
    } else {
-      shader_state = lvp_pipeline_compile(pipeline, nir);
-   }
-   switch (sh) {
-   case PIPE_SHADER_VERTEX:
-      state->pctx->bind_vs_state(state->pctx, shader_state);
-      break;
-   case PIPE_SHADER_TESS_CTRL:
-      state->pctx->bind_tcs_state(state->pctx, shader_state);
-      break;
-   case PIPE_SHADER_TESS_EVAL:
-      state->pctx->bind_tes_state(state->pctx, shader_state);
-      break;
-   case PIPE_SHADER_GEOMETRY:
-      state->pctx->bind_gs_state(state->pctx, shader_state);
-      break;
-   case PIPE_SHADER_FRAGMENT:
-      state->pctx->bind_fs_state(state->pctx, shader_state);
-      break;
-   case PIPE_SHADER_COMPUTE:
-      state->pctx->bind_compute_state(state->pctx, shader_state);
-      break;
-   default: break;
+      shader_state = lvp_pipeline_compile(pipeline, state->pctx, nir, true);
+      /* the shader depends on buffer contents at execution time */
+      if (state->rec)
+         state->rec->failed = true;
    }
+   bind_shader(state, sh, shader_state);
 }
 
 static void emit_compute_state(struct rendering_state *state)
@@ -369,6 +618,8 @@ static void emit_compute_state(struct rendering_state *state)
       state->pctx->set_shader_images(state->pctx, PIPE_SHADER_COMPUTE,
                                      0, state->num_shader_images[PIPE_SHADER_COMPUTE],
                                      0, state->iv[PIPE_SHADER_COMPUTE]);
+      rec_state(state, LVP_PKT_SHADER_IMAGES, PIPE_SHADER_COMPUTE, 0, state->iv[PIPE_SHADER_COMPUTE],
+                state->num_shader_images[PIPE_SHADER_COMPUTE] * sizeof(struct pipe_image_view));
       state->iv_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 
@@ -378,9 +629,12 @@ static void emit_compute_state(struct rendering_state *state)
 
    bool constbuf_dirty = state->constbuf_dirty[PIPE_SHADER_COMPUTE];
    if (state->constbuf_dirty[PIPE_SHADER_COMPUTE]) {
-      for (unsigned i = 0; i < state->num_const_bufs[PIPE_SHADER_COMPUTE]; i++)
+      for (unsigned i = 0; i < state->num_const_bufs[PIPE_SHADER_COMPUTE]; i++) {
          state->pctx->set_constant_buffer(state->pctx, PIPE_SHADER_COMPUTE,
                                           i + 1, false, &state->const_buffer[PIPE_SHADER_COMPUTE][i]);
+         rec_state(state, LVP_PKT_CONSTANT_BUFFER, PIPE_SHADER_COMPUTE, i + 1,
+                   &state->const_buffer[PIPE_SHADER_COMPUTE][i], sizeof(struct pipe_constant_buffer));
+      }
       state->constbuf_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 
@@ -391,17 +645,23 @@ static void emit_compute_state(struct rendering_state *state)
       state->pctx->set_shader_buffers(state->pctx, PIPE_SHADER_COMPUTE,
                                       0, state->num_shader_buffers[PIPE_SHADER_COMPUTE],
                                       state->sb[PIPE_SHADER_COMPUTE], state->access[MESA_SHADER_COMPUTE].buffers_written);
+      rec_state(state, LVP_PKT_SHADER_BUFFERS, PIPE_SHADER_COMPUTE, state->access[MESA_SHADER_COMPUTE].buffers_written,
+                state->sb[PIPE_SHADER_COMPUTE], state->num_shader_buffers[PIPE_SHADER_COMPUTE] * sizeof(struct pipe_shader_buffer));
       state->sb_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 
    if (state->sv_dirty[PIPE_SHADER_COMPUTE]) {
       state->pctx->set_sampler_views(state->pctx, PIPE_SHADER_COMPUTE, 0, state->num_sampler_views[PIPE_SHADER_COMPUTE],
                                      0, false, state->sv[PIPE_SHADER_COMPUTE]);
+      rec_state(state, LVP_PKT_SAMPLER_VIEWS, PIPE_SHADER_COMPUTE, 0, state->sv[PIPE_SHADER_COMPUTE],
+                state->num_sampler_views[PIPE_SHADER_COMPUTE] * sizeof(struct pipe_sampler_view *));
       state->sv_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 
    if (state->ss_dirty[PIPE_SHADER_COMPUTE]) {
       cso_set_samplers(state->cso, PIPE_SHADER_COMPUTE, state->num_sampler_states[PIPE_SHADER_COMPUTE], state->cso_ss_ptr[PIPE_SHADER_COMPUTE]);
+      rec_state(state, LVP_PKT_SAMPLERS, PIPE_SHADER_COMPUTE, 0, state->ss[PIPE_SHADER_COMPUTE],
+                state->num_sampler_states[PIPE_SHADER_COMPUTE] * sizeof(struct pipe_sampler_state));
       state->ss_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 }
@@ -419,6 +679,7 @@ static void emit_state(struct rendering_state *state)
          }
       }
       cso_set_blend(state->cso, &state->blend_state);
+      rec_state(state, LVP_PKT_BLEND, 0, 0, &state->blend_state, sizeof(state->blend_state));
       /* reset colormasks using saved bitmask */
       if (state->color_write_disables) {
          const uint32_t att_mask = BITFIELD_MASK(4);
@@ -448,42 +709,51 @@ static void emit_state(struct rendering_state *state)
          state->rs_state.offset_point = false;
       }
       cso_set_rasterizer(state->cso, &state->rs_state);
+      rec_state(state, LVP_PKT_RASTERIZER, 0, 0, &state->rs_state, sizeof(state->rs_state));
       state->rs_dirty = false;
       state->rs_state.multisample = ms;
    }
 
    if (state->dsa_dirty) {
       cso_set_depth_stencil_alpha(state->cso, &state->dsa_state);
+      rec_state(state, LVP_PKT_DSA, 0, 0, &state->dsa_state, sizeof(state->dsa_state));
       state->dsa_dirty = false;
    }
 
    if (state->sample_mask_dirty) {
       cso_set_sample_mask(state->cso, state->sample_mask);
+      rec_state(state, LVP_PKT_SAMPLE_MASK, 0, 0, &state->sample_mask, sizeof(state->sample_mask));
       state->sample_mask_dirty = false;
    }
 
    if (state->min_samples_dirty) {
       cso_set_min_samples(state->cso, state->min_samples);
+      rec_state(state, LVP_PKT_MIN_SAMPLES, 0, 0, &state->min_samples, sizeof(state->min_samples));
       state->min_samples_dirty = false;
    }
 
    if (state->blend_color_dirty) {
       state->pctx->set_blend_color(state->pctx, &state->blend_color);
+      rec_state(state, LVP_PKT_BLEND_COLOR, 0, 0, &state->blend_color, sizeof(state->blend_color));
       state->blend_color_dirty = false;
    }
 
    if (state->stencil_ref_dirty) {
       cso_set_stencil_ref(state->cso, state->stencil_ref);
+      rec_state(state, LVP_PKT_STENCIL_REF, 0, 0, &state->stencil_ref, sizeof(state->stencil_ref));
       state->stencil_ref_dirty = false;
    }
 
    if (state->vb_dirty) {
       cso_set_vertex_buffers(state->cso, state->start_vb, state->num_vb, 0, false, state->vb);
+      rec_state(state, LVP_PKT_VERTEX_BUFFERS, 0, state->start_vb, state->vb,
+                state->num_vb * sizeof(struct pipe_vertex_buffer));
       state->vb_dirty = false;
    }
 
    if (state->ve_dirty) {
       cso_set_vertex_elements(state->cso, &state->velem);
+      rec_state(state, LVP_PKT_VERTEX_ELEMENTS, 0, 0, &state->velem, sizeof(state->velem));
       state->ve_dirty = false;
    }
 
@@ -492,9 +762,12 @@ static void emit_state(struct rendering_state *state)
    for (sh = 0; sh < PIPE_SHADER_COMPUTE; sh++) {
       constbuf_dirty[sh] = state->constbuf_dirty[sh];
       if (state->constbuf_dirty[sh]) {
-         for (unsigned idx = 0; idx < state->num_const_bufs[sh]; idx++)
+         for (unsigned idx = 0; idx < state->num_const_bufs[sh]; idx++) {
             state->pctx->set_constant_buffer(state->pctx, sh,
                                              idx + 1, false, &state->const_buffer[sh][idx]);
+            rec_state(state, LVP_PKT_CONSTANT_BUFFER, sh, idx + 1,
+                      &state->const_buffer[sh][idx], sizeof(struct pipe_constant_buffer));
+         }
       }
       state->constbuf_dirty[sh] = false;
    }
@@ -515,6 +788,8 @@ static void emit_state(struct rendering_state *state)
          state->pctx->set_shader_buffers(state->pctx, sh,
                                          0, state->num_shader_buffers[sh],
                                          state->sb[sh], state->access[tgsi_processor_to_shader_stage(sh)].buffers_written);
+         rec_state(state, LVP_PKT_SHADER_BUFFERS, sh, state->access[tgsi_processor_to_shader_stage(sh)].buffers_written,
+                   state->sb[sh], state->num_shader_buffers[sh] * sizeof(struct pipe_shader_buffer));
       }
    }
 
@@ -523,6 +798,8 @@ static void emit_state(struct rendering_state *state)
          state->pctx->set_shader_images(state->pctx, sh,
                                         0, state->num_shader_images[sh], 0,
                                         state->iv[sh]);
+         rec_state(state, LVP_PKT_SHADER_IMAGES, sh, 0, state->iv[sh],
+                   state->num_shader_images[sh] * sizeof(struct pipe_image_view));
       }
    }
 
@@ -530,6 +807,8 @@ static void emit_state(struct rendering_state *state)
       if (state->sv_dirty[sh]) {
          state->pctx->set_sampler_views(state->pctx, sh, 0, state->num_sampler_views[sh],
                                         0, false, state->sv[sh]);
+         rec_state(state, LVP_PKT_SAMPLER_VIEWS, sh, 0, state->sv[sh],
+                   state->num_sampler_views[sh] * sizeof(struct pipe_sampler_view *));
          state->sv_dirty[sh] = false;
       }
    }
@@ -537,17 +816,23 @@ static void emit_state(struct rendering_state *state)
    for (sh = 0; sh < PIPE_SHADER_COMPUTE; sh++) {
       if (state->ss_dirty[sh]) {
          cso_set_samplers(state->cso, sh, state->num_sampler_states[sh], state->cso_ss_ptr[sh]);
+         rec_state(state, LVP_PKT_SAMPLERS, sh, 0, state->ss[sh],
+                   state->num_sampler_states[sh] * sizeof(struct pipe_sampler_state));
          state->ss_dirty[sh] = false;
       }
    }
 
    if (state->vp_dirty) {
       state->pctx->set_viewport_states(state->pctx, 0, state->num_viewports, state->viewports);
+      rec_state(state, LVP_PKT_VIEWPORTS, 0, 0, state->viewports,
+                state->num_viewports * sizeof(struct pipe_viewport_state));
       state->vp_dirty = false;
    }
 
    if (state->scissor_dirty) {
       state->pctx->set_scissor_states(state->pctx, 0, state->num_scissors, state->scissors);
+      rec_state(state, LVP_PKT_SCISSORS, 0, 0, state->scissors,
+                state->num_scissors * sizeof(struct pipe_scissor_state));
       state->scissor_dirty = false;
    }
 }
@@ -575,9 +860,9 @@ static void handle_compute_pipeline(struct vk_cmd_queue_entry *cmd,
    state->dispatch_info.block[0] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[0];
    state->dispatch_info.block[1] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[1];
    state->dispatch_info.block[2] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[2];
-   state->inlines_dirty[PIPE_SHADER_COMPUTE] = pipeline->inlines[MESA_SHADER_COMPUTE].can_inline;
-   if (!pipeline->inlines[MESA_SHADER_COMPUTE].can_inline)
-      state->pctx->bind_compute_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
+   state->inlines_dirty[PIPE_SHADER_COMPUTE] = inlinable_slots(state, pipeline, MESA_SHADER_COMPUTE);
+   if (!inlinable_slots(state, pipeline, MESA_SHADER_COMPUTE))
+      bind_shader(state, PIPE_SHADER_COMPUTE, get_shader_cso(state, pipeline, PIPE_SHADER_COMPUTE));
 }
 
 static void
@@ -632,6 +917,7 @@ update_samples(struct rendering_state *state, VkSampleCountFlags samples)
    if (samples != state->framebuffer.samples) {
       state->framebuffer.samples = samples;
       state->pctx->set_framebuffer_state(state->pctx, &state->framebuffer);
+      rec_state(state, LVP_PKT_FB_SAMPLES, 0, samples, NULL, 0);
    }
 }
 
@@ -667,11 +953,11 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
 
    bool has_stage[PIPE_SHADER_TYPES] = { false };
 
-   state->pctx->bind_gs_state(state->pctx, NULL);
+   bind_shader(state, PIPE_SHADER_GEOMETRY, NULL);
    if (state->pctx->bind_tcs_state)
-      state->pctx->bind_tcs_state(state->pctx, NULL);
+      bind_shader(state, PIPE_SHADER_TESS_CTRL, NULL);
    if (state->pctx->bind_tes_state)
-      state->pctx->bind_tes_state(state->pctx, NULL);
+      bind_shader(state, PIPE_SHADER_TESS_EVAL, NULL);
    state->tess_states[0] = NULL;
    state->tess_states[1] = NULL;
    state->gs_output_lines = GS_OUTPUT_NONE;
@@ -680,39 +966,39 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
          VkShaderStageFlagBits vk_stage = (1 << b);
          switch (vk_stage) {
          case VK_SHADER_STAGE_FRAGMENT_BIT:
-            state->inlines_dirty[PIPE_SHADER_FRAGMENT] = pipeline->inlines[MESA_SHADER_FRAGMENT].can_inline;
-            if (!pipeline->inlines[MESA_SHADER_FRAGMENT].can_inline)
-               state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+            state->inlines_dirty[PIPE_SHADER_FRAGMENT] = inlinable_slots(state, pipeline, MESA_SHADER_FRAGMENT);
+            if (!inlinable_slots(state, pipeline, MESA_SHADER_FRAGMENT))
+               bind_shader(state, PIPE_SHADER_FRAGMENT, get_shader_cso(state, pipeline, PIPE_SHADER_FRAGMENT));
             has_stage[PIPE_SHADER_FRAGMENT] = true;
             break;
          case VK_SHADER_STAGE_VERTEX_BIT:
-            state->inlines_dirty[PIPE_SHADER_VERTEX] = pipeline->inlines[MESA_SHADER_VERTEX].can_inline;
-            if (!pipeline->inlines[MESA_SHADER_VERTEX].can_inline)
-               state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
+            state->inlines_dirty[PIPE_SHADER_VERTEX] = inlinable_slots(state, pipeline, MESA_SHADER_VERTEX);
+            if (!inlinable_slots(state, pipeline, MESA_SHADER_VERTEX))
+               bind_shader(state, PIPE_SHADER_VERTEX, get_shader_cso(state, pipeline, PIPE_SHADER_VERTEX));
             has_stage[PIPE_SHADER_VERTEX] = true;
             break;
          case VK_SHADER_STAGE_GEOMETRY_BIT:
-            state->inlines_dirty[PIPE_SHADER_GEOMETRY] = pipeline->inlines[MESA_SHADER_GEOMETRY].can_inline;
-            if (!pipeline->inlines[MESA_SHADER_GEOMETRY].can_inline)
-               state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
+            state->inlines_dirty[PIPE_SHADER_GEOMETRY] = inlinable_slots(state, pipeline, MESA_SHADER_GEOMETRY);
+            if (!inlinable_slots(state, pipeline, MESA_SHADER_GEOMETRY))
+               bind_shader(state, PIPE_SHADER_GEOMETRY, get_shader_cso(state, pipeline, PIPE_SHADER_GEOMETRY));
             state->gs_output_lines = pipeline->gs_output_lines ? GS_OUTPUT_LINES : GS_OUTPUT_NOT_LINES;
             has_stage[PIPE_SHADER_GEOMETRY] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-            state->inlines_dirty[PIPE_SHADER_TESS_CTRL] = pipeline->inlines[MESA_SHADER_TESS_CTRL].can_inline;
-            if (!pipeline->inlines[MESA_SHADER_TESS_CTRL].can_inline)
-               state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
+            state->inlines_dirty[PIPE_SHADER_TESS_CTRL] = inlinable_slots(state, pipeline, MESA_SHADER_TESS_CTRL);
+            if (!inlinable_slots(state, pipeline, MESA_SHADER_TESS_CTRL))
+               bind_shader(state, PIPE_SHADER_TESS_CTRL, get_shader_cso(state, pipeline, PIPE_SHADER_TESS_CTRL));
             has_stage[PIPE_SHADER_TESS_CTRL] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-            state->inlines_dirty[PIPE_SHADER_TESS_EVAL] = pipeline->inlines[MESA_SHADER_TESS_EVAL].can_inline;
-            if (!pipeline->inlines[MESA_SHADER_TESS_EVAL].can_inline) {
+            state->inlines_dirty[PIPE_SHADER_TESS_EVAL] = inlinable_slots(state, pipeline, MESA_SHADER_TESS_EVAL);
+            if (!inlinable_slots(state, pipeline, MESA_SHADER_TESS_EVAL)) {
                if (BITSET_TEST(ps->dynamic, MESA_VK_DYNAMIC_TS_DOMAIN_ORIGIN)) {
-                  state->tess_states[0] = pipeline->shader_cso[PIPE_SHADER_TESS_EVAL];
-                  state->tess_states[1] = pipeline->tess_ccw_cso;
-                  state->pctx->bind_tes_state(state->pctx, state->tess_states[state->tess_ccw]);
+                  state->tess_states[0] = get_shader_cso(state, pipeline, PIPE_SHADER_TESS_EVAL);
+                  state->tess_states[1] = get_tess_ccw_cso(state, pipeline);
+                  bind_shader(state, PIPE_SHADER_TESS_EVAL, state->tess_states[state->tess_ccw]);
                } else {
-                  state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
+                  bind_shader(state, PIPE_SHADER_TESS_EVAL, get_shader_cso(state, pipeline, PIPE_SHADER_TESS_EVAL));
                }
             }
             if (!BITSET_TEST(ps->dynamic, MESA_VK_DYNAMIC_TS_DOMAIN_ORIGIN))
@@ -728,13 +1014,13 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
 
    /* there should always be a dummy fs. */
    if (!has_stage[PIPE_SHADER_FRAGMENT])
-      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+      bind_shader(state, PIPE_SHADER_FRAGMENT, get_shader_cso(state, pipeline, PIPE_SHADER_FRAGMENT));
    if (state->pctx->bind_gs_state && !has_stage[PIPE_SHADER_GEOMETRY])
-      state->pctx->bind_gs_state(state->pctx, NULL);
+      bind_shader(state, PIPE_SHADER_GEOMETRY, NULL);
    if (state->pctx->bind_tcs_state && !has_stage[PIPE_SHADER_TESS_CTRL])
-      state->pctx->bind_tcs_state(state->pctx, NULL);
+      bind_shader(state, PIPE_SHADER_TESS_CTRL, NULL);
    if (state->pctx->bind_tes_state && !has_stage[PIPE_SHADER_TESS_EVAL])
-      state->pctx->bind_tes_state(state->pctx, NULL);
+      bind_shader(state, PIPE_SHADER_TESS_EVAL, NULL);
 
    /* rasterization state */
    if (ps->rs) {
@@ -1134,7 +1420,8 @@ static void fill_sampler_view_stage(struct rendering_state *state,
    sv_idx += dyn_info->stage[stage].sampler_view_count;
 
    assert(sv_idx < ARRAY_SIZE(state->sv[p_stage]));
-   state->sv[p_stage][sv_idx] = descriptor->sampler_view;
+   state->sv[p_stage][sv_idx] = descriptor->sampler_view ?
+      descriptor->sampler_view[state->queue_index] : NULL;
 
    if (state->num_sampler_views[p_stage] <= sv_idx)
       state->num_sampler_views[p_stage] = sv_idx + 1;
@@ -1256,6 +1543,7 @@ static void handle_set_stage(struct rendering_state *state,
                              enum pipe_shader_type p_stage)
 {
    int j;
+   rec_descriptor_set(state, set);
    for (j = 0; j < set->layout->binding_count; j++) {
       const struct lvp_descriptor_set_binding_layout *binding;
       const struct lvp_descriptor *descriptor;
@@ -1917,8 +2205,7 @@ static void handle_draw(struct vk_cmd_queue_entry *cmd,
    draw.count = cmd->u.draw.vertex_count;
    draw.index_bias = 0;
 
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-   state->pctx->draw_vbo(state->pctx, &state->info, 0, NULL, &draw, 1);
+   draw_vbo(state, NULL, &draw, 1);
 }
 
 static void handle_draw_multi(struct vk_cmd_queue_entry *cmd,
@@ -1940,10 +2227,8 @@ static void handle_draw_multi(struct vk_cmd_queue_entry *cmd,
       draws[i].index_bias = 0;
    }
 
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-
    if (cmd->u.draw_multi_indexed_ext.draw_count)
-      state->pctx->draw_vbo(state->pctx, &state->info, 0, NULL, draws, cmd->u.draw_multi_ext.draw_count);
+      draw_vbo(state, NULL, draws, cmd->u.draw_multi_ext.draw_count);
 
    free(draws);
 }
@@ -2552,8 +2837,7 @@ static void handle_draw_indexed(struct vk_cmd_queue_entry *cmd,
    draw.start = (state->index_offset / state->index_size) + cmd->u.draw_indexed.first_index;
 
    state->info.index_bias_varies = !cmd->u.draw_indexed.vertex_offset;
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-   state->pctx->draw_vbo(state->pctx, &state->info, 0, NULL, &draw, 1);
+   draw_vbo(state, NULL, &draw, 1);
 }
 
 static void handle_draw_multi_indexed(struct vk_cmd_queue_entry *cmd,
@@ -2588,10 +2872,8 @@ static void handle_draw_multi_indexed(struct vk_cmd_queue_entry *cmd,
       draws[i].start = (state->index_offset / state->index_size) + draws[i].start;
 
    state->info.index_bias_varies = !cmd->u.draw_multi_indexed_ext.vertex_offset;
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-
    if (cmd->u.draw_multi_indexed_ext.draw_count)
-      state->pctx->draw_vbo(state->pctx, &state->info, 0, NULL, draws, cmd->u.draw_multi_indexed_ext.draw_count);
+      draw_vbo(state, NULL, draws, cmd->u.draw_multi_indexed_ext.draw_count);
 
    free(draws);
 }
@@ -2614,8 +2896,7 @@ static void handle_draw_indirect(struct vk_cmd_queue_entry *cmd,
    state->indirect_info.draw_count = cmd->u.draw_indirect.draw_count;
    state->indirect_info.buffer = lvp_buffer_from_handle(cmd->u.draw_indirect.buffer)->bo;
 
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-   state->pctx->draw_vbo(state->pctx, &state->info, 0, &state->indirect_info, &draw, 1);
+   draw_vbo(state, &state->indirect_info, &draw, 1);
 }
 
 static void handle_index_buffer(struct vk_cmd_queue_entry *cmd,
@@ -2654,7 +2935,7 @@ static void handle_dispatch(struct vk_cmd_queue_entry *cmd,
    state->dispatch_info.grid_base[1] = 0;
    state->dispatch_info.grid_base[2] = 0;
    state->dispatch_info.indirect = NULL;
-   state->pctx->launch_grid(state->pctx, &state->dispatch_info);
+   launch_grid(state);
 }
 
 static void handle_dispatch_base(struct vk_cmd_queue_entry *cmd,
@@ -2667,7 +2948,7 @@ static void handle_dispatch_base(struct vk_cmd_queue_entry *cmd,
    state->dispatch_info.grid_base[1] = cmd->u.dispatch_base.base_group_y;
    state->dispatch_info.grid_base[2] = cmd->u.dispatch_base.base_group_z;
    state->dispatch_info.indirect = NULL;
-   state->pctx->launch_grid(state->pctx, &state->dispatch_info);
+   launch_grid(state);
 }
 
 static void handle_dispatch_indirect(struct vk_cmd_queue_entry *cmd,
@@ -2675,7 +2956,7 @@ static void handle_dispatch_indirect(struct vk_cmd_queue_entry *cmd,
 {
    state->dispatch_info.indirect = lvp_buffer_from_handle(cmd->u.dispatch_indirect.buffer)->bo;
    state->dispatch_info.indirect_offset = cmd->u.dispatch_indirect.offset;
-   state->pctx->launch_grid(state->pctx, &state->dispatch_info);
+   launch_grid(state);
 }
 
 static void handle_push_constants(struct vk_cmd_queue_entry *cmd,
@@ -2767,11 +3048,14 @@ static void handle_begin_query(struct vk_cmd_queue_entry *cmd,
       emit_compute_state(state);
 
    emit_state(state);
+   /* after the state it emits so that replay sets it first */
+   rec_cmd(state, cmd);
 
    if (!pool->queries[qcmd->query]) {
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, 0);
+      pool->queues[qcmd->query] = state->queue;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2799,11 +3083,13 @@ static void handle_begin_query_indexed_ext(struct vk_cmd_queue_entry *cmd,
       emit_compute_state(state);
 
    emit_state(state);
+   rec_cmd(state, cmd);
 
    if (!pool->queries[qcmd->query]) {
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, qcmd->index);
+      pool->queues[qcmd->query] = state->queue;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2826,7 +3112,9 @@ static void handle_reset_query_pool(struct vk_cmd_queue_entry *cmd,
    LVP_FROM_HANDLE(lvp_query_pool, pool, qcmd->query_pool);
    for (unsigned i = qcmd->first_query; i < qcmd->first_query + qcmd->query_count; i++) {
       if (pool->queries[i]) {
-         state->pctx->destroy_query(state->pctx, pool->queries[i]);
+         struct pipe_context *ctx = lvp_query_ctx_lock(state->queue, pool, i);
+         ctx->destroy_query(ctx, pool->queries[i]);
+         lvp_query_ctx_unlock(state->queue, pool, i);
          pool->queries[i] = NULL;
       }
    }
@@ -2840,6 +3128,7 @@ static void handle_write_timestamp2(struct vk_cmd_queue_entry *cmd,
    if (!pool->queries[qcmd->query]) {
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              PIPE_QUERY_TIMESTAMP, 0);
+      pool->queues[qcmd->query] = state->queue;
    }
 
    if (!(qcmd->stage == VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT))
@@ -2861,39 +3150,41 @@ static void handle_copy_query_pool_results(struct vk_cmd_queue_entry *cmd,
    for (unsigned i = copycmd->first_query; i < copycmd->first_query + copycmd->query_count; i++) {
       unsigned offset = copycmd->dst_offset + (copycmd->stride * (i - copycmd->first_query));
       if (pool->queries[i]) {
+         struct pipe_context *ctx = lvp_query_ctx_lock(state->queue, pool, i);
          unsigned num_results = 0;
          if (copycmd->flags & VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) {
             if (pool->type == VK_QUERY_TYPE_PIPELINE_STATISTICS) {
                num_results = util_bitcount(pool->pipeline_stats);
             } else
                num_results = pool-> type == VK_QUERY_TYPE_TRANSFORM_FEEDBACK_STREAM_EXT ? 2 : 1;
-            state->pctx->get_query_result_resource(state->pctx,
-                                                   pool->queries[i],
-                                                   flags,
-                                                   copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
-                                                   -1,
-                                                   lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
-                                                   offset + num_results * result_size);
+            ctx->get_query_result_resource(ctx,
+                                           pool->queries[i],
+                                           flags,
+                                           copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
+                                           -1,
+                                           lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
+                                           offset + num_results * result_size);
          }
          if (pool->type == VK_QUERY_TYPE_PIPELINE_STATISTICS) {
             num_results = 0;
             u_foreach_bit(bit, pool->pipeline_stats)
-               state->pctx->get_query_result_resource(state->pctx,
-                                                      pool->queries[i],
-                                                      flags,
-                                                      copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
-                                                      bit,
-                                                      lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
-                                                      offset + num_results++ * result_size);
+               ctx->get_query_result_resource(ctx,
+                                              pool->queries[i],
+                                              flags,
+                                              copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
+                                              bit,
+                                              lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
+                                              offset + num_results++ * result_size);
          } else {
-            state->pctx->get_query_result_resource(state->pctx,
-                                                   pool->queries[i],
-                                                   flags,
-                                                   copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
-                                                   0,
-                                                   lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
-                                                   offset);
+            ctx->get_query_result_resource(ctx,
+                                           pool->queries[i],
+                                           flags,
+                                           copycmd->flags & VK_QUERY_RESULT_64_BIT ? PIPE_QUERY_TYPE_U64 : PIPE_QUERY_TYPE_U32,
+                                           0,
+                                           lvp_buffer_from_handle(copycmd->dst_buffer)->bo,
+                                           offset);
          }
+         lvp_query_ctx_unlock(state->queue, pool, i);
       } else {
          /* if no queries emitted yet, just reset the buffer to 0 so avail is reported correctly */
          if (copycmd->flags & VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) {
@@ -3117,8 +3408,7 @@ static void handle_draw_indirect_count(struct vk_cmd_queue_entry *cmd,
    state->indirect_info.indirect_draw_count_offset = cmd->u.draw_indirect_count.count_buffer_offset;
    state->indirect_info.indirect_draw_count = lvp_buffer_from_handle(cmd->u.draw_indirect_count.count_buffer)->bo;
 
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-   state->pctx->draw_vbo(state->pctx, &state->info, 0, &state->indirect_info, &draw, 1);
+   draw_vbo(state, &state->indirect_info, &draw, 1);
 }
 
 static void handle_compute_push_descriptor_set(struct lvp_cmd_push_descriptor_set *pds,
@@ -3509,8 +3799,7 @@ static void handle_draw_indirect_byte_count(struct vk_cmd_queue_entry *cmd,
    state->info.index_size = 0;
 
    draw.count /= cmd->u.draw_indirect_byte_count_ext.vertex_stride;
-   state->pctx->set_patch_vertices(state->pctx, state->patch_vertices);
-   state->pctx->draw_vbo(state->pctx, &state->info, 0, &state->indirect_info, &draw, 1);
+   draw_vbo(state, &state->indirect_info, &draw, 1);
 }
 
 static void handle_begin_conditional_rendering(struct vk_cmd_queue_entry *cmd,
@@ -3730,7 +4019,7 @@ static void handle_set_tessellation_domain_origin(struct vk_cmd_queue_entry *cmd
       return;
    state->tess_ccw = tess_ccw;
    if (state->tess_states[state->tess_ccw])
-      state->pctx->bind_tes_state(state->pctx, state->tess_states[state->tess_ccw]);
+      bind_shader(state, PIPE_SHADER_TESS_EVAL, state->tess_states[state->tess_ccw]);
 }
 
 static void handle_set_depth_clamp_enable(struct vk_cmd_queue_entry *cmd,
@@ -3990,324 +4279,605 @@ void lvp_add_enqueue_cmd_entrypoints(struct vk_device_dispatch_table *disp)
 #undef ENQUEUE_CMD
 }
 
-static void lvp_execute_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer,
-                                   struct rendering_state *state)
+/* Commands that make gallium calls other than through the recorded helpers
+ * above, these are recorded as they are.
+ */
+static bool
+cmd_is_opaque(enum vk_cmd_type type)
 {
-   struct vk_cmd_queue_entry *cmd;
-   bool first = true;
-   bool did_flush = false;
+   switch (type) {
+   case VK_CMD_COPY_BUFFER2:
+   case VK_CMD_COPY_IMAGE2:
+   case VK_CMD_BLIT_IMAGE2:
+   case VK_CMD_COPY_BUFFER_TO_IMAGE2:
+   case VK_CMD_COPY_IMAGE_TO_BUFFER2:
+   case VK_CMD_UPDATE_BUFFER:
+   case VK_CMD_FILL_BUFFER:
+   case VK_CMD_CLEAR_COLOR_IMAGE:
+   case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
+   case VK_CMD_CLEAR_ATTACHMENTS:
+   case VK_CMD_RESOLVE_IMAGE2:
+   case VK_CMD_PIPELINE_BARRIER2:
+   case VK_CMD_END_QUERY_INDEXED_EXT:
+   case VK_CMD_END_QUERY:
+   case VK_CMD_RESET_QUERY_POOL:
+   case VK_CMD_COPY_QUERY_POOL_RESULTS:
+   case VK_CMD_BEGIN_RENDERING:
+   case VK_CMD_END_RENDERING:
+   case VK_CMD_RESET_EVENT2:
+   case VK_CMD_SET_EVENT2:
+   case VK_CMD_WAIT_EVENTS2:
+   case VK_CMD_WRITE_TIMESTAMP2:
+      return true;
+   default:
+      /* begin query records itself once it emitted the current state */
+      return false;
+   }
+}
 
-   LIST_FOR_EACH_ENTRY(cmd, &cmd_buffer->vk.cmd_queue.cmds, cmd_link) {
-      switch (cmd->type) {
-      case VK_CMD_BIND_PIPELINE:
-         handle_pipeline(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT:
-         handle_set_viewport(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT_WITH_COUNT:
-         handle_set_viewport_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR:
-         handle_set_scissor(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR_WITH_COUNT:
-         handle_set_scissor_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_WIDTH:
-         handle_set_line_width(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS:
-         handle_set_depth_bias(cmd, state);
-         break;
-      case VK_CMD_SET_BLEND_CONSTANTS:
-         handle_set_blend_constants(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS:
-         handle_set_depth_bounds(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_COMPARE_MASK:
-         handle_set_stencil_compare_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_WRITE_MASK:
-         handle_set_stencil_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_REFERENCE:
-         handle_set_stencil_reference(cmd, state);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_SETS:
-         handle_descriptor_sets(cmd, state);
-         break;
-      case VK_CMD_BIND_INDEX_BUFFER:
-         handle_index_buffer(cmd, state);
+/* Commands whose effect depends on more than the recorded calls. */
+static bool
+cmd_can_compile(enum vk_cmd_type type)
+{
+   switch (type) {
+   case VK_CMD_EXECUTE_COMMANDS:
+   case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
+   case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
+   case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
+   case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
+   case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
+   case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
+      return false;
+   default:
+      return true;
+   }
+}
+
+static void lvp_execute_cmd(struct vk_cmd_queue_entry *cmd,
+                            struct rendering_state *state)
+{
+   if (state->rec) {
+      if (!cmd_can_compile(cmd->type))
+         state->rec->failed = true;
+      else if (cmd_is_opaque(cmd->type))
+         rec_cmd(state, cmd);
+   }
+
+   switch (cmd->type) {
+   case VK_CMD_BIND_PIPELINE:
+      handle_pipeline(cmd, state);
+      break;
+   case VK_CMD_SET_VIEWPORT:
+      handle_set_viewport(cmd, state);
+      break;
+   case VK_CMD_SET_VIEWPORT_WITH_COUNT:
+      handle_set_viewport_with_count(cmd, state);
+      break;
+   case VK_CMD_SET_SCISSOR:
+      handle_set_scissor(cmd, state);
+      break;
+   case VK_CMD_SET_SCISSOR_WITH_COUNT:
+      handle_set_scissor_with_count(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_WIDTH:
+      handle_set_line_width(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BIAS:
+      handle_set_depth_bias(cmd, state);
+      break;
+   case VK_CMD_SET_BLEND_CONSTANTS:
+      handle_set_blend_constants(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BOUNDS:
+      handle_set_depth_bounds(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_COMPARE_MASK:
+      handle_set_stencil_compare_mask(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_WRITE_MASK:
+      handle_set_stencil_write_mask(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_REFERENCE:
+      handle_set_stencil_reference(cmd, state);
+      break;
+   case VK_CMD_BIND_DESCRIPTOR_SETS:
+      handle_descriptor_sets(cmd, state);
+      break;
+   case VK_CMD_BIND_INDEX_BUFFER:
+      handle_index_buffer(cmd, state);
+      break;
+   case VK_CMD_BIND_VERTEX_BUFFERS2:
+      handle_vertex_buffers2(cmd, state);
+      break;
+   case VK_CMD_DRAW:
+      emit_state(state);
+      handle_draw(cmd, state);
+      break;
+   case VK_CMD_DRAW_MULTI_EXT:
+      emit_state(state);
+      handle_draw_multi(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDEXED:
+      emit_state(state);
+      handle_draw_indexed(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDIRECT:
+      emit_state(state);
+      handle_draw_indirect(cmd, state, false);
+      break;
+   case VK_CMD_DRAW_INDEXED_INDIRECT:
+      emit_state(state);
+      handle_draw_indirect(cmd, state, true);
+      break;
+   case VK_CMD_DRAW_MULTI_INDEXED_EXT:
+      emit_state(state);
+      handle_draw_multi_indexed(cmd, state);
+      break;
+   case VK_CMD_DISPATCH:
+      emit_compute_state(state);
+      handle_dispatch(cmd, state);
+      break;
+   case VK_CMD_DISPATCH_BASE:
+      emit_compute_state(state);
+      handle_dispatch_base(cmd, state);
+      break;
+   case VK_CMD_DISPATCH_INDIRECT:
+      emit_compute_state(state);
+      handle_dispatch_indirect(cmd, state);
+      break;
+   case VK_CMD_COPY_BUFFER2:
+      handle_copy_buffer(cmd, state);
+      break;
+   case VK_CMD_COPY_IMAGE2:
+      handle_copy_image(cmd, state);
+      break;
+   case VK_CMD_BLIT_IMAGE2:
+      handle_blit_image(cmd, state);
+      break;
+   case VK_CMD_COPY_BUFFER_TO_IMAGE2:
+      handle_copy_buffer_to_image(cmd, state);
+      break;
+   case VK_CMD_COPY_IMAGE_TO_BUFFER2:
+      handle_copy_image_to_buffer2(cmd, state);
+      break;
+   case VK_CMD_UPDATE_BUFFER:
+      handle_update_buffer(cmd, state);
+      break;
+   case VK_CMD_FILL_BUFFER:
+      handle_fill_buffer(cmd, state);
+      break;
+   case VK_CMD_CLEAR_COLOR_IMAGE:
+      handle_clear_color_image(cmd, state);
+      break;
+   case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
+      handle_clear_ds_image(cmd, state);
+      break;
+   case VK_CMD_CLEAR_ATTACHMENTS:
+      handle_clear_attachments(cmd, state);
+      break;
+   case VK_CMD_RESOLVE_IMAGE2:
+      handle_resolve_image(cmd, state);
+      break;
+   case VK_CMD_PIPELINE_BARRIER2:
+      handle_pipeline_barrier(cmd, state);
+      break;
+   case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
+      handle_begin_query_indexed_ext(cmd, state);
+      break;
+   case VK_CMD_END_QUERY_INDEXED_EXT:
+      handle_end_query_indexed_ext(cmd, state);
+      break;
+   case VK_CMD_BEGIN_QUERY:
+      handle_begin_query(cmd, state);
+      break;
+   case VK_CMD_END_QUERY:
+      handle_end_query(cmd, state);
+      break;
+   case VK_CMD_RESET_QUERY_POOL:
+      handle_reset_query_pool(cmd, state);
+      break;
+   case VK_CMD_COPY_QUERY_POOL_RESULTS:
+      handle_copy_query_pool_results(cmd, state);
+      break;
+   case VK_CMD_PUSH_CONSTANTS:
+      handle_push_constants(cmd, state);
+      break;
+   case VK_CMD_EXECUTE_COMMANDS:
+      handle_execute_commands(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDIRECT_COUNT:
+      emit_state(state);
+      handle_draw_indirect_count(cmd, state, false);
+      break;
+   case VK_CMD_DRAW_INDEXED_INDIRECT_COUNT:
+      emit_state(state);
+      handle_draw_indirect_count(cmd, state, true);
+      break;
+   case VK_CMD_PUSH_DESCRIPTOR_SET_KHR:
+      handle_push_descriptor_set(cmd, state);
+      break;
+   case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE_KHR:
+      handle_push_descriptor_set_with_template(cmd, state);
+      break;
+   case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
+      handle_bind_transform_feedback_buffers(cmd, state);
+      break;
+   case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
+      handle_begin_transform_feedback(cmd, state);
+      break;
+   case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
+      handle_end_transform_feedback(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
+      emit_state(state);
+      handle_draw_indirect_byte_count(cmd, state);
+      break;
+   case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
+      handle_begin_conditional_rendering(cmd, state);
+      break;
+   case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
+      handle_end_conditional_rendering(state);
+      break;
+   case VK_CMD_SET_VERTEX_INPUT_EXT:
+      handle_set_vertex_input(cmd, state);
+      break;
+   case VK_CMD_SET_CULL_MODE:
+      handle_set_cull_mode(cmd, state);
+      break;
+   case VK_CMD_SET_FRONT_FACE:
+      handle_set_front_face(cmd, state);
+      break;
+   case VK_CMD_SET_PRIMITIVE_TOPOLOGY:
+      handle_set_primitive_topology(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_TEST_ENABLE:
+      handle_set_depth_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_WRITE_ENABLE:
+      handle_set_depth_write_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_COMPARE_OP:
+      handle_set_depth_compare_op(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE:
+      handle_set_depth_bounds_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_TEST_ENABLE:
+      handle_set_stencil_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_OP:
+      handle_set_stencil_op(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_STIPPLE_EXT:
+      handle_set_line_stipple(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BIAS_ENABLE:
+      handle_set_depth_bias_enable(cmd, state);
+      break;
+   case VK_CMD_SET_LOGIC_OP_EXT:
+      handle_set_logic_op(cmd, state);
+      break;
+   case VK_CMD_SET_PATCH_CONTROL_POINTS_EXT:
+      handle_set_patch_control_points(cmd, state);
+      break;
+   case VK_CMD_SET_PRIMITIVE_RESTART_ENABLE:
+      handle_set_primitive_restart_enable(cmd, state);
+      break;
+   case VK_CMD_SET_RASTERIZER_DISCARD_ENABLE:
+      handle_set_rasterizer_discard_enable(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_WRITE_ENABLE_EXT:
+      handle_set_color_write_enable(cmd, state);
+      break;
+   case VK_CMD_BEGIN_RENDERING:
+      handle_begin_rendering(cmd, state);
+      break;
+   case VK_CMD_END_RENDERING:
+      handle_end_rendering(cmd, state);
+      break;
+   case VK_CMD_SET_DEVICE_MASK:
+      /* no-op */
+      break;
+   case VK_CMD_RESET_EVENT2:
+      handle_event_reset2(cmd, state);
+      break;
+   case VK_CMD_SET_EVENT2:
+      handle_event_set2(cmd, state);
+      break;
+   case VK_CMD_WAIT_EVENTS2:
+      handle_wait_events2(cmd, state);
+      break;
+   case VK_CMD_WRITE_TIMESTAMP2:
+      handle_write_timestamp2(cmd, state);
+      break;
+
+   case VK_CMD_SET_POLYGON_MODE_EXT:
+      handle_set_polygon_mode(cmd, state);
+      break;
+   case VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT:
+      handle_set_tessellation_domain_origin(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT:
+      handle_set_depth_clamp_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT:
+      handle_set_depth_clip_enable(cmd, state);
+      break;
+   case VK_CMD_SET_LOGIC_OP_ENABLE_EXT:
+      handle_set_logic_op_enable(cmd, state);
+      break;
+   case VK_CMD_SET_SAMPLE_MASK_EXT:
+      handle_set_sample_mask(cmd, state);
+      break;
+   case VK_CMD_SET_RASTERIZATION_SAMPLES_EXT:
+      handle_set_samples(cmd, state);
+      break;
+   case VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT:
+      handle_set_alpha_to_coverage(cmd, state);
+      break;
+   case VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT:
+      handle_set_alpha_to_one(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT:
+      handle_set_halfz(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT:
+      handle_set_line_rasterization_mode(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT:
+      handle_set_line_stipple_enable(cmd, state);
+      break;
+   case VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT:
+      handle_set_provoking_vertex_mode(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
+      handle_set_color_blend_enable(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
+      handle_set_color_write_mask(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
+      handle_set_color_blend_equation(cmd, state);
+      break;
+
+   default:
+      fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
+      unreachable("Unsupported command");
+      break;
+   }
+}
+
+static void
+replay_compiled(const struct lvp_cmd_compiled *compiled,
+                struct rendering_state *state)
+{
+   struct pipe_context *pctx = state->pctx;
+   const uint8_t *p = compiled->pkts.data;
+   const uint8_t *end = p + compiled->pkts.size;
+
+   while (p < end) {
+      const struct lvp_pkt *pkt = (const struct lvp_pkt *)p;
+      const void *data = p + LVP_PKT_HEADER_SIZE;
+      enum pipe_shader_type sh = pkt->sh;
+
+      switch (pkt->type) {
+      case LVP_PKT_SHADER:
+         bind_shader(state, sh, *(void *const *)data);
          break;
-      case VK_CMD_BIND_VERTEX_BUFFERS2:
-         handle_vertex_buffers2(cmd, state);
+      case LVP_PKT_BLEND:
+         cso_set_blend(state->cso, data);
          break;
-      case VK_CMD_DRAW:
-         emit_state(state);
-         handle_draw(cmd, state);
+      case LVP_PKT_RASTERIZER:
+         cso_set_rasterizer(state->cso, data);
          break;
-      case VK_CMD_DRAW_MULTI_EXT:
-         emit_state(state);
-         handle_draw_multi(cmd, state);
+      case LVP_PKT_DSA:
+         cso_set_depth_stencil_alpha(state->cso, data);
          break;
-      case VK_CMD_DRAW_INDEXED:
-         emit_state(state);
-         handle_draw_indexed(cmd, state);
+      case LVP_PKT_SAMPLE_MASK:
+         cso_set_sample_mask(state->cso, *(const uint32_t *)data);
          break;
-      case VK_CMD_DRAW_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, false);
+      case LVP_PKT_MIN_SAMPLES:
+         cso_set_min_samples(state->cso, *(const unsigned *)data);
          break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, true);
+      case LVP_PKT_BLEND_COLOR:
+         pctx->set_blend_color(pctx, data);
          break;
-      case VK_CMD_DRAW_MULTI_INDEXED_EXT:
-         emit_state(state);
-         handle_draw_multi_indexed(cmd, state);
+      case LVP_PKT_STENCIL_REF:
+         cso_set_stencil_ref(state->cso, *(const struct pipe_stencil_ref *)data);
          break;
-      case VK_CMD_DISPATCH:
-         emit_compute_state(state);
-         handle_dispatch(cmd, state);
+      case LVP_PKT_VERTEX_BUFFERS:
+         cso_set_vertex_buffers(state->cso, pkt->slot,
+                                pkt->size / sizeof(struct pipe_vertex_buffer),
+                                0, false, data);
          break;
-      case VK_CMD_DISPATCH_BASE:
-         emit_compute_state(state);
-         handle_dispatch_base(cmd, state);
+      case LVP_PKT_VERTEX_ELEMENTS:
+         cso_set_vertex_elements(state->cso, data);
          break;
-      case VK_CMD_DISPATCH_INDIRECT:
-         emit_compute_state(state);
-         handle_dispatch_indirect(cmd, state);
+      case LVP_PKT_CONSTANT_BUFFER:
+         pctx->set_constant_buffer(pctx, sh, pkt->slot, false, data);
          break;
-      case VK_CMD_COPY_BUFFER2:
-         handle_copy_buffer(cmd, state);
+      case LVP_PKT_UBO0: {
+         struct pipe_constant_buffer cbuf;
+         cbuf.buffer_size = pkt->size;
+         cbuf.buffer = NULL;
+         cbuf.user_buffer = NULL;
+         u_upload_data(state->uploader, 0, pkt->size, 64, data,
+                       &cbuf.buffer_offset, &cbuf.buffer);
+         pctx->set_constant_buffer(pctx, sh, 0, true, &cbuf);
          break;
-      case VK_CMD_COPY_IMAGE2:
-         handle_copy_image(cmd, state);
+      }
+      case LVP_PKT_SHADER_BUFFERS:
+         pctx->set_shader_buffers(pctx, sh, 0,
+                                  pkt->size / sizeof(struct pipe_shader_buffer),
+                                  data, pkt->slot);
          break;
-      case VK_CMD_BLIT_IMAGE2:
-         handle_blit_image(cmd, state);
+      case LVP_PKT_SHADER_IMAGES:
+         pctx->set_shader_images(pctx, sh, 0,
+                                 pkt->size / sizeof(struct pipe_image_view),
+                                 0, data);
          break;
-      case VK_CMD_COPY_BUFFER_TO_IMAGE2:
-         handle_copy_buffer_to_image(cmd, state);
+      case LVP_PKT_SAMPLER_VIEWS:
+         pctx->set_sampler_views(pctx, sh, 0,
+                                 pkt->size / sizeof(struct pipe_sampler_view *),
+                                 0, false, (struct pipe_sampler_view **)data);
          break;
-      case VK_CMD_COPY_IMAGE_TO_BUFFER2:
-         handle_copy_image_to_buffer2(cmd, state);
+      case LVP_PKT_SAMPLERS: {
+         const struct pipe_sampler_state *ss = data;
+         unsigned count = pkt->size / sizeof(*ss);
+         for (unsigned i = 0; i < count; i++)
+            state->cso_ss_ptr[sh][i] = &ss[i];
+         cso_set_samplers(state->cso, sh, count, state->cso_ss_ptr[sh]);
          break;
-      case VK_CMD_UPDATE_BUFFER:
-         handle_update_buffer(cmd, state);
+      }
+      case LVP_PKT_VIEWPORTS:
+         pctx->set_viewport_states(pctx, 0, pkt->size / sizeof(struct pipe_viewport_state), data);
          break;
-      case VK_CMD_FILL_BUFFER:
-         handle_fill_buffer(cmd, state);
+      case LVP_PKT_SCISSORS:
+         pctx->set_scissor_states(pctx, 0, pkt->size / sizeof(struct pipe_scissor_state), data);
          break;
-      case VK_CMD_CLEAR_COLOR_IMAGE:
-         handle_clear_color_image(cmd, state);
+      case LVP_PKT_FB_SAMPLES:
+         state->framebuffer.samples = pkt->slot;
+         pctx->set_framebuffer_state(pctx, &state->framebuffer);
          break;
-      case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
-         handle_clear_ds_image(cmd, state);
+      case LVP_PKT_DRAW: {
+         const struct lvp_pkt_draw *draw = data;
+         pctx->set_patch_vertices(pctx, draw->patch_vertices);
+         pctx->draw_vbo(pctx, &draw->info, 0,
+                        draw->has_indirect ? &draw->indirect : NULL,
+                        draw->draws, draw->num_draws);
          break;
-      case VK_CMD_CLEAR_ATTACHMENTS:
-         handle_clear_attachments(cmd, state);
+      }
+      case LVP_PKT_GRID:
+         pctx->launch_grid(pctx, data);
          break;
-      case VK_CMD_RESOLVE_IMAGE2:
-         handle_resolve_image(cmd, state);
+      case LVP_PKT_CMD:
+         lvp_execute_cmd(*(struct vk_cmd_queue_entry *const *)data, state);
          break;
-      case VK_CMD_PIPELINE_BARRIER2:
+      default:
+         unreachable("invalid packet");
+      }
+
+      p += LVP_PKT_HEADER_SIZE + ALIGN_POT(pkt->size, 8);
+   }
+}
+
+static void
+rec_init(struct lvp_cmd_recorder *rec)
+{
+   memset(rec, 0, sizeof(*rec));
+   util_dynarray_init(&rec->pkts, NULL);
+   rec->sets = _mesa_pointer_set_create(NULL);
+   if (!rec->sets)
+      rec->failed = true;
+}
+
+static struct lvp_cmd_compiled *
+rec_finish(struct lvp_cmd_recorder *rec, unsigned queue_index)
+{
+   struct lvp_cmd_compiled *compiled = NULL;
+
+   if (!rec->failed) {
+      unsigned num_sets = rec->sets->entries;
+      compiled = malloc(sizeof(*compiled) + num_sets * sizeof(compiled->sets[0]));
+   }
+   if (compiled) {
+      compiled->ref_cnt = 1;
+      compiled->queue_index = queue_index;
+      compiled->pkts = rec->pkts;
+      compiled->num_sets = 0;
+      set_foreach(rec->sets, entry) {
+         const struct lvp_descriptor_set *set = entry->key;
+         compiled->sets[compiled->num_sets].set = set;
+         compiled->sets[compiled->num_sets].generation = p_atomic_read(&set->generation);
+         compiled->num_sets++;
+      }
+   } else {
+      util_dynarray_fini(&rec->pkts);
+   }
+   _mesa_set_destroy(rec->sets, NULL);
+   return compiled;
+}
+
+void
+lvp_cmd_compiled_unref(struct lvp_cmd_compiled *compiled)
+{
+   if (compiled && p_atomic_dec_zero(&compiled->ref_cnt)) {
+      util_dynarray_fini(&compiled->pkts);
+      free(compiled);
+   }
+}
+
+static bool
+compiled_valid(const struct lvp_cmd_compiled *compiled, unsigned queue_index)
+{
+   /* sampler views and shader CSOs are per queue */
+   if (compiled->queue_index != queue_index)
+      return false;
+   for (unsigned i = 0; i < compiled->num_sets; i++) {
+      if (p_atomic_read(&compiled->sets[i].set->generation) != compiled->sets[i].generation)
+         return false;
+   }
+   return true;
+}
+
+/* Returns a reference to the compiled form of cmd_buffer if it can be
+ * replayed on this queue, otherwise NULL with *compile set if this
+ * execution should compile it.
+ */
+static struct lvp_cmd_compiled *
+get_compiled(struct lvp_cmd_buffer *cmd_buffer, unsigned queue_index,
+             bool *compile)
+{
+   struct lvp_cmd_compiled *compiled;
+
+   simple_mtx_lock(&cmd_buffer->compile_lock);
+   compiled = cmd_buffer->compiled;
+   if (compiled && !compiled_valid(compiled, queue_index)) {
+      cmd_buffer->compiled = NULL;
+      lvp_cmd_compiled_unref(compiled);
+      compiled = NULL;
+   }
+   if (compiled)
+      p_atomic_inc(&compiled->ref_cnt);
+   *compile = !compiled && !cmd_buffer->compile_failed;
+   simple_mtx_unlock(&cmd_buffer->compile_lock);
+
+   return compiled;
+}
+
+static void
+set_compiled(struct lvp_cmd_buffer *cmd_buffer, struct lvp_cmd_compiled *compiled)
+{
+   simple_mtx_lock(&cmd_buffer->compile_lock);
+   if (!compiled)
+      cmd_buffer->compile_failed = true;
+   else if (!cmd_buffer->compiled)
+      cmd_buffer->compiled = compiled;
+   else
+      lvp_cmd_compiled_unref(compiled);
+   simple_mtx_unlock(&cmd_buffer->compile_lock);
+}
+
+static void lvp_execute_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer,
+                                   struct rendering_state *state)
+{
+   struct vk_cmd_queue_entry *cmd;
+   bool first = true;
+   bool did_flush = false;
+
+   LIST_FOR_EACH_ENTRY(cmd, &cmd_buffer->vk.cmd_queue.cmds, cmd_link) {
+      if (cmd->type == VK_CMD_PIPELINE_BARRIER2) {
          /* skip flushes since every cmdbuf does a flush
             after iterating its cmds and so this is redundant
           */
          if (first || did_flush || cmd->cmd_link.next == &cmd_buffer->vk.cmd_queue.cmds)
             continue;
-         handle_pipeline_barrier(cmd, state);
          did_flush = true;
-         continue;
-      case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
-         handle_begin_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_END_QUERY_INDEXED_EXT:
-         handle_end_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_BEGIN_QUERY:
-         handle_begin_query(cmd, state);
-         break;
-      case VK_CMD_END_QUERY:
-         handle_end_query(cmd, state);
-         break;
-      case VK_CMD_RESET_QUERY_POOL:
-         handle_reset_query_pool(cmd, state);
-         break;
-      case VK_CMD_COPY_QUERY_POOL_RESULTS:
-         handle_copy_query_pool_results(cmd, state);
-         break;
-      case VK_CMD_PUSH_CONSTANTS:
-         handle_push_constants(cmd, state);
-         break;
-      case VK_CMD_EXECUTE_COMMANDS:
-         handle_execute_commands(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, false);
-         break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, true);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET_KHR:
-         handle_push_descriptor_set(cmd, state);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE_KHR:
-         handle_push_descriptor_set_with_template(cmd, state);
-         break;
-      case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
-         handle_bind_transform_feedback_buffers(cmd, state);
-         break;
-      case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
-         handle_begin_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
-         handle_end_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
-         emit_state(state);
-         handle_draw_indirect_byte_count(cmd, state);
-         break;
-      case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
-         handle_begin_conditional_rendering(cmd, state);
-         break;
-      case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
-         handle_end_conditional_rendering(state);
-         break;
-      case VK_CMD_SET_VERTEX_INPUT_EXT:
-         handle_set_vertex_input(cmd, state);
-         break;
-      case VK_CMD_SET_CULL_MODE:
-         handle_set_cull_mode(cmd, state);
-         break;
-      case VK_CMD_SET_FRONT_FACE:
-         handle_set_front_face(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_TOPOLOGY:
-         handle_set_primitive_topology(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_TEST_ENABLE:
-         handle_set_depth_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_WRITE_ENABLE:
-         handle_set_depth_write_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_COMPARE_OP:
-         handle_set_depth_compare_op(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE:
-         handle_set_depth_bounds_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_TEST_ENABLE:
-         handle_set_stencil_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_OP:
-         handle_set_stencil_op(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE_EXT:
-         handle_set_line_stipple(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS_ENABLE:
-         handle_set_depth_bias_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_EXT:
-         handle_set_logic_op(cmd, state);
-         break;
-      case VK_CMD_SET_PATCH_CONTROL_POINTS_EXT:
-         handle_set_patch_control_points(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_RESTART_ENABLE:
-         handle_set_primitive_restart_enable(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZER_DISCARD_ENABLE:
-         handle_set_rasterizer_discard_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_ENABLE_EXT:
-         handle_set_color_write_enable(cmd, state);
-         break;
-      case VK_CMD_BEGIN_RENDERING:
-         handle_begin_rendering(cmd, state);
-         break;
-      case VK_CMD_END_RENDERING:
-         handle_end_rendering(cmd, state);
-         break;
-      case VK_CMD_SET_DEVICE_MASK:
-         /* no-op */
-         break;
-      case VK_CMD_RESET_EVENT2:
-         handle_event_reset2(cmd, state);
-         break;
-      case VK_CMD_SET_EVENT2:
-         handle_event_set2(cmd, state);
-         break;
-      case VK_CMD_WAIT_EVENTS2:
-         handle_wait_events2(cmd, state);
-         break;
-      case VK_CMD_WRITE_TIMESTAMP2:
-         handle_write_timestamp2(cmd, state);
-         break;
-
-      case VK_CMD_SET_POLYGON_MODE_EXT:
-         handle_set_polygon_mode(cmd, state);
-         break;
-      case VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT:
-         handle_set_tessellation_domain_origin(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT:
-         handle_set_depth_clamp_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT:
-         handle_set_depth_clip_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_ENABLE_EXT:
-         handle_set_logic_op_enable(cmd, state);
-         break;
-      case VK_CMD_SET_SAMPLE_MASK_EXT:
-         handle_set_sample_mask(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZATION_SAMPLES_EXT:
-         handle_set_samples(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT:
-         handle_set_alpha_to_coverage(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT:
-         handle_set_alpha_to_one(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT:
-         handle_set_halfz(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT:
-         handle_set_line_rasterization_mode(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT:
-         handle_set_line_stipple_enable(cmd, state);
-         break;
-      case VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT:
-         handle_set_provoking_vertex_mode(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
-         handle_set_color_blend_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
-         handle_set_color_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
-         handle_set_color_blend_equation(cmd, state);
-         break;
-
-      default:
-         fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
-         unreachable("Unsupported command");
-         break;
+      } else {
+         first = false;
+         did_flush = false;
       }
-      first = false;
-      did_flush = false;
+      lvp_execute_cmd(cmd, state);
    }
 }
 
@@ -4316,25 +4886,50 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_cmd_buffer *cmd_buffer)
 {
    struct rendering_state *state = queue->state;
+   struct lvp_cmd_compiled *compiled = NULL;
+   struct lvp_cmd_recorder rec;
+   bool compile = false;
+
    memset(state, 0, sizeof(*state));
    state->pctx = queue->ctx;
    state->uploader = queue->uploader;
    state->cso = queue->cso;
-   state->blend_dirty = true;
-   state->dsa_dirty = true;
-   state->rs_dirty = true;
-   state->vp_dirty = true;
-   state->rs_state.point_tri_clip = true;
-   state->rs_state.unclamped_fragment_depth_values = device->vk.enabled_extensions.EXT_depth_range_unrestricted;
-   state->sample_mask_dirty = true;
-   state->min_samples_dirty = true;
-   state->sample_mask = UINT32_MAX;
+   state->queue = queue;
+   state->queue_index = queue->index;
    for (enum pipe_shader_type s = PIPE_SHADER_VERTEX; s < PIPE_SHADER_TYPES; s++) {
       for (unsigned i = 0; i < ARRAY_SIZE(state->cso_ss_ptr[s]); i++)
          state->cso_ss_ptr[s][i] = &state->ss[s][i];
    }
-   /* create a gallium context */
-   lvp_execute_cmd_buffer(cmd_buffer, state);
+
+   if (cmd_buffer->compile)
+      compiled = get_compiled(cmd_buffer, queue->index, &compile);
+
+   if (compiled) {
+      /* nothing is dirty, so the state emitted by the commands run as they
+       * are (queries) is what the packets before them set
+       */
+      replay_compiled(compiled, state);
+      lvp_cmd_compiled_unref(compiled);
+   } else {
+      state->blend_dirty = true;
+      state->dsa_dirty = true;
+      state->rs_dirty = true;
+      state->vp_dirty = true;
+      state->rs_state.point_tri_clip = true;
+      state->rs_state.unclamped_fragment_depth_values = device->vk.enabled_extensions.EXT_depth_range_unrestricted;
+      state->sample_mask_dirty = true;
+      state->min_samples_dirty = true;
+      state->sample_mask = UINT32_MAX;
+
+      if (compile) {
+         rec_init(&rec);
+         state->rec = &rec;
+      }
+      /* create a gallium context */
+      lvp_execute_cmd_buffer(cmd_buffer, state);
+      if (compile)
+         set_compiled(cmd_buffer, rec_finish(&rec, queue->index));
+   }
 
    state->start_vb = -1;
    state->num_vb = 0;
@@ -277,7 +277,8 @@ lvp_CreateImageView(VkDevice _device,
    view->image = image;
    view->surface = NULL;
    view->iv = lvp_create_imageview(view);
-   view->sv = lvp_create_samplerview(device->queue.ctx, view);
+   for (unsigned i = 0; i < device->queue_count; i++)
+      view->sv[i] = lvp_create_samplerview(device->queues[i].ctx, view);
    *pView = lvp_image_view_to_handle(view);
 
    return VK_SUCCESS;
@@ -293,7 +294,8 @@ lvp_DestroyImageView(VkDevice _device, VkImageView _iview,
    if (!_iview)
      return;
 
-   pipe_sampler_view_reference(&iview->sv, NULL);
+   for (unsigned i = 0; i < device->queue_count; i++)
+      pipe_sampler_view_reference(&iview->sv[i], NULL);
    pipe_surface_reference(&iview->surface, NULL);
    vk_image_view_destroy(&device->vk, pAllocator, &iview->vk);
 }
@@ -515,7 +517,8 @@ lvp_CreateBufferView(VkDevice _device,
       view->range = view->buffer->size - view->offset;
    else
       view->range = pCreateInfo->range;
-   view->sv = lvp_create_samplerview_buffer(device->queue.ctx, view);
+   for (unsigned i = 0; i < device->queue_count; i++)
+      view->sv[i] = lvp_create_samplerview_buffer(device->queues[i].ctx, view);
    view->iv = lvp_create_imageview_buffer(view);
    *pView = lvp_buffer_view_to_handle(view);
 
@@ -531,7 +534,8 @@ lvp_DestroyBufferView(VkDevice _device, VkBufferView bufferView,
 
    if (!bufferView)
      return;
-   pipe_sampler_view_reference(&view->sv, NULL);
+   for (unsigned i = 0; i < device->queue_count; i++)
+      pipe_sampler_view_reference(&view->sv[i], NULL);
    vk_object_base_finish(&view->base);
    vk_free2(&device->vk.alloc, pAllocator, view);
 }
@@ -23,9 +23,11 @@
 
 #include "lvp_private.h"
 #include "vk_pipeline.h"
+#include "vk_pipeline_cache.h"
 #include "vk_render_pass.h"
 #include "vk_util.h"
 #include "glsl_types.h"
+#include "util/mesa-sha1.h"
 #include "util/os_time.h"
 #include "spirv/nir_spirv.h"
 #include "nir/nir_builder.h"
@@ -46,24 +48,47 @@
       dst = temp;                                                \
    } while(0)
 
+static bool
+pipeline_has_queue_state(const struct lvp_pipeline *pipeline, unsigned queue_index)
+{
+   for (unsigned i = 0; i < PIPE_SHADER_TYPES; i++) {
+      if (pipeline->shader_cso[queue_index][i])
+         return true;
+   }
+   return pipeline->tess_ccw_cso[queue_index] != NULL;
+}
+
+/* Deletes the CSOs the pipeline has in the queue's context. */
+void
+lvp_pipeline_destroy_queue_state(struct lvp_queue *queue, struct lvp_pipeline *pipeline)
+{
+   struct pipe_context *ctx = queue->ctx;
+   void **shader_cso = pipeline->shader_cso[queue->index];
+
+   if (shader_cso[PIPE_SHADER_VERTEX])
+      ctx->delete_vs_state(ctx, shader_cso[PIPE_SHADER_VERTEX]);
+   if (shader_cso[PIPE_SHADER_FRAGMENT])
+      ctx->delete_fs_state(ctx, shader_cso[PIPE_SHADER_FRAGMENT]);
+   if (shader_cso[PIPE_SHADER_GEOMETRY])
+      ctx->delete_gs_state(ctx, shader_cso[PIPE_SHADER_GEOMETRY]);
+   if (shader_cso[PIPE_SHADER_TESS_CTRL])
+      ctx->delete_tcs_state(ctx, shader_cso[PIPE_SHADER_TESS_CTRL]);
+   if (shader_cso[PIPE_SHADER_TESS_EVAL])
+      ctx->delete_tes_state(ctx, shader_cso[PIPE_SHADER_TESS_EVAL]);
+   if (shader_cso[PIPE_SHADER_COMPUTE])
+      ctx->delete_compute_state(ctx, shader_cso[PIPE_SHADER_COMPUTE]);
+   if (pipeline->tess_ccw_cso[queue->index])
+      ctx->delete_tes_state(ctx, pipeline->tess_ccw_cso[queue->index]);
+}
+
 void
 lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline)
 {
-   if (pipeline->shader_cso[PIPE_SHADER_VERTEX])
-      device->queue.ctx->delete_vs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
-   if (pipeline->shader_cso[PIPE_SHADER_FRAGMENT])
-      device->queue.ctx->delete_fs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
-   if (pipeline->shader_cso[PIPE_SHADER_GEOMETRY])
-      device->queue.ctx->delete_gs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_CTRL])
-      device->queue.ctx->delete_tcs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_EVAL])
-      device->queue.ctx->delete_tes_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
-   if (pipeline->shader_cso[PIPE_SHADER_COMPUTE])
-      device->queue.ctx->delete_compute_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
-
-   for (unsigned i = 0; i < MESA_SHADER_STAGES; i++)
+   for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
       ralloc_free(pipeline->pipeline_nir[i]);
+      if (pipeline->shader_objects[i])
+         vk_pipeline_cache_object_unref(pipeline->shader_objects[i]);
+   }
 
    if (pipeline->layout)
       vk_pipeline_layout_unref(&device->vk, &pipeline->layout->vk);
@@ -85,9 +110,25 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipeline(
    if (!_pipeline)
       return;
 
-   simple_mtx_lock(&device->queue.pipeline_lock);
-   util_dynarray_append(&device->queue.pipeline_destroys, struct lvp_pipeline*, pipeline);
-   simple_mtx_unlock(&device->queue.pipeline_lock);
+   /* Every queue with CSOs for the pipeline deletes them on its own thread,
+    * the last one frees the pipeline.  The first queue always takes part.
+    */
+   bool queues[LVP_MAX_QUEUES];
+   unsigned refs = 0;
+   for (unsigned i = 0; i < device->queue_count; i++) {
+      queues[i] = i == 0 || pipeline_has_queue_state(pipeline, i);
+      refs += queues[i];
+   }
+   p_atomic_set(&pipeline->destroy_refs, refs);
+
+   for (unsigned i = 0; i < device->queue_count; i++) {
+      if (!queues[i])
+         continue;
+      struct lvp_queue *queue = &device->queues[i];
+      simple_mtx_lock(&queue->pipeline_lock);
+      util_dynarray_append(&queue->pipeline_destroys, struct lvp_pipeline*, pipeline);
+      simple_mtx_unlock(&queue->pipeline_lock);
+   }
 }
 
 static void
@@ -357,13 +398,63 @@ lvp_shader_optimize(nir_shader *nir)
    nir_sweep(nir);
 }
 
+/* Everything lvp_shader_compile_to_nir() depends on besides the device. */
+static void
+lvp_hash_shader_stage(const struct lvp_pipeline *pipeline,
+                      const VkPipelineShaderStageCreateInfo *sinfo,
+                      unsigned char sha1[20])
+{
+   const struct lvp_pipeline_layout *layout = pipeline->layout;
+   gl_shader_stage stage = vk_to_mesa_shader_stage(sinfo->stage);
+   unsigned char stage_sha1[20];
+   struct mesa_sha1 ctx;
+
+   vk_pipeline_hash_shader_stage(sinfo, NULL, stage_sha1);
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, stage_sha1, sizeof(stage_sha1));
+
+   /* The parts of the layout lvp_lower_pipeline_layout() looks at */
+   if (layout) {
+      _mesa_sha1_update(&ctx, &layout->push_constant_size,
+                        sizeof(layout->push_constant_size));
+      _mesa_sha1_update(&ctx, &layout->push_constant_stages,
+                        sizeof(layout->push_constant_stages));
+      _mesa_sha1_update(&ctx, &layout->stage[stage], sizeof(layout->stage[stage]));
+      _mesa_sha1_update(&ctx, &layout->vk.set_count, sizeof(layout->vk.set_count));
+      for (unsigned s = 0; s < layout->vk.set_count; s++) {
+         const uint16_t no_set = UINT16_MAX;
+         if (!layout->vk.set_layouts[s]) {
+            _mesa_sha1_update(&ctx, &no_set, sizeof(no_set));
+            continue;
+         }
+         const struct lvp_descriptor_set_layout *set_layout =
+            vk_to_lvp_descriptor_set_layout(layout->vk.set_layouts[s]);
+         _mesa_sha1_update(&ctx, &set_layout->binding_count,
+                           sizeof(set_layout->binding_count));
+         _mesa_sha1_update(&ctx, &set_layout->stage[stage],
+                           sizeof(set_layout->stage[stage]));
+         for (unsigned b = 0; b < set_layout->binding_count; b++) {
+            const struct lvp_descriptor_set_binding_layout *binding =
+               &set_layout->binding[b];
+            _mesa_sha1_update(&ctx, &binding->type, sizeof(binding->type));
+            _mesa_sha1_update(&ctx, &binding->array_size, sizeof(binding->array_size));
+            _mesa_sha1_update(&ctx, &binding->valid, sizeof(binding->valid));
+            _mesa_sha1_update(&ctx, &binding->stage[stage], sizeof(binding->stage[stage]));
+         }
+      }
+   }
+
+   _mesa_sha1_final(&ctx, sha1);
+}
+
 static VkResult
-lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
-                         const VkPipelineShaderStageCreateInfo *sinfo)
+lvp_shader_compile_to_nir(struct lvp_pipeline *pipeline,
+                          const VkPipelineShaderStageCreateInfo *sinfo,
+                          nir_shader **out_nir)
 {
    struct lvp_device *pdevice = pipeline->device;
    gl_shader_stage stage = vk_to_mesa_shader_stage(sinfo->stage);
-   assert(stage <= MESA_SHADER_COMPUTE && stage != MESA_SHADER_NONE);
    VkResult result;
    nir_shader *nir;
 
@@ -506,9 +597,41 @@ lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
    nir_assign_io_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
                                nir->info.stage);
 
-   nir_function_impl *impl = nir_shader_get_entrypoint(nir);
-   if (impl->ssa_alloc > 100) //skip for small shaders
-      pipeline->inlines[stage].must_inline = lvp_find_inlinable_uniforms(pipeline, nir);
+   *out_nir = nir;
+   return VK_SUCCESS;
+}
+
+static VkResult
+lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
+                         struct vk_pipeline_cache *cache,
+                         const VkPipelineShaderStageCreateInfo *sinfo)
+{
+   gl_shader_stage stage = vk_to_mesa_shader_stage(sinfo->stage);
+   assert(stage <= MESA_SHADER_COMPUTE && stage != MESA_SHADER_NONE);
+   unsigned char sha1[20];
+   nir_shader *nir = NULL;
+
+   if (cache) {
+      lvp_hash_shader_stage(pipeline, sinfo, sha1);
+      nir = lvp_pipeline_cache_lookup_shader(cache, sha1, pipeline, stage);
+   }
+
+   if (!nir) {
+      VkResult result = lvp_shader_compile_to_nir(pipeline, sinfo, &nir);
+      if (result != VK_SUCCESS)
+         return result;
+
+      nir_function_impl *impl = nir_shader_get_entrypoint(nir);
+      if (impl->ssa_alloc > 100) //skip for small shaders
+         pipeline->inlines[stage].must_inline = lvp_find_inlinable_uniforms(pipeline, nir);
+
+      /* ssa_alloc doesn't survive serialization, so the inlining info is
+       * cached rather than recomputed.
+       */
+      if (cache)
+         lvp_pipeline_cache_add_shader(cache, sha1, pipeline, nir);
+   }
+
    pipeline->pipeline_nir[stage] = nir;
 
    return VK_SUCCESS;
@@ -593,34 +716,41 @@ lvp_pipeline_xfb_init(struct lvp_pipeline *pipeline)
    }
 }
 
+/* Code for shaders with inlined uniforms isn't shared through the pipeline
+ * cache, it only fits the values it was inlined with.
+ */
 void *
-lvp_pipeline_compile_stage(struct lvp_pipeline *pipeline, nir_shader *nir)
+lvp_pipeline_compile_stage(struct lvp_pipeline *pipeline, struct pipe_context *pctx,
+                           nir_shader *nir, bool inlined)
 {
-   struct lvp_device *device = pipeline->device;
+   void *code_cache_data = inlined ? NULL : pipeline->shader_objects[nir->info.stage];
+
    if (nir->info.stage == MESA_SHADER_COMPUTE) {
       struct pipe_compute_state shstate = {0};
       shstate.prog = nir;
       shstate.ir_type = PIPE_SHADER_IR_NIR;
       shstate.req_local_mem = nir->info.shared_size;
-      return device->queue.ctx->create_compute_state(device->queue.ctx, &shstate);
+      shstate.code_cache_data = code_cache_data;
+      return pctx->create_compute_state(pctx, &shstate);
    } else {
       struct pipe_shader_state shstate = {0};
       shstate.type = PIPE_SHADER_IR_NIR;
       shstate.ir.nir = nir;
+      shstate.code_cache_data = code_cache_data;
       if (nir->info.stage == pipeline->last_vertex)
          memcpy(&shstate.stream_output, &pipeline->stream_output, sizeof(shstate.stream_output));
 
       switch (nir->info.stage) {
       case MESA_SHADER_FRAGMENT:
-         return device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+         return pctx->create_fs_state(pctx, &shstate);
       case MESA_SHADER_VERTEX:
-         return device->queue.ctx->create_vs_state(device->queue.ctx, &shstate);
+         return pctx->create_vs_state(pctx, &shstate);
       case MESA_SHADER_GEOMETRY:
-         return device->queue.ctx->create_gs_state(device->queue.ctx, &shstate);
+         return pctx->create_gs_state(pctx, &shstate);
       case MESA_SHADER_TESS_CTRL:
-         return device->queue.ctx->create_tcs_state(device->queue.ctx, &shstate);
+         return pctx->create_tcs_state(pctx, &shstate);
       case MESA_SHADER_TESS_EVAL:
-         return device->queue.ctx->create_tes_state(device->queue.ctx, &shstate);
+         return pctx->create_tes_state(pctx, &shstate);
       default:
          unreachable("illegal shader");
          break;
@@ -630,11 +760,12 @@ lvp_pipeline_compile_stage(struct lvp_pipeline *pipeline, nir_shader *nir)
 }
 
 void *
-lvp_pipeline_compile(struct lvp_pipeline *pipeline, nir_shader *nir)
+lvp_pipeline_compile(struct lvp_pipeline *pipeline, struct pipe_context *pctx,
+                     nir_shader *nir, bool inlined)
 {
    struct lvp_device *device = pipeline->device;
    device->physical_device->pscreen->finalize_nir(device->physical_device->pscreen, nir);
-   return lvp_pipeline_compile_stage(pipeline, nir);
+   return lvp_pipeline_compile_stage(pipeline, pctx, nir, inlined);
 }
 
 #ifndef NDEBUG
@@ -729,7 +860,7 @@ merge_layouts(struct vk_device *device, struct lvp_pipeline *dst, struct lvp_pip
 static VkResult
 lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
                            struct lvp_device *device,
-                           struct lvp_pipeline_cache *cache,
+                           struct vk_pipeline_cache *cache,
                            const VkGraphicsPipelineCreateInfo *pCreateInfo)
 {
    VkResult result;
@@ -818,7 +949,7 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
          if (!(pipeline->stages & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT))
             continue;
       }
-      result = lvp_shader_compile_to_ir(pipeline, sinfo);
+      result = lvp_shader_compile_to_ir(pipeline, cache, sinfo);
       if (result != VK_SUCCESS)
          goto fail;
 
@@ -851,11 +982,15 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
           if (p->stages & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT) {
              if (p->pipeline_nir[MESA_SHADER_FRAGMENT])
                 pipeline->pipeline_nir[MESA_SHADER_FRAGMENT] = nir_shader_clone(pipeline->mem_ctx, p->pipeline_nir[MESA_SHADER_FRAGMENT]);
+             if (p->shader_objects[MESA_SHADER_FRAGMENT])
+                pipeline->shader_objects[MESA_SHADER_FRAGMENT] = vk_pipeline_cache_object_ref(p->shader_objects[MESA_SHADER_FRAGMENT]);
           }
           if (p->stages & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT) {
              for (unsigned j = MESA_SHADER_VERTEX; j < MESA_SHADER_FRAGMENT; j++) {
                 if (p->pipeline_nir[j])
                    pipeline->pipeline_nir[j] = nir_shader_clone(pipeline->mem_ctx, p->pipeline_nir[j]);
+                if (p->shader_objects[j])
+                   pipeline->shader_objects[j] = vk_pipeline_cache_object_ref(p->shader_objects[j]);
              }
              if (p->tess_ccw)
                 pipeline->tess_ccw = nir_shader_clone(pipeline->mem_ctx, p->tess_ccw);
@@ -884,11 +1019,13 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
          assert(stage == pipeline->pipeline_nir[i]->info.stage);
          enum pipe_shader_type pstage = pipe_shader_type_from_mesa(stage);
          if (!pipeline->inlines[stage].can_inline) {
-            pipeline->shader_cso[pstage] = lvp_pipeline_compile(pipeline,
-                                                                nir_shader_clone(NULL, pipeline->pipeline_nir[stage]));
+            pipeline->shader_cso[0][pstage] = lvp_pipeline_compile(pipeline, device->queues[0].ctx,
+                                                                   nir_shader_clone(NULL, pipeline->pipeline_nir[stage]),
+                                                                   false);
             if (pipeline->tess_ccw)
-               pipeline->tess_ccw_cso = lvp_pipeline_compile(pipeline,
-                                                             nir_shader_clone(NULL, pipeline->tess_ccw));
+               pipeline->tess_ccw_cso[0] = lvp_pipeline_compile(pipeline, device->queues[0].ctx,
+                                                                nir_shader_clone(NULL, pipeline->tess_ccw),
+                                                                false);
          }
          if (stage == MESA_SHADER_FRAGMENT)
             has_fragment_shader = true;
@@ -903,7 +1040,7 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
          struct pipe_shader_state shstate = {0};
          shstate.type = PIPE_SHADER_IR_NIR;
          shstate.ir.nir = nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_FRAGMENT]);
-         pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+         pipeline->shader_cso[0][PIPE_SHADER_FRAGMENT] = device->queues[0].ctx->create_fs_state(device->queues[0].ctx, &shstate);
       }
    }
    return VK_SUCCESS;
@@ -912,6 +1049,8 @@ fail:
    for (unsigned i = 0; i < ARRAY_SIZE(pipeline->pipeline_nir); i++) {
       if (pipeline->pipeline_nir[i])
          ralloc_free(pipeline->pipeline_nir[i]);
+      if (pipeline->shader_objects[i])
+         vk_pipeline_cache_object_unref(pipeline->shader_objects[i]);
    }
    vk_free(&device->vk.alloc, pipeline->state_data);
 
@@ -926,7 +1065,7 @@ lvp_graphics_pipeline_create(
    VkPipeline *pPipeline)
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, _cache);
    struct lvp_pipeline *pipeline;
    VkResult result;
 
@@ -994,7 +1133,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateGraphicsPipelines(
 static VkResult
 lvp_compute_pipeline_init(struct lvp_pipeline *pipeline,
                           struct lvp_device *device,
-                          struct lvp_pipeline_cache *cache,
+                          struct vk_pipeline_cache *cache,
                           const VkComputePipelineCreateInfo *pCreateInfo)
 {
    pipeline->device = device;
@@ -1005,12 +1144,14 @@ lvp_compute_pipeline_init(struct lvp_pipeline *pipeline,
    pipeline->mem_ctx = ralloc_context(NULL);
    pipeline->is_compute_pipeline = true;
 
-   VkResult result = lvp_shader_compile_to_ir(pipeline, &pCreateInfo->stage);
+   VkResult result = lvp_shader_compile_to_ir(pipeline, cache, &pCreateInfo->stage);
    if (result != VK_SUCCESS)
       return result;
 
    if (!pipeline->inlines[MESA_SHADER_COMPUTE].can_inline)
-      pipeline->shader_cso[PIPE_SHADER_COMPUTE] = lvp_pipeline_compile(pipeline, nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_COMPUTE]));
+      pipeline->shader_cso[0][PIPE_SHADER_COMPUTE] = lvp_pipeline_compile(pipeline, device->queues[0].ctx,
+                                                                         nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_COMPUTE]),
+                                                                         false);
    return VK_SUCCESS;
 }
 
@@ -1022,7 +1163,7 @@ lvp_compute_pipeline_create(
    VkPipeline *pPipeline)
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, _cache);
    struct lvp_pipeline *pipeline;
    VkResult result;
 
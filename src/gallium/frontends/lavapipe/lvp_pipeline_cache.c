@@ -23,80 +23,329 @@
 
 #include "lvp_private.h"
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineCache(
-    VkDevice                                    _device,
-    const VkPipelineCacheCreateInfo*            pCreateInfo,
-    const VkAllocationCallbacks*                pAllocator,
-    VkPipelineCache*                            pPipelineCache)
+#include "nir_serialize.h"
+#include "util/blob.h"
+#include "util/u_atomic.h"
+#include "util/u_dynarray.h"
+
+/*
+ * Shaders are cached as NIR after all of the lowering lvp_pipeline.c does,
+ * together with the access and inlining info gathered on the way.  The code
+ * llvmpipe generates for them depends on state only known at draw time, so
+ * it is added to the shader's cache object as llvmpipe compiles it (see
+ * pipe_screen::set_shader_code_cache), and written out with the shader.
+ * Pipelines keep a reference to their shaders' cache objects for that.
+ */
+
+/* Variants compiled beyond this are not cached. */
+#define LVP_MAX_SHADER_CODE 64
+
+struct lvp_shader_code {
+   unsigned char key[20];
+   uint32_t size;
+   uint8_t data[0];
+};
+
+struct lvp_shader_cache_object {
+   struct vk_pipeline_cache_object base;
+   unsigned char sha1[20];
+
+   struct lvp_access_info access;
+   struct lvp_inline_info inlines;
+
+   simple_mtx_t code_lock;
+   struct util_dynarray code; /* struct lvp_shader_code * */
+
+   size_t nir_size;
+   uint8_t nir[0];
+};
+
+static const struct vk_pipeline_cache_object_ops lvp_shader_cache_object_ops;
+
+static struct lvp_shader_cache_object *
+lvp_shader_cache_object_create(struct vk_device *device,
+                               const unsigned char sha1[20],
+                               const struct lvp_access_info *access,
+                               const struct lvp_inline_info *inlines,
+                               const void *nir, size_t nir_size)
+{
+   struct lvp_shader_cache_object *shader =
+      vk_alloc(&device->alloc, sizeof(*shader) + nir_size, 8,
+               VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!shader)
+      return NULL;
+
+   memcpy(shader->sha1, sha1, sizeof(shader->sha1));
+   vk_pipeline_cache_object_init(device, &shader->base,
+                                 &lvp_shader_cache_object_ops,
+                                 shader->sha1, sizeof(shader->sha1));
+   shader->access = *access;
+   shader->inlines = *inlines;
+   simple_mtx_init(&shader->code_lock, mtx_plain);
+   util_dynarray_init(&shader->code, NULL);
+   shader->nir_size = nir_size;
+   memcpy(shader->nir, nir, nir_size);
+
+   return shader;
+}
+
+/* Takes shader->code_lock */
+static bool
+lvp_shader_cache_object_add_code(struct lvp_shader_cache_object *shader,
+                                 const unsigned char key[20],
+                                 const void *data, size_t size)
+{
+   struct vk_device *device = shader->base.device;
+   bool added = false;
+
+   if (size > UINT32_MAX)
+      return false;
+
+   simple_mtx_lock(&shader->code_lock);
+   util_dynarray_foreach(&shader->code, struct lvp_shader_code *, code) {
+      if (!memcmp((*code)->key, key, sizeof((*code)->key)))
+         goto out;
+   }
+   if (util_dynarray_num_elements(&shader->code, struct lvp_shader_code *) >=
+       LVP_MAX_SHADER_CODE)
+      goto out;
+
+   struct lvp_shader_code *code =
+      vk_alloc(&device->alloc, sizeof(*code) + size, 8,
+               VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!code)
+      goto out;
+   memcpy(code->key, key, sizeof(code->key));
+   code->size = size;
+   memcpy(code->data, data, size);
+   if (!util_dynarray_grow(&shader->code, struct lvp_shader_code *, 1)) {
+      vk_free(&device->alloc, code);
+      goto out;
+   }
+   util_dynarray_top(&shader->code, struct lvp_shader_code *) = code;
+   added = true;
+
+out:
+   simple_mtx_unlock(&shader->code_lock);
+   return added;
+}
+
+static bool
+lvp_shader_cache_object_serialize(struct vk_pipeline_cache_object *object,
+                                  struct blob *blob)
+{
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
+
+   blob_write_bytes(blob, &shader->access, sizeof(shader->access));
+   blob_write_bytes(blob, &shader->inlines, sizeof(shader->inlines));
+   blob_write_uint32(blob, shader->nir_size);
+   blob_write_bytes(blob, shader->nir, shader->nir_size);
+
+   simple_mtx_lock(&shader->code_lock);
+   blob_write_uint32(blob, util_dynarray_num_elements(&shader->code,
+                                                      struct lvp_shader_code *));
+   util_dynarray_foreach(&shader->code, struct lvp_shader_code *, code) {
+      blob_write_bytes(blob, (*code)->key, sizeof((*code)->key));
+      blob_write_uint32(blob, (*code)->size);
+      blob_write_bytes(blob, (*code)->data, (*code)->size);
+   }
+   simple_mtx_unlock(&shader->code_lock);
+
+   return true;
+}
+
+static void
+lvp_shader_cache_object_destroy(struct vk_pipeline_cache_object *object);
+
+static struct vk_pipeline_cache_object *
+lvp_shader_cache_object_deserialize(struct vk_device *device,
+                                    const void *key_data, size_t key_size,
+                                    struct blob_reader *blob)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
-   struct lvp_pipeline_cache *cache;
+   struct lvp_access_info access;
+   struct lvp_inline_info inlines;
 
-   assert(pCreateInfo->sType == VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO);
+   if (key_size != 20)
+      return NULL;
 
-   cache = vk_alloc2(&device->vk.alloc, pAllocator,
-                       sizeof(*cache), 8,
-                       VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
-   if (cache == NULL)
-      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+   blob_copy_bytes(blob, &access, sizeof(access));
+   blob_copy_bytes(blob, &inlines, sizeof(inlines));
+   uint32_t nir_size = blob_read_uint32(blob);
+   const void *nir = blob_read_bytes(blob, nir_size);
+   uint32_t num_code = blob_read_uint32(blob);
+   if (blob->overrun)
+      return NULL;
 
-   vk_object_base_init(&device->vk, &cache->base,
-                       VK_OBJECT_TYPE_PIPELINE_CACHE);
-   if (pAllocator)
-     cache->alloc = *pAllocator;
-   else
-     cache->alloc = device->vk.alloc;
+   struct lvp_shader_cache_object *shader =
+      lvp_shader_cache_object_create(device, key_data, &access, &inlines,
+                                     nir, nir_size);
+   if (!shader)
+      return NULL;
 
-   cache->device = device;
-   *pPipelineCache = lvp_pipeline_cache_to_handle(cache);
+   for (uint32_t i = 0; i < num_code && !blob->overrun; i++) {
+      const void *key = blob_read_bytes(blob, 20);
+      uint32_t size = blob_read_uint32(blob);
+      const void *data = blob_read_bytes(blob, size);
+      if (!blob->overrun)
+         lvp_shader_cache_object_add_code(shader, key, data, size);
+   }
+   if (blob->overrun) {
+      lvp_shader_cache_object_destroy(&shader->base);
+      return NULL;
+   }
 
-   return VK_SUCCESS;
+   return &shader->base;
 }
 
-VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipelineCache(
-    VkDevice                                    _device,
-    VkPipelineCache                             _cache,
-    const VkAllocationCallbacks*                pAllocator)
+static void
+lvp_shader_cache_object_destroy(struct vk_pipeline_cache_object *object)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
 
-   if (!_cache)
+   util_dynarray_foreach(&shader->code, struct lvp_shader_code *, code)
+      vk_free(&object->device->alloc, *code);
+   util_dynarray_fini(&shader->code);
+   simple_mtx_destroy(&shader->code_lock);
+   vk_pipeline_cache_object_finish(&shader->base);
+   vk_free(&object->device->alloc, shader);
+}
+
+static const struct vk_pipeline_cache_object_ops lvp_shader_cache_object_ops = {
+   .serialize = lvp_shader_cache_object_serialize,
+   .deserialize = lvp_shader_cache_object_deserialize,
+   .destroy = lvp_shader_cache_object_destroy,
+};
+
+/* On a hit, the pipeline takes a reference to the cache object, so that
+ * llvmpipe can add code to it later.
+ */
+nir_shader *
+lvp_pipeline_cache_lookup_shader(struct vk_pipeline_cache *cache,
+                                 const unsigned char sha1[20],
+                                 struct lvp_pipeline *pipeline,
+                                 gl_shader_stage stage)
+{
+   const nir_shader_compiler_options *options =
+      pipeline->device->physical_device->drv_options[stage];
+
+   if (!cache)
+      return NULL;
+
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_lookup_object(cache, sha1, 20,
+                                      &lvp_shader_cache_object_ops, NULL);
+   if (!object)
+      return NULL;
+
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
+
+   struct blob_reader blob;
+   blob_reader_init(&blob, shader->nir, shader->nir_size);
+   nir_shader *nir = nir_deserialize(NULL, options, &blob);
+   if (blob.overrun) {
+      ralloc_free(nir);
+      vk_pipeline_cache_object_unref(object);
+      return NULL;
+   }
+
+   pipeline->access[stage] = shader->access;
+   pipeline->inlines[stage] = shader->inlines;
+   pipeline->shader_objects[stage] = object;
+
+   return nir;
+}
+
+void
+lvp_pipeline_cache_add_shader(struct vk_pipeline_cache *cache,
+                              const unsigned char sha1[20],
+                              struct lvp_pipeline *pipeline,
+                              const nir_shader *nir)
+{
+   gl_shader_stage stage = nir->info.stage;
+
+   if (!cache)
       return;
-//   lvp_pipeline_cache_finish(cache);
-   vk_object_base_finish(&cache->base);
-   vk_free2(&device->vk.alloc, pAllocator, cache);
+
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, nir, false);
+   if (blob.out_of_memory) {
+      blob_finish(&blob);
+      return;
+   }
+
+   struct lvp_shader_cache_object *shader =
+      lvp_shader_cache_object_create(cache->base.device, sha1,
+                                     &pipeline->access[stage],
+                                     &pipeline->inlines[stage],
+                                     blob.data, blob.size);
+   blob_finish(&blob);
+   if (!shader)
+      return;
+
+   pipeline->shader_objects[stage] =
+      vk_pipeline_cache_add_object(cache, &shader->base);
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_GetPipelineCacheData(
-        VkDevice                                    _device,
-        VkPipelineCache                             _cache,
-        size_t*                                     pDataSize,
-        void*                                       pData)
+static void *
+lvp_code_cache_find(void *data, void *shader_data,
+                    const unsigned char key[20], size_t *size)
 {
-   VkResult result = VK_SUCCESS;
-   if (pData) {
-      if (*pDataSize < 32) {
-         *pDataSize = 0;
-         result = VK_INCOMPLETE;
-      } else {
-         uint32_t *hdr = (uint32_t *)pData;
-         hdr[0] = 32;
-         hdr[1] = 1;
-         hdr[2] = VK_VENDOR_ID_MESA;
-         hdr[3] = 0;
-         lvp_device_get_cache_uuid(&hdr[4]);
+   struct lvp_shader_cache_object *shader =
+      container_of((struct vk_pipeline_cache_object *)shader_data,
+                   struct lvp_shader_cache_object, base);
+   void *found = NULL;
+
+   simple_mtx_lock(&shader->code_lock);
+   util_dynarray_foreach(&shader->code, struct lvp_shader_code *, code) {
+      if (memcmp((*code)->key, key, sizeof((*code)->key)))
+         continue;
+      found = malloc((*code)->size);
+      if (found) {
+         memcpy(found, (*code)->data, (*code)->size);
+         *size = (*code)->size;
       }
-   } else
-      *pDataSize = 32;
-   return result;
+      break;
+   }
+   simple_mtx_unlock(&shader->code_lock);
+
+   return found;
+}
+
+static void
+lvp_code_cache_insert(void *data, void *shader_data,
+                      const unsigned char key[20], const void *code,
+                      size_t size)
+{
+   struct lvp_shader_cache_object *shader =
+      container_of((struct vk_pipeline_cache_object *)shader_data,
+                   struct lvp_shader_cache_object, base);
+
+   /* Drop the size vkGetPipelineCacheData() remembered for the object, so
+    * the next size query includes the new code.
+    */
+   if (lvp_shader_cache_object_add_code(shader, key, code, size))
+      p_atomic_set(&shader->base.data_size, 0);
+}
+
+void
+lvp_physical_device_init_code_cache(struct lvp_physical_device *device)
+{
+   if (device->pscreen->set_shader_code_cache) {
+      const struct pipe_shader_code_cache code_cache = {
+         .find = lvp_code_cache_find,
+         .insert = lvp_code_cache_insert,
+      };
+      device->pscreen->set_shader_code_cache(device->pscreen, &code_cache);
+   }
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_MergePipelineCaches(
-        VkDevice                                    _device,
-        VkPipelineCache                             destCache,
-        uint32_t                                    srcCacheCount,
-        const VkPipelineCache*                      pSrcCaches)
+void
+lvp_physical_device_finish_code_cache(struct lvp_physical_device *device)
 {
-   return VK_SUCCESS;
+   if (device->pscreen->set_shader_code_cache)
+      device->pscreen->set_shader_code_cache(device->pscreen, NULL);
 }
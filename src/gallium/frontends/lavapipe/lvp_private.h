@@ -61,6 +61,7 @@ typedef uint32_t xcb_window_t;
 #include "vk_image.h"
 #include "vk_log.h"
 #include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
 #include "vk_shader_module.h"
 #include "vk_util.h"
 #include "vk_format.h"
@@ -86,6 +87,7 @@ extern "C" {
 #define MAX_PUSH_DESCRIPTORS 32
 #define MAX_DESCRIPTOR_UNIFORM_BLOCK_SIZE 4096
 #define MAX_PER_STAGE_DESCRIPTOR_UNIFORM_BLOCKS 8
+#define LVP_MAX_QUEUES 4
 
 #ifdef _WIN32
 #define lvp_printflike(a, b)
@@ -157,6 +159,7 @@ bool lvp_physical_device_extension_supported(struct lvp_physical_device *dev,
 struct lvp_queue {
    struct vk_queue vk;
    struct lvp_device *                         device;
+   unsigned index;
    struct pipe_context *ctx;
    struct cso_context *cso;
    struct u_upload_mgr *uploader;
@@ -164,22 +167,26 @@ struct lvp_queue {
    void *state;
    struct util_dynarray pipeline_destroys;
    simple_mtx_t pipeline_lock;
-};
-
-struct lvp_pipeline_cache {
-   struct vk_object_base                        base;
-   struct lvp_device *                          device;
-   VkAllocationCallbacks                        alloc;
+   /* Held while ctx is in use, queries are only used with the context that
+    * created them, which may be another queue's.
+    */
+   simple_mtx_t ctx_lock;
 };
 
 struct lvp_device {
    struct vk_device vk;
 
-   struct lvp_queue queue;
+   /* Each queue has its own context and submit thread, they only share
+    * llvmpipe's rasterizer and compute thread pools.
+    */
+   struct lvp_queue queues[LVP_MAX_QUEUES];
+   unsigned queue_count;
    struct lvp_instance *                       instance;
    struct lvp_physical_device *physical_device;
    struct pipe_screen *pscreen;
    bool poison_mem;
+   bool compile_cmd_buffers;
+   uint64_t descriptor_generation;
 };
 
 void lvp_device_get_cache_uuid(void *uuid);
@@ -238,7 +245,8 @@ struct lvp_image_view {
 
    enum pipe_format pformat;
 
-   struct pipe_sampler_view *sv;
+   /* One per queue, views can't be shared between contexts */
+   struct pipe_sampler_view *sv[LVP_MAX_QUEUES];
    struct pipe_image_view iv;
 
    struct pipe_surface *surface; /* have we created a pipe surface for this? */
@@ -315,7 +323,8 @@ vk_to_lvp_descriptor_set_layout(const struct vk_descriptor_set_layout *layout)
 union lvp_descriptor_info {
    struct {
       struct pipe_sampler_state *sampler;
-      struct pipe_sampler_view *sampler_view;
+      /* The sv array of the view, indexed by queue */
+      struct pipe_sampler_view **sampler_view;
    };
    struct pipe_image_view image_view;
    struct pipe_shader_buffer ssbo;
@@ -333,6 +342,8 @@ struct lvp_descriptor_set {
    struct vk_object_base base;
    struct lvp_descriptor_set_layout *layout;
    struct list_head link;
+   /* changes on every update, from lvp_device::descriptor_generation */
+   uint64_t generation;
    struct lvp_descriptor descriptors[0];
 };
 
@@ -403,6 +414,15 @@ struct lvp_access_info {
    uint64_t buffers_written;
 };
 
+struct lvp_inline_info {
+   uint32_t uniform_offsets[PIPE_MAX_CONSTANT_BUFFERS][MAX_INLINABLE_UNIFORMS];
+   uint8_t count[PIPE_MAX_CONSTANT_BUFFERS];
+   bool must_inline;
+   uint32_t can_inline; //bitmask
+   /* Inlining didn't pay off, each queue's thread only writes its own */
+   bool failed[LVP_MAX_QUEUES];
+};
+
 struct lvp_pipeline {
    struct vk_object_base base;
    struct lvp_device *                          device;
@@ -416,14 +436,16 @@ struct lvp_pipeline {
    bool force_min_sample;
    nir_shader *pipeline_nir[MESA_SHADER_STAGES];
    nir_shader *tess_ccw;
-   void *shader_cso[PIPE_SHADER_TYPES];
-   void *tess_ccw_cso;
-   struct {
-      uint32_t uniform_offsets[PIPE_MAX_CONSTANT_BUFFERS][MAX_INLINABLE_UNIFORMS];
-      uint8_t count[PIPE_MAX_CONSTANT_BUFFERS];
-      bool must_inline;
-      uint32_t can_inline; //bitmask
-   } inlines[MESA_SHADER_STAGES];
+   /* pipeline cache objects of the shaders, which llvmpipe adds code to */
+   struct vk_pipeline_cache_object *shader_objects[MESA_SHADER_STAGES];
+   /* llvmpipe shaders can't be shared between contexts, so there is a set
+    * of CSOs per queue.  The first queue's are created with the pipeline,
+    * the others' on first use.
+    */
+   void *shader_cso[LVP_MAX_QUEUES][PIPE_SHADER_TYPES];
+   void *tess_ccw_cso[LVP_MAX_QUEUES];
+   uint32_t destroy_refs;
+   struct lvp_inline_info inlines[MESA_SHADER_STAGES];
    gl_shader_stage last_vertex;
    struct pipe_stream_output_info stream_output;
    struct vk_graphics_pipeline_state graphics_state;
@@ -457,7 +479,7 @@ struct lvp_buffer_view {
    struct vk_object_base base;
    VkFormat format;
    enum pipe_format pformat;
-   struct pipe_sampler_view *sv;
+   struct pipe_sampler_view *sv[LVP_MAX_QUEUES]; /**< one per queue */
    struct pipe_image_view iv;
    struct lvp_buffer *buffer;
    uint32_t offset;
@@ -470,9 +492,17 @@ struct lvp_query_pool {
    uint32_t count;
    VkQueryPipelineStatisticFlags pipeline_stats;
    enum pipe_query_type base_type;
+   struct lvp_queue **queues; /**< queue whose context created each query */
    struct pipe_query *queries[0];
 };
 
+struct pipe_context *
+lvp_query_ctx_lock(struct lvp_queue *queue, struct lvp_query_pool *pool,
+                   uint32_t query);
+void
+lvp_query_ctx_unlock(struct lvp_queue *queue, struct lvp_query_pool *pool,
+                     uint32_t query);
+
 enum lvp_cmd_buffer_status {
    LVP_CMD_BUFFER_STATUS_INVALID,
    LVP_CMD_BUFFER_STATUS_INITIAL,
@@ -489,6 +519,15 @@ struct lvp_cmd_buffer {
    enum lvp_cmd_buffer_status status;
 
    uint8_t push_constants[MAX_PUSH_CONSTANTS_SIZE];
+
+   /* Command buffers that may be submitted more than once are compiled on
+    * first execution into the gallium calls it made, which later
+    * submissions replay, see lvp_execute.c.
+    */
+   bool compile;
+   bool compile_failed;
+   simple_mtx_t compile_lock;
+   struct lvp_cmd_compiled *compiled;
 };
 
 extern const struct vk_command_buffer_ops lvp_cmd_buffer_ops;
@@ -536,8 +575,6 @@ VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_event, base, VkEvent, VK_OBJECT_TYPE_EVENT)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_image, vk.base, VkImage, VK_OBJECT_TYPE_IMAGE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_image_view, vk.base, VkImageView,
                                VK_OBJECT_TYPE_IMAGE_VIEW);
-VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline_cache, base, VkPipelineCache,
-                               VK_OBJECT_TYPE_PIPELINE_CACHE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline, base, VkPipeline,
                                VK_OBJECT_TYPE_PIPELINE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline_layout, vk.base, VkPipelineLayout,
@@ -568,6 +605,7 @@ void lvp_add_enqueue_cmd_entrypoints(struct vk_device_dispatch_table *disp);
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer);
+void lvp_cmd_compiled_unref(struct lvp_cmd_compiled *compiled);
 size_t
 lvp_get_rendering_state_size(void);
 struct lvp_image *lvp_swapchain_get_image(VkSwapchainKHR swapchain,
@@ -606,6 +644,8 @@ lvp_vk_format_to_pipe_format(VkFormat format)
 
 void
 lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline);
+void
+lvp_pipeline_destroy_queue_state(struct lvp_queue *queue, struct lvp_pipeline *pipeline);
 
 void
 queue_thread_noop(void *data, void *gdata, int thread_index);
@@ -613,13 +653,30 @@ queue_thread_noop(void *data, void *gdata, int thread_index);
 void
 lvp_shader_optimize(nir_shader *nir);
 void *
-lvp_pipeline_compile_stage(struct lvp_pipeline *pipeline, nir_shader *nir);
+lvp_pipeline_compile_stage(struct lvp_pipeline *pipeline, struct pipe_context *pctx,
+                           nir_shader *nir, bool inlined);
 bool
 lvp_find_inlinable_uniforms(struct lvp_pipeline *pipeline, nir_shader *shader);
 void
 lvp_inline_uniforms(nir_shader *shader, const struct lvp_pipeline *pipeline, const uint32_t *uniform_values, uint32_t ubo);
 void *
-lvp_pipeline_compile(struct lvp_pipeline *pipeline, nir_shader *base_nir);
+lvp_pipeline_compile(struct lvp_pipeline *pipeline, struct pipe_context *pctx,
+                     nir_shader *base_nir, bool inlined);
+
+void
+lvp_physical_device_init_code_cache(struct lvp_physical_device *device);
+void
+lvp_physical_device_finish_code_cache(struct lvp_physical_device *device);
+nir_shader *
+lvp_pipeline_cache_lookup_shader(struct vk_pipeline_cache *cache,
+                                 const unsigned char sha1[20],
+                                 struct lvp_pipeline *pipeline,
+                                 gl_shader_stage stage);
+void
+lvp_pipeline_cache_add_shader(struct vk_pipeline_cache *cache,
+                              const unsigned char sha1[20],
+                              struct lvp_pipeline *pipeline,
+                              const nir_shader *nir);
 #ifdef __cplusplus
 }
 #endif
@@ -53,7 +53,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
       return VK_ERROR_FEATURE_NOT_PRESENT;
    }
    struct lvp_query_pool *pool;
-   uint32_t pool_size = sizeof(*pool) + pCreateInfo->queryCount * sizeof(struct pipe_query *);
+   uint32_t pool_size = sizeof(*pool) + pCreateInfo->queryCount *
+                        (sizeof(struct pipe_query *) + sizeof(struct lvp_queue *));
 
    pool = vk_zalloc2(&device->vk.alloc, pAllocator,
                     pool_size, 8,
@@ -67,11 +68,53 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
    pool->count = pCreateInfo->queryCount;
    pool->base_type = pipeq;
    pool->pipeline_stats = pCreateInfo->pipelineStatistics;
+   pool->queues = (struct lvp_queue **)&pool->queries[pool->count];
 
    *pQueryPool = lvp_query_pool_to_handle(pool);
    return VK_SUCCESS;
 }
 
+/**
+ * Locks and returns the context which created the query.  queue is the
+ * queue whose context the caller holds, or NULL on application threads.  Its
+ * lock is dropped meanwhile, so no thread ever holds two context locks.
+ */
+struct pipe_context *
+lvp_query_ctx_lock(struct lvp_queue *queue, struct lvp_query_pool *pool,
+                   uint32_t query)
+{
+   struct lvp_queue *owner = pool->queues[query];
+
+   if (owner != queue) {
+      if (queue)
+         simple_mtx_unlock(&queue->ctx_lock);
+      simple_mtx_lock(&owner->ctx_lock);
+   }
+   return owner->ctx;
+}
+
+void
+lvp_query_ctx_unlock(struct lvp_queue *queue, struct lvp_query_pool *pool,
+                     uint32_t query)
+{
+   struct lvp_queue *owner = pool->queues[query];
+
+   if (owner != queue) {
+      simple_mtx_unlock(&owner->ctx_lock);
+      if (queue)
+         simple_mtx_lock(&queue->ctx_lock);
+   }
+}
+
+static void
+destroy_query(struct lvp_query_pool *pool, uint32_t query)
+{
+   struct pipe_context *ctx = lvp_query_ctx_lock(NULL, pool, query);
+   ctx->destroy_query(ctx, pool->queries[query]);
+   lvp_query_ctx_unlock(NULL, pool, query);
+   pool->queries[query] = NULL;
+}
+
 VKAPI_ATTR void VKAPI_CALL lvp_DestroyQueryPool(
     VkDevice                                    _device,
     VkQueryPool                                 _pool,
@@ -85,7 +128,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyQueryPool(
 
    for (unsigned i = 0; i < pool->count; i++)
       if (pool->queries[i])
-         device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[i]);
+         destroy_query(pool, i);
    vk_object_base_finish(&pool->base);
    vk_free2(&device->vk.alloc, pAllocator, pool);
 }
@@ -111,10 +154,12 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_GetQueryPoolResults(
       union pipe_query_result result;
       bool ready = false;
       if (pool->queries[i]) {
-        ready = device->queue.ctx->get_query_result(device->queue.ctx,
-                                                    pool->queries[i],
-                                                    (flags & VK_QUERY_RESULT_WAIT_BIT),
-                                                    &result);
+        struct pipe_context *ctx = lvp_query_ctx_lock(NULL, pool, i);
+        ready = ctx->get_query_result(ctx,
+                                      pool->queries[i],
+                                      (flags & VK_QUERY_RESULT_WAIT_BIT),
+                                      &result);
+        lvp_query_ctx_unlock(NULL, pool, i);
       } else {
         result.u64 = 0;
       }
@@ -203,15 +248,12 @@ VKAPI_ATTR void VKAPI_CALL lvp_ResetQueryPool(
    uint32_t                                    firstQuery,
    uint32_t                                    queryCount)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
    LVP_FROM_HANDLE(lvp_query_pool, pool, queryPool);
 
    for (uint32_t i = 0; i < queryCount; i++) {
       uint32_t idx = i + firstQuery;
 
-      if (pool->queries[idx]) {
-         device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[idx]);
-         pool->queries[idx] = NULL;
-      }
+      if (pool->queries[idx])
+         destroy_query(pool, idx);
    }
 }
@@ -78,6 +78,24 @@ typedef void (*pipe_vertex_state_destroy_func)(struct pipe_screen *screen,
                                                struct pipe_vertex_state *);
 typedef void (*pipe_driver_thread_func)(void *job, void *gdata, int thread_index);
 
+/**
+ * Frontend-managed cache of compiled shader code, see
+ * pipe_screen::set_shader_code_cache.
+ *
+ * The callbacks are only called for shaders created with a non-NULL
+ * code_cache_data, which is passed as shader_data, so that the frontend can
+ * keep the code with its own shader object.  Keys are 20 byte SHA1s which
+ * already identify the driver build and the CPU/GPU the code was compiled
+ * for.  find() returns a malloc'ed copy of the code, which the driver frees,
+ * or NULL.  Both callbacks may be called from any thread.
+ */
+struct pipe_shader_code_cache {
+   void *data;
+   void *(*find)(void *data, void *shader_data,
+                 const unsigned char key[20], size_t *size);
+   void (*insert)(void *data, void *shader_data,
+                  const unsigned char key[20], const void *code, size_t size);
+};
 
 
 /**
@@ -469,6 +487,15 @@ struct pipe_screen {
     */
    struct disk_cache *(*get_disk_shader_cache)(struct pipe_screen *screen);
 
+   /**
+    * Install a cache the driver consults for compiled shader code before its
+    * own on-disk shader cache, and stores newly compiled code into.  NULL
+    * removes it.  This lets frontends export driver code through API-level
+    * caches.  The callback itself may be NULL if the driver has no use for it.
+    */
+   void (*set_shader_code_cache)(struct pipe_screen *screen,
+                                 const struct pipe_shader_code_cache *cache);
+
    /**
     * Create a new texture object from the given template info, taking
     * format modifiers into account. \p modifiers specifies a list of format
@@ -307,6 +307,11 @@ struct pipe_shader_state
       void *nir;
    } ir;
    struct pipe_stream_output_info stream_output;
+   /**
+    * Passed to the pipe_shader_code_cache callbacks for this shader's code,
+    * NULL to not use the frontend code cache for it.
+    */
+   void *code_cache_data;
 };
 
 static inline void
@@ -1008,6 +1013,7 @@ struct pipe_compute_state
    unsigned req_local_mem; /**< Required size of the LOCAL resource. */
    unsigned req_private_mem; /**< Required size of the PRIVATE resource. */
    unsigned req_input_mem; /**< Required size of the INPUT resource. */
+   void *code_cache_data; /**< See pipe_shader_state::code_cache_data. */
 };
 
 /**
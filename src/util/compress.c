@@ -36,8 +36,12 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "util/compress.h"
 #include "macros.h"
 
@@ -69,14 +73,312 @@ util_compress_max_compressed_len(size_t in_data_size)
 #endif
 }
 
+struct util_compress_dict {
+#ifdef HAVE_ZSTD
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+   unsigned id;
+#elif defined(HAVE_ZLIB)
+   /* zlib can only make use of the last 32K of a preset dictionary */
+   uint8_t *data;
+   uInt size;
+   uLong adler;
+#endif
+};
+
 /* Compress data and return the size of the compressed data */
 size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size)
 {
+   return util_compress_deflate_dict(NULL, in_data, in_data_size, out_data,
+                                     out_buff_size);
+}
+
+/**
+ * Decompresses data, returns true if successful.
+ */
+bool
+util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_data_size)
+{
+   return util_compress_inflate_dict(NULL, in_data, in_data_size, out_data,
+                                     out_data_size);
+}
+
+#if !defined(HAVE_ZSTD) && defined(HAVE_ZLIB)
+
+/* zlib has no dictionary builder, the dictionary is made of the regions of
+ * the samples that are found in several of them. The regions are located by
+ * content defined anchors, i.e. positions where the hash of the preceding
+ * DICT_WINDOW bytes matches DICT_ANCHOR_MASK, so shared data is found at any
+ * offset. The regions found in the most samples are placed at the end of the
+ * dictionary where matches are the cheapest.
+ */
+#define DICT_WINDOW 32
+#define DICT_ANCHOR_MASK 0xf
+#define DICT_REGION_SIZE 256
+#define DICT_MAX_SIZE 32768
+
+struct dict_anchor {
+   uint32_t hash;
+   uint32_t count;
+   uint32_t last_sample;
+   uint32_t sample;
+   size_t start;
+};
+
+struct dict_region {
+   size_t start;
+   size_t end;
+   uint32_t count;
+};
+
+static int
+compare_regions_by_start(const void *a, const void *b)
+{
+   const struct dict_region *ra = a, *rb = b;
+   return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+static int
+compare_regions_by_count(const void *a, const void *b)
+{
+   const struct dict_region *ra = a, *rb = b;
+   if (ra->count != rb->count)
+      return ra->count > rb->count ? -1 : 1;
+   return compare_regions_by_start(a, b);
+}
+
+static size_t
+train_zlib_dict(const uint8_t *samples, const size_t *sample_sizes,
+                unsigned num_samples, uint8_t *dict_data, size_t dict_capacity)
+{
+   size_t total_size = 0;
+   for (unsigned i = 0; i < num_samples; i++)
+      total_size += sample_sizes[i];
+
+   /* Twice the expected number of anchors, as a power of two */
+   size_t table_size = 1024;
+   while (table_size < total_size / (DICT_ANCHOR_MASK + 1) * 2)
+      table_size *= 2;
+
+   struct dict_anchor *table = calloc(table_size, sizeof(*table));
+   if (!table)
+      return 0;
+
+   /* Rolling hash of the last DICT_WINDOW bytes */
+   const uint32_t mult = 0x01000193;
+   uint32_t mult_pow = 1;
+   for (unsigned i = 0; i < DICT_WINDOW; i++)
+      mult_pow *= mult;
+
+   size_t num_anchors = 0;
+   size_t base = 0;
+   for (unsigned s = 0; s < num_samples; s++) {
+      const uint8_t *sample = samples + base;
+      uint32_t hash = 0;
+
+      for (size_t i = 0; i < sample_sizes[s]; i++) {
+         hash = hash * mult + sample[i] + 1;
+         if (i >= DICT_WINDOW)
+            hash -= mult_pow * (sample[i - DICT_WINDOW] + 1);
+         else if (i < DICT_WINDOW - 1)
+            continue;
+
+         if (((hash >> 16) & DICT_ANCHOR_MASK) != 0)
+            continue;
+
+         /* Hash 0 marks the free slots */
+         uint32_t key = hash ? hash : 1;
+         size_t slot = key & (table_size - 1);
+         while (table[slot].hash && table[slot].hash != key)
+            slot = (slot + 1) & (table_size - 1);
+
+         struct dict_anchor *anchor = &table[slot];
+         if (!anchor->hash) {
+            /* Keep the table at most half full */
+            if (num_anchors >= table_size / 2)
+               continue;
+
+            anchor->hash = key;
+            anchor->sample = s;
+            anchor->start = base + i + 1 - DICT_WINDOW;
+            anchor->last_sample = s;
+            anchor->count = 1;
+            num_anchors++;
+         } else if (anchor->last_sample != s) {
+            anchor->last_sample = s;
+            anchor->count++;
+         }
+      }
+      base += sample_sizes[s];
+   }
+
+   /* Turn the anchors found in several samples into regions of the sample
+    * they were first seen in, and merge the overlapping ones.
+    */
+   struct dict_region *regions = malloc(MAX2(num_anchors, 1) * sizeof(*regions));
+   if (!regions) {
+      free(table);
+      return 0;
+   }
+
+   size_t num_regions = 0;
+   for (size_t i = 0; i < table_size; i++) {
+      if (table[i].count < 2)
+         continue;
+
+      size_t sample_end = 0;
+      for (unsigned s = 0; s <= table[i].sample; s++)
+         sample_end += sample_sizes[s];
+
+      regions[num_regions].start = table[i].start;
+      regions[num_regions].end = MIN2(table[i].start + DICT_REGION_SIZE,
+                                      sample_end);
+      regions[num_regions].count = table[i].count;
+      num_regions++;
+   }
+   free(table);
+
+   qsort(regions, num_regions, sizeof(*regions), compare_regions_by_start);
+
+   size_t num_merged = 0;
+   for (size_t i = 0; i < num_regions; i++) {
+      struct dict_region *last = num_merged ? &regions[num_merged - 1] : NULL;
+      if (last && regions[i].start <= last->end) {
+         last->end = MAX2(last->end, regions[i].end);
+         last->count = MAX2(last->count, regions[i].count);
+      } else {
+         regions[num_merged++] = regions[i];
+      }
+   }
+
+   qsort(regions, num_merged, sizeof(*regions), compare_regions_by_count);
+
+   /* Fill the dictionary from its end with the most common regions first */
+   size_t capacity = MIN2(dict_capacity, DICT_MAX_SIZE);
+   size_t pos = capacity;
+   for (size_t i = 0; i < num_merged && pos > 0; i++) {
+      size_t size = MIN2(regions[i].end - regions[i].start, pos);
+      pos -= size;
+      memcpy(dict_data + pos, samples + regions[i].end - size, size);
+   }
+   free(regions);
+
+   memmove(dict_data, dict_data + pos, capacity - pos);
+   return capacity - pos;
+}
+
+#endif
+
+/**
+ * Build a dictionary for compressing data similar to the given samples,
+ * which are stored one after the other in \p samples. Returns the size of
+ * the dictionary written to \p dict_data, or 0 on failure.
+ */
+size_t
+util_compress_train_dict(const uint8_t *samples, const size_t *sample_sizes,
+                         unsigned num_samples, uint8_t *dict_data,
+                         size_t dict_capacity)
+{
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict_data, dict_capacity, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#elif defined(HAVE_ZLIB)
+   return train_zlib_dict(samples, sample_sizes, num_samples, dict_data,
+                          dict_capacity);
+#else
+   STATIC_ASSERT(false);
+#endif
+}
+
+/**
+ * Create a dictionary from the output of util_compress_train_dict(). The
+ * dictionary can be used by several threads at once.
+ */
+struct util_compress_dict *
+util_compress_dict_create(const uint8_t *dict_data, size_t dict_size)
+{
+   if (dict_size == 0)
+      return NULL;
+
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (!dict)
+      return NULL;
+
+#ifdef HAVE_ZSTD
+   dict->cdict = ZSTD_createCDict(dict_data, dict_size, ZSTD_COMPRESSION_LEVEL);
+   dict->ddict = ZSTD_createDDict(dict_data, dict_size);
+   dict->id = ZSTD_getDictID_fromDict(dict_data, dict_size);
+   if (!dict->cdict || !dict->ddict) {
+      util_compress_dict_destroy(dict);
+      return NULL;
+   }
+#elif defined(HAVE_ZLIB)
+   if (dict_size > DICT_MAX_SIZE) {
+      dict_data += dict_size - DICT_MAX_SIZE;
+      dict_size = DICT_MAX_SIZE;
+   }
+
+   dict->data = malloc(dict_size);
+   if (!dict->data) {
+      free(dict);
+      return NULL;
+   }
+
+   memcpy(dict->data, dict_data, dict_size);
+   dict->size = dict_size;
+   dict->adler = adler32(adler32(0, Z_NULL, 0), dict->data, dict->size);
+#else
+   STATIC_ASSERT(false);
+#endif
+
+   return dict;
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+   if (!dict)
+      return;
+
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
-                              ZSTD_COMPRESSION_LEVEL);
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+#elif defined(HAVE_ZLIB)
+   free(dict->data);
+#endif
+   free(dict);
+}
+
+/* Compress data, using the dictionary if there is one, and return the size
+ * of the compressed data. The dictionary is needed to decompress the data.
+ */
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size)
+{
+#ifdef HAVE_ZSTD
+   size_t ret;
+
+   if (dict) {
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      if (!cctx)
+         return 0;
+
+      ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size, in_data,
+                                     in_data_size, dict->cdict);
+      ZSTD_freeCCtx(cctx);
+   } else {
+      ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
+                          ZSTD_COMPRESSION_LEVEL);
+   }
    if (ZSTD_isError(ret))
       return 0;
 
@@ -100,6 +402,11 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
        return 0;
    }
 
+   if (dict && deflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+       (void) deflateEnd(&strm);
+       return 0;
+   }
+
    /* compress until end of in_data */
    ret = deflate(&strm, Z_FINISH);
 
@@ -118,14 +425,34 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
 }
 
 /**
- * Decompresses data, returns true if successful.
+ * Decompresses data, returns true if successful. The data records whether
+ * it was compressed with a dictionary, \p dict is only used in that case
+ * and may be NULL otherwise.
  */
 bool
-util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
-                      uint8_t *out_data, size_t out_data_size)
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size)
 {
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   /* Dictionaries built by zstd have an id that is recorded in the frame */
+   unsigned dict_id = ZSTD_getDictID_fromFrame(in_data, in_data_size);
+   size_t ret;
+
+   if (dict_id) {
+      if (!dict || dict->id != dict_id)
+         return false;
+
+      ZSTD_DCtx *dctx = ZSTD_createDCtx();
+      if (!dctx)
+         return false;
+
+      ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size, in_data,
+                                       in_data_size, dict->ddict);
+      ZSTD_freeDCtx(dctx);
+   } else {
+      ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   }
    return !ZSTD_isError(ret);
 #elif defined(HAVE_ZLIB)
    z_stream strm;
@@ -146,6 +473,17 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
    ret = inflate(&strm, Z_NO_FLUSH);
    assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
 
+   /* The stream header has the checksum of the dictionary it needs */
+   if (ret == Z_NEED_DICT) {
+      if (!dict || strm.adler != dict->adler ||
+          inflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+         (void)inflateEnd(&strm);
+         return false;
+      }
+
+      ret = inflate(&strm, Z_NO_FLUSH);
+   }
+
    /* Unless there was an error we should have decompressed everything in one
     * go as we know the uncompressed file size.
     */
@@ -24,8 +24,12 @@
 #ifdef HAVE_COMPRESSION
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
 
+/* Dictionary shared by the compression of many small, similar buffers */
+struct util_compress_dict;
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size);
 
@@ -37,4 +41,25 @@ size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size);
 
+size_t
+util_compress_train_dict(const uint8_t *samples, const size_t *sample_sizes,
+                         unsigned num_samples, uint8_t *dict_data,
+                         size_t dict_capacity);
+
+struct util_compress_dict *
+util_compress_dict_create(const uint8_t *dict_data, size_t dict_size);
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict);
+
+bool
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size);
+
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size);
+
 #endif
@@ -62,12 +62,199 @@
  */
 #define CACHE_VERSION 1
 
+/* The items of MESA_DISK_CACHE_DEDUP caches aren't compressed, give them keys
+ * of their own.
+ */
+#define CACHE_VERSION_DEDUP (CACHE_VERSION | 0x80)
+
 #define DRV_KEY_CPY(_dst, _src, _src_size) \
 do {                                       \
    memcpy(_dst, _src, _src_size);          \
    _dst += _src_size;                      \
 } while (0);
 
+/* Number of keys looked up by a single job of a batch */
+#define CACHE_BATCH_JOB_KEYS 8
+
+struct disk_cache_batch_job {
+   struct util_queue_fence fence;
+   struct disk_cache_batch *batch;
+   unsigned first;
+   unsigned count;
+};
+
+struct disk_cache_batch {
+   struct disk_cache *cache;
+   disk_cache_batch_cb cb;
+   void *cb_data;
+
+   /* Only load the items, don't record them as used */
+   bool prefetch;
+
+   cache_key *keys;
+   unsigned num_jobs;
+   struct disk_cache_batch_job jobs[];
+};
+
+static struct disk_cache_batch *
+create_batch(struct disk_cache *cache, const cache_key *keys,
+             unsigned num_keys, disk_cache_batch_cb cb, void *cb_data,
+             bool prefetch);
+
+static uint32_t
+cache_key_hash(const void *key)
+{
+   /* Cache keys are SHA-1 hashes already */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+cache_key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+static void
+prefetch_item_loaded(void *cb_data, const uint8_t *key, void *data,
+                     size_t size)
+{
+   struct disk_cache *cache = cb_data;
+   struct disk_cache_prefetched_item *item;
+
+   if (!data)
+      return;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+
+   /* Drop the items which were asked for in the meantime and the ones
+    * exceeding the memory budget.
+    */
+   if (_mesa_set_search(cache->used_keys, key) ||
+       cache->prefetched_size + size > CACHE_PREFETCH_MAX_SIZE)
+      goto drop;
+
+   item = malloc(sizeof(*item));
+   if (!item)
+      goto drop;
+
+   memcpy(item->key, key, CACHE_KEY_SIZE);
+   item->data = data;
+   item->size = size;
+
+   _mesa_set_add(cache->prefetched, item);
+   cache->prefetched_size += size;
+
+   simple_mtx_unlock(&cache->prefetch_mtx);
+
+   return;
+
+drop:
+   simple_mtx_unlock(&cache->prefetch_mtx);
+   free(data);
+}
+
+static void
+start_prefetch(void *mem_ctx, struct disk_cache *cache)
+{
+   unsigned num_keys;
+   cache_key *keys;
+
+   cache->used_keys = _mesa_set_create(NULL, cache_key_hash,
+                                       cache_key_equals);
+   cache->prefetched = _mesa_set_create(NULL, cache_key_hash,
+                                        cache_key_equals);
+   if (!cache->used_keys || !cache->prefetched) {
+      _mesa_set_destroy(cache->used_keys, NULL);
+      _mesa_set_destroy(cache->prefetched, NULL);
+      return;
+   }
+
+   simple_mtx_init(&cache->prefetch_mtx, mtx_plain);
+   cache->prefetch = true;
+
+   keys = disk_cache_load_prefetch_manifest(mem_ctx, cache, &num_keys);
+   if (keys) {
+      cache->prefetch_batch = create_batch(cache, keys, num_keys,
+                                           prefetch_item_loaded, cache,
+                                           true);
+   }
+}
+
+static void
+free_prefetched_item(struct set_entry *entry)
+{
+   struct disk_cache_prefetched_item *item =
+      (struct disk_cache_prefetched_item *) entry->key;
+
+   free(item->data);
+   free(item);
+}
+
+static void
+finish_prefetch(struct disk_cache *cache)
+{
+   disk_cache_batch_wait(cache->prefetch_batch);
+
+   /* Don't override the manifest by a run that didn't use the cache */
+   if (cache->used_keys->entries)
+      disk_cache_write_prefetch_manifest(cache, cache->used_keys);
+
+   _mesa_set_destroy(cache->prefetched, free_prefetched_item);
+   _mesa_set_destroy(cache->used_keys, NULL);
+   simple_mtx_destroy(&cache->prefetch_mtx);
+}
+
+static void
+record_used_key(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->prefetch)
+      return;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+
+   if (cache->used_keys->entries < CACHE_PREFETCH_MAX_KEYS &&
+       !_mesa_set_search(cache->used_keys, key)) {
+      uint8_t *copy = ralloc_size(cache->used_keys, CACHE_KEY_SIZE);
+      if (copy) {
+         memcpy(copy, key, CACHE_KEY_SIZE);
+         _mesa_set_add(cache->used_keys, copy);
+      }
+   }
+
+   simple_mtx_unlock(&cache->prefetch_mtx);
+}
+
+static void *
+take_prefetched_item(struct disk_cache *cache, const cache_key key,
+                     size_t *size)
+{
+   struct disk_cache_prefetched_item *item = NULL;
+   struct set_entry *entry;
+   void *data = NULL;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+
+   entry = _mesa_set_search(cache->prefetched, key);
+   if (entry) {
+      item = (struct disk_cache_prefetched_item *) entry->key;
+      _mesa_set_remove(cache->prefetched, entry);
+      cache->prefetched_size -= item->size;
+   }
+
+   simple_mtx_unlock(&cache->prefetch_mtx);
+
+   if (item) {
+      data = item->data;
+      if (size)
+         *size = item->size;
+      free(item);
+   }
+
+   return data;
+}
+
 struct disk_cache *
 disk_cache_create(const char *gpu_name, const char *driver_id,
                   uint64_t driver_flags)
@@ -121,6 +308,16 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    if (debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false)) {
       if (!disk_cache_load_cache_index_foz(local, cache))
          goto path_fail;
+
+      /* Similar items share most of their data, which can only be found
+       * before compression. The foz db compresses the chunks instead.
+       */
+      if (debug_get_bool_option("MESA_DISK_CACHE_DEDUP", false)) {
+         cache->foz_db.dedup = true;
+         cache->foz_db.compress_chunks = !cache->compression_disabled;
+         cache->compression_disabled = true;
+         cache_version = CACHE_VERSION_DEDUP;
+      }
    } else if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE", false)) {
       if (!disk_cache_db_load_cache_index(local, cache))
          goto path_fail;
@@ -238,6 +435,16 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
+   /* Both need the driver keys, the dictionary is per driver and the
+    * prefetched items are validated.
+    */
+   if (!cache->path_init_failed)
+      disk_cache_init_compression_dict(cache);
+
+   if (!cache->path_init_failed &&
+       debug_get_bool_option("MESA_DISK_CACHE_PREFETCH", false))
+      start_prefetch(local, cache);
+
    ralloc_free(local);
 
    return cache;
@@ -255,6 +462,10 @@ disk_cache_destroy(struct disk_cache *cache)
 {
    if (cache && !cache->path_init_failed) {
       util_queue_finish(&cache->cache_queue);
+
+      if (cache->prefetch)
+         finish_prefetch(cache);
+
       util_queue_destroy(&cache->cache_queue);
 
       if (debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false))
@@ -263,6 +474,7 @@ disk_cache_destroy(struct disk_cache *cache)
       if (cache->use_cache_db)
          mesa_cache_db_close(&cache->cache_db);
 
+      disk_cache_finish_compression_dict(cache);
       disk_cache_destroy_mmap(cache);
    }
 
@@ -273,6 +485,10 @@ void
 disk_cache_wait_for_idle(struct disk_cache *cache)
 {
    util_queue_finish(&cache->cache_queue);
+
+   /* The writes may have scheduled the database compaction */
+   if (cache->use_cache_db)
+      mesa_cache_db_wait_for_idle(&cache->cache_db);
 }
 
 void
@@ -399,6 +615,8 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    if (cache->path_init_failed)
       return;
 
+   record_used_key(cache, key);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, (void*)data, size, cache_item_metadata, false);
 
@@ -425,6 +643,8 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
       return;
    }
 
+   record_used_key(cache, key);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, data, size, cache_item_metadata, true);
 
@@ -435,9 +655,27 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
    }
 }
 
+static void *
+load_item(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   if (debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false)) {
+      return disk_cache_load_item_foz(cache, key, size);
+   } else if (cache->use_cache_db) {
+      return disk_cache_db_load_item(cache, key, size);
+   } else {
+      char *filename = disk_cache_get_cache_filename(cache, key);
+      if (filename == NULL)
+         return NULL;
+
+      return disk_cache_load_item(cache, filename, size);
+   }
+}
+
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
+   void *data = NULL;
+
    if (size)
       *size = 0;
 
@@ -463,17 +701,141 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
-   if (debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false)) {
-      return disk_cache_load_item_foz(cache, key, size);
-   } else if (cache->use_cache_db) {
-      return disk_cache_db_load_item(cache, key, size);
-   } else {
-      char *filename = disk_cache_get_cache_filename(cache, key);
-      if (filename == NULL)
-         return NULL;
+   if (cache->prefetch)
+      data = take_prefetched_item(cache, key, size);
 
-      return disk_cache_load_item(cache, filename, size);
+   if (!data)
+      data = load_item(cache, key, size);
+
+   if (data)
+      record_used_key(cache, key);
+
+   return data;
+}
+
+static void
+release_nop(void *data)
+{
+}
+
+static void
+release_free(void *data)
+{
+   free(data);
+}
+
+const void *
+disk_cache_get_nocopy(struct disk_cache *cache, const cache_key key,
+                      size_t *size, disk_cache_release_cb *release)
+{
+   *release = release_free;
+
+   if (!cache->blob_get_cb &&
+       debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false)) {
+      const void *data = disk_cache_load_item_foz_nocopy(cache, key, size);
+      if (data) {
+         record_used_key(cache, key);
+         *release = release_nop;
+         return data;
+      }
+   }
+
+   return disk_cache_get(cache, key, size);
+}
+
+static void
+cache_get_batch(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_batch_job *batch_job = (struct disk_cache_batch_job *) job;
+   struct disk_cache_batch *batch = batch_job->batch;
+
+   for (unsigned i = batch_job->first;
+        i < batch_job->first + batch_job->count; i++) {
+      size_t size = 0;
+      void *data;
+
+      if (batch->prefetch)
+         data = load_item(batch->cache, batch->keys[i], &size);
+      else
+         data = disk_cache_get(batch->cache, batch->keys[i], &size);
+
+      batch->cb(batch->cb_data, batch->keys[i], data, size);
+   }
+}
+
+static struct disk_cache_batch *
+create_batch(struct disk_cache *cache, const cache_key *keys,
+             unsigned num_keys, disk_cache_batch_cb cb, void *cb_data,
+             bool prefetch)
+{
+   unsigned num_jobs = DIV_ROUND_UP(num_keys, CACHE_BATCH_JOB_KEYS);
+   struct disk_cache_batch *batch = NULL;
+
+   /* The callbacks can't go through the cache threads, do the lookups
+    * right here.
+    */
+   if (cache->path_init_failed || cache->blob_get_cb || !num_keys)
+      goto sync;
+
+   batch = (struct disk_cache_batch *)
+      malloc(sizeof(*batch) + num_jobs * sizeof(batch->jobs[0]) +
+             num_keys * sizeof(cache_key));
+   if (!batch)
+      goto sync;
+
+   batch->cache = cache;
+   batch->cb = cb;
+   batch->cb_data = cb_data;
+   batch->prefetch = prefetch;
+   batch->keys = (cache_key *) &batch->jobs[num_jobs];
+   batch->num_jobs = num_jobs;
+   memcpy(batch->keys, keys, num_keys * sizeof(cache_key));
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      struct disk_cache_batch_job *job = &batch->jobs[i];
+
+      job->batch = batch;
+      job->first = i * CACHE_BATCH_JOB_KEYS;
+      job->count = MIN2(num_keys - job->first, CACHE_BATCH_JOB_KEYS);
+
+      util_queue_fence_init(&job->fence);
+      util_queue_add_job(&cache->cache_queue, job, &job->fence,
+                         cache_get_batch, NULL, 0);
+   }
+
+   return batch;
+
+sync:
+   for (unsigned i = 0; i < num_keys; i++) {
+      size_t size = 0;
+      void *data = prefetch ? NULL : disk_cache_get(cache, keys[i], &size);
+
+      cb(cb_data, keys[i], data, size);
    }
+
+   return NULL;
+}
+
+struct disk_cache_batch *
+disk_cache_get_batch(struct disk_cache *cache, const cache_key *keys,
+                     unsigned num_keys, disk_cache_batch_cb cb,
+                     void *cb_data)
+{
+   return create_batch(cache, keys, num_keys, cb, cb_data, false);
+}
+
+void
+disk_cache_batch_wait(struct disk_cache_batch *batch)
+{
+   if (!batch)
+      return;
+
+   for (unsigned i = 0; i < batch->num_jobs; i++) {
+      util_queue_fence_wait(&batch->jobs[i].fence);
+      util_queue_fence_destroy(&batch->jobs[i].fence);
+   }
+
+   free(batch);
 }
 
 void
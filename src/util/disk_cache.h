@@ -64,6 +64,13 @@ typedef signed long
 (*disk_cache_get_cb) (const void *key, signed long keySize,
                       void *value, signed long valueSize);
 
+typedef void
+(*disk_cache_release_cb) (void *data);
+
+typedef void
+(*disk_cache_batch_cb) (void *cb_data, const uint8_t *key,
+                        void *data, size_t size);
+
 struct cache_item_metadata {
    /**
     * The cache item type. This could be used to identify a GLSL cache item,
@@ -78,6 +85,7 @@ struct cache_item_metadata {
 };
 
 struct disk_cache;
+struct disk_cache_batch;
 
 static inline char *
 disk_cache_format_hex_id(char *buf, const uint8_t *hex_id, unsigned size)
@@ -244,6 +252,39 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Retrieve an item like disk_cache_get(), but without copying it when the
+ * cache can hand out its storage directly (currently uncompressed items of
+ * read only single file caches, which are mapped).
+ *
+ * \p release is set to the function the returned pointer must be passed to
+ * once the caller is done with the data, instead of free().
+ */
+const void *
+disk_cache_get_nocopy(struct disk_cache *cache, const cache_key key,
+                      size_t *size, disk_cache_release_cb *release);
+
+/**
+ * Retrieve a number of items asynchronously, on the cache threads.
+ *
+ * \p cb is called once for every key with the data as disk_cache_get()
+ * would return it, which the callback takes the ownership of. It may be
+ * called from several threads at once, and before this function returns.
+ *
+ * \return A batch to be passed to disk_cache_batch_wait(), or NULL if all
+ * the callbacks have been called already.
+ */
+struct disk_cache_batch *
+disk_cache_get_batch(struct disk_cache *cache, const cache_key *keys,
+                     unsigned num_keys, disk_cache_batch_cb cb,
+                     void *cb_data);
+
+/**
+ * Wait for all the callbacks of a batch to be called and free the batch.
+ */
+void
+disk_cache_batch_wait(struct disk_cache_batch *batch);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -322,6 +363,30 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline const void *
+disk_cache_get_nocopy(struct disk_cache *cache, const cache_key key,
+                      size_t *size, disk_cache_release_cb *release)
+{
+   return NULL;
+}
+
+static inline struct disk_cache_batch *
+disk_cache_get_batch(struct disk_cache *cache, const cache_key *keys,
+                     unsigned num_keys, disk_cache_batch_cb cb,
+                     void *cb_data)
+{
+   for (unsigned i = 0; i < num_keys; i++)
+      cb(cb_data, keys[i], NULL, 0);
+
+   return NULL;
+}
+
+static inline void
+disk_cache_batch_wait(struct disk_cache_batch *batch)
+{
+   return;
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -97,9 +97,12 @@ disk_cache_get_function_identifier(void *ptr, struct mesa_sha1 *ctx)
 
 #include "util/blob.h"
 #include "util/crc32.h"
+#include "util/mesa-sha1.h"
+#include "util/u_atomic.h"
 #include "util/u_debug.h"
 #include "util/ralloc.h"
 #include "util/rand_xor.h"
+#include "util/u_process.h"
 
 /* Create a directory named 'path' if it does not already exist.
  *
@@ -490,34 +493,38 @@ disk_cache_evict_item(struct disk_cache *cache, char *filename)
       p_atomic_add(cache->size, - (uint64_t)sb.st_blocks * 512);
 }
 
-static void *
-parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
-                              size_t cache_item_size, size_t *size)
+/* Check the header and CRC of a cache item and return its (possibly
+ * compressed) payload, which points into cache_item. The CRC check can be
+ * skipped for items the storage already verified.
+ */
+static const uint8_t *
+validate_cache_item(struct disk_cache *cache, const void *cache_item,
+                    size_t cache_item_size, bool check_crc,
+                    const struct cache_entry_file_data **cf_data_out,
+                    size_t *data_size)
 {
-   uint8_t *uncompressed_data = NULL;
-
    struct blob_reader ci_blob_reader;
    blob_reader_init(&ci_blob_reader, cache_item, cache_item_size);
 
    size_t header_size = cache->driver_keys_blob_size;
    const void *keys_blob = blob_read_bytes(&ci_blob_reader, header_size);
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
 
    /* Check for extremely unlikely hash collisions */
    if (memcmp(cache->driver_keys_blob, keys_blob, header_size) != 0) {
       assert(!"Mesa cache keys mismatch!");
-      goto fail;
+      return NULL;
    }
 
    uint32_t md_type = blob_read_uint32(&ci_blob_reader);
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
 
    if (md_type == CACHE_ITEM_TYPE_GLSL) {
       uint32_t num_keys = blob_read_uint32(&ci_blob_reader);
       if (ci_blob_reader.overrun)
-         goto fail;
+         return NULL;
 
       /* The cache item metadata is currently just used for distributing
        * precompiled shaders, they are not used by Mesa so just skip them for
@@ -528,27 +535,45 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
       const void UNUSED *metadata =
          blob_read_bytes(&ci_blob_reader, num_keys * sizeof(cache_key));
       if (ci_blob_reader.overrun)
-         goto fail;
+         return NULL;
    }
 
    /* Load the CRC that was created when the file was written. */
-   struct cache_entry_file_data *cf_data =
-      (struct cache_entry_file_data *)
+   const struct cache_entry_file_data *cf_data =
+      (const struct cache_entry_file_data *)
          blob_read_bytes(&ci_blob_reader, sizeof(struct cache_entry_file_data));
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
 
    size_t cache_data_size = ci_blob_reader.end - ci_blob_reader.current;
-   const uint8_t *data = (uint8_t *) blob_read_bytes(&ci_blob_reader, cache_data_size);
+   const uint8_t *data = (const uint8_t *) blob_read_bytes(&ci_blob_reader, cache_data_size);
 
    /* Check the data for corruption */
-   if (cf_data->crc32 != util_hash_crc32(data, cache_data_size))
-      goto fail;
+   if (check_crc && cf_data->crc32 != util_hash_crc32(data, cache_data_size))
+      return NULL;
+
+   *cf_data_out = cf_data;
+   *data_size = cache_data_size;
+   return data;
+}
+
+static void *
+parse_and_validate_cache_item(struct disk_cache *cache, const void *cache_item,
+                              size_t cache_item_size, bool check_crc,
+                              size_t *size)
+{
+   const struct cache_entry_file_data *cf_data;
+   size_t cache_data_size;
+   const uint8_t *data = validate_cache_item(cache, cache_item, cache_item_size,
+                                             check_crc, &cf_data,
+                                             &cache_data_size);
+   if (!data)
+      return NULL;
 
    /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data->uncompressed_size);
+   uint8_t *uncompressed_data = malloc(cf_data->uncompressed_size);
    if (!uncompressed_data)
-      goto fail;
+      return NULL;
 
    if (cache->compression_disabled) {
       if (cf_data->uncompressed_size != cache_data_size)
@@ -556,8 +581,10 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
       memcpy(uncompressed_data, data, cache_data_size);
    } else {
-      if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                                 cf_data->uncompressed_size))
+      if (!util_compress_inflate_dict(p_atomic_read(&cache->compress_dict),
+                                      data, cache_data_size,
+                                      uncompressed_data,
+                                      cf_data->uncompressed_size))
          goto fail;
    }
 
@@ -567,8 +594,7 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
    return uncompressed_data;
 
  fail:
-   if (uncompressed_data)
-      free(uncompressed_data);
+   free(uncompressed_data);
 
    return NULL;
 }
@@ -596,7 +622,7 @@ disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size)
       goto fail;
 
     uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, data, sb.st_size, size);
+       parse_and_validate_cache_item(cache, data, sb.st_size, true, size);
    if (!uncompressed_data)
       goto fail;
 
@@ -638,10 +664,147 @@ disk_cache_get_cache_filename(struct disk_cache *cache, const cache_key key)
    return filename;
 }
 
+static char *
+get_compression_dict_filename(void *mem_ctx, struct disk_cache *cache)
+{
+   /* The single file and database caches are shared by all the drivers */
+   unsigned char sha1[20];
+   char sha1_str[41];
+   _mesa_sha1_compute(cache->driver_keys_blob, cache->driver_keys_blob_size,
+                      sha1);
+   _mesa_sha1_format(sha1_str, sha1);
+
+   return ralloc_asprintf(mem_ctx, "%s/compression_%.16s.dict", cache->path,
+                          sha1_str);
+}
+
+static struct util_compress_dict *
+load_compression_dict(const char *filename)
+{
+   struct util_compress_dict *dict = NULL;
+   uint8_t *data = NULL;
+   struct stat sb;
+
+   int fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (fstat(fd, &sb) == -1 || !sb.st_size || sb.st_size > CACHE_DICT_MAX_SIZE)
+      goto fail;
+
+   data = malloc(sb.st_size);
+   if (data == NULL || read_all(fd, data, sb.st_size) == -1)
+      goto fail;
+
+   dict = util_compress_dict_create(data, sb.st_size);
+
+fail:
+   free(data);
+   close(fd);
+
+   return dict;
+}
+
+/* Store the dictionary unless another instance did it first, in which case
+ * all of them use that one.
+ */
+static struct util_compress_dict *
+store_compression_dict(struct disk_cache *cache, const uint8_t *data,
+                       size_t size)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   struct util_compress_dict *dict = NULL;
+
+   char *filename = get_compression_dict_filename(mem_ctx, cache);
+   if (filename == NULL)
+      goto done;
+
+   char *filename_tmp = ralloc_asprintf(mem_ctx, "%s.%d.tmp", filename,
+                                        (int) getpid());
+   if (filename_tmp == NULL)
+      goto done;
+
+   int fd = open(filename_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1)
+      goto done;
+
+   int ret = write_all(fd, data, size);
+   close(fd);
+
+   if (ret != -1 && link(filename_tmp, filename) == 0)
+      dict = util_compress_dict_create(data, size);
+   else if (ret != -1 && errno == EEXIST)
+      dict = load_compression_dict(filename);
+
+   unlink(filename_tmp);
+
+done:
+   ralloc_free(mem_ctx);
+
+   return dict;
+}
+
+static void
+add_compression_dict_sample(struct disk_cache *cache, const void *data,
+                            size_t size)
+{
+   size = MIN2(size, CACHE_DICT_MAX_SAMPLE_SIZE);
+
+   simple_mtx_lock(&cache->dict_mtx);
+
+   if (!cache->train_dict) {
+      simple_mtx_unlock(&cache->dict_mtx);
+      return;
+   }
+
+   memcpy(util_dynarray_grow_bytes(&cache->dict_samples, 1, size), data, size);
+   util_dynarray_append(&cache->dict_sample_sizes, size_t, size);
+
+   if (cache->dict_samples.size < CACHE_DICT_SAMPLES_SIZE) {
+      simple_mtx_unlock(&cache->dict_mtx);
+      return;
+   }
+
+   /* Enough samples, train the dictionary outside of the lock. The other
+    * threads keep compressing without it in the mean time.
+    */
+   struct util_dynarray samples = cache->dict_samples;
+   struct util_dynarray sample_sizes = cache->dict_sample_sizes;
+   util_dynarray_init(&cache->dict_samples, NULL);
+   util_dynarray_init(&cache->dict_sample_sizes, NULL);
+   p_atomic_set(&cache->train_dict, false);
+
+   simple_mtx_unlock(&cache->dict_mtx);
+
+   uint8_t *dict_data = malloc(CACHE_DICT_MAX_SIZE);
+   if (dict_data) {
+      size_t dict_size =
+         util_compress_train_dict(samples.data, sample_sizes.data,
+                                  util_dynarray_num_elements(&sample_sizes,
+                                                             size_t),
+                                  dict_data, CACHE_DICT_MAX_SIZE);
+
+      struct util_compress_dict *dict = NULL;
+      if (dict_size)
+         dict = store_compression_dict(cache, dict_data, dict_size);
+
+      if (dict) {
+         p_atomic_set(&cache->compress_dict, dict);
+         p_atomic_set(&cache->foz_db.dict, dict);
+      }
+      free(dict_data);
+   }
+
+   util_dynarray_fini(&samples);
+   util_dynarray_fini(&sample_sizes);
+}
+
 static bool
 create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
                                   struct blob *cache_blob)
 {
+   if (p_atomic_read(&dc_job->cache->train_dict))
+      add_compression_dict_sample(dc_job->cache, dc_job->data, dc_job->size);
 
    /* Compress the cache item data */
    size_t max_buf = util_compress_max_compressed_len(dc_job->size);
@@ -656,8 +819,9 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
       if (compressed_data == NULL)
          return false;
       compressed_size =
-         util_compress_deflate(dc_job->data, dc_job->size,
-                              compressed_data, max_buf);
+         util_compress_deflate_dict(p_atomic_read(&dc_job->cache->compress_dict),
+                                    dc_job->data, dc_job->size,
+                                    compressed_data, max_buf);
       if (compressed_size == 0)
          goto fail;
    }
@@ -950,17 +1114,58 @@ disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size)
 {
    size_t cache_tem_size = 0;
+
+   /* Items of mapped read only dbs are parsed in place, and their CRC was
+    * already checked by the foz db.
+    */
+   const void *mapped = foz_read_entry_mapped(&cache->foz_db, key,
+                                              &cache_tem_size);
+   if (mapped)
+      return parse_and_validate_cache_item(cache, mapped, cache_tem_size,
+                                           false, size);
+
    void *cache_item = foz_read_entry(&cache->foz_db, key, &cache_tem_size);
    if (!cache_item)
       return NULL;
 
    uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size);
+       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, true,
+                                     size);
    free(cache_item);
 
    return uncompressed_data;
 }
 
+/* Return a pointer to the data of an item of a mapped read only foz db, if
+ * it can be used as is, i.e. isn't compressed. The data stays valid until
+ * the cache is destroyed.
+ */
+const void *
+disk_cache_load_item_foz_nocopy(struct disk_cache *cache, const cache_key key,
+                                size_t *size)
+{
+   if (!cache->compression_disabled)
+      return NULL;
+
+   size_t cache_item_size;
+   const void *cache_item = foz_read_entry_mapped(&cache->foz_db, key,
+                                                  &cache_item_size);
+   if (!cache_item)
+      return NULL;
+
+   const struct cache_entry_file_data *cf_data;
+   size_t data_size;
+   const uint8_t *data = validate_cache_item(cache, cache_item, cache_item_size,
+                                             false, &cf_data, &data_size);
+   if (!data || cf_data->uncompressed_size != data_size)
+      return NULL;
+
+   if (size)
+      *size = data_size;
+
+   return data;
+}
+
 bool
 disk_cache_write_item_to_disk_foz(struct disk_cache_put_job *dc_job)
 {
@@ -1048,6 +1253,138 @@ disk_cache_destroy_mmap(struct disk_cache *cache)
    munmap(cache->index_mmap, cache->index_mmap_size);
 }
 
+static char *
+get_prefetch_manifest_filename(void *mem_ctx, struct disk_cache *cache)
+{
+   const char *process_name = util_get_process_name();
+
+   if (!process_name || !*process_name)
+      return NULL;
+
+   return ralloc_asprintf(mem_ctx, "%s/%s.prefetch", cache->path,
+                          process_name);
+}
+
+/* The prefetch manifest is just an array of the keys used by the last run
+ * of the application.
+ */
+cache_key *
+disk_cache_load_prefetch_manifest(void *mem_ctx, struct disk_cache *cache,
+                                  unsigned *num_keys)
+{
+   cache_key *keys = NULL;
+   struct stat sb;
+   int fd = -1;
+
+   *num_keys = 0;
+
+   char *filename = get_prefetch_manifest_filename(mem_ctx, cache);
+   if (filename == NULL)
+      return NULL;
+
+   fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (fstat(fd, &sb) == -1 || !sb.st_size ||
+       sb.st_size % CACHE_KEY_SIZE ||
+       sb.st_size > CACHE_PREFETCH_MAX_KEYS * CACHE_KEY_SIZE)
+      goto fail;
+
+   keys = ralloc_size(mem_ctx, sb.st_size);
+   if (keys == NULL)
+      goto fail;
+
+   if (read_all(fd, keys, sb.st_size) == -1) {
+      ralloc_free(keys);
+      keys = NULL;
+      goto fail;
+   }
+
+   *num_keys = sb.st_size / CACHE_KEY_SIZE;
+
+fail:
+   close(fd);
+
+   return keys;
+}
+
+void
+disk_cache_write_prefetch_manifest(struct disk_cache *cache,
+                                   struct set *keys)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   char *filename, *filename_tmp;
+   int fd;
+
+   filename = get_prefetch_manifest_filename(mem_ctx, cache);
+   if (filename == NULL)
+      goto done;
+
+   /* Write the manifest to a temporary file first, so that other instances
+    * of the application never see a partial one.
+    */
+   filename_tmp = ralloc_asprintf(mem_ctx, "%s.%d.tmp", filename,
+                                  (int) getpid());
+   if (filename_tmp == NULL)
+      goto done;
+
+   fd = open(filename_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1)
+      goto done;
+
+   set_foreach(keys, entry) {
+      if (write_all(fd, entry->key, CACHE_KEY_SIZE) == -1) {
+         close(fd);
+         unlink(filename_tmp);
+         goto done;
+      }
+   }
+
+   close(fd);
+
+   if (rename(filename_tmp, filename) == -1)
+      unlink(filename_tmp);
+
+done:
+   ralloc_free(mem_ctx);
+}
+
+/* The dictionary used to compress the items, once written, is kept for the
+ * lifetime of the cache directory. It is loaded even if
+ * MESA_DISK_CACHE_COMPRESSION_DICT isn't set anymore, as the items compressed
+ * with it couldn't be read otherwise.
+ */
+void
+disk_cache_init_compression_dict(struct disk_cache *cache)
+{
+   void *mem_ctx = ralloc_context(NULL);
+
+   simple_mtx_init(&cache->dict_mtx, mtx_plain);
+   util_dynarray_init(&cache->dict_samples, NULL);
+   util_dynarray_init(&cache->dict_sample_sizes, NULL);
+
+   char *filename = get_compression_dict_filename(mem_ctx, cache);
+   if (filename)
+      cache->compress_dict = load_compression_dict(filename);
+
+   if (cache->compress_dict)
+      cache->foz_db.dict = cache->compress_dict;
+   else if (debug_get_bool_option("MESA_DISK_CACHE_COMPRESSION_DICT", false))
+      cache->train_dict = true;
+
+   ralloc_free(mem_ctx);
+}
+
+void
+disk_cache_finish_compression_dict(struct disk_cache *cache)
+{
+   util_compress_dict_destroy(cache->compress_dict);
+   util_dynarray_fini(&cache->dict_samples);
+   util_dynarray_fini(&cache->dict_sample_sizes);
+   simple_mtx_destroy(&cache->dict_mtx);
+}
+
 void *
 disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
                         size_t *size)
@@ -1059,7 +1396,8 @@ disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
       return NULL;
 
    uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size);
+       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, true,
+                                     size);
    free(cache_item);
 
    return uncompressed_data;
@@ -34,6 +34,9 @@
 
 #include "util/fossilize_db.h"
 #include "util/mesa_cache_db.h"
+#include "util/set.h"
+#include "util/simple_mtx.h"
+#include "util/u_dynarray.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,6 +51,18 @@ extern "C" {
 /* The number of keys that can be stored in the index. */
 #define CACHE_INDEX_MAX_KEYS (1 << CACHE_INDEX_KEY_BITS)
 
+/* Limits of the working set recorded and loaded for MESA_DISK_CACHE_PREFETCH */
+#define CACHE_PREFETCH_MAX_KEYS 16384
+#define CACHE_PREFETCH_MAX_SIZE (64 * 1024 * 1024)
+
+/* MESA_DISK_CACHE_COMPRESSION_DICT: the dictionary is trained once that many
+ * bytes of items were stored, taking at most CACHE_DICT_MAX_SAMPLE_SIZE of
+ * every item.
+ */
+#define CACHE_DICT_SAMPLES_SIZE (1024 * 1024)
+#define CACHE_DICT_MAX_SAMPLE_SIZE (64 * 1024)
+#define CACHE_DICT_MAX_SIZE (64 * 1024)
+
 struct disk_cache {
    /* The path to the cache directory. */
    char *path;
@@ -85,8 +100,39 @@ struct disk_cache {
    disk_cache_put_cb blob_put_cb;
    disk_cache_get_cb blob_get_cb;
 
-   /* Don't compress cached data. This is for testing purposes only. */
+   /* Don't compress cached data. This is for testing purposes, or because
+    * the foz db compresses the chunks of the items it deduplicates.
+    */
    bool compression_disabled;
+
+   /* Dictionary the items are compressed with, loaded from the cache
+    * directory or trained from the first items stored when
+    * MESA_DISK_CACHE_COMPRESSION_DICT is set. It is set atomically and
+    * doesn't change after that.
+    */
+   struct util_compress_dict *compress_dict;
+   simple_mtx_t dict_mtx;
+   bool train_dict;
+   struct util_dynarray dict_samples;
+   struct util_dynarray dict_sample_sizes;
+
+   /* MESA_DISK_CACHE_PREFETCH: keys used by this run are recorded into a
+    * manifest of the application, the items listed in the manifest of the
+    * previous run are loaded on the cache threads at creation.
+    */
+   bool prefetch;
+   simple_mtx_t prefetch_mtx;
+   struct set *used_keys;
+   struct set *prefetched;
+   size_t prefetched_size;
+   struct disk_cache_batch *prefetch_batch;
+};
+
+/* Item loaded by the prefetch that wasn't asked for yet */
+struct disk_cache_prefetched_item {
+   cache_key key;
+   void *data;
+   size_t size;
 };
 
 struct cache_entry_file_data {
@@ -124,6 +170,10 @@ void *
 disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size);
 
+const void *
+disk_cache_load_item_foz_nocopy(struct disk_cache *cache, const cache_key key,
+                                size_t *size);
+
 void *
 disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size);
 
@@ -150,6 +200,20 @@ disk_cache_mmap_cache_index(void *mem_ctx, struct disk_cache *cache,
 void
 disk_cache_destroy_mmap(struct disk_cache *cache);
 
+cache_key *
+disk_cache_load_prefetch_manifest(void *mem_ctx, struct disk_cache *cache,
+                                  unsigned *num_keys);
+
+void
+disk_cache_write_prefetch_manifest(struct disk_cache *cache,
+                                   struct set *keys);
+
+void
+disk_cache_init_compression_dict(struct disk_cache *cache);
+
+void
+disk_cache_finish_compression_dict(struct disk_cache *cache);
+
 void *
 disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
                         size_t *size);
@@ -25,7 +25,8 @@
  * use with the Mesa shader cache.
  *
  * The format is compatible enough to allow the fossilize db tools to be used
- * to do things like merge db collections.
+ * to do things like merge db collections. This doesn't apply to the entries
+ * written with deduplication enabled, which use Mesa specific formats.
  */
 
 #include "fossilize_db.h"
@@ -37,16 +38,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "compress.h"
 #include "crc32.h"
 #include "hash_table.h"
 #include "mesa-sha1.h"
 #include "ralloc.h"
+#include "u_atomic.h"
 
 #define FOZ_REF_MAGIC_SIZE 16
 
+/* Deduplicated entries are cut where the gear hash of the preceding bytes
+ * has its top FOZ_CHUNK_MASK_BITS bits cleared, so identical data gets the
+ * same chunks wherever it is in the entries. Chunks are 2.5K on average.
+ */
+#define FOZ_CHUNK_MIN_SIZE 512
+#define FOZ_CHUNK_MAX_SIZE 8192
+#define FOZ_CHUNK_MASK_BITS 11
+
 static const uint8_t stream_reference_magic_and_version[FOZ_REF_MAGIC_SIZE] = {
    0x81, 'F', 'O', 'S',
    'S', 'I', 'L', 'I',
@@ -108,7 +121,8 @@ create_foz_db_filenames(char *cache_path, char *name, char **filename,
 /* This looks at stuff that was added to the index since the last time we looked at it. This is safe
  * to do without locking the file as we assume the file is append only */
 static void
-update_foz_index(struct foz_db *foz_db, FILE *db_idx, unsigned file_idx)
+update_foz_index(struct foz_db *foz_db, struct hash_table_u64 *index_db,
+                 FILE *db_idx, unsigned file_idx)
 {
    uint64_t offset = ftell(db_idx);
    fseek(db_idx, 0, SEEK_END);
@@ -156,8 +170,8 @@ update_foz_index(struct foz_db *foz_db, FILE *db_idx, unsigned file_idx)
       offset += header->payload_size;
       parsed_offset = offset;
 
-      struct foz_db_entry *entry = ralloc(foz_db->mem_ctx,
-                                          struct foz_db_entry);
+      struct foz_db_entry *entry = rzalloc(foz_db->mem_ctx,
+                                           struct foz_db_entry);
       entry->header = *header;
       entry->file_idx = file_idx;
       _mesa_sha1_hex_to_sha1(entry->key, hash_str);
@@ -170,7 +184,7 @@ update_foz_index(struct foz_db *foz_db, FILE *db_idx, unsigned file_idx)
 
       entry->offset = cache_offset;
 
-      _mesa_hash_table_u64_insert(foz_db->index_db, key, entry);
+      _mesa_hash_table_u64_insert(index_db, key, entry);
    }
 
 
@@ -250,7 +264,8 @@ load_foz_dbs(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx,
 
    flock(fileno(foz_db->file[file_idx]), LOCK_UN);
 
-   update_foz_index(foz_db, db_idx, file_idx);
+   update_foz_index(foz_db, read_only ? foz_db->ro_index_db : foz_db->index_db,
+                    db_idx, file_idx);
 
    foz_db->alive = true;
    return true;
@@ -261,6 +276,26 @@ fail:
    return false;
 }
 
+/* Map a read only foz db so entries can be read from it without locking. If
+ * this fails reads fall back to going through the FILE.
+ */
+static void
+map_foz_db(struct foz_db *foz_db, uint8_t file_idx)
+{
+   struct stat st;
+   int fd = fileno(foz_db->file[file_idx]);
+
+   if (fstat(fd, &st) == -1 || st.st_size == 0)
+      return;
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      return;
+
+   foz_db->map[file_idx] = map;
+   foz_db->map_size[file_idx] = st.st_size;
+}
+
 /* Here we open mesa cache foz dbs files. If the files exist we load the index
  * db into a hash table. The index db contains the offsets needed to later
  * read cache entries from the foz db containing the actual cache entries.
@@ -289,6 +324,7 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
    simple_mtx_init(&foz_db->flock_mtx, mtx_plain);
    foz_db->mem_ctx = ralloc_context(NULL);
    foz_db->index_db = _mesa_hash_table_u64_create(NULL);
+   foz_db->ro_index_db = _mesa_hash_table_u64_create(NULL);
 
    if (!load_foz_dbs(foz_db, foz_db->db_idx, 0, false))
       return false;
@@ -331,6 +367,7 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
       }
 
       fclose(db_idx);
+      map_foz_db(foz_db, file_idx);
       file_idx++;
 
       if (file_idx >= FOZ_MAX_DBS)
@@ -346,11 +383,14 @@ foz_destroy(struct foz_db *foz_db)
    if (foz_db->db_idx)
       fclose(foz_db->db_idx);
    for (unsigned i = 0; i < FOZ_MAX_DBS; i++) {
+      if (foz_db->map[i])
+         munmap((void *)foz_db->map[i], foz_db->map_size[i]);
       if (foz_db->file[i])
          fclose(foz_db->file[i]);
    }
 
    if (foz_db->mem_ctx) {
+      _mesa_hash_table_u64_destroy(foz_db->ro_index_db);
       _mesa_hash_table_u64_destroy(foz_db->index_db);
       ralloc_free(foz_db->mem_ctx);
       simple_mtx_destroy(&foz_db->flock_mtx);
@@ -358,53 +398,105 @@ foz_destroy(struct foz_db *foz_db)
    }
 }
 
-/* Here we lookup a cache entry in the index hash table. If an entry is found
- * we use the retrieved offset to read the cache entry from disk.
+/* Look up an entry of the read only dbs. Their index isn't modified after
+ * foz_prepare() so no locking is needed.
  */
-void *
-foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
-               size_t *size)
+static struct foz_db_entry *
+search_ro_index(struct foz_db *foz_db, const uint8_t *cache_key_160bit)
 {
    uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
 
-   void *data = NULL;
+   struct foz_db_entry *entry =
+      _mesa_hash_table_u64_search(foz_db->ro_index_db, hash);
+
+   /* Check for collision using full 160bit hash for increased assurance
+    * against potential collisions.
+    */
+   if (!entry || memcmp(entry->key, cache_key_160bit, 20) != 0)
+      return NULL;
+
+   return entry;
+}
 
+/* Return a pointer to the payload of an entry of a mapped read only db, or
+ * NULL if there is no such entry. The payload has been checked against its
+ * CRC, entries without one or that are deduplicated are left to
+ * foz_read_entry(). The data stays valid until foz_destroy() and must not be
+ * freed. This doesn't take any locks.
+ */
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size)
+{
    if (!foz_db->alive)
       return NULL;
 
-   simple_mtx_lock(&foz_db->mtx);
+   struct foz_db_entry *entry = search_ro_index(foz_db, cache_key_160bit);
+   if (!entry || !foz_db->map[entry->file_idx])
+      return NULL;
+
+   const uint8_t *map = foz_db->map[entry->file_idx];
+   size_t map_size = foz_db->map_size[entry->file_idx];
+   struct foz_payload_header header;
+
+   if (entry->offset > map_size || map_size - entry->offset < sizeof(header))
+      return NULL;
+
+   memcpy(&header, map + entry->offset, sizeof(header));
+
+   size_t data_offset = entry->offset + sizeof(header);
+   if (header.payload_size > map_size - data_offset)
+      return NULL;
+
+   const uint8_t *data = map + data_offset;
+
+   if (header.crc == 0 || header.format != FOSSILIZE_COMPRESSION_NONE)
+      return NULL;
+
+   /* verify checksum, once per entry as the data can't change */
+   if (!p_atomic_read(&entry->verified)) {
+      if (util_hash_crc32(data, header.payload_size) != header.crc)
+         return NULL;
+      p_atomic_set(&entry->verified, 1);
+   }
+
+   if (size)
+      *size = header.payload_size;
+
+   return data;
+}
+
+/* Look up an entry of the default db. Called with the mutex held. */
+static struct foz_db_entry *
+search_index(struct foz_db *foz_db, const uint8_t *cache_key_160bit)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
 
    struct foz_db_entry *entry =
       _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (!entry) {
-      update_foz_index(foz_db, foz_db->db_idx, 0);
-      entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   }
-   if (!entry) {
-      simple_mtx_unlock(&foz_db->mtx);
+   if (!entry || memcmp(entry->key, cache_key_160bit, 20) != 0)
       return NULL;
-   }
 
-   uint8_t file_idx = entry->file_idx;
-   if (fseek(foz_db->file[file_idx], entry->offset, SEEK_SET) < 0)
-      goto fail;
+   return entry;
+}
 
-   uint32_t header_size = sizeof(struct foz_payload_header);
-   if (fread(&entry->header, 1, header_size, foz_db->file[file_idx]) !=
-       header_size)
-      goto fail;
+/* Read the header and payload of an entry from its db and verify the
+ * payload. Called with the mutex held.
+ */
+static void *
+read_payload(struct foz_db *foz_db, struct foz_db_entry *entry)
+{
+   FILE *file = foz_db->file[entry->file_idx];
+   if (fseek(file, entry->offset, SEEK_SET) < 0)
+      return NULL;
 
-   /* Check for collision using full 160bit hash for increased assurance
-    * against potential collisions.
-    */
-   for (int i = 0; i < 20; i++) {
-      if (cache_key_160bit[i] != entry->key[i])
-         goto fail;
-   }
+   uint32_t header_size = sizeof(struct foz_payload_header);
+   if (fread(&entry->header, 1, header_size, file) != header_size)
+      return NULL;
 
    uint32_t data_sz = entry->header.payload_size;
-   data = malloc(data_sz);
-   if (fread(data, 1, data_sz, foz_db->file[file_idx]) != data_sz)
+   void *data = malloc(data_sz);
+   if (fread(data, 1, data_sz, file) != data_sz)
       goto fail;
 
    /* verify checksum */
@@ -413,63 +505,149 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
          goto fail;
    }
 
-   simple_mtx_unlock(&foz_db->mtx);
-
-   if (size)
-      *size = data_sz;
-
    return data;
 
 fail:
    free(data);
+   return NULL;
+}
 
-   /* reading db entry failed. reset the file offset */
-   simple_mtx_unlock(&foz_db->mtx);
+/* Put a deduplicated entry back together from the chunks listed by its
+ * payload. Called with the mutex held.
+ */
+static void *
+read_chunks(struct foz_db *foz_db, const struct foz_payload_header *header,
+            const uint8_t *chunk_keys)
+{
+   if (header->payload_size % 20 != 0)
+      return NULL;
+
+   uint8_t *data = malloc(header->uncompressed_size);
+   if (!data)
+      return NULL;
 
+   size_t offset = 0;
+   for (unsigned i = 0; i < header->payload_size / 20; i++) {
+      const uint8_t *chunk_key = chunk_keys + i * 20;
+      struct foz_db_entry *chunk = search_ro_index(foz_db, chunk_key);
+      if (!chunk)
+         chunk = search_index(foz_db, chunk_key);
+      if (!chunk)
+         goto fail;
+
+      uint8_t *payload = read_payload(foz_db, chunk);
+      if (!payload)
+         goto fail;
+
+      uint32_t size = chunk->header.uncompressed_size;
+      bool valid = size <= header->uncompressed_size - offset;
+      if (valid && chunk->header.format == FOSSILIZE_COMPRESSION_NONE) {
+         valid = chunk->header.payload_size == size;
+         if (valid)
+            memcpy(data + offset, payload, size);
+#ifdef HAVE_COMPRESSION
+      } else if (valid &&
+                 chunk->header.format == FOZ_FORMAT_COMPRESSED_CHUNK) {
+         valid = util_compress_inflate_dict(p_atomic_read(&foz_db->dict),
+                                            payload,
+                                            chunk->header.payload_size,
+                                            data + offset, size);
+#endif
+      } else {
+         valid = false;
+      }
+      free(payload);
+
+      if (!valid)
+         goto fail;
+
+      offset += size;
+   }
+
+   if (offset != header->uncompressed_size)
+      goto fail;
+
+   return data;
+
+fail:
+   free(data);
    return NULL;
 }
 
-/* Here we write the cache entry to disk and store its offset in the index db.
+/* Here we lookup a cache entry in the index hash table. If an entry is found
+ * we use the retrieved offset to read the cache entry from disk.
  */
-bool
-foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
-                const void *blob, size_t blob_size)
+void *
+foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+               size_t *size)
 {
    uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
 
-   if (!foz_db->alive)
-      return false;
+   void *data = NULL;
 
-   /* The flock is per-fd, not per thread, we do it outside of the main mutex to avoid having to
-    * wait in the mutex potentially blocking reads. We use the secondary flock_mtx to stop race
-    * conditions between the write threads sharing the same file descriptor. */
-   simple_mtx_lock(&foz_db->flock_mtx);
+   if (!foz_db->alive)
+      return NULL;
 
-   /* Wait for 1 second. This is done outside of the main mutex as I believe there is more potential
-    * for file contention than mtx contention of significant length. */
-   int err = lock_file_with_timeout(foz_db->file[0], 1000000000);
-   if (err == -1)
-      goto fail_file;
+   size_t mapped_size;
+   const void *mapped = foz_read_entry_mapped(foz_db, cache_key_160bit,
+                                              &mapped_size);
+   if (mapped) {
+      data = malloc(mapped_size);
+      if (!data)
+         return NULL;
+
+      memcpy(data, mapped, mapped_size);
+      if (size)
+         *size = mapped_size;
+      return data;
+   }
 
    simple_mtx_lock(&foz_db->mtx);
 
-   update_foz_index(foz_db, foz_db->db_idx, 0);
+   struct foz_db_entry *entry = search_ro_index(foz_db, cache_key_160bit);
+   if (!entry)
+      entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
+   if (!entry) {
+      update_foz_index(foz_db, foz_db->index_db, foz_db->db_idx, 0);
+      entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
+   }
 
-   struct foz_db_entry *entry =
-      _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (entry) {
+   /* Check for collision using full 160bit hash for increased assurance
+    * against potential collisions.
+    */
+   if (!entry || memcmp(entry->key, cache_key_160bit, 20) != 0) {
       simple_mtx_unlock(&foz_db->mtx);
-      flock(fileno(foz_db->file[0]), LOCK_UN);
-      simple_mtx_unlock(&foz_db->flock_mtx);
       return NULL;
    }
 
-   /* Prepare db entry header and blob ready for writing */
-   struct foz_payload_header header;
-   header.uncompressed_size = blob_size;
-   header.format = FOSSILIZE_COMPRESSION_NONE;
-   header.payload_size = blob_size;
-   header.crc = util_hash_crc32(blob, blob_size);
+   data = read_payload(foz_db, entry);
+   size_t data_sz = entry->header.payload_size;
+
+   if (data && entry->header.format == FOZ_FORMAT_CHUNK_LIST) {
+      struct foz_payload_header header = entry->header;
+      void *chunk_keys = data;
+
+      data = read_chunks(foz_db, &header, chunk_keys);
+      data_sz = header.uncompressed_size;
+      free(chunk_keys);
+   }
+
+   simple_mtx_unlock(&foz_db->mtx);
+
+   if (data && size)
+      *size = data_sz;
+
+   return data;
+}
+
+/* Append an entry to the default db and store its offset in the index db.
+ * Called with the file locked and the mutex held.
+ */
+static bool
+write_record(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+             struct foz_payload_header header, const void *payload)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
 
    fseek(foz_db->file[0], 0, SEEK_END);
 
@@ -478,17 +656,18 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    _mesa_sha1_format(hash_str, cache_key_160bit);
    if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->file[0]) !=
        FOSSILIZE_BLOB_HASH_LENGTH)
-      goto fail;
+      return false;
 
    off_t offset = ftell(foz_db->file[0]);
 
    /* Write db entry header */
    if (fwrite(&header, 1, sizeof(header), foz_db->file[0]) != sizeof(header))
-      goto fail;
+      return false;
 
    /* Now write the db entry blob */
-   if (fwrite(blob, 1, blob_size, foz_db->file[0]) != blob_size)
-      goto fail;
+   if (fwrite(payload, 1, header.payload_size, foz_db->file[0]) !=
+       header.payload_size)
+      return false;
 
    /* Flush everything to file to reduce chance of cache corruption */
    fflush(foz_db->file[0]);
@@ -496,7 +675,7 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    /* Write hash header to index db */
    if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->db_idx) !=
        FOSSILIZE_BLOB_HASH_LENGTH)
-      goto fail;
+      return false;
 
    header.uncompressed_size = sizeof(uint64_t);
    header.format = FOSSILIZE_COMPRESSION_NONE;
@@ -505,34 +684,265 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
 
    if (fwrite(&header, 1, sizeof(header), foz_db->db_idx) !=
        sizeof(header))
-      goto fail;
+      return false;
 
    if (fwrite(&offset, 1, sizeof(uint64_t), foz_db->db_idx) !=
        sizeof(uint64_t))
-      goto fail;
+      return false;
 
    /* Flush everything to file to reduce chance of cache corruption */
    fflush(foz_db->db_idx);
 
-   entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
+   struct foz_db_entry *entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
    entry->header = header;
    entry->offset = offset;
    entry->file_idx = 0;
+   entry->verified = 0;
    _mesa_sha1_hex_to_sha1(entry->key, hash_str);
    _mesa_hash_table_u64_insert(foz_db->index_db, hash, entry);
 
-   simple_mtx_unlock(&foz_db->mtx);
-   flock(fileno(foz_db->file[0]), LOCK_UN);
-   simple_mtx_unlock(&foz_db->flock_mtx);
+   return true;
+}
 
+/* The flock is per-fd, not per thread, we do it outside of the main mutex to
+ * avoid having to wait in the mutex potentially blocking reads. We use the
+ * secondary flock_mtx to stop race conditions between the write threads
+ * sharing the same file descriptor.
+ */
+static bool
+lock_for_write(struct foz_db *foz_db)
+{
+   simple_mtx_lock(&foz_db->flock_mtx);
+
+   /* Wait for 1 second. This is done outside of the main mutex as I believe
+    * there is more potential for file contention than mtx contention of
+    * significant length.
+    */
+   int err = lock_file_with_timeout(foz_db->file[0], 1000000000);
+   if (err == -1) {
+      simple_mtx_unlock(&foz_db->flock_mtx);
+      return false;
+   }
+
+   simple_mtx_lock(&foz_db->mtx);
+
+   update_foz_index(foz_db, foz_db->index_db, foz_db->db_idx, 0);
    return true;
+}
 
-fail:
+static void
+unlock_for_write(struct foz_db *foz_db)
+{
    simple_mtx_unlock(&foz_db->mtx);
-fail_file:
    flock(fileno(foz_db->file[0]), LOCK_UN);
    simple_mtx_unlock(&foz_db->flock_mtx);
-   return false;
+}
+
+struct foz_chunk {
+   uint8_t key[20];
+   const uint8_t *data;
+   uint32_t size;
+   bool stored;
+
+   /* What gets written if the chunk isn't stored yet */
+   void *compressed;
+   struct foz_payload_header header;
+};
+
+static void
+init_gear_table(uint64_t *gear)
+{
+   /* splitmix64, the table must be the same for every db */
+   uint64_t x = 0;
+   for (unsigned i = 0; i < 256; i++) {
+      uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      gear[i] = z ^ (z >> 31);
+   }
+}
+
+static size_t
+find_chunk_size(const uint64_t *gear, const uint8_t *data, size_t size)
+{
+   if (size <= FOZ_CHUNK_MIN_SIZE)
+      return size;
+
+   size_t max_size = MIN2(size, FOZ_CHUNK_MAX_SIZE);
+   uint64_t hash = 0;
+   for (size_t i = FOZ_CHUNK_MIN_SIZE; i < max_size; i++) {
+      hash = (hash << 1) + gear[data[i]];
+      if ((hash >> (64 - FOZ_CHUNK_MASK_BITS)) == 0)
+         return i + 1;
+   }
+
+   return max_size;
+}
+
+static void
+compress_chunk(struct foz_db *foz_db, struct foz_chunk *chunk)
+{
+   chunk->header.uncompressed_size = chunk->size;
+   chunk->header.format = FOSSILIZE_COMPRESSION_NONE;
+   chunk->header.payload_size = chunk->size;
+
+#ifdef HAVE_COMPRESSION
+   if (foz_db->compress_chunks) {
+      size_t max_size = util_compress_max_compressed_len(chunk->size);
+      void *compressed = malloc(max_size);
+      size_t compressed_size = 0;
+
+      if (compressed) {
+         compressed_size =
+            util_compress_deflate_dict(p_atomic_read(&foz_db->dict),
+                                       chunk->data, chunk->size,
+                                       compressed, max_size);
+      }
+
+      /* Keep the chunks that don't compress as they are */
+      if (compressed_size && compressed_size < chunk->size) {
+         chunk->compressed = compressed;
+         chunk->header.format = FOZ_FORMAT_COMPRESSED_CHUNK;
+         chunk->header.payload_size = compressed_size;
+      } else {
+         free(compressed);
+      }
+   }
+#endif
+
+   const void *payload = chunk->compressed ? chunk->compressed : chunk->data;
+   chunk->header.crc = util_hash_crc32(payload, chunk->header.payload_size);
+}
+
+/* Write an entry as the list of its chunks, after writing the chunks that
+ * aren't in the default db yet. Shader binaries and NIR share a lot of data,
+ * e.g. between variants of the same shader, which is only stored once this
+ * way.
+ */
+static bool
+write_chunked_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                    const uint8_t *blob, size_t blob_size)
+{
+   struct foz_chunk *chunks =
+      calloc(blob_size / FOZ_CHUNK_MIN_SIZE + 1, sizeof(*chunks));
+   uint8_t *chunk_keys =
+      malloc((blob_size / FOZ_CHUNK_MIN_SIZE + 1) * 20);
+   bool ret = false;
+
+   if (!chunks || !chunk_keys)
+      goto out;
+
+   uint64_t gear[256];
+   init_gear_table(gear);
+
+   unsigned num_chunks = 0;
+   for (size_t offset = 0; offset < blob_size; num_chunks++) {
+      struct foz_chunk *chunk = &chunks[num_chunks];
+
+      chunk->data = blob + offset;
+      chunk->size = find_chunk_size(gear, chunk->data, blob_size - offset);
+      offset += chunk->size;
+
+      /* Keep the keys of chunks and entries apart */
+      struct mesa_sha1 ctx;
+      _mesa_sha1_init(&ctx);
+      _mesa_sha1_update(&ctx, "foz chunk", 9);
+      _mesa_sha1_update(&ctx, chunk->data, chunk->size);
+      _mesa_sha1_final(&ctx, chunk->key);
+      memcpy(chunk_keys + num_chunks * 20, chunk->key, 20);
+   }
+
+   /* Only compress the chunks that aren't stored yet */
+   simple_mtx_lock(&foz_db->mtx);
+   update_foz_index(foz_db, foz_db->index_db, foz_db->db_idx, 0);
+   for (unsigned i = 0; i < num_chunks; i++)
+      chunks[i].stored = search_index(foz_db, chunks[i].key) != NULL;
+   simple_mtx_unlock(&foz_db->mtx);
+
+   for (unsigned i = 0; i < num_chunks; i++) {
+      if (!chunks[i].stored)
+         compress_chunk(foz_db, &chunks[i]);
+   }
+
+   if (!lock_for_write(foz_db))
+      goto out;
+
+   if (search_index(foz_db, cache_key_160bit))
+      goto out_unlock;
+
+   for (unsigned i = 0; i < num_chunks; i++) {
+      struct foz_chunk *chunk = &chunks[i];
+
+      /* Written by another process in the mean time, or earlier in this
+       * entry.
+       */
+      if (chunk->stored || search_index(foz_db, chunk->key))
+         continue;
+
+      if (!write_record(foz_db, chunk->key, chunk->header,
+                        chunk->compressed ? chunk->compressed : chunk->data))
+         goto out_unlock;
+   }
+
+   /* The list is written last so it never refers to missing chunks */
+   struct foz_payload_header header;
+   header.uncompressed_size = blob_size;
+   header.format = FOZ_FORMAT_CHUNK_LIST;
+   header.payload_size = num_chunks * 20;
+   header.crc = util_hash_crc32(chunk_keys, header.payload_size);
+
+   ret = write_record(foz_db, cache_key_160bit, header, chunk_keys);
+
+out_unlock:
+   unlock_for_write(foz_db);
+out:
+   if (chunks) {
+      for (unsigned i = 0; i < num_chunks; i++)
+         free(chunks[i].compressed);
+   }
+   free(chunks);
+   free(chunk_keys);
+   return ret;
+}
+
+/* Here we write the cache entry to disk and store its offset in the index db.
+ */
+bool
+foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                const void *blob, size_t blob_size)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
+
+   if (!foz_db->alive)
+      return false;
+
+   /* Already in one of the read only dbs */
+   if (search_ro_index(foz_db, cache_key_160bit))
+      return false;
+
+   /* Entries that fit in a single chunk have nothing to share */
+   if (foz_db->dedup && blob_size > FOZ_CHUNK_MIN_SIZE * 2)
+      return write_chunked_entry(foz_db, cache_key_160bit, blob, blob_size);
+
+   if (!lock_for_write(foz_db))
+      return false;
+
+   if (_mesa_hash_table_u64_search(foz_db->index_db, hash)) {
+      unlock_for_write(foz_db);
+      return false;
+   }
+
+   /* Prepare db entry header and blob ready for writing */
+   struct foz_payload_header header;
+   header.uncompressed_size = blob_size;
+   header.format = FOSSILIZE_COMPRESSION_NONE;
+   header.payload_size = blob_size;
+   header.crc = util_hash_crc32(blob, blob_size);
+
+   bool ret = write_record(foz_db, cache_key_160bit, header, blob);
+
+   unlock_for_write(foz_db);
+   return ret;
 }
 #else
 
@@ -557,6 +967,13 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size)
+{
+   return NULL;
+}
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size)
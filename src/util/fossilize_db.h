@@ -53,6 +53,15 @@ enum {
    FOSSILIZE_COMPRESSION_DEFLATE = 2
 };
 
+/* Mesa specific payload formats of deduplicated entries, see foz_db::dedup.
+ * The payload of a chunk list is the 160bit keys of the chunks making up the
+ * entry, the payload of a compressed chunk is the output of util_compress.
+ */
+enum {
+   FOZ_FORMAT_CHUNK_LIST = 0x100,
+   FOZ_FORMAT_COMPRESSED_CHUNK = 0x101
+};
+
 enum {
    FOSSILIZE_FORMAT_VERSION = 6,
    FOSSILIZE_FORMAT_MIN_COMPAT_VERSION = 5
@@ -68,6 +77,7 @@ struct foz_payload_header {
 struct foz_db_entry {
    uint8_t file_idx;
    uint8_t key[20];
+   uint8_t verified;                 /* Payload CRC checked, mapped dbs only */
    uint64_t offset;
    struct foz_payload_header header;
 };
@@ -78,7 +88,26 @@ struct foz_db {
    simple_mtx_t mtx;                 /* Mutex for file/hash table read/writes */
    simple_mtx_t flock_mtx;           /* Mutex for flocking the file for writes */
    void *mem_ctx;
-   struct hash_table_u64 *index_db;  /* Hash table of all foz db entries */
+   struct hash_table_u64 *index_db;  /* Hash table of the default foz db entries */
+
+   /* The read only dbs don't change once loaded, their index is built by
+    * foz_prepare() and only read after that, and their files are mapped
+    * when possible so they can be read from without taking the mutex.
+    */
+   struct hash_table_u64 *ro_index_db;
+   const uint8_t *map[FOZ_MAX_DBS];
+   size_t map_size[FOZ_MAX_DBS];
+
+   /* When set before writing, entries are split into content defined
+    * chunks, each of them stored once in the default db and compressed if
+    * compress_chunks is set. The chunks are compressed with dict if there is
+    * one, it is read atomically and may be set at any time, but must not
+    * change once set.
+    */
+   bool dedup;
+   bool compress_chunks;
+   struct util_compress_dict *dict;
+
    bool alive;
 };
 
@@ -92,6 +121,10 @@ void *
 foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                size_t *size);
 
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size);
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size);
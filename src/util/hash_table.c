@@ -38,6 +38,9 @@
  * For more information, see:
  *
  * http://cgit.freedesktop.org/~anholt/hash_table/tree/README
+ *
+ * Tables use the grouped layout described in hash_table_ctrl.h by default,
+ * the double hashing one is kept for comparison.
  */
 
 #include <stdlib.h>
@@ -49,6 +52,7 @@
 #include "macros.h"
 #include "u_memory.h"
 #include "fast_urem_by_const.h"
+#include "hash_table_ctrl.h"
 #include "util/u_memory.h"
 
 #define XXH_INLINE_ALL
@@ -145,6 +149,66 @@ entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
    return entry->key != NULL && entry->key != ht->deleted_key;
 }
 
+static bool
+hash_entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
+{
+   if (ht->ctrl)
+      return hash_ctrl_is_full(ht->ctrl, entry - ht->table);
+
+   return entry_is_present(ht, entry);
+}
+
+static enum hash_table_layout default_layout = HASH_TABLE_LAYOUT_GROUPED;
+
+void
+_mesa_hash_table_set_default_layout(enum hash_table_layout layout)
+{
+   default_layout = layout;
+}
+
+enum hash_table_layout
+_mesa_hash_table_get_default_layout(void)
+{
+   return default_layout;
+}
+
+/**
+ * Allocates the entries and the control bytes of a grouped table with
+ * 2^size_index slots as a single block.  Doesn't modify the table on
+ * failure.
+ */
+static bool
+grouped_table_alloc(struct hash_table *ht, void *mem_ctx, unsigned size_index)
+{
+   if (size_index > HASH_CTRL_MAX_SIZE_INDEX)
+      return false;
+
+   uint32_t size = 1u << size_index;
+
+   /* Objects can't be bigger than PTRDIFF_MAX, which 32-bit builds reach
+    * before the maximum size index.
+    */
+   uint64_t bytes = (uint64_t)size * sizeof(struct hash_entry) +
+                    hash_ctrl_size(size);
+   if (bytes > PTRDIFF_MAX)
+      return false;
+
+   struct hash_entry *table = ralloc_size(mem_ctx, bytes);
+   if (table == NULL)
+      return false;
+
+   ht->table = table;
+   ht->ctrl = (uint8_t *)(table + size);
+   ht->size = size;
+   ht->size_index = size_index;
+   ht->max_entries = hash_ctrl_max_entries(size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+   hash_ctrl_init(ht->ctrl, size);
+
+   return true;
+}
+
 bool
 _mesa_hash_table_init(struct hash_table *ht,
                       void *mem_ctx,
@@ -152,18 +216,29 @@ _mesa_hash_table_init(struct hash_table *ht,
                       bool (*key_equals_function)(const void *a,
                                                   const void *b))
 {
+   ht->key_hash_function = key_hash_function;
+   ht->key_equals_function = key_equals_function;
+   ht->deleted_key = &deleted_key_value;
+
+   if (default_layout == HASH_TABLE_LAYOUT_GROUPED) {
+      ht->rehash = 0;
+      ht->size_magic = 0;
+      ht->rehash_magic = 0;
+      ht->table = NULL;
+      ht->ctrl = NULL;
+      return grouped_table_alloc(ht, mem_ctx, HASH_CTRL_MIN_SIZE_INDEX);
+   }
+
+   ht->ctrl = NULL;
    ht->size_index = 0;
    ht->size = hash_sizes[ht->size_index].size;
    ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
    ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->key_hash_function = key_hash_function;
-   ht->key_equals_function = key_equals_function;
    ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
-   ht->deleted_key = &deleted_key_value;
 
    return ht->table != NULL;
 }
@@ -222,13 +297,19 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   size_t table_size = ht->size * sizeof(struct hash_entry);
+   if (src->ctrl)
+      table_size += hash_ctrl_size(ht->size);
+
+   ht->table = ralloc_size(ht, table_size);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, table_size);
+   if (src->ctrl)
+      ht->ctrl = (uint8_t *)(ht->table + ht->size);
 
    return ht;
 }
@@ -257,7 +338,10 @@ _mesa_hash_table_destroy(struct hash_table *ht,
 static void
 hash_table_clear_fast(struct hash_table *ht)
 {
-   memset(ht->table, 0, sizeof(struct hash_entry) * hash_sizes[ht->size_index].size);
+   if (ht->ctrl)
+      hash_ctrl_init(ht->ctrl, ht->size);
+   else
+      memset(ht->table, 0, sizeof(struct hash_entry) * hash_sizes[ht->size_index].size);
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -278,11 +362,13 @@ _mesa_hash_table_clear(struct hash_table *ht,
 
    if (delete_function) {
       for (entry = ht->table; entry != ht->table + ht->size; entry++) {
-         if (entry_is_present(ht, entry))
+         if (hash_entry_is_present(ht, entry))
             delete_function(entry);
 
          entry->key = NULL;
       }
+      if (ht->ctrl)
+         hash_ctrl_init(ht->ctrl, ht->size);
       ht->entries = 0;
       ht->deleted_entries = 0;
    } else
@@ -305,11 +391,40 @@ _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
    ht->deleted_key = deleted_key;
 }
 
+static struct hash_entry *
+grouped_search(struct hash_table *ht, uint32_t hash, const void *key)
+{
+   uint32_t mixed = hash_ctrl_mix(hash);
+   uint8_t h2 = hash_ctrl_h2(mixed);
+   struct hash_ctrl_probe probe = hash_ctrl_probe_start(mixed, ht->size);
+
+   do {
+      uint32_t offset = hash_ctrl_probe_offset(&probe);
+      const uint8_t *ctrl = ht->ctrl + offset;
+      uint64_t match = hash_group_match(ctrl, h2);
+
+      while (match) {
+         struct hash_entry *entry = ht->table + offset + hash_group_next(&match);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      if (hash_group_match_empty(ctrl))
+         return NULL;
+   } while (hash_ctrl_probe_next(&probe));
+
+   return NULL;
+}
+
 static struct hash_entry *
 hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
 {
    assert(!key_pointer_is_reserved(ht, key));
 
+   if (ht->ctrl)
+      return grouped_search(ht, hash, key);
+
    uint32_t size = ht->size;
    uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
    uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
@@ -385,12 +500,48 @@ hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
    } while (true);
 }
 
+static void
+grouped_rehash(struct hash_table *ht, unsigned new_size_index)
+{
+   struct hash_table old_ht;
+
+   if (ht->size_index == new_size_index && !ht->entries) {
+      hash_table_clear_fast(ht);
+      return;
+   }
+
+   old_ht = *ht;
+
+   if (!grouped_table_alloc(ht, ralloc_parent(old_ht.table), new_size_index))
+      return;
+
+   for (uint32_t i = 0; i < old_ht.size; i++) {
+      if (!hash_ctrl_is_full(old_ht.ctrl, i))
+         continue;
+
+      uint32_t mixed = hash_ctrl_mix(old_ht.table[i].hash);
+      uint32_t slot = hash_ctrl_find_free(ht->ctrl, ht->size, mixed);
+
+      ht->ctrl[slot] = old_ht.ctrl[i];
+      ht->table[slot] = old_ht.table[i];
+   }
+
+   ht->entries = old_ht.entries;
+
+   ralloc_free(old_ht.table);
+}
+
 static void
 _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
 {
    struct hash_table old_ht;
    struct hash_entry *table;
 
+   if (ht->ctrl) {
+      grouped_rehash(ht, new_size_index);
+      return;
+   }
+
    if (ht->size_index == new_size_index && ht->deleted_entries == ht->max_entries) {
       hash_table_clear_fast(ht);
       assert(!ht->entries);
@@ -426,6 +577,44 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    ralloc_free(old_ht.table);
 }
 
+static struct hash_entry *
+grouped_insert(struct hash_table *ht, uint32_t hash,
+               const void *key, void *data)
+{
+   struct hash_entry *entry = grouped_search(ht, hash, key);
+
+   /* Replace the matching entry, as the double hashing layout does. */
+   if (entry) {
+      entry->key = key;
+      entry->data = data;
+      return entry;
+   }
+
+   if (ht->entries >= ht->max_entries) {
+      _mesa_hash_table_rehash(ht, ht->size_index + 1);
+   } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
+      _mesa_hash_table_rehash(ht, ht->size_index);
+   }
+
+   /* We could hit here if a required resize failed. */
+   if (ht->entries >= ht->size)
+      return NULL;
+
+   uint32_t mixed = hash_ctrl_mix(hash);
+   uint32_t slot = hash_ctrl_find_free(ht->ctrl, ht->size, mixed);
+
+   if (ht->ctrl[slot] == HASH_CTRL_DELETED)
+      ht->deleted_entries--;
+   ht->ctrl[slot] = hash_ctrl_h2(mixed);
+   ht->entries++;
+
+   entry = ht->table + slot;
+   entry->hash = hash;
+   entry->key = key;
+   entry->data = data;
+   return entry;
+}
+
 static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
                   const void *key, void *data)
@@ -434,6 +623,9 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
 
    assert(!key_pointer_is_reserved(ht, key));
 
+   if (ht->ctrl)
+      return grouped_insert(ht, hash, key, data);
+
    if (ht->entries >= ht->max_entries) {
       _mesa_hash_table_rehash(ht, ht->size_index + 1);
    } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
@@ -530,6 +722,13 @@ _mesa_hash_table_remove(struct hash_table *ht,
    if (!entry)
       return;
 
+   if (ht->ctrl) {
+      if (hash_ctrl_erase(ht->ctrl, entry - ht->table))
+         ht->deleted_entries++;
+      ht->entries--;
+      return;
+   }
+
    entry->key = ht->deleted_key;
    ht->entries--;
    ht->deleted_entries++;
@@ -544,6 +743,23 @@ void _mesa_hash_table_remove_key(struct hash_table *ht,
    _mesa_hash_table_remove(ht, _mesa_hash_table_search(ht, key));
 }
 
+/**
+ * Removes the entry without leaving a tombstone, which is only valid when
+ * all the entries are removed, as hash_table_foreach_remove does.
+ */
+void
+_mesa_hash_table_remove_unsafe(struct hash_table *ht,
+                               struct hash_entry *entry)
+{
+   if (ht->ctrl)
+      ht->ctrl[entry - ht->table] = HASH_CTRL_EMPTY;
+
+   entry->hash = 0;
+   entry->key = NULL;
+   entry->data = NULL;
+   ht->entries--;
+}
+
 /**
  * This function is an iterator over the hash_table when no deleted entries are present.
  *
@@ -559,6 +775,13 @@ _mesa_hash_table_next_entry_unsafe(const struct hash_table *ht, struct hash_entr
       entry = ht->table;
    else
       entry = entry + 1;
+   if (ht->ctrl) {
+      for (; entry != ht->table + ht->size; entry++) {
+         if (hash_ctrl_is_full(ht->ctrl, entry - ht->table))
+            return entry;
+      }
+      return NULL;
+   }
    if (entry != ht->table + ht->size)
       return entry->key ? entry : _mesa_hash_table_next_entry_unsafe(ht, entry);
 
@@ -581,7 +804,7 @@ _mesa_hash_table_next_entry(struct hash_table *ht,
       entry = entry + 1;
 
    for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry)) {
+      if (hash_entry_is_present(ht, entry)) {
          return entry;
       }
    }
@@ -608,14 +831,14 @@ _mesa_hash_table_random_entry(struct hash_table *ht,
       return NULL;
 
    for (entry = ht->table + i; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry) &&
+      if (hash_entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
    }
 
    for (entry = ht->table; entry != ht->table + i; entry++) {
-      if (entry_is_present(ht, entry) &&
+      if (hash_entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
@@ -733,6 +956,13 @@ _mesa_hash_table_reserve(struct hash_table *ht, unsigned size)
 {
    if (size < ht->max_entries)
       return true;
+   if (ht->ctrl) {
+      unsigned i = ht->size_index + 1;
+      while (i < HASH_CTRL_MAX_SIZE_INDEX && hash_ctrl_max_entries(1u << i) < size)
+         i++;
+      _mesa_hash_table_rehash(ht, i);
+      return ht->max_entries >= size;
+   }
    for (unsigned i = ht->size_index + 1; i < ARRAY_SIZE(hash_sizes); i++) {
       if (hash_sizes[i].max_entries >= size) {
          _mesa_hash_table_rehash(ht, i);
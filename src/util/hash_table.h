@@ -45,6 +45,10 @@ struct hash_entry {
 
 struct hash_table {
    struct hash_entry *table;
+   /* Control bytes following the entries, NULL for the double hashing
+    * layout.
+    */
+   uint8_t *ctrl;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    const void *deleted_key;
@@ -58,6 +62,32 @@ struct hash_table {
    uint32_t deleted_entries;
 };
 
+/**
+ * Memory layout of the hash tables and sets.
+ */
+enum hash_table_layout {
+   /**
+    * Power-of-two number of slots with a control byte each, holding 7 bits
+    * of the hash, which are compared a group of slots at a time with SIMD.
+    */
+   HASH_TABLE_LAYOUT_GROUPED,
+   /**
+    * Prime number of slots probed with double hashing, where every removal
+    * leaves a deleted_key tombstone.
+    */
+   HASH_TABLE_LAYOUT_DOUBLE_HASHING,
+};
+
+/**
+ * Sets the layout of the hash tables and sets initialized from now on,
+ * for comparing them.  The existing ones keep theirs.
+ */
+void
+_mesa_hash_table_set_default_layout(enum hash_table_layout layout);
+
+enum hash_table_layout
+_mesa_hash_table_get_default_layout(void);
+
 struct hash_table *
 _mesa_hash_table_create(void *mem_ctx,
                         uint32_t (*key_hash_function)(const void *key),
@@ -102,6 +132,8 @@ void _mesa_hash_table_remove(struct hash_table *ht,
                              struct hash_entry *entry);
 void _mesa_hash_table_remove_key(struct hash_table *ht,
                                  const void *key);
+void _mesa_hash_table_remove_unsafe(struct hash_table *ht,
+                                    struct hash_entry *entry);
 
 struct hash_entry *_mesa_hash_table_next_entry(struct hash_table *ht,
                                                struct hash_entry *entry);
@@ -148,8 +180,8 @@ _mesa_hash_table_reserve(struct hash_table *ht, unsigned size);
 #define hash_table_foreach_remove(ht, entry)                                      \
    for (struct hash_entry *entry = _mesa_hash_table_next_entry_unsafe(ht, NULL);  \
         (ht)->entries;                                                     \
-        entry->hash = 0, entry->key = (void*)NULL, entry->data = NULL,      \
-        (ht)->entries--, entry = _mesa_hash_table_next_entry_unsafe(ht, entry))
+        _mesa_hash_table_remove_unsafe(ht, entry),                          \
+        entry = _mesa_hash_table_next_entry_unsafe(ht, entry))
 
 static inline void
 hash_table_call_foreach(struct hash_table *ht,
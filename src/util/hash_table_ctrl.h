@@ -0,0 +1,269 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Control bytes of the grouped hash table layout, shared by hash_table.c
+ * and set.c.
+ *
+ * The table has a power-of-two number of slots and one control byte per
+ * slot next to the entries.  The control byte of a slot in use holds 7 bits
+ * of the hash of its key, the others hold one of the special values below.
+ * Lookups compare the control bytes of a whole group of slots at once and
+ * only touch the entries whose 7 bits match, probing the groups
+ * triangularly until one of them has an empty slot.
+ *
+ * Once a group was full, a probe sequence may have gone through it, so
+ * removing an entry from it leaves a DELETED tombstone.  Groups which were
+ * never full get EMPTY instead, which keeps tables with churn from filling
+ * up with tombstones.
+ */
+
+#ifndef _HASH_TABLE_CTRL_H
+#define _HASH_TABLE_CTRL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bitscan.h"
+#include "macros.h"
+#include "u_math.h"
+
+#if defined(__SSE2__) || (defined(_M_X64) && !defined(_M_ARM64EC))
+#include <emmintrin.h>
+#define HASH_GROUP_SSE2 1
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && UTIL_ARCH_LITTLE_ENDIAN
+#include <arm_neon.h>
+#define HASH_GROUP_NEON 1
+#endif
+
+#define HASH_CTRL_EMPTY    0x80
+#define HASH_CTRL_DELETED  0xfe
+/* Pads the control bytes of tables smaller than a group. */
+#define HASH_CTRL_SENTINEL 0xff
+
+/* Log2 of the number of slots of new tables. */
+#define HASH_CTRL_MIN_SIZE_INDEX 3
+#define HASH_CTRL_MAX_SIZE_INDEX 31
+
+/* Group matches have one bit (SSE2) or one byte (otherwise) per slot. */
+#ifdef HASH_GROUP_SSE2
+#define HASH_GROUP_WIDTH 16
+#define HASH_GROUP_SHIFT 0
+#else
+#define HASH_GROUP_WIDTH 8
+#define HASH_GROUP_SHIFT 3
+#define HASH_GROUP_LSBS 0x0101010101010101ull
+#define HASH_GROUP_MSBS 0x8080808080808080ull
+#endif
+
+#ifdef HASH_GROUP_SSE2
+
+static inline uint64_t
+hash_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+static inline uint64_t
+hash_group_match_empty(const uint8_t *ctrl)
+{
+   return hash_group_match(ctrl, HASH_CTRL_EMPTY);
+}
+
+static inline uint64_t
+hash_group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+   /* EMPTY and DELETED are the only values smaller than SENTINEL (-1). */
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));
+}
+
+#elif defined(HASH_GROUP_NEON)
+
+static inline uint64_t
+hash_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+   uint8x8_t eq = vceq_u8(vld1_u8(ctrl), vdup_n_u8(h2));
+   return vget_lane_u64(vreinterpret_u64_u8(eq), 0) & HASH_GROUP_MSBS;
+}
+
+static inline uint64_t
+hash_group_match_empty(const uint8_t *ctrl)
+{
+   return hash_group_match(ctrl, HASH_CTRL_EMPTY);
+}
+
+static inline uint64_t
+hash_group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+   uint8x8_t lt = vclt_s8(vld1_s8((const int8_t *)ctrl), vdup_n_s8(-1));
+   return vget_lane_u64(vreinterpret_u64_u8(lt), 0) & HASH_GROUP_MSBS;
+}
+
+#else
+
+static inline uint64_t
+hash_group_load(const uint8_t *ctrl)
+{
+   uint64_t group;
+   memcpy(&group, ctrl, sizeof(group));
+   return util_le64_to_cpu(group);
+}
+
+/* This can report false positives for bytes following a real match, which
+ * is harmless since the entries are compared anyway.
+ */
+static inline uint64_t
+hash_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+   uint64_t x = hash_group_load(ctrl) ^ (HASH_GROUP_LSBS * h2);
+   return (x - HASH_GROUP_LSBS) & ~x & HASH_GROUP_MSBS;
+}
+
+static inline uint64_t
+hash_group_match_empty(const uint8_t *ctrl)
+{
+   /* Only EMPTY has the top bit set and bit 1 clear. */
+   uint64_t group = hash_group_load(ctrl);
+   return group & ~(group << 6) & HASH_GROUP_MSBS;
+}
+
+static inline uint64_t
+hash_group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+   /* Only EMPTY and DELETED have the top bit set and bit 0 clear. */
+   uint64_t group = hash_group_load(ctrl);
+   return group & ~(group << 7) & HASH_GROUP_MSBS;
+}
+
+#endif
+
+/** Returns the slot of the lowest match in the group and removes it. */
+static inline unsigned
+hash_group_next(uint64_t *match)
+{
+   return u_bit_scan64(match) >> HASH_GROUP_SHIFT;
+}
+
+/**
+ * Spreads the bits of the user's hash, which may be weak in some of them
+ * (like the pointer hash is in the upper ones), over the group index and
+ * the 7 control bits.
+ */
+static inline uint32_t
+hash_ctrl_mix(uint32_t hash)
+{
+   return (uint32_t)(((uint64_t)hash * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static inline uint8_t
+hash_ctrl_h2(uint32_t mixed)
+{
+   return mixed & 0x7f;
+}
+
+static inline uint32_t
+hash_ctrl_size(uint32_t capacity)
+{
+   return MAX2(capacity, HASH_GROUP_WIDTH);
+}
+
+static inline uint32_t
+hash_ctrl_max_entries(uint32_t capacity)
+{
+   return capacity - capacity / 8;
+}
+
+static inline void
+hash_ctrl_init(uint8_t *ctrl, uint32_t capacity)
+{
+   memset(ctrl, HASH_CTRL_EMPTY, capacity);
+   memset(ctrl + capacity, HASH_CTRL_SENTINEL,
+          hash_ctrl_size(capacity) - capacity);
+}
+
+static inline bool
+hash_ctrl_is_full(const uint8_t *ctrl, uint32_t slot)
+{
+   return !(ctrl[slot] & 0x80);
+}
+
+struct hash_ctrl_probe {
+   uint32_t group;
+   uint32_t group_mask;
+   uint32_t step;
+};
+
+static inline struct hash_ctrl_probe
+hash_ctrl_probe_start(uint32_t mixed, uint32_t capacity)
+{
+   struct hash_ctrl_probe probe;
+
+   probe.group_mask = hash_ctrl_size(capacity) / HASH_GROUP_WIDTH - 1;
+   probe.group = (mixed >> 7) & probe.group_mask;
+   probe.step = 0;
+   return probe;
+}
+
+/** Returns the first slot of the group to look at. */
+static inline uint32_t
+hash_ctrl_probe_offset(const struct hash_ctrl_probe *probe)
+{
+   return probe->group * HASH_GROUP_WIDTH;
+}
+
+/**
+ * Moves to the next group, returns false once all of them were visited.
+ * Triangular steps visit every group of a power-of-two sized table.
+ */
+static inline bool
+hash_ctrl_probe_next(struct hash_ctrl_probe *probe)
+{
+   if (probe->step == probe->group_mask)
+      return false;
+
+   probe->step++;
+   probe->group = (probe->group + probe->step) & probe->group_mask;
+   return true;
+}
+
+/**
+ * Finds the slot a key with the given mixed hash should be inserted in.
+ * The table must have an empty or deleted slot.
+ */
+static inline uint32_t
+hash_ctrl_find_free(const uint8_t *ctrl, uint32_t capacity, uint32_t mixed)
+{
+   struct hash_ctrl_probe probe = hash_ctrl_probe_start(mixed, capacity);
+
+   do {
+      uint32_t offset = hash_ctrl_probe_offset(&probe);
+      uint64_t match = hash_group_match_empty_or_deleted(ctrl + offset);
+      if (match)
+         return offset + hash_group_next(&match);
+   } while (hash_ctrl_probe_next(&probe));
+
+   unreachable("hash table without free slots");
+}
+
+/**
+ * Marks a slot as unused, returns whether this left a tombstone.
+ */
+static inline bool
+hash_ctrl_erase(uint8_t *ctrl, uint32_t slot)
+{
+   const uint8_t *group = ctrl + (slot & ~(HASH_GROUP_WIDTH - 1));
+
+   if (hash_group_match_empty(group)) {
+      ctrl[slot] = HASH_CTRL_EMPTY;
+      return false;
+   }
+
+   ctrl[slot] = HASH_CTRL_DELETED;
+   return true;
+}
+
+#endif /* _HASH_TABLE_CTRL_H */
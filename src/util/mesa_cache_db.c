@@ -30,6 +30,11 @@
 #define MESA_CACHE_DB_VERSION          1
 #define MESA_CACHE_DB_MAGIC            "MESA_DB"
 
+/* Number of access times collected by lock-less reads before they are
+ * written back to the index file, so that other processes evict entries
+ * in roughly LRU order. */
+#define MESA_CACHE_DB_ATIME_BATCH      256
+
 struct PACKED mesa_db_file_header {
    char magic[8];
    uint32_t version;
@@ -49,12 +54,20 @@ struct PACKED mesa_index_db_file_entry {
    uint64_t cache_db_file_offset;
 };
 
+struct mesa_db_compact_job {
+   struct mesa_cache_db *db;
+   uint64_t uuid;
+   uint64_t keep_offset;
+   uint32_t blob_size;
+};
+
 struct mesa_index_db_hash_entry {
    uint64_t cache_db_file_offset;
    uint64_t index_db_file_offset;
    uint64_t last_access_time;
    uint32_t size;
    bool evicted;
+   bool atime_dirty;
 };
 
 static inline bool mesa_db_seek_end(FILE *file)
@@ -89,6 +102,14 @@ static inline bool mesa_db_truncate(FILE *file, long pos)
    return !ftruncate(fileno(file), pos);
 }
 
+/* Positioned reads don't touch the stream, hence they may be done without
+ * holding the lock and concurrently with the stream users. */
+static inline bool mesa_db_pread(FILE *file, void *data, size_t size,
+                                 uint64_t pos)
+{
+   return pread(fileno(file), data, size, pos) == (ssize_t)size;
+}
+
 static bool
 mesa_db_lock(struct mesa_cache_db *db)
 {
@@ -154,6 +175,20 @@ mesa_db_read_header(FILE *file, struct mesa_db_file_header *header)
    return true;
 }
 
+/* Returns UUID of the file or 0 if the file is invalid or being compacted */
+static uint64_t
+mesa_db_peek_uuid(FILE *file)
+{
+   struct mesa_db_file_header header;
+
+   if (!mesa_db_pread(file, &header, sizeof(header), 0) ||
+       strncmp(header.magic, MESA_CACHE_DB_MAGIC, sizeof(header.magic)) ||
+       header.version != MESA_CACHE_DB_VERSION)
+      return 0;
+
+   return header.uuid;
+}
+
 static bool
 mesa_db_load_header(struct mesa_cache_db_file *db_file)
 {
@@ -268,7 +303,7 @@ mesa_db_update_index(struct mesa_cache_db *db)
       if (!mesa_db_index_entry_valid(&index_entry))
          break;
 
-      hash_entry = ralloc(db->mem_ctx, struct mesa_index_db_hash_entry);
+      hash_entry = rzalloc(db->mem_ctx, struct mesa_index_db_hash_entry);
       if (!hash_entry)
          break;
 
@@ -288,9 +323,13 @@ mesa_db_update_index(struct mesa_cache_db *db)
    return db->index.offset == file_length;
 }
 
+/* Must be called with index_lock held for writing */
 static void
 mesa_db_hash_table_reset(struct mesa_cache_db *db)
 {
+   /* The pending access times refer to the old entries, drop them */
+   util_dynarray_clear(&db->dirty_entries);
+
    _mesa_hash_table_u64_clear(db->index_db);
    ralloc_free(db->mem_ctx);
    db->mem_ctx = ralloc_context(NULL);
@@ -317,6 +356,8 @@ mesa_db_load(struct mesa_cache_db *db, bool reload)
          return false;
    }
 
+   u_rwlock_wrlock(&db->index_lock);
+
    /* If file headers are invalid, then zap database files and start over */
    if (!mesa_db_load_header(&db->cache) ||
        !mesa_db_load_header(&db->index) ||
@@ -340,6 +381,8 @@ mesa_db_load(struct mesa_cache_db *db, bool reload)
    if (!mesa_db_update_index(db))
       goto fail;
 
+   u_rwlock_wrunlock(&db->index_lock);
+
    if (!reload)
       mesa_db_unlock(db);
 
@@ -348,6 +391,8 @@ mesa_db_load(struct mesa_cache_db *db, bool reload)
    return true;
 
 fail:
+   u_rwlock_wrunlock(&db->index_lock);
+
    if (!reload)
       mesa_db_unlock(db);
 
@@ -363,6 +408,85 @@ mesa_db_reload(struct mesa_cache_db *db)
    return mesa_db_load(db, true);
 }
 
+/* Write back the access times collected by the lock-less readers. Must be
+ * called with the database locked and its UUID unchanged.
+ */
+static bool
+mesa_db_flush_access_times(struct mesa_cache_db *db)
+{
+   struct mesa_index_db_file_entry index_entry;
+   bool success = true;
+
+   simple_mtx_lock(&db->atime_mtx);
+
+   util_dynarray_foreach(&db->dirty_entries,
+                         struct mesa_index_db_hash_entry *, entry) {
+      struct mesa_index_db_hash_entry *hash_entry = *entry;
+
+      hash_entry->atime_dirty = false;
+
+      if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
+          !mesa_db_read(db->index.file, &index_entry) ||
+          !mesa_db_index_entry_valid(&index_entry) ||
+          index_entry.cache_db_file_offset != hash_entry->cache_db_file_offset ||
+          index_entry.size != hash_entry->size) {
+         success = false;
+         break;
+      }
+
+      index_entry.last_access_time = hash_entry->last_access_time;
+
+      if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
+          !mesa_db_write(db->index.file, &index_entry)) {
+         success = false;
+         break;
+      }
+   }
+
+   util_dynarray_clear(&db->dirty_entries);
+
+   simple_mtx_unlock(&db->atime_mtx);
+
+   fflush(db->index.file);
+
+   return success;
+}
+
+/* Bring the index up to date with the database files, must be called with
+ * the database locked.
+ */
+static bool
+mesa_db_sync_index(struct mesa_cache_db *db)
+{
+   bool success;
+
+   /* The pending access times are stale if the database was compacted by
+    * somebody else, reloading drops them. */
+   if (mesa_db_uuid_changed(db))
+      return mesa_db_reload(db);
+
+   if (!mesa_db_flush_access_times(db))
+      return false;
+
+   u_rwlock_wrlock(&db->index_lock);
+   success = mesa_db_update_index(db);
+   u_rwlock_wrunlock(&db->index_lock);
+
+   return success;
+}
+
+static void
+mesa_db_write_back_access_times(struct mesa_cache_db *db)
+{
+   if (!mesa_db_lock(db))
+      return;
+
+   if (db->alive && !mesa_db_sync_index(db))
+      mesa_db_zap(db);
+
+   mesa_db_unlock(db);
+}
+
 static void
 touch_file(const char* path)
 {
@@ -433,8 +557,12 @@ static uint32_t blob_file_size(uint32_t blob_size)
    return sizeof(struct mesa_cache_db_file_entry) + blob_size;
 }
 
+/* Evict at least blob_size bytes of the least recently used entries,
+ * except for the entry stored at keep_offset if it's non-zero.
+ */
 static bool
-mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size)
+mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
+                uint64_t keep_offset)
 {
    uint32_t num_entries, buffer_size = sizeof(struct mesa_index_db_file_entry);
    struct mesa_db_file_header cache_header, index_header;
@@ -444,6 +572,7 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size)
    bool success = false, compact = false;
    void *buffer = NULL;
    unsigned int i = 0;
+   uint64_t uuid;
 
    /* reload index to sync the last access times */
    if (!mesa_db_reload(db))
@@ -478,6 +607,9 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size)
                 entry_sort_lru, db);
 
    for (i = 0; blob_size > 0 && i < num_entries; i++) {
+      if (entries[i]->cache_db_file_offset == keep_offset)
+         continue;
+
       blob_size -= blob_file_size(entries[i]->size);
       entries[i]->evicted = true;
    }
@@ -562,11 +694,13 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size)
        !mesa_db_truncate(db->index.file, ftell(compacted_index)))
       goto cleanup;
 
-   /* Set the new UUID to let all cache readers know that the cache was changed */
-   db->uuid = mesa_db_generate_uuid();
+   /* Set the new UUID to let all cache readers know that the cache was
+    * changed. Our own index picks it up on reload below, the lock-less
+    * readers must not see the new UUID along with the old index. */
+   uuid = mesa_db_generate_uuid();
 
-   if (!mesa_db_write_header(&db->cache, db->uuid, false) ||
-       !mesa_db_write_header(&db->index, db->uuid, false))
+   if (!mesa_db_write_header(&db->cache, uuid, false) ||
+       !mesa_db_write_header(&db->index, uuid, false))
       goto cleanup;
 
    success = true;
@@ -586,6 +720,75 @@ cleanup:
    return success;
 }
 
+/* Make room for the entry whose write overflowed the cache, like the
+ * writer would have done before appending it.
+ */
+static void
+mesa_db_compact_job(void *data, void *gdata, int thread_index)
+{
+   struct mesa_db_compact_job *job = data;
+   struct mesa_cache_db *db = job->db;
+   uint64_t keep_offset;
+
+   if (!mesa_db_lock(db))
+      return;
+
+   if (!db->alive)
+      goto unlock;
+
+   if (!mesa_db_sync_index(db) ||
+       !mesa_db_seek_end(db->cache.file))
+      goto fail_fatal;
+
+   /* Somebody else may have compacted the cache in the meantime */
+   if (ftell(db->cache.file) <= db->max_cache_size)
+      goto unlock;
+
+   keep_offset = db->uuid == job->uuid ? job->keep_offset : 0;
+
+   if (!mesa_db_compact(db, MAX2(job->blob_size, db->max_cache_size / 2),
+                        keep_offset))
+      goto fail_fatal;
+
+unlock:
+   mesa_db_unlock(db);
+
+   return;
+
+fail_fatal:
+   mesa_db_zap(db);
+   mesa_db_unlock(db);
+}
+
+static void
+mesa_db_compact_job_cleanup(void *data, void *gdata, int thread_index)
+{
+   free(data);
+}
+
+/* Must be called with the database locked */
+static void
+mesa_db_schedule_compaction(struct mesa_cache_db *db,
+                            struct mesa_index_db_hash_entry *hash_entry)
+{
+   struct mesa_db_compact_job *job;
+
+   if (!util_queue_fence_is_signalled(&db->compact_fence))
+      return;
+
+   job = malloc(sizeof(*job));
+   if (!job)
+      return;
+
+   job->db = db;
+   job->uuid = db->uuid;
+   job->keep_offset = hash_entry->cache_db_file_offset;
+   job->blob_size = hash_entry->size;
+
+   util_queue_add_job(&db->compact_queue, job, &db->compact_fence,
+                      mesa_db_compact_job, mesa_db_compact_job_cleanup, 0);
+}
+
 bool
 mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
 {
@@ -600,19 +803,37 @@ mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
       goto close_index;
 
    simple_mtx_init(&db->flock_mtx, mtx_plain);
+   simple_mtx_init(&db->atime_mtx, mtx_plain);
+   util_dynarray_init(&db->dirty_entries, NULL);
+
+   if (u_rwlock_init(&db->index_lock))
+      goto destroy_mtx;
 
    db->index_db = _mesa_hash_table_u64_create(NULL);
    if (!db->index_db)
-      goto destroy_mtx;
+      goto destroy_rwlock;
 
-   if (!mesa_db_load(db, false))
+   util_queue_fence_init(&db->compact_fence);
+
+   if (!util_queue_init(&db->compact_queue, "mesa_db", 1, 1,
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL))
       goto destroy_hash;
 
+   if (!mesa_db_load(db, false))
+      goto destroy_queue;
+
    return true;
 
+destroy_queue:
+   util_queue_destroy(&db->compact_queue);
 destroy_hash:
+   util_queue_fence_destroy(&db->compact_fence);
    _mesa_hash_table_u64_destroy(db->index_db);
+destroy_rwlock:
+   u_rwlock_destroy(&db->index_lock);
 destroy_mtx:
+   util_dynarray_fini(&db->dirty_entries);
+   simple_mtx_destroy(&db->atime_mtx);
    simple_mtx_destroy(&db->flock_mtx);
 
    ralloc_free(db->mem_ctx);
@@ -627,7 +848,16 @@ close_cache:
 void
 mesa_cache_db_close(struct mesa_cache_db *db)
 {
+   util_queue_finish(&db->compact_queue);
+   util_queue_destroy(&db->compact_queue);
+   util_queue_fence_destroy(&db->compact_fence);
+
+   mesa_db_write_back_access_times(db);
+
    _mesa_hash_table_u64_destroy(db->index_db);
+   u_rwlock_destroy(&db->index_lock);
+   util_dynarray_fini(&db->dirty_entries);
+   simple_mtx_destroy(&db->atime_mtx);
    simple_mtx_destroy(&db->flock_mtx);
    ralloc_free(db->mem_ctx);
 
@@ -642,12 +872,111 @@ mesa_cache_db_set_size_limit(struct mesa_cache_db *db,
    db->max_cache_size = max_cache_size;
 }
 
+void
+mesa_cache_db_wait_for_idle(struct mesa_cache_db *db)
+{
+   util_queue_finish(&db->compact_queue);
+}
+
 unsigned int
 mesa_cache_db_file_entry_size(void)
 {
    return sizeof(struct mesa_cache_db_file_entry);
 }
 
+/* Look up the entry without taking the database lock.
+ *
+ * Appending never modifies the existing entries, while compaction sets the
+ * zero UUID before moving them and a new UUID afterwards, UUIDs are never
+ * reused. Hence the data is consistent if the cache file still has the UUID
+ * of our index after it was read. On a failure *retry tells whether the
+ * locked lookup may succeed, e.g. because the entry was added by another
+ * process.
+ */
+static void *
+mesa_db_read_entry_lockless(struct mesa_cache_db *db,
+                            const uint8_t *cache_key_160bit,
+                            size_t *size, bool *retry)
+{
+   uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
+   struct mesa_cache_db_file_entry *cache_entry;
+   struct mesa_index_db_hash_entry *hash_entry;
+   unsigned num_dirty = 0;
+   uint8_t *data = NULL;
+   uint32_t data_size;
+   uint64_t uuid;
+
+   *retry = true;
+
+   u_rwlock_rdlock(&db->index_lock);
+
+   if (!db->alive) {
+      *retry = false;
+      goto fail;
+   }
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (!hash_entry)
+      goto fail;
+
+   /* Read the entry header along with the data in one go, the header is
+    * moved out of the way afterwards. */
+   data_size = hash_entry->size;
+   data = malloc(blob_file_size(data_size));
+   if (!data) {
+      *retry = false;
+      goto fail;
+   }
+
+   if (!mesa_db_pread(db->cache.file, data, blob_file_size(data_size),
+                      hash_entry->cache_db_file_offset))
+      goto fail;
+
+   uuid = mesa_db_peek_uuid(db->cache.file);
+   if (uuid != db->uuid)
+      goto fail_uuid;
+
+   /* Let the locked path deal with a corrupted entry */
+   cache_entry = (struct mesa_cache_db_file_entry *)data;
+   if (!mesa_db_cache_entry_valid(cache_entry) ||
+       cache_entry->size != data_size ||
+       memcmp(cache_entry->key, cache_key_160bit, sizeof(cache_entry->key)) ||
+       util_hash_crc32(data + sizeof(*cache_entry), data_size) != cache_entry->crc)
+      goto fail;
+
+   memmove(data, data + sizeof(*cache_entry), data_size);
+
+   simple_mtx_lock(&db->atime_mtx);
+   hash_entry->last_access_time = os_time_get_nano();
+   if (!hash_entry->atime_dirty) {
+      hash_entry->atime_dirty = true;
+      util_dynarray_append(&db->dirty_entries,
+                           struct mesa_index_db_hash_entry *, hash_entry);
+   }
+   num_dirty = util_dynarray_num_elements(&db->dirty_entries,
+                                          struct mesa_index_db_hash_entry *);
+   simple_mtx_unlock(&db->atime_mtx);
+
+   u_rwlock_rdunlock(&db->index_lock);
+
+   if (num_dirty >= MESA_CACHE_DB_ATIME_BATCH)
+      mesa_db_write_back_access_times(db);
+
+   *size = data_size;
+
+   return data;
+
+fail_uuid:
+   /* Zero UUID means that the database is being compacted right now,
+    * don't wait for it and report a cache miss. */
+   *retry = uuid != 0;
+fail:
+   u_rwlock_rdunlock(&db->index_lock);
+   free(data);
+
+   return NULL;
+}
+
 void *
 mesa_cache_db_read_entry(struct mesa_cache_db *db,
                          const uint8_t *cache_key_160bit,
@@ -658,6 +987,11 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    struct mesa_index_db_file_entry index_entry;
    struct mesa_index_db_hash_entry *hash_entry;
    void *data = NULL;
+   bool retry;
+
+   data = mesa_db_read_entry_lockless(db, cache_key_160bit, size, &retry);
+   if (data || !retry)
+      return data;
 
    if (!mesa_db_lock(db))
       return NULL;
@@ -665,10 +999,7 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    if (!db->alive)
       goto fail;
 
-   if (mesa_db_uuid_changed(db) && !mesa_db_reload(db))
-      goto fail_fatal;
-
-   if (!mesa_db_update_index(db))
+   if (!mesa_db_sync_index(db))
       goto fail_fatal;
 
    hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
@@ -739,17 +1070,21 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    if (!db->alive)
       goto fail;
 
-   if (mesa_db_uuid_changed(db) && !mesa_db_reload(db))
+   if (!mesa_db_sync_index(db))
       goto fail_fatal;
 
    if (!mesa_db_seek_end(db->cache.file))
       goto fail_fatal;
 
    if (ftell(db->cache.file) + blob_file_size(blob_size) > db->max_cache_size) {
-      if (!mesa_db_compact(db, MAX2(blob_size, db->max_cache_size / 2)))
-         goto fail_fatal;
-   } else {
-      if (!mesa_db_update_index(db))
+      /* Don't wait for the background compaction, skip the write */
+      if (!util_queue_fence_is_signalled(&db->compact_fence))
+         goto fail;
+
+      /* The cache was overflowed by an entry that didn't fit by itself or
+       * by another process, compact it right away. */
+      if (ftell(db->cache.file) > db->max_cache_size &&
+          !mesa_db_compact(db, MAX2(blob_size, db->max_cache_size / 2), 0))
          goto fail_fatal;
    }
 
@@ -772,7 +1107,7 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    index_entry.last_access_time = os_time_get_nano();
    index_entry.cache_db_file_offset = ftell(db->cache.file);
 
-   hash_entry = ralloc(db->mem_ctx, struct mesa_index_db_hash_entry);
+   hash_entry = rzalloc(db->mem_ctx, struct mesa_index_db_hash_entry);
    if (!hash_entry)
       goto fail;
 
@@ -789,9 +1124,14 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    fflush(db->cache.file);
    fflush(db->index.file);
 
+   u_rwlock_wrlock(&db->index_lock);
    db->index.offset = ftell(db->index.file);
-
    _mesa_hash_table_u64_insert(db->index_db, hash, hash_entry);
+   u_rwlock_wrunlock(&db->index_lock);
+
+   /* Evict the old entries in the background */
+   if (ftell(db->cache.file) > db->max_cache_size)
+      mesa_db_schedule_compaction(db, hash_entry);
 
    mesa_db_unlock(db);
 
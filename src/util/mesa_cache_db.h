@@ -15,7 +15,10 @@
 #include <stdio.h>
 
 #include "detect_os.h"
+#include "rwlock.h"
 #include "simple_mtx.h"
+#include "u_dynarray.h"
+#include "u_queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +40,21 @@ struct mesa_cache_db {
    void *mem_ctx;
    uint64_t uuid;
    bool alive;
+
+   /* Protects index_db and uuid against the lock-less readers, which
+    * don't take the file locks.
+    */
+   struct u_rwlock index_lock;
+
+   /* Index entries whose last access time was updated by a lock-less
+    * read and hasn't been written back to the index file yet.
+    */
+   simple_mtx_t atime_mtx;
+   struct util_dynarray dirty_entries;
+
+   /* Compaction runs in the background once a write overflows the cache */
+   struct util_queue compact_queue;
+   struct util_queue_fence compact_fence;
 };
 
 #if DETECT_OS_WINDOWS == 0
@@ -62,6 +80,9 @@ bool
 mesa_cache_db_entry_write(struct mesa_cache_db *db,
                           const uint8_t *cache_key_160bit,
                           const void *blob, size_t blob_size);
+
+void
+mesa_cache_db_wait_for_idle(struct mesa_cache_db *db);
 #else
 static inline bool
 mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
@@ -101,6 +122,11 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
 {
    return false;
 }
+
+static inline void
+mesa_cache_db_wait_for_idle(struct mesa_cache_db *db)
+{
+}
 #endif /* DETECT_OS_WINDOWS */
 
 #ifdef __cplusplus
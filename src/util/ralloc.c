@@ -67,13 +67,167 @@ struct ralloc_header
    struct ralloc_header *next;
 
    void (*destructor)(void *);
+
+   /* The arena the block's children are carved from, if any. */
+   struct ralloc_arena *arena;
 };
 
 typedef struct ralloc_header ralloc_header;
 
+/* Arenas start with chunks of the minimum size and double it for every new
+ * one.  Blocks bigger than a quarter of the chunk size get their own chunk.
+ */
+#define ARENA_MIN_CHUNK_SIZE (8 * 1024)
+#define ARENA_MAX_CHUNK_SIZE (1024 * 1024)
+
+struct ralloc_arena_chunk
+{
+   HEADER_ALIGN
+
+   struct ralloc_arena_chunk *next;
+   size_t size;
+};
+
+/**
+ * The memory the descendants of an arena context are carved from.
+ *
+ * Carved blocks keep their header, so that everything ralloc does works on
+ * them, but they are never freed one at a time: the chunks they were carved
+ * from are freed all at once with the arena.  Freeing the arena context
+ * doesn't even need to walk its descendants, unless one of them has a
+ * destructor or has children which weren't carved from the arena.
+ *
+ * Carved blocks which were stolen out of the arena keep the chunks alive
+ * until they are freed as well.
+ */
+struct ralloc_arena
+{
+   /* The arena context, NULL once it was freed. */
+   ralloc_header *root;
+
+   /* The chunks, the one blocks are currently carved from first. */
+   struct ralloc_arena_chunk *chunks;
+   char *next, *end;
+   size_t chunk_size;
+
+   /* Carved blocks with a destructor. */
+   unsigned destructors;
+
+   /* Blocks with a parent in the arena which weren't carved from it. */
+   unsigned foreign;
+
+   /* Carved blocks without a parent in the arena. */
+   unsigned escaped;
+};
+
 static void unlink_block(ralloc_header *info);
 static void unsafe_free(ralloc_header *info);
 
+static inline size_t
+block_size(size_t size)
+{
+   return align64(size + sizeof(ralloc_header), alignof(ralloc_header));
+}
+
+static inline bool
+is_carved(const ralloc_header *info)
+{
+   return info->arena != NULL && info->arena->root != info;
+}
+
+#define CHUNK_DATA(chunk) ((char *) ((chunk) + 1))
+
+static void *
+arena_carve(struct ralloc_arena *arena, size_t size)
+{
+   struct ralloc_arena_chunk *chunk;
+   char *ptr;
+
+   if (likely(size <= (size_t)(arena->end - arena->next))) {
+      ptr = arena->next;
+      arena->next += size;
+      return ptr;
+   }
+
+   if (size > arena->chunk_size / 4) {
+      chunk = malloc(sizeof(*chunk) + size);
+      if (unlikely(chunk == NULL))
+         return NULL;
+
+      chunk->size = size;
+
+      /* Keep carving from the current chunk. */
+      if (arena->chunks != NULL) {
+         chunk->next = arena->chunks->next;
+         arena->chunks->next = chunk;
+      } else {
+         chunk->next = NULL;
+         arena->chunks = chunk;
+         arena->next = arena->end = CHUNK_DATA(chunk) + size;
+      }
+      return CHUNK_DATA(chunk);
+   }
+
+   chunk = malloc(sizeof(*chunk) + arena->chunk_size);
+   if (unlikely(chunk == NULL))
+      return NULL;
+
+   chunk->size = arena->chunk_size;
+   chunk->next = arena->chunks;
+   arena->chunks = chunk;
+   arena->next = CHUNK_DATA(chunk) + size;
+   arena->end = CHUNK_DATA(chunk) + chunk->size;
+   arena->chunk_size = MIN2(arena->chunk_size * 2, ARENA_MAX_CHUNK_SIZE);
+
+   return CHUNK_DATA(chunk);
+}
+
+/* Returns how many bytes there are from ptr to the end of its chunk. */
+static size_t
+arena_bytes_after(const struct ralloc_arena *arena, const char *ptr)
+{
+   for (struct ralloc_arena_chunk *chunk = arena->chunks; chunk != NULL;
+        chunk = chunk->next) {
+      if (ptr >= CHUNK_DATA(chunk) && ptr < CHUNK_DATA(chunk) + chunk->size)
+         return CHUNK_DATA(chunk) + chunk->size - ptr;
+   }
+
+   unreachable("block not carved from this arena");
+}
+
+static void
+arena_release_if_unused(struct ralloc_arena *arena)
+{
+   if (arena->root != NULL || arena->escaped != 0)
+      return;
+
+   struct ralloc_arena_chunk *chunk = arena->chunks;
+   while (chunk != NULL) {
+      struct ralloc_arena_chunk *next = chunk->next;
+      free(chunk);
+      chunk = next;
+   }
+   free(arena);
+}
+
+/* Updates the counts of the arenas involved when info gets linked to parent
+ * (delta = 1) or unlinked from it (delta = -1).
+ */
+static inline void
+arena_link(const ralloc_header *info, const ralloc_header *parent, int delta)
+{
+   struct ralloc_arena *parent_arena = parent ? parent->arena : NULL;
+
+   if (likely(info->arena == parent_arena))
+      return;
+
+   if (parent_arena != NULL)
+      parent_arena->foreign += delta;
+
+   if (is_carved(info))
+      info->arena->escaped += delta;
+}
+
 static ralloc_header *
 get_header(const void *ptr)
 {
@@ -96,6 +250,33 @@ add_child(ralloc_header *parent, ralloc_header *info)
       if (info->next != NULL)
 	 info->next->prev = info;
    }
+
+   arena_link(info, parent, 1);
+}
+
+static void *
+init_block(void *block, ralloc_header *parent, struct ralloc_arena *arena)
+{
+   ralloc_header *info = (ralloc_header *) block;
+
+   /* measurements have shown that calloc is slower (because of
+    * the multiplication overflow checking?), so clear things
+    * manually
+    */
+   info->parent = NULL;
+   info->child = NULL;
+   info->prev = NULL;
+   info->next = NULL;
+   info->destructor = NULL;
+   info->arena = arena;
+
+   add_child(parent, info);
+
+#ifndef NDEBUG
+   info->canary = CANARY;
+#endif
+
+   return PTR_FROM_HEADER(info);
 }
 
 void *
@@ -107,6 +288,9 @@ ralloc_context(const void *ctx)
 void *
 ralloc_size(const void *ctx, size_t size)
 {
+   ralloc_header *parent = ctx != NULL ? get_header(ctx) : NULL;
+   void *block;
+
    /* Some malloc allocation doesn't always align to 16 bytes even on 64 bits
     * system, from Android bionic/tests/malloc_test.cpp:
     *  - Allocations of a size that rounds up to a multiple of 16 bytes
@@ -114,34 +298,45 @@ ralloc_size(const void *ctx, size_t size)
     *  - Allocations of a size that rounds up to a multiple of 8 bytes and
     *    not 16 bytes, are only required to have at least 8 byte alignment.
     */
-   void *block = malloc(align64(size + sizeof(ralloc_header),
-                                alignof(ralloc_header)));
-   ralloc_header *info;
-   ralloc_header *parent;
+   if (parent != NULL && parent->arena != NULL)
+      block = arena_carve(parent->arena, block_size(size));
+   else
+      block = malloc(block_size(size));
 
    if (unlikely(block == NULL))
       return NULL;
 
-   info = (ralloc_header *) block;
-   /* measurements have shown that calloc is slower (because of
-    * the multiplication overflow checking?), so clear things
-    * manually
-    */
-   info->parent = NULL;
-   info->child = NULL;
-   info->prev = NULL;
-   info->next = NULL;
-   info->destructor = NULL;
+   return init_block(block, parent, parent ? parent->arena : NULL);
+}
 
-   parent = ctx != NULL ? get_header(ctx) : NULL;
+void *
+ralloc_arena_size(const void *ctx, size_t size)
+{
+   struct ralloc_arena *arena = calloc(1, sizeof(*arena));
+   void *block;
 
-   add_child(parent, info);
+   if (unlikely(arena == NULL))
+      return NULL;
 
-#ifndef NDEBUG
-   info->canary = CANARY;
-#endif
+   /* The arena context itself is malloc'ed, so that it can be resized and
+    * stolen like any other context.
+    */
+   block = malloc(block_size(size));
+   if (unlikely(block == NULL)) {
+      free(arena);
+      return NULL;
+   }
 
-   return PTR_FROM_HEADER(info);
+   arena->root = (ralloc_header *) block;
+   arena->chunk_size = ARENA_MIN_CHUNK_SIZE;
+
+   return init_block(block, ctx != NULL ? get_header(ctx) : NULL, arena);
+}
+
+void *
+ralloc_arena_context(const void *ctx)
+{
+   return ralloc_arena_size(ctx, 0);
 }
 
 void *
@@ -162,8 +357,21 @@ resize(void *ptr, size_t size)
    ralloc_header *child, *old, *info;
 
    old = get_header(ptr);
-   info = realloc(old, align64(size + sizeof(ralloc_header),
-                               alignof(ralloc_header)));
+
+   if (is_carved(old)) {
+      /* The size of the old block isn't known, copy as much of the new size
+       * as its chunk has; the ranges may overlap when the new block follows
+       * the old one.
+       */
+      size_t avail = arena_bytes_after(old->arena, (char *) old);
+      info = arena_carve(old->arena, block_size(size));
+      if (info != NULL)
+         memmove(info, old, MIN2(block_size(size), avail));
+   } else {
+      info = realloc(old, block_size(size));
+      if (info != NULL && info->arena != NULL)
+         info->arena->root = info;
+   }
 
    if (info == NULL)
       return NULL;
@@ -258,13 +466,20 @@ ralloc_free(void *ptr)
       return;
 
    info = get_header(ptr);
+   struct ralloc_arena *arena = is_carved(info) ? info->arena : NULL;
+
    unlink_block(info);
    unsafe_free(info);
+
+   if (arena != NULL)
+      arena_release_if_unused(arena);
 }
 
 static void
 unlink_block(ralloc_header *info)
 {
+   arena_link(info, info->parent, -1);
+
    /* Unlink from parent & siblings */
    if (info->parent != NULL) {
       if (info->parent->child == info)
@@ -284,19 +499,45 @@ unlink_block(ralloc_header *info)
 static void
 unsafe_free(ralloc_header *info)
 {
+   struct ralloc_arena *arena = info->arena;
+
+   /* Carved blocks go away with their arena, there is nothing to do for
+    * them unless some have destructors or children from elsewhere.
+    */
+   if (arena != NULL && arena->root == info &&
+       arena->destructors == 0 && arena->foreign == 0)
+      info->child = NULL;
+
    /* Recursively free any children...don't waste time unlinking them. */
    ralloc_header *temp;
    while (info->child != NULL) {
       temp = info->child;
       info->child = temp->next;
+
+      struct ralloc_arena *escaped =
+         is_carved(temp) && temp->arena != arena ? temp->arena : NULL;
+
+      arena_link(temp, info, -1);
       unsafe_free(temp);
+
+      if (escaped != NULL)
+         arena_release_if_unused(escaped);
    }
 
    /* Free the block itself.  Call the destructor first, if any. */
-   if (info->destructor != NULL)
+   if (info->destructor != NULL) {
       info->destructor(PTR_FROM_HEADER(info));
+      if (is_carved(info))
+         arena->destructors--;
+   }
 
-   free(info);
+   if (arena == NULL) {
+      free(info);
+   } else if (arena->root == info) {
+      arena->root = NULL;
+      free(info);
+      arena_release_if_unused(arena);
+   }
 }
 
 void
@@ -331,10 +572,14 @@ ralloc_adopt(const void *new_ctx, void *old_ctx)
       return;
 
    /* Set all the children's parent to new_ctx; get a pointer to the last child. */
-   for (child = old_info->child; child->next != NULL; child = child->next) {
+   for (child = old_info->child; ; child = child->next) {
+      arena_link(child, old_info, -1);
       child->parent = new_info;
+      arena_link(child, new_info, 1);
+
+      if (child->next == NULL)
+         break;
    }
-   child->parent = new_info;
 
    /* Connect the two lists together; parent them to new_ctx; make old_ctx empty. */
    child->next = new_info->child;
@@ -360,6 +605,12 @@ void
 ralloc_set_destructor(const void *ptr, void(*destructor)(void *))
 {
    ralloc_header *info = get_header(ptr);
+
+   if (is_carved(info)) {
+      info->arena->destructors += (destructor != NULL) -
+                                  (info->destructor != NULL);
+   }
+
    info->destructor = destructor;
 }
 
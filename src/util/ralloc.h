@@ -107,6 +107,28 @@ void *ralloc_size(const void *ctx, size_t size) MALLOCLIKE;
  */
 void *rzalloc_size(const void *ctx, size_t size) MALLOCLIKE;
 
+/**
+ * Allocate a new ralloc context whose descendants are carved from an arena.
+ *
+ * The descendants are regular ralloc'd pointers, but they are bump allocated
+ * out of big chunks and freeing them one by one doesn't give their memory
+ * back.  Freeing the arena context frees all the chunks at once, without
+ * walking the descendants unless some of them have destructors or children
+ * which weren't allocated from the arena.
+ *
+ * This suits short lived trees of many small objects which are freed
+ * together.  Descendants stolen to a context outside of the arena keep all
+ * of its memory alive until they are freed.
+ */
+void *ralloc_arena_size(const void *ctx, size_t size) MALLOCLIKE;
+
+/**
+ * Allocate a new arena context with no associated memory.
+ *
+ * \sa ralloc_arena_size
+ */
+void *ralloc_arena_context(const void *ctx);
+
 /**
  * Resize a piece of ralloc-managed memory, preserving data.
  *
@@ -81,6 +81,11 @@
 #include "register_allocate.h"
 #include "register_allocate_internal.h"
 
+/* Interference graphs with more nodes than this don't get an adjacency
+ * matrix, which would take more than 16MB.
+ */
+#define RA_MAX_ADJACENCY_MATRIX_NODES 16384
+
 /**
  * Creates a set of registers for the allocator.
  *
@@ -490,6 +495,22 @@ ra_get_adjacency_bit_index(unsigned n1, unsigned n2)
 static bool
 ra_test_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
 {
+   if (!g->adjacency) {
+      /* Look for the node with fewer neighbors in the other's list. */
+      if (util_dynarray_num_elements(&g->nodes[n1].adjacency_list, unsigned int) >
+          util_dynarray_num_elements(&g->nodes[n2].adjacency_list, unsigned int)) {
+         unsigned tmp = n1;
+         n1 = n2;
+         n2 = tmp;
+      }
+
+      util_dynarray_foreach(&g->nodes[n2].adjacency_list, unsigned int, n) {
+         if (*n == n1)
+            return true;
+      }
+      return false;
+   }
+
    uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    return BITSET_TEST(g->adjacency, index);
 }
@@ -497,14 +518,20 @@ ra_test_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
 static void
 ra_set_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
 {
-   unsigned index = ra_get_adjacency_bit_index(n1, n2);
+   if (!g->adjacency)
+      return;
+
+   uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    BITSET_SET(g->adjacency, index);
 }
 
 static void
 ra_clear_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
 {
-   unsigned index = ra_get_adjacency_bit_index(n1, n2);
+   if (!g->adjacency)
+      return;
+
+   uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    BITSET_CLEAR(g->adjacency, index);
 }
 
@@ -546,9 +573,19 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
    assert(g->alloc % BITSET_WORDBITS == 0);
    alloc = align64(alloc, BITSET_WORDBITS);
    g->nodes = rerzalloc(g, g->nodes, struct ra_node, g->alloc, alloc);
-   g->adjacency = rerzalloc(g, g->adjacency, BITSET_WORD,
-                            BITSET_WORDS(ra_get_num_adjacency_bits(g->alloc)),
-                            BITSET_WORDS(ra_get_num_adjacency_bits(alloc)));
+
+   /* The adjacency matrix only speeds up finding duplicate interferences.
+    * Past a point it is too big to be worth it, and the adjacency lists
+    * are searched instead.
+    */
+   if (alloc > RA_MAX_ADJACENCY_MATRIX_NODES) {
+      ralloc_free(g->adjacency);
+      g->adjacency = NULL;
+   } else {
+      g->adjacency = rerzalloc(g, g->adjacency, BITSET_WORD,
+                               BITSET_WORDS(ra_get_num_adjacency_bits(g->alloc)),
+                               BITSET_WORDS(ra_get_num_adjacency_bits(alloc)));
+   }
 
    /* Initialize new nodes. */
    for (unsigned i = g->alloc; i < alloc; i++) {
@@ -765,17 +802,16 @@ ra_simplify(struct ra_graph *g)
              * know we're going to loop again before attempting to do anything
              * optimistic.
              */
-            for (int j = high_bit; j >= 0; j--) {
-               if (pq & BITSET_BIT(j)) {
-                  unsigned int n = i * BITSET_WORDBITS + j;
-                  assert(n < g->count);
-                  add_node_to_stack(g, n);
-                  /* add_node_to_stack() may update pq_test for this word so
-                   * we need to update our local copy.
-                   */
-                  pq = g->tmp.pq_test[i] & ~skip;
-                  progress = true;
-               }
+            while (pq) {
+               int j = util_last_bit(pq) - 1;
+               unsigned int n = i * BITSET_WORDBITS + j;
+               assert(n < g->count);
+               add_node_to_stack(g, n);
+               /* add_node_to_stack() may update pq_test for this word so
+                * we need to update our local copy.
+                */
+               pq = g->tmp.pq_test[i] & ~skip & (BITSET_BIT(j) - 1);
+               progress = true;
             }
          } else if (!progress) {
             if (g->tmp.min_q_total[i] == UINT_MAX) {
@@ -783,13 +819,13 @@ ra_simplify(struct ra_graph *g)
                 * one of these nodes to the stack.  It needs to be
                 * recalculated.
                 */
-               for (int j = high_bit; j >= 0; j--) {
-                  if (skip & BITSET_BIT(j))
-                     continue;
-
+               BITSET_WORD nodes = ~skip & mask;
+               while (nodes) {
+                  int j = u_bit_scan(&nodes);
                   unsigned int n = i * BITSET_WORDBITS + j;
                   assert(n < g->count);
-                  if (g->nodes[n].tmp.q_total < g->tmp.min_q_total[i]) {
+                  /* Going up, ties go to the highest node index. */
+                  if (g->nodes[n].tmp.q_total <= g->tmp.min_q_total[i]) {
                      g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
                      g->tmp.min_q_node[i] = n;
                   }
@@ -829,28 +865,11 @@ ra_class_allocations_conflict(struct ra_class *c1, unsigned int r1,
    }
 }
 
-static struct ra_node *
-ra_find_conflicting_neighbor(struct ra_graph *g, unsigned int n, unsigned int r)
-{
-   util_dynarray_foreach(&g->nodes[n].adjacency_list, unsigned int, n2p) {
-      unsigned int n2 = *n2p;
-
-      /* If our adjacent node is in the stack, it's not allocated yet. */
-      if (!BITSET_TEST(g->tmp.in_stack, n2) &&
-          ra_class_allocations_conflict(g->regs->classes[g->nodes[n].class], r,
-                                        g->regs->classes[g->nodes[n2].class], g->nodes[n2].reg)) {
-         return &g->nodes[n2];
-      }
-   }
-
-   return NULL;
-}
-
 /* Computes a bitfield of what regs are available for a given register
  * selection.
  *
  * This lets drivers implement a more complicated policy than our simple first
- * or round robin policies (which don't require knowing the whole bitset)
+ * or round robin policies, which pick from the same bitset.
  */
 static bool
 ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
@@ -871,8 +890,7 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
          if (c->contig_len) {
             int start = MAX2(0, (int)n2->reg - c->contig_len + 1);
             int end = MIN2(g->regs->count, n2->reg + n2c->contig_len);
-            for (unsigned i = start; i < end; i++)
-               BITSET_CLEAR(regs, i);
+            BITSET_CLEAR_RANGE(regs, start, end - 1);
          } else {
             for (int j = 0; j < BITSET_WORDS(g->regs->count); j++)
                regs[j] &= ~g->regs->regs[n2->reg].conflicts[j];
@@ -888,6 +906,32 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
    return false;
 }
 
+/* Finds the first register set in regs at or after start, wrapping around
+ * at count.
+ */
+static unsigned int
+ra_find_available_reg(const BITSET_WORD *regs, unsigned int start,
+                      unsigned int count)
+{
+   start %= count;
+
+   const unsigned int first_word = BITSET_BITWORD(start);
+   for (unsigned int i = first_word; i < BITSET_WORDS(count); i++) {
+      BITSET_WORD word = regs[i];
+      if (i == first_word)
+         word &= ~(BITSET_BIT(start) - 1);
+      if (word)
+         return i * BITSET_WORDBITS + ffs(word) - 1;
+   }
+
+   for (unsigned int i = 0; i <= first_word; i++) {
+      if (regs[i])
+         return i * BITSET_WORDBITS + ffs(regs[i]) - 1;
+   }
+
+   return NO_REG;
+}
+
 /**
  * Pops nodes from the stack back into the graph, coloring them with
  * registers as they go.
@@ -899,58 +943,35 @@ static bool
 ra_select(struct ra_graph *g)
 {
    int start_search_reg = 0;
-   BITSET_WORD *select_regs = NULL;
-
-   if (g->select_reg_callback)
-      select_regs = malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
+   BITSET_WORD *select_regs =
+      malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
 
    while (g->tmp.stack_count != 0) {
-      unsigned int ri;
-      unsigned int r = -1;
+      unsigned int r;
       int n = g->tmp.stack[g->tmp.stack_count - 1];
-      struct ra_class *c = g->regs->classes[g->nodes[n].class];
 
       /* set this to false even if we return here so that
        * ra_get_best_spill_node() considers this node later.
        */
       BITSET_CLEAR(g->tmp.in_stack, n);
 
-      if (g->select_reg_callback) {
-         if (!ra_compute_available_regs(g, n, select_regs)) {
-            free(select_regs);
-            return false;
-         }
+      /* Gathering the free registers a word at a time is cheaper than
+       * looking for conflicting neighbors one register at a time.
+       */
+      if (!ra_compute_available_regs(g, n, select_regs)) {
+         free(select_regs);
+         return false;
+      }
 
+      if (g->select_reg_callback) {
          r = g->select_reg_callback(n, select_regs, g->select_reg_callback_data);
          assert(r < g->regs->count);
       } else {
-         /* Find the lowest-numbered reg which is not used by a member
-          * of the graph adjacent to us.
+         /* Take the lowest-numbered reg which is not used by a member of the
+          * graph adjacent to us.
           */
-         for (ri = 0; ri < g->regs->count; ri++) {
-            r = (start_search_reg + ri) % g->regs->count;
-            if (!reg_belongs_to_class(r, c))
-               continue;
-
-            struct ra_node *conflicting = ra_find_conflicting_neighbor(g, n, r);
-            if (!conflicting) {
-               /* Found a reg! */
-               break;
-            }
-            if (g->regs->classes[conflicting->class]->contig_len) {
-               /* Skip to point at the last base reg of the conflicting reg
-                * allocation -- the loop will increment us to check the next reg
-                * after the conflicting allocaiton.
-                */
-               unsigned conflicting_end = (conflicting->reg +
-                                           g->regs->classes[conflicting->class]->contig_len - 1);
-               assert(conflicting_end >= r);
-               ri += conflicting_end - r;
-            }
-         }
-
-         if (ri >= g->regs->count)
-            return false;
+         r = ra_find_available_reg(select_regs, start_search_reg,
+                                   g->regs->count);
       }
 
       g->nodes[n].reg = r;
@@ -982,6 +1003,39 @@ ra_allocate(struct ra_graph *g)
    return ra_select(g);
 }
 
+/**
+ * Colors the nodes in order of their index, skipping the simplify step.
+ *
+ * This is tree-scan allocation: if the nodes are SSA values numbered in
+ * the order of their definitions along a dominance-respecting walk, the
+ * interference graph is chordal and the order is a perfect elimination
+ * order, so the nodes get colored with as many registers as there are
+ * values live at once.  It is much cheaper than ra_allocate() for huge
+ * graphs, but for irregular register classes or graphs of non-SSA values
+ * it may fail where ra_allocate() would succeed.
+ *
+ * As with ra_allocate(), ra_get_best_spill_node() can be used after a
+ * failure.
+ */
+bool
+ra_allocate_scan(struct ra_graph *g)
+{
+   memset(g->tmp.in_stack, 0, BITSET_WORDS(g->count) * sizeof(BITSET_WORD));
+
+   /* Push the nodes backwards so that ra_select() pops them in order. */
+   g->tmp.stack_count = 0;
+   for (int n = g->count - 1; n >= 0; n--) {
+      g->nodes[n].reg = g->nodes[n].forced_reg;
+      if (g->nodes[n].reg == NO_REG) {
+         g->tmp.stack[g->tmp.stack_count++] = n;
+         BITSET_SET(g->tmp.in_stack, n);
+      }
+   }
+   g->tmp.stack_optimistic_start = UINT_MAX;
+
+   return ra_select(g);
+}
+
 unsigned int
 ra_get_node_reg(struct ra_graph *g, unsigned int n)
 {
@@ -1077,3 +1131,77 @@ ra_set_node_spill_cost(struct ra_graph *g, unsigned int n, float cost)
 {
    g->nodes[n].spill_cost = cost;
 }
+
+/**
+ * Serializes an interference graph, so that the allocation of a shader can
+ * be replayed outside of the driver, e.g. to benchmark the allocator.
+ *
+ * The register set has to be serialized separately with ra_set_serialize().
+ * The select register callback isn't part of the graph.
+ */
+void
+ra_graph_serialize(const struct ra_graph *g, struct blob *blob)
+{
+   blob_write_uint32(blob, g->count);
+
+   /* The classes come first, they are needed to add the interferences. */
+   for (unsigned int n = 0; n < g->count; n++) {
+      blob_write_uint32(blob, g->nodes[n].class);
+      blob_write_uint32(blob, g->nodes[n].forced_reg);
+      blob_write_uint32(blob, fui(g->nodes[n].spill_cost));
+   }
+
+   /* Each interference is written once, with its lower numbered node. */
+   for (unsigned int n = 0; n < g->count; n++) {
+      const struct util_dynarray *adjacency = &g->nodes[n].adjacency_list;
+      unsigned int count = 0;
+
+      util_dynarray_foreach(adjacency, unsigned int, n2p) {
+         if (*n2p > n)
+            count++;
+      }
+
+      blob_write_uint32(blob, count);
+      util_dynarray_foreach(adjacency, unsigned int, n2p) {
+         if (*n2p > n)
+            blob_write_uint32(blob, *n2p);
+      }
+   }
+}
+
+struct ra_graph *
+ra_graph_deserialize(struct ra_regs *regs, struct blob_reader *blob)
+{
+   unsigned int count = blob_read_uint32(blob);
+   struct ra_graph *g = ra_alloc_interference_graph(regs, count);
+
+   for (unsigned int n = 0; n < count; n++) {
+      g->nodes[n].class = blob_read_uint32(blob);
+      if (g->nodes[n].class >= regs->class_count)
+         goto fail;
+      g->nodes[n].forced_reg = blob_read_uint32(blob);
+      if (g->nodes[n].forced_reg != NO_REG &&
+          g->nodes[n].forced_reg >= regs->count)
+         goto fail;
+      g->nodes[n].spill_cost = uif(blob_read_uint32(blob));
+   }
+
+   for (unsigned int n = 0; n < count && !blob->overrun; n++) {
+      unsigned int adjacency_count = blob_read_uint32(blob);
+      for (unsigned int i = 0; i < adjacency_count && !blob->overrun; i++) {
+         unsigned int n2 = blob_read_uint32(blob);
+         if (n2 >= count)
+            goto fail;
+         ra_add_node_interference(g, n, n2);
+      }
+   }
+
+   if (blob->overrun)
+      goto fail;
+
+   return g;
+
+fail:
+   ralloc_free(g);
+   return NULL;
+}
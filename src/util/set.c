@@ -41,6 +41,7 @@
 #include "ralloc.h"
 #include "set.h"
 #include "fast_urem_by_const.h"
+#include "hash_table_ctrl.h"
 
 /*
  * From Knuth -- a good choice for hash/rehash values is p, p-2 where
@@ -116,20 +117,76 @@ entry_is_present(struct set_entry *entry)
    return entry->key != NULL && entry->key != deleted_key;
 }
 
+static bool
+set_entry_is_present(const struct set *ht, struct set_entry *entry)
+{
+   if (ht->ctrl)
+      return hash_ctrl_is_full(ht->ctrl, entry - ht->table);
+
+   return entry_is_present(entry);
+}
+
+/**
+ * Allocates the entries and the control bytes of a grouped set with
+ * 2^size_index slots as a single block.  Doesn't modify the set on failure.
+ */
+static bool
+grouped_set_alloc(struct set *ht, void *mem_ctx, unsigned size_index)
+{
+   if (size_index > HASH_CTRL_MAX_SIZE_INDEX)
+      return false;
+
+   uint32_t size = 1u << size_index;
+
+   /* Objects can't be bigger than PTRDIFF_MAX, which 32-bit builds reach
+    * before the maximum size index.
+    */
+   uint64_t bytes = (uint64_t)size * sizeof(struct set_entry) +
+                    hash_ctrl_size(size);
+   if (bytes > PTRDIFF_MAX)
+      return false;
+
+   struct set_entry *table = ralloc_size(mem_ctx, bytes);
+   if (table == NULL)
+      return false;
+
+   ht->table = table;
+   ht->ctrl = (uint8_t *)(table + size);
+   ht->size = size;
+   ht->size_index = size_index;
+   ht->max_entries = hash_ctrl_max_entries(size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+   hash_ctrl_init(ht->ctrl, size);
+
+   return true;
+}
+
 bool
 _mesa_set_init(struct set *ht, void *mem_ctx,
                  uint32_t (*key_hash_function)(const void *key),
                  bool (*key_equals_function)(const void *a,
                                              const void *b))
 {
+   ht->key_hash_function = key_hash_function;
+   ht->key_equals_function = key_equals_function;
+
+   if (_mesa_hash_table_get_default_layout() == HASH_TABLE_LAYOUT_GROUPED) {
+      ht->rehash = 0;
+      ht->size_magic = 0;
+      ht->rehash_magic = 0;
+      ht->table = NULL;
+      ht->ctrl = NULL;
+      return grouped_set_alloc(ht, mem_ctx, HASH_CTRL_MIN_SIZE_INDEX);
+   }
+
+   ht->ctrl = NULL;
    ht->size_index = 0;
    ht->size = hash_sizes[ht->size_index].size;
    ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
    ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->key_hash_function = key_hash_function;
-   ht->key_equals_function = key_equals_function;
    ht->table = rzalloc_array(mem_ctx, struct set_entry, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
@@ -188,13 +245,19 @@ _mesa_set_clone(struct set *set, void *dst_mem_ctx)
 
    memcpy(clone, set, sizeof(struct set));
 
-   clone->table = ralloc_array(clone, struct set_entry, clone->size);
+   size_t table_size = clone->size * sizeof(struct set_entry);
+   if (set->ctrl)
+      table_size += hash_ctrl_size(clone->size);
+
+   clone->table = ralloc_size(clone, table_size);
    if (clone->table == NULL) {
       ralloc_free(clone);
       return NULL;
    }
 
-   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry));
+   memcpy(clone->table, set->table, table_size);
+   if (set->ctrl)
+      clone->ctrl = (uint8_t *)(clone->table + clone->size);
 
    return clone;
 }
@@ -224,7 +287,10 @@ _mesa_set_destroy(struct set *ht, void (*delete_function)(struct set_entry *entr
 static void
 set_clear_fast(struct set *ht)
 {
-   memset(ht->table, 0, sizeof(struct set_entry) * hash_sizes[ht->size_index].size);
+   if (ht->ctrl)
+      hash_ctrl_init(ht->ctrl, ht->size);
+   else
+      memset(ht->table, 0, sizeof(struct set_entry) * hash_sizes[ht->size_index].size);
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -244,11 +310,13 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
 
    if (delete_function) {
       for (entry = set->table; entry != set->table + set->size; entry++) {
-         if (entry_is_present(entry))
+         if (set_entry_is_present(set, entry))
             delete_function(entry);
 
          entry->key = NULL;
       }
+      if (set->ctrl)
+         hash_ctrl_init(set->ctrl, set->size);
       set->entries = 0;
       set->deleted_entries = 0;
    } else
@@ -260,11 +328,40 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
  *
  * Returns NULL if no entry is found.
  */
+static struct set_entry *
+grouped_search(const struct set *ht, uint32_t hash, const void *key)
+{
+   uint32_t mixed = hash_ctrl_mix(hash);
+   uint8_t h2 = hash_ctrl_h2(mixed);
+   struct hash_ctrl_probe probe = hash_ctrl_probe_start(mixed, ht->size);
+
+   do {
+      uint32_t offset = hash_ctrl_probe_offset(&probe);
+      const uint8_t *ctrl = ht->ctrl + offset;
+      uint64_t match = hash_group_match(ctrl, h2);
+
+      while (match) {
+         struct set_entry *entry = ht->table + offset + hash_group_next(&match);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      if (hash_group_match_empty(ctrl))
+         return NULL;
+   } while (hash_ctrl_probe_next(&probe));
+
+   return NULL;
+}
+
 static struct set_entry *
 set_search(const struct set *ht, uint32_t hash, const void *key)
 {
    assert(!key_pointer_is_reserved(key));
 
+   if (ht->ctrl)
+      return grouped_search(ht, hash, key);
+
    uint32_t size = ht->size;
    uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
    uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
@@ -327,12 +424,48 @@ set_add_rehash(struct set *ht, uint32_t hash, const void *key)
    } while (true);
 }
 
+static void
+grouped_rehash(struct set *ht, unsigned new_size_index)
+{
+   struct set old_ht;
+
+   if (ht->size_index == new_size_index && !ht->entries) {
+      set_clear_fast(ht);
+      return;
+   }
+
+   old_ht = *ht;
+
+   if (!grouped_set_alloc(ht, ralloc_parent(old_ht.table), new_size_index))
+      return;
+
+   for (uint32_t i = 0; i < old_ht.size; i++) {
+      if (!hash_ctrl_is_full(old_ht.ctrl, i))
+         continue;
+
+      uint32_t mixed = hash_ctrl_mix(old_ht.table[i].hash);
+      uint32_t slot = hash_ctrl_find_free(ht->ctrl, ht->size, mixed);
+
+      ht->ctrl[slot] = old_ht.ctrl[i];
+      ht->table[slot] = old_ht.table[i];
+   }
+
+   ht->entries = old_ht.entries;
+
+   ralloc_free(old_ht.table);
+}
+
 static void
 set_rehash(struct set *ht, unsigned new_size_index)
 {
    struct set old_ht;
    struct set_entry *table;
 
+   if (ht->ctrl) {
+      grouped_rehash(ht, new_size_index);
+      return;
+   }
+
    if (ht->size_index == new_size_index && ht->deleted_entries == ht->max_entries) {
       set_clear_fast(ht);
       assert(!ht->entries);
@@ -375,6 +508,16 @@ _mesa_set_resize(struct set *set, uint32_t entries)
    if (set->entries > entries)
       entries = set->entries;
 
+   if (set->ctrl) {
+      unsigned size_index = HASH_CTRL_MIN_SIZE_INDEX;
+      while (size_index < HASH_CTRL_MAX_SIZE_INDEX &&
+             hash_ctrl_max_entries(1u << size_index) < entries)
+         size_index++;
+
+      set_rehash(set, size_index);
+      return;
+   }
+
    unsigned size_index = 0;
    while (hash_sizes[size_index].max_entries < entries)
       size_index++;
@@ -389,6 +532,44 @@ _mesa_set_resize(struct set *set, uint32_t entries)
  * Note that insertion may rearrange the table on a resize or rehash,
  * so previously found hash_entries are no longer valid after this function.
  */
+static struct set_entry *
+grouped_search_or_add(struct set *ht, uint32_t hash, const void *key,
+                      bool *found)
+{
+   struct set_entry *entry = grouped_search(ht, hash, key);
+
+   if (entry) {
+      if (found)
+         *found = true;
+      return entry;
+   }
+
+   if (ht->entries >= ht->max_entries) {
+      set_rehash(ht, ht->size_index + 1);
+   } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
+      set_rehash(ht, ht->size_index);
+   }
+
+   /* We could hit here if a required resize failed. */
+   if (ht->entries >= ht->size)
+      return NULL;
+
+   uint32_t mixed = hash_ctrl_mix(hash);
+   uint32_t slot = hash_ctrl_find_free(ht->ctrl, ht->size, mixed);
+
+   if (ht->ctrl[slot] == HASH_CTRL_DELETED)
+      ht->deleted_entries--;
+   ht->ctrl[slot] = hash_ctrl_h2(mixed);
+   ht->entries++;
+
+   entry = ht->table + slot;
+   entry->hash = hash;
+   entry->key = key;
+   if (found)
+      *found = false;
+   return entry;
+}
+
 static struct set_entry *
 set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
 {
@@ -396,6 +577,9 @@ set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
 
    assert(!key_pointer_is_reserved(key));
 
+   if (ht->ctrl)
+      return grouped_search_or_add(ht, hash, key, found);
+
    if (ht->entries >= ht->max_entries) {
       set_rehash(ht, ht->size_index + 1);
    } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
@@ -546,6 +730,13 @@ _mesa_set_remove(struct set *ht, struct set_entry *entry)
    if (!entry)
       return;
 
+   if (ht->ctrl) {
+      if (hash_ctrl_erase(ht->ctrl, entry - ht->table))
+         ht->deleted_entries++;
+      ht->entries--;
+      return;
+   }
+
    entry->key = deleted_key;
    ht->entries--;
    ht->deleted_entries++;
@@ -560,6 +751,21 @@ _mesa_set_remove_key(struct set *set, const void *key)
    _mesa_set_remove(set, _mesa_set_search(set, key));
 }
 
+/**
+ * Removes the entry without leaving a tombstone, which is only valid when
+ * all the entries are removed, as set_foreach_remove does.
+ */
+void
+_mesa_set_remove_unsafe(struct set *ht, struct set_entry *entry)
+{
+   if (ht->ctrl)
+      ht->ctrl[entry - ht->table] = HASH_CTRL_EMPTY;
+
+   entry->hash = 0;
+   entry->key = NULL;
+   ht->entries--;
+}
+
 /**
  * This function is an iterator over the set when no deleted entries are present.
  *
@@ -575,6 +781,13 @@ _mesa_set_next_entry_unsafe(const struct set *ht, struct set_entry *entry)
       entry = ht->table;
    else
       entry = entry + 1;
+   if (ht->ctrl) {
+      for (; entry != ht->table + ht->size; entry++) {
+         if (hash_ctrl_is_full(ht->ctrl, entry - ht->table))
+            return entry;
+      }
+      return NULL;
+   }
    if (entry != ht->table + ht->size)
       return entry->key ? entry : _mesa_set_next_entry_unsafe(ht, entry);
 
@@ -596,7 +809,7 @@ _mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
       entry = entry + 1;
 
    for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(entry)) {
+      if (set_entry_is_present(ht, entry)) {
          return entry;
       }
    }
@@ -615,14 +828,14 @@ _mesa_set_random_entry(struct set *ht,
       return NULL;
 
    for (entry = ht->table + i; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(entry) &&
+      if (set_entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
    }
 
    for (entry = ht->table; entry != ht->table + i; entry++) {
-      if (entry_is_present(entry) &&
+      if (set_entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
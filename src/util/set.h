@@ -43,6 +43,10 @@ struct set_entry {
 struct set {
    void *mem_ctx;
    struct set_entry *table;
+   /* Control bytes following the entries, NULL for the double hashing
+    * layout.
+    */
+   uint8_t *ctrl;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    uint32_t size;
@@ -108,6 +112,8 @@ void
 _mesa_set_remove(struct set *set, struct set_entry *entry);
 void
 _mesa_set_remove_key(struct set *set, const void *key);
+void
+_mesa_set_remove_unsafe(struct set *set, struct set_entry *entry);
 
 struct set_entry *
 _mesa_set_next_entry(const struct set *set, struct set_entry *entry);
@@ -141,7 +147,7 @@ _mesa_set_intersects(struct set *a, struct set *b);
 #define set_foreach_remove(set, entry)                              \
    for (struct set_entry *entry = _mesa_set_next_entry_unsafe(set, NULL);  \
         (set)->entries;                                              \
-        entry->hash = 0, entry->key = (void*)NULL, (set)->entries--, entry = _mesa_set_next_entry_unsafe(set, entry))
+        _mesa_set_remove_unsafe(set, entry), entry = _mesa_set_next_entry_unsafe(set, entry))
 
 #ifdef __cplusplus
 } /* extern C */
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <dirent.h>
 #include <ftw.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -36,6 +37,12 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
@@ -651,6 +658,511 @@ test_put_and_get_between_instances_with_eviction(const char *driver_id)
    disk_cache_destroy(cache[0]);
    disk_cache_destroy(cache[1]);
 }
+#define FOZ_READ_ITEMS 256
+#define FOZ_READ_THREADS 8
+#define FOZ_READ_ITERATIONS 32
+
+static size_t
+foz_read_item_size(unsigned i)
+{
+   return 512 + (i * 37) % 4096;
+}
+
+static void
+fill_foz_read_item(uint8_t *data, unsigned i)
+{
+   for (size_t j = 0; j < foz_read_item_size(i); j++)
+      data[j] = (uint8_t)(i + j);
+}
+
+/* Look up every item FOZ_READ_ITERATIONS times from FOZ_READ_THREADS
+ * threads at once and return the elapsed time in microseconds, or -1 if
+ * any lookup failed.
+ */
+static int64_t
+time_concurrent_reads(struct disk_cache *cache, const cache_key *keys,
+                      bool nocopy)
+{
+   std::vector<std::thread> threads;
+   bool failed[FOZ_READ_THREADS] = { false };
+
+   auto start = std::chrono::steady_clock::now();
+
+   for (unsigned t = 0; t < FOZ_READ_THREADS; t++) {
+      threads.emplace_back([=, &failed]() {
+         for (unsigned n = 0; n < FOZ_READ_ITERATIONS; n++) {
+            for (unsigned i = 0; i < FOZ_READ_ITEMS; i++) {
+               /* spread the threads over different items */
+               unsigned item = (i + t * FOZ_READ_ITEMS / FOZ_READ_THREADS) % FOZ_READ_ITEMS;
+               size_t size = 0;
+
+               if (nocopy) {
+                  disk_cache_release_cb release;
+                  const uint8_t *data = (const uint8_t *)
+                     disk_cache_get_nocopy(cache, keys[item], &size, &release);
+                  if (!data || size != foz_read_item_size(item) ||
+                      data[size - 1] != (uint8_t)(item + size - 1))
+                     failed[t] = true;
+                  if (data)
+                     release((void *)data);
+               } else {
+                  uint8_t *data = (uint8_t *)disk_cache_get(cache, keys[item], &size);
+                  if (!data || size != foz_read_item_size(item) ||
+                      data[size - 1] != (uint8_t)(item + size - 1))
+                     failed[t] = true;
+                  free(data);
+               }
+            }
+         }
+      });
+   }
+
+   for (auto &thread : threads)
+      thread.join();
+
+   auto end = std::chrono::steady_clock::now();
+
+   for (unsigned t = 0; t < FOZ_READ_THREADS; t++) {
+      if (failed[t])
+         return -1;
+   }
+
+   return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+/* Multithreaded read benchmark comparing lookups in the writable single file
+ * cache, which go through the db mutex and the FILE, with lookups in a read
+ * only db, which is mapped and read without locking.
+ */
+static void
+test_concurrent_reads_read_only_foz(const char *driver_id)
+{
+   cache_key keys[FOZ_READ_ITEMS];
+   uint8_t *data = (uint8_t *) malloc(foz_read_item_size(FOZ_READ_ITEMS) + 4096);
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   struct disk_cache *cache = disk_cache_create("test_concurrent_reads",
+                                                driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+
+   for (unsigned i = 0; i < FOZ_READ_ITEMS; i++) {
+      disk_cache_compute_key(cache, &i, sizeof(i), keys[i]);
+      fill_foz_read_item(data, i);
+      disk_cache_put(cache, keys[i], data, foz_read_item_size(i), NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+
+   int64_t locked_time = time_concurrent_reads(cache, keys, false);
+   EXPECT_GE(locked_time, 0) << "concurrent reads from the writable foz db";
+
+   char *path = strdup(cache->path);
+   disk_cache_destroy(cache);
+
+   /* Turn the db we just wrote into a read only one. */
+   char *from, *to;
+   ASSERT_NE(asprintf(&from, "%s/foz_cache.foz", path), -1);
+   ASSERT_NE(asprintf(&to, "%s/ro_reads.foz", path), -1);
+   EXPECT_EQ(rename(from, to), 0);
+   free(from);
+   free(to);
+   ASSERT_NE(asprintf(&from, "%s/foz_cache_idx.foz", path), -1);
+   ASSERT_NE(asprintf(&to, "%s/ro_reads_idx.foz", path), -1);
+   EXPECT_EQ(rename(from, to), 0);
+   free(from);
+   free(to);
+   free(path);
+
+   setenv("MESA_DISK_CACHE_READ_ONLY_FOZ_DBS", "ro_reads", 1);
+   cache = disk_cache_create("test_concurrent_reads", driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+
+   for (unsigned i = 0; i < FOZ_READ_ITEMS; i++) {
+      size_t size;
+      uint8_t *result = (uint8_t *) disk_cache_get(cache, keys[i], &size);
+
+      fill_foz_read_item(data, i);
+      EXPECT_EQ(size, foz_read_item_size(i)) << "read only foz item size";
+      EXPECT_TRUE(result && memcmp(result, data, size) == 0)
+         << "read only foz item contents";
+      free(result);
+
+      disk_cache_release_cb release;
+      const void *a = disk_cache_get_nocopy(cache, keys[i], &size, &release);
+      EXPECT_TRUE(a && memcmp(a, data, size) == 0)
+         << "disk_cache_get_nocopy contents";
+      if (cache->compression_disabled) {
+         disk_cache_release_cb release_b;
+         const void *b = disk_cache_get_nocopy(cache, keys[i], &size, &release_b);
+         EXPECT_EQ(a, b) << "uncompressed read only items aren't copied";
+         release_b((void *)b);
+      }
+      release((void *)a);
+   }
+
+   int64_t mapped_time = time_concurrent_reads(cache, keys, false);
+   EXPECT_GE(mapped_time, 0) << "concurrent reads from the read only foz db";
+
+   int64_t nocopy_time = time_concurrent_reads(cache, keys, true);
+   EXPECT_GE(nocopy_time, 0) << "concurrent nocopy reads from the read only foz db";
+
+   printf("%u threads x %u lookups (%s):\n", FOZ_READ_THREADS,
+          FOZ_READ_ITEMS * FOZ_READ_ITERATIONS, driver_id);
+   printf("  writable db:           %8" PRId64 " usec\n", locked_time);
+   printf("  read only db:          %8" PRId64 " usec\n", mapped_time);
+   printf("  read only db, nocopy:  %8" PRId64 " usec\n", nocopy_time);
+
+   disk_cache_destroy(cache);
+   unsetenv("MESA_DISK_CACHE_READ_ONLY_FOZ_DBS");
+   free(data);
+}
+
+/* Multithreaded read benchmark of the database cache. The items are written
+ * by another instance, hence the first lookup of every item has to take the
+ * lock to pick it up, while the rest are done without locking.
+ */
+static void
+test_concurrent_reads_db(const char *driver_id)
+{
+   cache_key keys[FOZ_READ_ITEMS];
+   uint8_t *data = (uint8_t *) malloc(foz_read_item_size(FOZ_READ_ITEMS) + 4096);
+   struct disk_cache *cache[2];
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+
+   cache[0] = disk_cache_create("test_concurrent_reads_db", driver_id, 0);
+   cache[1] = disk_cache_create("test_concurrent_reads_db", driver_id, 0);
+   ASSERT_NE(cache[0], nullptr);
+   ASSERT_NE(cache[1], nullptr);
+
+   for (unsigned i = 0; i < FOZ_READ_ITEMS; i++) {
+      disk_cache_compute_key(cache[0], &i, sizeof(i), keys[i]);
+      fill_foz_read_item(data, i);
+      disk_cache_put(cache[0], keys[i], data, foz_read_item_size(i), NULL);
+   }
+   disk_cache_wait_for_idle(cache[0]);
+
+   int64_t first_time = time_concurrent_reads(cache[1], keys, false);
+   EXPECT_GE(first_time, 0) << "concurrent reads of the items of other instance";
+
+   int64_t again_time = time_concurrent_reads(cache[1], keys, false);
+   EXPECT_GE(again_time, 0) << "concurrent reads of the indexed items";
+
+   printf("%u threads x %u lookups (%s, database):\n", FOZ_READ_THREADS,
+          FOZ_READ_ITEMS * FOZ_READ_ITERATIONS, driver_id);
+   printf("  first pass:            %8" PRId64 " usec\n", first_time);
+   printf("  second pass:           %8" PRId64 " usec\n", again_time);
+
+   disk_cache_destroy(cache[0]);
+   disk_cache_destroy(cache[1]);
+   free(data);
+}
+
+#define BATCH_ITEMS 64
+
+struct batch_results {
+   const cache_key *keys;
+   std::atomic<unsigned> found;
+   std::atomic<unsigned> missing;
+   std::atomic<unsigned> mismatched;
+};
+
+static void
+batch_item_done(void *cb_data, const uint8_t *key, void *data, size_t size)
+{
+   struct batch_results *results = (struct batch_results *) cb_data;
+   uint8_t *expected = (uint8_t *) malloc(foz_read_item_size(BATCH_ITEMS) + 4096);
+
+   if (!data) {
+      results->missing++;
+      free(expected);
+      return;
+   }
+
+   results->found++;
+
+   for (unsigned i = 0; i < BATCH_ITEMS; i++) {
+      if (memcmp(key, results->keys[i], CACHE_KEY_SIZE))
+         continue;
+
+      fill_foz_read_item(expected, i);
+      if (size != foz_read_item_size(i) || memcmp(data, expected, size))
+         results->mismatched++;
+   }
+
+   free(expected);
+   free(data);
+}
+
+static void
+put_batch_items(struct disk_cache *cache, cache_key *keys)
+{
+   uint8_t *data = (uint8_t *) malloc(foz_read_item_size(BATCH_ITEMS) + 4096);
+
+   for (unsigned i = 0; i < BATCH_ITEMS; i++) {
+      disk_cache_compute_key(cache, &i, sizeof(i), keys[i]);
+      fill_foz_read_item(data, i);
+      disk_cache_put(cache, keys[i], data, foz_read_item_size(i), NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+
+   free(data);
+}
+
+static void
+test_get_batch(const char *driver_id)
+{
+   cache_key keys[BATCH_ITEMS + 1];
+   struct batch_results results;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+
+   struct disk_cache *cache = disk_cache_create("test_get_batch", driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+
+   put_batch_items(cache, keys);
+
+   /* The last key was never stored */
+   const char missing[] = "missing";
+   disk_cache_compute_key(cache, missing, sizeof(missing), keys[BATCH_ITEMS]);
+
+   results.keys = keys;
+   results.found = 0;
+   results.missing = 0;
+   results.mismatched = 0;
+
+   struct disk_cache_batch *batch =
+      disk_cache_get_batch(cache, keys, BATCH_ITEMS + 1, batch_item_done,
+                           &results);
+   disk_cache_batch_wait(batch);
+
+   EXPECT_EQ(results.found, BATCH_ITEMS) << "disk_cache_get_batch of existing items";
+   EXPECT_EQ(results.missing, 1) << "disk_cache_get_batch of non-existent item";
+   EXPECT_EQ(results.mismatched, 0) << "disk_cache_get_batch item contents";
+
+   disk_cache_destroy(cache);
+}
+
+static void
+test_prefetch(const char *driver_id)
+{
+   uint8_t *expected = (uint8_t *) malloc(foz_read_item_size(BATCH_ITEMS) + 4096);
+   cache_key keys[BATCH_ITEMS];
+   struct disk_cache *cache;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+   setenv("MESA_DISK_CACHE_PREFETCH", "true", 1);
+
+   /* The stored items make it into the manifest */
+   cache = disk_cache_create("test_prefetch", driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+   put_batch_items(cache, keys);
+   disk_cache_destroy(cache);
+
+   cache = disk_cache_create("test_prefetch", driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_EQ(cache->prefetched->entries, BATCH_ITEMS)
+      << "items of the manifest are prefetched";
+
+   for (unsigned i = 0; i < BATCH_ITEMS / 2; i++) {
+      size_t size;
+      uint8_t *result = (uint8_t *) disk_cache_get(cache, keys[i], &size);
+
+      fill_foz_read_item(expected, i);
+      EXPECT_EQ(size, foz_read_item_size(i)) << "prefetched item size";
+      EXPECT_TRUE(result && memcmp(result, expected, size) == 0)
+         << "prefetched item contents";
+      free(result);
+   }
+
+   EXPECT_EQ(cache->prefetched->entries, BATCH_ITEMS / 2)
+      << "prefetched items are handed out once";
+
+   /* Only the items looked up by the last run are prefetched */
+   disk_cache_destroy(cache);
+
+   cache = disk_cache_create("test_prefetch", driver_id, 0);
+   ASSERT_NE(cache, nullptr);
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_EQ(cache->prefetched->entries, BATCH_ITEMS / 2)
+      << "manifest holds the items used by the last run";
+
+   disk_cache_destroy(cache);
+   unsetenv("MESA_DISK_CACHE_PREFETCH");
+   free(expected);
+}
+
+#define STORAGE_ITEMS 128
+#define STORAGE_FRAGMENTS 32
+#define STORAGE_FRAGMENTS_PER_ITEM 6
+
+/* Text looking like printed NIR, as the items of a shader cache, which are
+ * mostly made of fragments shared with other items, e.g. inlined builtins
+ * or the code common to the variants of an uber shader.
+ */
+static void
+append_shader_text(std::string &text, uint32_t seed, unsigned lines)
+{
+   static const char *ops[] = { "fadd", "fmul", "ffma", "iadd", "load_const",
+                                "load_deref", "store_deref", "fsat", "bcsel" };
+
+   for (unsigned i = 0; i < lines; i++) {
+      char line[128];
+      seed = seed * 1103515245 + 12345;
+      snprintf(line, sizeof(line), "   ssa_%u = %s ssa_%u, ssa_%u\n",
+               (seed >> 8) % 4096, ops[(seed >> 4) % ARRAY_SIZE(ops)],
+               (seed >> 12) % 4096, (seed >> 20) % 4096);
+      text += line;
+   }
+}
+
+static std::string
+storage_item(unsigned i)
+{
+   std::string text = "shader " + std::to_string(i) + "\n";
+
+   for (unsigned f = 0; f < STORAGE_FRAGMENTS_PER_ITEM; f++) {
+      append_shader_text(text, (i * 7 + f * 13) % STORAGE_FRAGMENTS, 256);
+      append_shader_text(text, 1000 + i * STORAGE_FRAGMENTS_PER_ITEM + f, 16);
+   }
+   return text;
+}
+
+/* Size of the files of the single file cache, i.e. the foz db and the
+ * compression dictionary.
+ */
+static uint64_t
+directory_size(const char *path)
+{
+   uint64_t size = 0;
+   DIR *dir = opendir(path);
+   if (!dir)
+      return 0;
+
+   while (struct dirent *entry = readdir(dir)) {
+      std::string filename = std::string(path) + "/" + entry->d_name;
+      if (strcmp(entry->d_name, "index") == 0)
+         continue;
+
+      struct stat sb;
+      if (stat(filename.c_str(), &sb) == 0 && S_ISREG(sb.st_mode))
+         size += sb.st_size;
+   }
+   closedir(dir);
+   return size;
+}
+
+/* Storage benchmark of the single file cache, reporting the size of the
+ * cache directory and the throughput of reading the items back, with and
+ * without the compression dictionary and deduplication.
+ */
+static void
+test_storage_efficiency(const char *driver_id)
+{
+   static const struct {
+      const char *name;
+      bool dict;
+      bool dedup;
+   } configs[] = {
+      { "default", false, false },
+      { "dictionary", true, false },
+      { "dedup", false, true },
+      { "dedup + dictionary", true, true },
+   };
+   uint64_t sizes[ARRAY_SIZE(configs)];
+   size_t total_size = 0;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   printf("%u items (%s):\n", STORAGE_ITEMS, driver_id);
+
+   for (unsigned c = 0; c < ARRAY_SIZE(configs); c++) {
+      cache_key keys[STORAGE_ITEMS];
+
+      setenv("MESA_DISK_CACHE_COMPRESSION_DICT",
+             configs[c].dict ? "true" : "false", 1);
+      setenv("MESA_DISK_CACHE_DEDUP", configs[c].dedup ? "true" : "false", 1);
+
+      struct disk_cache *cache = disk_cache_create("test_storage", driver_id, 0);
+      ASSERT_NE(cache, nullptr);
+
+      char *path = strdup(cache->path);
+      rmrf_local(path);
+      disk_cache_destroy(cache);
+
+      cache = disk_cache_create("test_storage", driver_id, 0);
+      ASSERT_NE(cache, nullptr);
+
+      total_size = 0;
+      for (unsigned i = 0; i < STORAGE_ITEMS; i++) {
+         std::string item = storage_item(i);
+         disk_cache_compute_key(cache, &i, sizeof(i), keys[i]);
+         disk_cache_put(cache, keys[i], item.data(), item.size(), NULL);
+         total_size += item.size();
+      }
+      disk_cache_wait_for_idle(cache);
+
+      if (configs[c].dict) {
+         EXPECT_NE(cache->compress_dict, nullptr)
+            << "the dictionary was trained";
+      }
+      disk_cache_destroy(cache);
+
+      sizes[c] = directory_size(path);
+
+      /* Read everything back in a new instance, which loads the dictionary */
+      cache = disk_cache_create("test_storage", driver_id, 0);
+      ASSERT_NE(cache, nullptr);
+
+      auto start = std::chrono::steady_clock::now();
+      unsigned mismatches = 0;
+      for (unsigned i = 0; i < STORAGE_ITEMS; i++) {
+         size_t size;
+         char *data = (char *) disk_cache_get(cache, keys[i], &size);
+         std::string item = storage_item(i);
+         if (!data || size != item.size() || memcmp(data, item.data(), size))
+            mismatches++;
+         free(data);
+      }
+      auto end = std::chrono::steady_clock::now();
+      int64_t usec =
+         std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+      EXPECT_EQ(mismatches, 0) << configs[c].name << " items read back";
+
+      printf("  %-20s %9" PRIu64 " bytes (%5.1f%%), read %7.1f MB/s\n",
+             configs[c].name, sizes[c], sizes[c] * 100.0 / total_size,
+             total_size / (double) MAX2(usec, 1));
+
+      disk_cache_destroy(cache);
+      free(path);
+   }
+
+   /* The fragments shared by the items are stored once */
+   EXPECT_LT(sizes[2], sizes[0]) << "deduplication reduces the cache size";
+
+   unsetenv("MESA_DISK_CACHE_COMPRESSION_DICT");
+   unsetenv("MESA_DISK_CACHE_DEDUP");
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 class Cache : public ::testing::Test {
@@ -686,6 +1198,10 @@ run_tests:
 
    test_put_key_and_get_key(driver_id);
 
+   test_get_batch(driver_id);
+
+   test_prefetch(driver_id);
+
    int err = rmrf_local(CACHE_TEST_TMP);
    EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
 
@@ -724,6 +1240,10 @@ run_tests:
 
    test_put_and_get_between_instances(driver_id);
 
+   test_concurrent_reads_read_only_foz(driver_id);
+
+   test_storage_efficiency(driver_id);
+
    setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -767,6 +1287,12 @@ TEST_F(Cache, Database)
 
    test_put_and_get_between_instances_with_eviction(driver_id);
 
+   test_concurrent_reads_db(driver_id);
+
+   test_get_batch(driver_id);
+
+   test_prefetch(driver_id);
+
    setenv("MESA_DISK_CACHE_DATABASE", "false", 1);
 
    err = rmrf_local(CACHE_TEST_TMP);
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ *
+ * Testing the hash table and set layouts against each other.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "util/hash_table.h"
+#include "util/ralloc.h"
+#include "util/set.h"
+
+class HashTableLayout : public ::testing::TestWithParam<hash_table_layout> {
+protected:
+   void SetUp() override
+   {
+      old_layout = _mesa_hash_table_get_default_layout();
+      _mesa_hash_table_set_default_layout(GetParam());
+   }
+
+   void TearDown() override
+   {
+      _mesa_hash_table_set_default_layout(old_layout);
+   }
+
+   hash_table_layout old_layout;
+};
+
+INSTANTIATE_TEST_SUITE_P(
+   Layouts, HashTableLayout,
+   ::testing::Values(HASH_TABLE_LAYOUT_GROUPED,
+                     HASH_TABLE_LAYOUT_DOUBLE_HASHING),
+   [](const ::testing::TestParamInfo<hash_table_layout> &info) {
+      return info.param == HASH_TABLE_LAYOUT_GROUPED ? "Grouped"
+                                                     : "DoubleHashing";
+   });
+
+static void *
+u32_key(uint32_t i)
+{
+   /* 0 and 1 are reserved by _mesa_hash_table_create_u32_keys users. */
+   return (void *)(uintptr_t)(i + 2);
+}
+
+TEST_P(HashTableLayout, MatchesReference)
+{
+   struct hash_table *ht = _mesa_hash_table_create_u32_keys(NULL);
+   std::unordered_map<uint32_t, uintptr_t> ref;
+   std::mt19937 rand(42);
+
+   EXPECT_EQ(ht->ctrl != NULL, GetParam() == HASH_TABLE_LAYOUT_GROUPED);
+
+   for (unsigned i = 0; i < 200000; i++) {
+      uint32_t key = rand() % 4096;
+      switch (rand() % 3) {
+      case 0:
+         _mesa_hash_table_insert(ht, u32_key(key), (void *)(uintptr_t)i);
+         ref[key] = i;
+         break;
+      case 1:
+         _mesa_hash_table_remove_key(ht, u32_key(key));
+         ref.erase(key);
+         break;
+      case 2: {
+         struct hash_entry *entry = _mesa_hash_table_search(ht, u32_key(key));
+         auto it = ref.find(key);
+         ASSERT_EQ(entry != NULL, it != ref.end());
+         if (entry)
+            ASSERT_EQ((uintptr_t)entry->data, it->second);
+         break;
+      }
+      }
+
+      if (i % 10000 == 0) {
+         unsigned count = 0;
+         hash_table_foreach(ht, entry)
+            count++;
+         ASSERT_EQ(count, ref.size());
+         ASSERT_EQ(_mesa_hash_table_num_entries(ht), ref.size());
+      }
+   }
+
+   _mesa_hash_table_destroy(ht, NULL);
+}
+
+TEST_P(HashTableLayout, SetMatchesReference)
+{
+   struct set *s = _mesa_set_create_u32_keys(NULL);
+   std::unordered_set<uint32_t> ref;
+   std::mt19937 rand(7);
+
+   for (unsigned i = 0; i < 200000; i++) {
+      uint32_t key = rand() % 4096;
+      bool found;
+
+      if (rand() % 2) {
+         _mesa_set_search_or_add(s, u32_key(key), &found);
+         ASSERT_EQ(found, !ref.insert(key).second);
+      } else {
+         _mesa_set_remove_key(s, u32_key(key));
+         ref.erase(key);
+      }
+   }
+
+   ASSERT_EQ(s->entries, ref.size());
+   set_foreach(s, entry)
+      EXPECT_EQ(ref.count((uintptr_t)entry->key - 2), 1u);
+
+   _mesa_set_resize(s, 0);
+   ASSERT_EQ(s->entries, ref.size());
+   for (uint32_t key : ref)
+      EXPECT_TRUE(_mesa_set_search(s, u32_key(key)));
+
+   _mesa_set_destroy(s, NULL);
+}
+
+TEST_P(HashTableLayout, RemoveWhileIterating)
+{
+   struct hash_table *ht = _mesa_hash_table_create_u32_keys(NULL);
+
+   for (uint32_t i = 0; i < 1000; i++)
+      _mesa_hash_table_insert(ht, u32_key(i), NULL);
+
+   hash_table_foreach(ht, entry) {
+      if (((uintptr_t)entry->key - 2) % 2)
+         _mesa_hash_table_remove(ht, entry);
+   }
+
+   EXPECT_EQ(ht->entries, 500u);
+   for (uint32_t i = 0; i < 1000; i++)
+      EXPECT_EQ(_mesa_hash_table_search(ht, u32_key(i)) != NULL, i % 2 == 0);
+
+   _mesa_hash_table_destroy(ht, NULL);
+}
+
+TEST_P(HashTableLayout, ForeachRemove)
+{
+   struct set *s = _mesa_set_create_u32_keys(NULL);
+
+   for (uint32_t i = 0; i < 100; i++)
+      _mesa_set_add(s, u32_key(i));
+
+   unsigned count = 0;
+   set_foreach_remove(s, entry)
+      count++;
+   EXPECT_EQ(count, 100u);
+
+   /* The set must be usable afterwards. */
+   for (uint32_t i = 0; i < 100; i += 2)
+      _mesa_set_add(s, u32_key(i));
+   EXPECT_EQ(s->entries, 50u);
+   for (uint32_t i = 0; i < 100; i++)
+      EXPECT_EQ(_mesa_set_search(s, u32_key(i)) != NULL, i % 2 == 0);
+
+   _mesa_set_destroy(s, NULL);
+}
+
+TEST_P(HashTableLayout, ReserveAndClone)
+{
+   struct hash_table *ht = _mesa_hash_table_create_u32_keys(NULL);
+
+   ASSERT_TRUE(_mesa_hash_table_reserve(ht, 1000));
+   struct hash_entry *table = ht->table;
+   for (uint32_t i = 0; i < 1000; i++)
+      _mesa_hash_table_insert(ht, u32_key(i), (void *)(uintptr_t)i);
+   EXPECT_EQ(ht->table, table);
+
+   _mesa_hash_table_remove_key(ht, u32_key(10));
+
+   struct hash_table *clone = _mesa_hash_table_clone(ht, NULL);
+   _mesa_hash_table_destroy(ht, NULL);
+
+   EXPECT_EQ(clone->entries, 999u);
+   for (uint32_t i = 0; i < 1000; i++) {
+      struct hash_entry *entry = _mesa_hash_table_search(clone, u32_key(i));
+      if (i == 10) {
+         EXPECT_FALSE(entry);
+      } else {
+         ASSERT_TRUE(entry);
+         EXPECT_EQ((uintptr_t)entry->data, i);
+      }
+   }
+
+   _mesa_hash_table_destroy(clone, NULL);
+}
+
+TEST(HashTableGrouped, ChurnLeavesFewTombstones)
+{
+   enum hash_table_layout old_layout = _mesa_hash_table_get_default_layout();
+   _mesa_hash_table_set_default_layout(HASH_TABLE_LAYOUT_GROUPED);
+
+   struct hash_table *ht = _mesa_hash_table_create_u32_keys(NULL);
+   std::vector<uint32_t> live;
+   std::mt19937 rand(1);
+
+   ASSERT_TRUE(_mesa_hash_table_reserve(ht, 1000));
+   for (uint32_t i = 0; i < 100; i++) {
+      _mesa_hash_table_insert(ht, u32_key(i), NULL);
+      live.push_back(i);
+   }
+   uint32_t size = ht->size;
+
+   /* Replace random entries with new ones while the table is nearly empty:
+    * no group gets full, so no tombstones are needed and the table is never
+    * rehashed.  The double hashing layout leaves one for each removal.
+    */
+   for (uint32_t i = 100; i < 100000; i++) {
+      uint32_t &victim = live[rand() % live.size()];
+      _mesa_hash_table_remove_key(ht, u32_key(victim));
+      _mesa_hash_table_insert(ht, u32_key(i), NULL);
+      victim = i;
+   }
+
+   EXPECT_EQ(ht->size, size);
+   EXPECT_EQ(ht->deleted_entries, 0u);
+   for (uint32_t key : live)
+      EXPECT_TRUE(_mesa_hash_table_search(ht, u32_key(key)));
+
+   _mesa_hash_table_destroy(ht, NULL);
+   _mesa_hash_table_set_default_layout(old_layout);
+}
+
+/* The benchmark workloads follow how NIR uses tables and sets.  The benchmark
+ * is disabled by default, run it with --gtest_also_run_disabled_tests.
+ */
+
+struct fake_alu {
+   uint32_t op;
+   const void *srcs[3];
+};
+
+static uint32_t
+fake_alu_hash(const void *data)
+{
+   return _mesa_hash_data(data, sizeof(struct fake_alu));
+}
+
+static bool
+fake_alu_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, sizeof(struct fake_alu)) == 0;
+}
+
+/* nir_opt_cse: look every instruction up in an instruction set, adding it
+ * if there is no equivalent one yet.
+ */
+static void
+bench_instr_set(const std::vector<fake_alu> &instrs)
+{
+   struct set *s = _mesa_set_create(NULL, fake_alu_hash, fake_alu_equal);
+   unsigned found_count = 0;
+
+   for (const fake_alu &instr : instrs) {
+      bool found;
+      _mesa_set_search_or_add(s, &instr, &found);
+      found_count += found;
+   }
+
+   EXPECT_GT(found_count, 0u);
+   _mesa_set_destroy(s, NULL);
+}
+
+/* Pass-local remap tables, like nir_lower_vars_to_ssa or nir_clone: a
+ * pointer table filled once and then looked up a few times per entry.
+ */
+static void
+bench_pointer_remap(const std::vector<fake_alu> &instrs,
+                    const std::vector<uint32_t> &order)
+{
+   struct hash_table *ht = _mesa_pointer_hash_table_create(NULL);
+
+   for (const fake_alu &instr : instrs)
+      _mesa_hash_table_insert(ht, &instr, (void *)&instr.srcs[0]);
+
+   for (unsigned pass = 0; pass < 4; pass++) {
+      for (uint32_t i : order)
+         ASSERT_TRUE(_mesa_hash_table_search(ht, &instrs[i]));
+   }
+
+   _mesa_hash_table_destroy(ht, NULL);
+}
+
+/* Per-block and per-variable sets, which hardly ever grow. */
+static void
+bench_small_sets(const std::vector<fake_alu> &instrs)
+{
+   for (size_t i = 0; i + 8 <= instrs.size(); i += 8) {
+      struct set *s = _mesa_pointer_set_create(NULL);
+
+      for (unsigned j = 0; j < 6; j++)
+         _mesa_set_add(s, &instrs[i + j]);
+      for (unsigned j = 0; j < 8; j++)
+         _mesa_set_search(s, &instrs[i + j]);
+
+      _mesa_set_destroy(s, NULL);
+   }
+}
+
+/* Long-lived tables with entries coming and going, like the live
+ * instruction sets of the schedulers and register allocators.
+ */
+static void
+bench_churn(const std::vector<fake_alu> &instrs,
+            const std::vector<uint32_t> &order)
+{
+   struct set *s = _mesa_pointer_set_create(NULL);
+   const size_t live = 3000;
+
+   for (size_t i = 0; i < live; i++)
+      _mesa_set_add(s, &instrs[order[i]]);
+
+   for (size_t i = live; i < order.size(); i++) {
+      _mesa_set_remove_key(s, &instrs[order[i - live]]);
+      _mesa_set_add(s, &instrs[order[i]]);
+      _mesa_set_search(s, &instrs[order[i - live / 2]]);
+   }
+
+   EXPECT_EQ(s->entries, live);
+   _mesa_set_destroy(s, NULL);
+}
+
+template <typename F>
+static double
+time_ms(enum hash_table_layout layout, F f)
+{
+   _mesa_hash_table_set_default_layout(layout);
+
+   double best = 0;
+   for (unsigned i = 0; i < 3; i++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      auto end = std::chrono::steady_clock::now();
+      double ms = std::chrono::duration<double, std::milli>(end - start).count();
+      if (i == 0 || ms < best)
+         best = ms;
+   }
+   return best;
+}
+
+TEST(HashTableLayout, DISABLED_Benchmark)
+{
+   enum hash_table_layout old_layout = _mesa_hash_table_get_default_layout();
+   std::mt19937 rand(1234);
+
+   /* Instructions whose sources mostly are other instructions, with a
+    * limited set of opcodes so that CSE finds matches.
+    */
+   std::vector<fake_alu> instrs(200000);
+   for (size_t i = 0; i < instrs.size(); i++) {
+      instrs[i].op = rand() % 32;
+      for (unsigned s = 0; s < 3; s++)
+         instrs[i].srcs[s] = &instrs[rand() % MAX2(1, i / 64 + 1)];
+   }
+
+   std::vector<uint32_t> order(instrs.size());
+   for (uint32_t i = 0; i < order.size(); i++)
+      order[i] = i;
+   std::shuffle(order.begin(), order.end(), rand);
+
+   const struct {
+      const char *name;
+      std::function<void()> run;
+   } workloads[] = {
+      { "instr set (cse)", [&]() { bench_instr_set(instrs); } },
+      { "pointer remap", [&]() { bench_pointer_remap(instrs, order); } },
+      { "small sets", [&]() { bench_small_sets(instrs); } },
+      { "insert/remove churn", [&]() { bench_churn(instrs, order); } },
+   };
+
+   printf("%-22s %16s %10s\n", "workload", "double hashing", "grouped");
+   for (const auto &workload : workloads) {
+      double old_ms = time_ms(HASH_TABLE_LAYOUT_DOUBLE_HASHING, workload.run);
+      double new_ms = time_ms(HASH_TABLE_LAYOUT_GROUPED, workload.run);
+      printf("%-22s %13.2f ms %7.2f ms\n", workload.name, old_ms, new_ms);
+   }
+
+   _mesa_hash_table_set_default_layout(old_layout);
+}
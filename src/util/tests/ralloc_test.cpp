@@ -0,0 +1,205 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ *
+ * Testing ralloc arena contexts
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string.h>
+
+#include "util/ralloc.h"
+
+static unsigned destroyed;
+
+static void
+count_destructor(void *ptr)
+{
+   destroyed++;
+}
+
+TEST(RallocArena, Tree)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   void *arena = ralloc_arena_context(mem_ctx);
+
+   char *parent = ralloc_strdup(arena, "parent");
+   char *child = ralloc_strdup(parent, "child");
+   uint64_t *big = ralloc_array(child, uint64_t, 100000);
+
+   EXPECT_EQ(ralloc_parent(parent), arena);
+   EXPECT_EQ(ralloc_parent(child), parent);
+   EXPECT_EQ(ralloc_parent(big), child);
+   EXPECT_EQ((uintptr_t)big % alignof(max_align_t), 0u);
+
+   for (unsigned i = 0; i < 100000; i++)
+      big[i] = i;
+   EXPECT_STREQ(parent, "parent");
+   EXPECT_STREQ(child, "child");
+
+   ralloc_free(child);
+   ralloc_free(mem_ctx);
+}
+
+TEST(RallocArena, Resize)
+{
+   void *arena = ralloc_arena_context(NULL);
+
+   char *str = ralloc_strdup(arena, "a");
+   char *other = ralloc_strdup(str, "other");
+   for (unsigned i = 0; i < 5000; i++)
+      ASSERT_TRUE(ralloc_strcat(&str, "b"));
+
+   EXPECT_EQ(strlen(str), 5001u);
+   EXPECT_EQ(str[0], 'a');
+   EXPECT_EQ(str[5000], 'b');
+   EXPECT_EQ(ralloc_parent(other), str);
+   EXPECT_EQ(ralloc_parent(str), arena);
+
+   /* Resizing the arena context itself keeps the arena. */
+   arena = reralloc_size(NULL, arena, 100);
+   EXPECT_EQ(ralloc_parent(str), arena);
+   void *child = ralloc_size(arena, 16);
+   EXPECT_EQ(ralloc_parent(child), arena);
+
+   ralloc_free(arena);
+}
+
+TEST(RallocArena, Destructors)
+{
+   void *arena = ralloc_arena_context(NULL);
+   destroyed = 0;
+
+   void *a = ralloc_size(arena, 16);
+   void *b = ralloc_size(a, 16);
+   void *c = ralloc_size(arena, 16);
+   ralloc_set_destructor(a, count_destructor);
+   ralloc_set_destructor(b, count_destructor);
+   ralloc_set_destructor(c, count_destructor);
+   ralloc_set_destructor(c, NULL);
+
+   ralloc_free(arena);
+   EXPECT_EQ(destroyed, 2u);
+}
+
+TEST(RallocArena, ForeignChildren)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *outside = ralloc_context(NULL);
+   destroyed = 0;
+
+   /* Children which weren't carved from the arena are still freed with it,
+    * arenas nested in it included.
+    */
+   void *a = ralloc_size(arena, 16);
+   void *b = ralloc_size(outside, 16);
+   ralloc_set_destructor(b, count_destructor);
+   ralloc_steal(a, b);
+
+   void *nested = ralloc_arena_context(a);
+   void *c = ralloc_size(nested, 16);
+   ralloc_set_destructor(c, count_destructor);
+
+   ralloc_free(outside);
+   EXPECT_EQ(destroyed, 0u);
+   ralloc_free(arena);
+   EXPECT_EQ(destroyed, 2u);
+}
+
+TEST(RallocArena, Escape)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *outside = ralloc_context(NULL);
+   destroyed = 0;
+
+   char *a = ralloc_strdup(arena, "escaped");
+   char *b = ralloc_strdup(a, "child of escaped");
+   ralloc_set_destructor(b, count_destructor);
+   ralloc_steal(outside, a);
+
+   /* The escaped blocks outlive the arena context. */
+   ralloc_free(arena);
+   EXPECT_EQ(destroyed, 0u);
+   EXPECT_STREQ(a, "escaped");
+   EXPECT_STREQ(b, "child of escaped");
+
+   /* They can still be allocated from. */
+   char *c = ralloc_strdup(a, "late");
+   EXPECT_STREQ(c, "late");
+
+   ralloc_free(outside);
+   EXPECT_EQ(destroyed, 1u);
+}
+
+TEST(RallocArena, StealBack)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *outside = ralloc_context(NULL);
+
+   void *a = ralloc_size(arena, 16);
+   ralloc_steal(NULL, a);
+   ralloc_steal(outside, a);
+   ralloc_steal(arena, a);
+   ralloc_free(outside);
+
+   void *b = ralloc_size(NULL, 16);
+   void *c = ralloc_size(arena, 16);
+   ralloc_steal(b, c);
+   ralloc_adopt(arena, b);
+   EXPECT_EQ(ralloc_parent(c), arena);
+
+   ralloc_free(b);
+   ralloc_free(arena);
+}
+
+struct ir_node {
+   struct ir_node *next;
+   const char *name;
+   int value[4];
+};
+
+/* Builds and frees trees of small objects the way the GLSL IR is built,
+ * with a context per function and names and nodes hanging off each other.
+ */
+static double
+ir_like_tree(void *(*context)(const void *))
+{
+   auto start = std::chrono::steady_clock::now();
+
+   for (unsigned i = 0; i < 200; i++) {
+      void *mem_ctx = context(NULL);
+
+      for (unsigned f = 0; f < 10; f++) {
+         void *func = ralloc_context(mem_ctx);
+         struct ir_node *prev = NULL;
+
+         for (unsigned n = 0; n < 500; n++) {
+            struct ir_node *node = rzalloc(func, struct ir_node);
+            node->next = prev;
+            if (n % 4 == 0)
+               node->name = ralloc_asprintf(node, "tmp@%u", n);
+            if (prev && n % 8 == 0)
+               ralloc_strdup(prev, "swizzle");
+            prev = node;
+         }
+      }
+
+      ralloc_free(mem_ctx);
+   }
+
+   auto end = std::chrono::steady_clock::now();
+   return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/* Run with --gtest_also_run_disabled_tests. */
+TEST(RallocArena, DISABLED_Benchmark)
+{
+   double malloced = ir_like_tree(ralloc_context);
+   double carved = ir_like_tree(ralloc_arena_context);
+
+   printf("200 trees of 10 x 500 nodes:\n");
+   printf("  ralloc_context:       %8.2f ms\n", malloced);
+   printf("  ralloc_arena_context: %8.2f ms\n", carved);
+}
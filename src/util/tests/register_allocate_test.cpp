@@ -22,6 +22,9 @@
  */
 
 #include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <vector>
 #include "ralloc.h"
 #include "register_allocate.h"
 #include "register_allocate_internal.h"
@@ -279,3 +282,218 @@ TEST_F(ra_test, serialization_roundtrip)
    blob_finish(&blob);
 }
 
+
+/* Builds the interference graph of count SSA values defined one after the
+ * other, each live for up to max_len more definitions, and returns the
+ * highest number of values live at once.
+ */
+static unsigned
+build_interval_graph(struct ra_graph *g, struct ra_class **classes,
+                     unsigned num_classes, unsigned count, unsigned max_len,
+                     unsigned seed)
+{
+   std::mt19937 rand(seed);
+   std::vector<unsigned> end(count);
+   unsigned max_live = 0;
+
+   for (unsigned n = 0; n < count; n++) {
+      ra_set_node_class(g, n, classes[rand() % num_classes]);
+      ra_set_node_spill_cost(g, n, 1 + rand() % 16);
+      end[n] = n + rand() % (max_len + 1);
+   }
+
+   for (unsigned n = 0; n < count; n++) {
+      unsigned live = 1;
+      for (unsigned n2 = n - MIN2(n, max_len); n2 < n; n2++) {
+         if (end[n2] >= n) {
+            ra_add_node_interference(g, n2, n);
+            live++;
+         }
+      }
+      max_live = MAX2(max_live, live);
+   }
+
+   return max_live;
+}
+
+static void
+check_allocation(struct ra_graph *g)
+{
+   for (unsigned n = 0; n < g->count; n++) {
+      struct ra_class *c = ra_get_node_class(g, n);
+      unsigned reg = ra_get_node_reg(g, n);
+      ASSERT_NE(reg, NO_REG);
+      ASSERT_TRUE(g->nodes[n].forced_reg != NO_REG || BITSET_TEST(c->regs, reg));
+
+      util_dynarray_foreach(&g->nodes[n].adjacency_list, unsigned int, n2) {
+         ASSERT_FALSE(ra_class_allocations_conflict(c, reg,
+                                                    ra_get_node_class(g, *n2),
+                                                    ra_get_node_reg(g, *n2)))
+            << "nodes " << n << " and " << *n2;
+      }
+   }
+}
+
+static struct ra_regs *
+contig_reg_set(void *mem_ctx, unsigned count, struct ra_class **classes,
+               unsigned num_classes)
+{
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, count, false);
+
+   for (unsigned c = 0; c < num_classes; c++) {
+      classes[c] = ra_alloc_contig_reg_class(regs, 1 << c);
+      for (unsigned r = 0; r + (1 << c) <= count; r += 1 << c)
+         ra_class_add_reg(classes[c], r);
+   }
+
+   ra_set_finalize(regs, NULL);
+   return regs;
+}
+
+TEST_F(ra_test, allocate_scan)
+{
+   for (unsigned seed = 0; seed < 10; seed++) {
+      struct ra_class *c;
+      struct ra_regs *regs = contig_reg_set(mem_ctx, 64, &c, 1);
+      struct ra_graph *g = ra_alloc_interference_graph(regs, 2000);
+      unsigned max_live = build_interval_graph(g, &c, 1, 2000, 40, seed);
+      ralloc_free(g);
+
+      /* The graph is chordal, so scanning needs as many registers as there
+       * are values live at once.
+       */
+      regs = contig_reg_set(mem_ctx, max_live, &c, 1);
+      g = ra_alloc_interference_graph(regs, 2000);
+      build_interval_graph(g, &c, 1, 2000, 40, seed);
+      ra_set_node_reg(g, 0, max_live - 1);
+
+      ASSERT_TRUE(ra_allocate_scan(g)) << "seed " << seed;
+      check_allocation(g);
+      EXPECT_EQ(ra_get_node_reg(g, 0), max_live - 1);
+      ralloc_free(g);
+
+      /* With one register less, something has to be spilled. */
+      regs = contig_reg_set(mem_ctx, max_live - 1, &c, 1);
+      g = ra_alloc_interference_graph(regs, 2000);
+      build_interval_graph(g, &c, 1, 2000, 40, seed);
+
+      EXPECT_FALSE(ra_allocate_scan(g));
+      EXPECT_GE(ra_get_best_spill_node(g), 0);
+      ralloc_free(g);
+   }
+}
+
+TEST_F(ra_test, large_graph)
+{
+   struct ra_class *classes[2];
+   struct ra_regs *regs = contig_reg_set(mem_ctx, 128, classes, 2);
+   struct ra_graph *g = ra_alloc_interference_graph(regs, 20000);
+   build_interval_graph(g, classes, 2, 20000, 20, 0);
+
+   /* Graphs this big use the adjacency lists to find duplicates. */
+   ASSERT_EQ(g->adjacency, nullptr);
+
+   unsigned q_total = g->nodes[100].q_total;
+   unsigned adjacency_count =
+      util_dynarray_num_elements(&g->nodes[100].adjacency_list, unsigned int);
+   util_dynarray_foreach(&g->nodes[100].adjacency_list, unsigned int, n2)
+      ra_add_node_interference(g, *n2, 100);
+   EXPECT_EQ(g->nodes[100].q_total, q_total);
+   EXPECT_EQ(util_dynarray_num_elements(&g->nodes[100].adjacency_list,
+                                        unsigned int), adjacency_count);
+
+   ra_reset_node_interference(g, 100);
+   ra_add_node_interference(g, 99, 100);
+   EXPECT_EQ(util_dynarray_num_elements(&g->nodes[100].adjacency_list,
+                                        unsigned int), 1u);
+
+   ASSERT_TRUE(ra_allocate(g));
+   check_allocation(g);
+
+   ralloc_free(g);
+}
+
+TEST_F(ra_test, graph_serialization_roundtrip)
+{
+   struct ra_class *classes[3];
+   struct ra_regs *regs = contig_reg_set(mem_ctx, 64, classes, 3);
+   struct ra_graph *g = ra_alloc_interference_graph(regs, 500);
+   build_interval_graph(g, classes, 3, 500, 16, 1);
+   ra_set_node_reg(g, 7, 3);
+
+   struct blob blob;
+   blob_init(&blob);
+   ra_set_serialize(regs, &blob);
+   size_t graph_offset = blob.size;
+   ra_graph_serialize(g, &blob);
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, blob.data, blob.size);
+   struct ra_regs *regs2 = ra_set_deserialize(mem_ctx, &reader);
+   struct ra_graph *g2 = ra_graph_deserialize(regs2, &reader);
+   ASSERT_NE(g2, nullptr);
+   EXPECT_EQ(reader.current, reader.end);
+
+   ASSERT_TRUE(ra_allocate(g));
+   ASSERT_TRUE(ra_allocate(g2));
+   for (unsigned n = 0; n < g->count; n++)
+      EXPECT_EQ(ra_get_node_reg(g2, n), ra_get_node_reg(g, n));
+
+   /* Truncated graphs are rejected. */
+   blob_reader_init(&reader, blob.data, blob.size - 4);
+   ra_set_deserialize(mem_ctx, &reader);
+   EXPECT_EQ(ra_graph_deserialize(regs2, &reader), nullptr);
+
+   /* So are forced registers out of the register set. */
+   uint32_t bad_reg = regs->count;
+   memcpy(blob.data + graph_offset + 4 + 7 * 12 + 4, &bad_reg, 4);
+   blob_reader_init(&reader, blob.data, blob.size);
+   ra_set_deserialize(mem_ctx, &reader);
+   EXPECT_EQ(ra_graph_deserialize(regs2, &reader), nullptr);
+
+   blob_finish(&blob);
+   ralloc_free(g);
+   ralloc_free(g2);
+}
+
+/* Compares the allocators on serialized graphs, like the ones of unrolled
+ * compute shaders, with values of one, two and four registers.  Run with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST_F(ra_test, DISABLED_benchmark)
+{
+   for (unsigned count = 2000; count <= 32000; count *= 4) {
+      struct ra_class *classes[3];
+      struct ra_regs *regs = contig_reg_set(mem_ctx, 256, classes, 3);
+      struct ra_graph *g = ra_alloc_interference_graph(regs, count);
+      build_interval_graph(g, classes, 3, count, 60, count);
+
+      struct blob blob;
+      blob_init(&blob);
+      ra_graph_serialize(g, &blob);
+      ralloc_free(g);
+
+      double ms[2];
+      bool success[2];
+      for (unsigned scan = 0; scan < 2; scan++) {
+         struct blob_reader reader;
+         blob_reader_init(&reader, blob.data, blob.size);
+         g = ra_graph_deserialize(regs, &reader);
+         ASSERT_NE(g, nullptr);
+
+         auto start = std::chrono::steady_clock::now();
+         success[scan] = scan ? ra_allocate_scan(g) : ra_allocate(g);
+         auto end = std::chrono::steady_clock::now();
+         ms[scan] = std::chrono::duration<double, std::milli>(end - start).count();
+
+         if (success[scan])
+            check_allocation(g);
+         ralloc_free(g);
+      }
+
+      printf("%6u nodes: ra_allocate %8.2f ms%s, ra_allocate_scan %8.2f ms%s\n",
+             count, ms[0], success[0] ? "" : " (failed)",
+             ms[1], success[1] ? "" : " (failed)");
+      blob_finish(&blob);
+   }
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ *
+ * Testing u_queue.h
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/u_queue.h"
+
+class UtilQueue : public ::testing::TestWithParam<unsigned> {};
+
+INSTANTIATE_TEST_SUITE_P(Flags, UtilQueue,
+                         ::testing::Values(0u, UTIL_QUEUE_INIT_WORK_STEALING),
+                         [](const ::testing::TestParamInfo<unsigned> &info) {
+                            return info.param ? "WorkStealing" : "Ring";
+                         });
+
+static void
+count_job(void *job, void *gdata, int thread_index)
+{
+   ((std::atomic<unsigned> *)job)->fetch_add(1, std::memory_order_relaxed);
+}
+
+TEST_P(UtilQueue, AllJobsRun)
+{
+   struct util_queue queue;
+   std::atomic<unsigned> count(0);
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 16, 4, GetParam(), NULL));
+
+   for (unsigned i = 0; i < 10000; i++)
+      util_queue_add_job(&queue, &count, NULL, count_job, NULL, 0);
+   util_queue_finish(&queue);
+
+   EXPECT_EQ(count, 10000u);
+   util_queue_destroy(&queue);
+}
+
+static void
+slow_job(void *job, void *gdata, int thread_index)
+{
+   std::this_thread::sleep_for(std::chrono::microseconds(200));
+   ((std::atomic<unsigned> *)job)->fetch_add(1);
+}
+
+TEST_P(UtilQueue, FinishWaitsForPreviousJobs)
+{
+   struct util_queue queue;
+   std::atomic<unsigned> count(0);
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 64, 4,
+                               GetParam() | UTIL_QUEUE_INIT_RESIZE_IF_FULL,
+                               NULL));
+
+   for (unsigned i = 0; i < 200; i++)
+      util_queue_add_job(&queue, &count, NULL, slow_job, NULL, 0);
+   util_queue_finish(&queue);
+
+   EXPECT_EQ(count, 200u);
+
+   /* With fewer threads the jobs of the terminated ones are still waited
+    * for.
+    */
+   util_queue_adjust_num_threads(&queue, 2);
+   for (unsigned i = 0; i < 200; i++)
+      util_queue_add_job(&queue, &count, NULL, slow_job, NULL, 0);
+   util_queue_adjust_num_threads(&queue, 1);
+   util_queue_finish(&queue);
+
+   EXPECT_EQ(count, 400u);
+   util_queue_destroy(&queue);
+}
+
+/* Jobs recording the order they are executed in, after the gate job that
+ * blocks the only thread of the queue until it's opened.
+ */
+struct order_job {
+   unsigned id;
+   std::mutex *mutex;
+   std::vector<unsigned> *order;
+   struct util_queue_fence fence;
+};
+
+static void
+gate_job(void *job, void *gdata, int thread_index)
+{
+   std::atomic<bool> *open = (std::atomic<bool> *)job;
+   while (!*open)
+      std::this_thread::yield();
+}
+
+static void
+order_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct order_job *job = (struct order_job *)data;
+   std::lock_guard<std::mutex> lock(*job->mutex);
+   job->order->push_back(job->id);
+}
+
+struct order_test {
+   struct util_queue queue;
+   std::atomic<bool> open;
+   struct util_queue_fence gate_fence;
+   std::mutex mutex;
+   std::vector<unsigned> order;
+   struct order_job jobs[16];
+
+   order_test(unsigned flags) : open(false)
+   {
+      EXPECT_TRUE(util_queue_init(&queue, "test", 32, 1, flags, NULL));
+      util_queue_fence_init(&gate_fence);
+      util_queue_add_job(&queue, &open, &gate_fence, gate_job, NULL, 0);
+
+      for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++) {
+         jobs[i].id = i;
+         jobs[i].mutex = &mutex;
+         jobs[i].order = &order;
+         util_queue_fence_init(&jobs[i].fence);
+      }
+   }
+
+   ~order_test()
+   {
+      util_queue_destroy(&queue);
+      for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++)
+         util_queue_fence_destroy(&jobs[i].fence);
+      util_queue_fence_destroy(&gate_fence);
+   }
+
+   void add(unsigned i, enum util_queue_priority priority)
+   {
+      util_queue_add_job_prio(&queue, &jobs[i], &jobs[i].fence,
+                              order_job_execute, NULL, 0, priority);
+   }
+};
+
+TEST(UtilQueueWorkStealing, HighPriorityFirst)
+{
+   order_test test(UTIL_QUEUE_INIT_WORK_STEALING);
+
+   for (unsigned i = 0; i < 8; i++)
+      test.add(i, UTIL_QUEUE_PRIORITY_NORMAL);
+   test.add(8, UTIL_QUEUE_PRIORITY_HIGH);
+   test.add(9, UTIL_QUEUE_PRIORITY_HIGH);
+
+   test.open = true;
+   util_queue_finish(&test.queue);
+
+   std::vector<unsigned> expected = { 8, 9, 0, 1, 2, 3, 4, 5, 6, 7 };
+   EXPECT_EQ(test.order, expected);
+}
+
+TEST(UtilQueueWorkStealing, PromoteJob)
+{
+   order_test test(UTIL_QUEUE_INIT_WORK_STEALING);
+
+   for (unsigned i = 0; i < 8; i++)
+      test.add(i, UTIL_QUEUE_PRIORITY_NORMAL);
+
+   util_queue_promote_job(&test.queue, &test.jobs[5].fence);
+
+   test.open = true;
+   util_queue_wait_job(&test.queue, &test.jobs[5].fence);
+   util_queue_finish(&test.queue);
+
+   std::vector<unsigned> expected = { 5, 0, 1, 2, 3, 4, 6, 7 };
+   EXPECT_EQ(test.order, expected);
+}
+
+TEST_P(UtilQueue, DropJob)
+{
+   order_test test(GetParam());
+
+   for (unsigned i = 0; i < 4; i++)
+      test.add(i, UTIL_QUEUE_PRIORITY_NORMAL);
+
+   util_queue_drop_job(&test.queue, &test.jobs[2].fence);
+   EXPECT_TRUE(util_queue_fence_is_signalled(&test.jobs[2].fence));
+
+   test.open = true;
+   util_queue_finish(&test.queue);
+
+   std::vector<unsigned> expected = { 0, 1, 3 };
+   EXPECT_EQ(test.order, expected);
+}
+
+#define BENCH_PRODUCERS 4
+#define BENCH_THREADS 4
+#define BENCH_JOBS_PER_PRODUCER 50000
+
+/* Job throughput with several threads adding small jobs at once, which
+ * all go through the lock of the queue unless it's work stealing.
+ */
+static double
+queue_throughput(unsigned flags)
+{
+   struct util_queue queue;
+   std::atomic<unsigned> count(0);
+
+   if (!util_queue_init(&queue, "bench", 64, BENCH_THREADS,
+                        flags | UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL))
+      return 0;
+
+   auto start = std::chrono::steady_clock::now();
+
+   std::vector<std::thread> producers;
+   for (unsigned p = 0; p < BENCH_PRODUCERS; p++) {
+      producers.emplace_back([&]() {
+         for (unsigned i = 0; i < BENCH_JOBS_PER_PRODUCER; i++)
+            util_queue_add_job(&queue, &count, NULL, count_job, NULL, 0);
+      });
+   }
+   for (auto &producer : producers)
+      producer.join();
+   util_queue_finish(&queue);
+
+   auto end = std::chrono::steady_clock::now();
+
+   EXPECT_EQ(count, BENCH_PRODUCERS * BENCH_JOBS_PER_PRODUCER);
+   util_queue_destroy(&queue);
+
+   double sec = std::chrono::duration<double>(end - start).count();
+   return count / sec;
+}
+
+TEST(UtilQueueWorkStealing, Throughput)
+{
+   double ring = queue_throughput(0);
+   double stealing = queue_throughput(UTIL_QUEUE_INIT_WORK_STEALING);
+
+   printf("%u producers, %u threads, %u jobs:\n", BENCH_PRODUCERS,
+          BENCH_THREADS, BENCH_PRODUCERS * BENCH_JOBS_PER_PRODUCER);
+   printf("  ring buffer:    %10.0f jobs/s\n", ring);
+   printf("  work stealing:  %10.0f jobs/s\n", stealing);
+}
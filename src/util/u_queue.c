@@ -28,6 +28,7 @@
 
 #include "c11/threads.h"
 #include "util/u_cpu_detect.h"
+#include "util/u_math.h"
 #include "util/os_time.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
@@ -246,6 +247,205 @@ struct thread_input {
    int thread_index;
 };
 
+static void
+util_queue_finish_execute(void *data, void *gdata, int num_thread);
+
+static bool
+deque_init(struct util_queue_deque *deque, unsigned size)
+{
+   memset(deque, 0, sizeof(*deque));
+   simple_mtx_init(&deque->lock, mtx_plain);
+   deque->size = util_next_power_of_two(MAX2(size, 1));
+   deque->jobs = (struct util_queue_job*)
+                 calloc(deque->size, sizeof(struct util_queue_job));
+   return deque->jobs != NULL;
+}
+
+static void
+deque_destroy(struct util_queue_deque *deque)
+{
+   simple_mtx_destroy(&deque->lock);
+   free(deque->jobs);
+}
+
+static void
+deque_push(struct util_queue_deque *deque, const struct util_queue_job *job)
+{
+   simple_mtx_lock(&deque->lock);
+
+   if (deque->num_queued == deque->size) {
+      /* Deques are never full, grow them instead. */
+      unsigned new_size = deque->size * 2;
+      struct util_queue_job *jobs =
+         (struct util_queue_job*)calloc(new_size,
+                                        sizeof(struct util_queue_job));
+      assert(jobs);
+
+      for (unsigned i = 0; i < deque->num_queued; i++)
+         jobs[i] = deque->jobs[(deque->read_idx + i) & (deque->size - 1)];
+
+      free(deque->jobs);
+      deque->jobs = jobs;
+      deque->read_idx = 0;
+      deque->size = new_size;
+   }
+
+   deque->jobs[(deque->read_idx + deque->num_queued) & (deque->size - 1)] =
+      *job;
+   p_atomic_inc(&deque->num_queued);
+
+   simple_mtx_unlock(&deque->lock);
+}
+
+static bool
+deque_pop(struct util_queue_deque *deque, struct util_queue_job *job)
+{
+   /* Skip empty deques without taking their lock. */
+   if (!p_atomic_read(&deque->num_queued))
+      return false;
+
+   simple_mtx_lock(&deque->lock);
+
+   if (!deque->num_queued) {
+      simple_mtx_unlock(&deque->lock);
+      return false;
+   }
+
+   *job = deque->jobs[deque->read_idx];
+   memset(&deque->jobs[deque->read_idx], 0, sizeof(struct util_queue_job));
+   deque->read_idx = (deque->read_idx + 1) & (deque->size - 1);
+   p_atomic_dec(&deque->num_queued);
+
+   simple_mtx_unlock(&deque->lock);
+   return true;
+}
+
+/* Take the job of the fence out of the deque, its slot is left as a no-op
+ * job like util_queue_drop_job() does for the ring buffer.
+ */
+static bool
+deque_remove(struct util_queue_deque *deque, struct util_queue_fence *fence,
+             struct util_queue_job *job)
+{
+   bool found = false;
+
+   if (!p_atomic_read(&deque->num_queued))
+      return false;
+
+   simple_mtx_lock(&deque->lock);
+   for (unsigned i = 0; i < deque->num_queued; i++) {
+      unsigned idx = (deque->read_idx + i) & (deque->size - 1);
+
+      if (deque->jobs[idx].fence == fence && deque->jobs[idx].job) {
+         *job = deque->jobs[idx];
+         memset(&deque->jobs[idx], 0, sizeof(struct util_queue_job));
+         found = true;
+         break;
+      }
+   }
+   simple_mtx_unlock(&deque->lock);
+
+   return found;
+}
+
+/* High priority jobs come first, then the jobs of the thread, then those of
+ * the other threads, including the threads that were terminated.
+ */
+static bool
+get_job_work_stealing(struct util_queue *queue, unsigned thread_index,
+                      struct util_queue_job *job)
+{
+   if (deque_pop(&queue->high_priority_jobs, job))
+      return true;
+
+   for (unsigned i = 0; i < queue->max_threads; i++) {
+      if (deque_pop(&queue->deques[(thread_index + i) % queue->max_threads],
+                    job))
+         return true;
+   }
+
+   return false;
+}
+
+static void
+wake_up_thread_work_stealing(struct util_queue *queue)
+{
+   /* The sleeping threads check num_queued after announcing themselves with
+    * the lock held, so either they see the new job or we see them.
+    */
+   if (p_atomic_read(&queue->num_sleeping)) {
+      mtx_lock(&queue->lock);
+      cnd_signal(&queue->has_queued_cond);
+      mtx_unlock(&queue->lock);
+   }
+}
+
+static void
+util_queue_work_stealing_thread(struct util_queue *queue, unsigned thread_index)
+{
+   while (1) {
+      struct util_queue_job job;
+
+      /* only kill threads that are above "num_threads" */
+      if (thread_index >= p_atomic_read(&queue->num_threads))
+         break;
+
+      if (!get_job_work_stealing(queue, thread_index, &job)) {
+         /* wait if the queue is empty */
+         mtx_lock(&queue->lock);
+         p_atomic_inc(&queue->num_sleeping);
+         while (thread_index < queue->num_threads &&
+                !p_atomic_read(&queue->num_queued))
+            cnd_wait(&queue->has_queued_cond, &queue->lock);
+         p_atomic_dec(&queue->num_sleeping);
+         mtx_unlock(&queue->lock);
+         continue;
+      }
+
+      p_atomic_dec(&queue->num_queued);
+      if (job.job)
+         p_atomic_add(&queue->total_jobs_size, -job.job_size);
+
+      if (p_atomic_read(&queue->num_waiting_for_space)) {
+         mtx_lock(&queue->lock);
+         cnd_broadcast(&queue->has_space_cond);
+         mtx_unlock(&queue->lock);
+      }
+
+      if (job.job) {
+         job.execute(job.job, job.global_data, thread_index);
+         if (job.fence)
+            util_queue_fence_signal(job.fence);
+         if (job.cleanup)
+            job.cleanup(job.job, job.global_data, thread_index);
+      }
+   }
+
+   mtx_lock(&queue->lock);
+   if (queue->num_threads == 0) {
+      /* signal remaining jobs if all threads are being terminated */
+      struct util_queue_job job;
+
+      while (get_job_work_stealing(queue, thread_index, &job)) {
+         if (job.job && job.fence)
+            util_queue_fence_signal(job.fence);
+         p_atomic_dec(&queue->num_queued);
+      }
+   } else {
+      /* Hand the jobs of the thread over to a remaining one, so that
+       * util_queue_finish() still waits for them.
+       */
+      struct util_queue_deque *deque = &queue->deques[thread_index];
+      struct util_queue_deque *dst =
+         &queue->deques[thread_index % queue->num_threads];
+      struct util_queue_job job;
+
+      while (deque_pop(deque, &job))
+         deque_push(dst, &job);
+   }
+   mtx_unlock(&queue->lock);
+}
+
 static int
 util_queue_thread_func(void *input)
 {
@@ -279,6 +479,11 @@ util_queue_thread_func(void *input)
       u_thread_setname(name);
    }
 
+   if (queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      util_queue_work_stealing_thread(queue, thread_index);
+      return 0;
+   }
+
    while (1) {
       struct util_queue_job job;
 
@@ -457,6 +662,20 @@ util_queue_init(struct util_queue *queue,
    if (!queue->threads)
       goto fail;
 
+   if (flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      queue->deques = (struct util_queue_deque*)
+                      calloc(queue->max_threads, sizeof(struct util_queue_deque));
+      if (!queue->deques)
+         goto fail;
+
+      for (i = 0; i < queue->max_threads; i++) {
+         if (!deque_init(&queue->deques[i], max_jobs))
+            goto fail;
+      }
+      if (!deque_init(&queue->high_priority_jobs, 8))
+         goto fail;
+   }
+
    /* start threads */
    for (i = 0; i < queue->num_threads; i++) {
       if (!util_queue_create_thread(queue, i)) {
@@ -477,6 +696,14 @@ util_queue_init(struct util_queue *queue,
 fail:
    free(queue->threads);
 
+   if (queue->deques) {
+      for (i = 0; i < queue->max_threads; i++)
+         deque_destroy(&queue->deques[i]);
+      free(queue->deques);
+   }
+   if (queue->high_priority_jobs.jobs)
+      deque_destroy(&queue->high_priority_jobs);
+
    if (queue->jobs) {
       cnd_destroy(&queue->has_space_cond);
       cnd_destroy(&queue->has_queued_cond);
@@ -542,6 +769,81 @@ util_queue_destroy(struct util_queue *queue)
    mtx_destroy(&queue->lock);
    free(queue->jobs);
    free(queue->threads);
+
+   if (queue->deques) {
+      for (unsigned i = 0; i < queue->max_threads; i++)
+         deque_destroy(&queue->deques[i]);
+      free(queue->deques);
+      deque_destroy(&queue->high_priority_jobs);
+   }
+}
+
+/* Add a job to the given deque, or to the next one for deque_index < 0. */
+static void
+add_job_work_stealing(struct util_queue *queue,
+                      void *job,
+                      struct util_queue_fence *fence,
+                      util_queue_execute_func execute,
+                      util_queue_execute_func cleanup,
+                      const size_t job_size,
+                      enum util_queue_priority priority,
+                      int deque_index)
+{
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+   if (num_threads == 0) {
+      /* well no good option here, but any leaks will be
+       * short-lived as things are shutting down..
+       */
+      return;
+   }
+
+   if (fence)
+      util_queue_fence_reset(fence);
+
+   /* Scale the number of threads up if there's already one job waiting. */
+   if (p_atomic_read(&queue->num_queued) > 0 &&
+       queue->flags & UTIL_QUEUE_INIT_SCALE_THREADS &&
+       execute != util_queue_finish_execute &&
+       num_threads < queue->max_threads) {
+      util_queue_adjust_num_threads(queue, num_threads + 1);
+   }
+
+   /* max_jobs is only a soft limit here, the deques grow as needed. */
+   if (p_atomic_read(&queue->num_queued) >= queue->max_jobs &&
+       !(queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL &&
+         p_atomic_read(&queue->total_jobs_size) + job_size < S_256MB)) {
+      /* Wait until there is a free slot. */
+      mtx_lock(&queue->lock);
+      p_atomic_inc(&queue->num_waiting_for_space);
+      while (p_atomic_read(&queue->num_queued) >= queue->max_jobs &&
+             queue->num_threads)
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+      p_atomic_dec(&queue->num_waiting_for_space);
+      mtx_unlock(&queue->lock);
+   }
+
+   struct util_queue_job ptr = {
+      .job = job,
+      .global_data = queue->global_data,
+      .job_size = job_size,
+      .fence = fence,
+      .execute = execute,
+      .cleanup = cleanup,
+   };
+
+   struct util_queue_deque *deque;
+   if (deque_index >= 0)
+      deque = &queue->deques[deque_index];
+   else if (priority == UTIL_QUEUE_PRIORITY_HIGH)
+      deque = &queue->high_priority_jobs;
+   else
+      deque = &queue->deques[p_atomic_inc_return(&queue->next_deque) % num_threads];
+
+   deque_push(deque, &ptr);
+   p_atomic_add(&queue->total_jobs_size, job_size);
+   p_atomic_inc(&queue->num_queued);
+
+   wake_up_thread_work_stealing(queue);
 }
 
 void
@@ -551,9 +853,28 @@ util_queue_add_job(struct util_queue *queue,
                    util_queue_execute_func execute,
                    util_queue_execute_func cleanup,
                    const size_t job_size)
+{
+   util_queue_add_job_prio(queue, job, fence, execute, cleanup, job_size,
+                           UTIL_QUEUE_PRIORITY_NORMAL);
+}
+
+void
+util_queue_add_job_prio(struct util_queue *queue,
+                        void *job,
+                        struct util_queue_fence *fence,
+                        util_queue_execute_func execute,
+                        util_queue_execute_func cleanup,
+                        const size_t job_size,
+                        enum util_queue_priority priority)
 {
    struct util_queue_job *ptr;
 
+   if (queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      add_job_work_stealing(queue, job, fence, execute, cleanup, job_size,
+                            priority, -1);
+      return;
+   }
+
    mtx_lock(&queue->lock);
    if (queue->num_threads == 0) {
       mtx_unlock(&queue->lock);
@@ -646,6 +967,18 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
+   if (queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      struct util_queue_job job;
+
+      removed = deque_remove(&queue->high_priority_jobs, fence, &job);
+      for (unsigned i = 0; !removed && i < queue->max_threads; i++)
+         removed = deque_remove(&queue->deques[i], fence, &job);
+
+      if (removed && job.cleanup)
+         job.cleanup(job.job, queue->global_data, -1);
+      goto done;
+   }
+
    mtx_lock(&queue->lock);
    for (unsigned i = queue->read_idx; i != queue->write_idx;
         i = (i + 1) % queue->max_jobs) {
@@ -661,12 +994,40 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    }
    mtx_unlock(&queue->lock);
 
+done:
    if (removed)
       util_queue_fence_signal(fence);
    else
       util_queue_fence_wait(fence);
 }
 
+/**
+ * Move a queued job ahead of the jobs of normal priority, e.g. because
+ * something is about to wait for it. This does nothing if the job has
+ * started execution already, or if the queue wasn't initialized with
+ * UTIL_QUEUE_INIT_WORK_STEALING.
+ */
+void
+util_queue_promote_job(struct util_queue *queue,
+                       struct util_queue_fence *fence)
+{
+   struct util_queue_job job;
+
+   if (!(queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) ||
+       util_queue_fence_is_signalled(fence))
+      return;
+
+   for (unsigned i = 0; i < queue->max_threads; i++) {
+      if (deque_remove(&queue->deques[i], fence, &job)) {
+         /* The slot left behind still counts as a queued job. */
+         deque_push(&queue->high_priority_jobs, &job);
+         p_atomic_inc(&queue->num_queued);
+         wake_up_thread_work_stealing(queue);
+         return;
+      }
+   }
+}
+
 /**
  * Wait until all previously added jobs have completed.
  */
@@ -693,8 +1054,18 @@ util_queue_finish(struct util_queue *queue)
 
    for (unsigned i = 0; i < queue->num_threads; ++i) {
       util_queue_fence_init(&fences[i]);
-      util_queue_add_job(queue, &barrier, &fences[i],
-                         util_queue_finish_execute, NULL, 0);
+
+      /* Every thread takes the jobs of its deque in order, so the barrier
+       * job of each deque only starts once the jobs before it have.
+       */
+      if (queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+         add_job_work_stealing(queue, &barrier, &fences[i],
+                               util_queue_finish_execute, NULL, 0,
+                               UTIL_QUEUE_PRIORITY_NORMAL, i);
+      } else {
+         util_queue_add_job(queue, &barrier, &fences[i],
+                            util_queue_finish_execute, NULL, 0);
+      }
    }
 
    for (unsigned i = 0; i < queue->num_threads; ++i) {
@@ -51,6 +51,15 @@ extern "C" {
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
 #define UTIL_QUEUE_INIT_SCALE_THREADS             (1 << 3)
+#define UTIL_QUEUE_INIT_WORK_STEALING             (1 << 4)
+
+/* Only queues initialized with UTIL_QUEUE_INIT_WORK_STEALING take priorities
+ * into account.
+ */
+enum util_queue_priority {
+   UTIL_QUEUE_PRIORITY_NORMAL,
+   UTIL_QUEUE_PRIORITY_HIGH,
+};
 
 #if UTIL_FUTEX_SUPPORTED
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -202,6 +211,15 @@ struct util_queue_job {
    util_queue_execute_func cleanup;
 };
 
+/* Ring buffer of jobs with its own lock, see UTIL_QUEUE_INIT_WORK_STEALING */
+struct util_queue_deque {
+   simple_mtx_t lock;
+   unsigned size; /* power of two */
+   unsigned read_idx;
+   unsigned num_queued; /* also read without the lock */
+   struct util_queue_job *jobs;
+};
+
 /* Put this into your context. */
 struct util_queue {
    char name[14]; /* 13 characters = the thread name without the index */
@@ -220,6 +238,20 @@ struct util_queue {
    struct util_queue_job *jobs;
    void *global_data;
 
+   /* UTIL_QUEUE_INIT_WORK_STEALING: the jobs are spread over one deque per
+    * thread instead of the ring buffer, every thread takes the jobs of its
+    * deque and those of the others once it runs out, so that adding and
+    * taking jobs doesn't go through a single lock. The high priority jobs
+    * and the promoted ones have a deque of their own, which every thread
+    * checks first. num_queued and total_jobs_size are updated atomically,
+    * "lock" is only taken to sleep or wake threads up.
+    */
+   struct util_queue_deque *deques;
+   struct util_queue_deque high_priority_jobs;
+   unsigned next_deque;
+   int num_sleeping;
+   int num_waiting_for_space;
+
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
 };
@@ -239,8 +271,31 @@ void util_queue_add_job(struct util_queue *queue,
                         util_queue_execute_func execute,
                         util_queue_execute_func cleanup,
                         const size_t job_size);
+void util_queue_add_job_prio(struct util_queue *queue,
+                             void *job,
+                             struct util_queue_fence *fence,
+                             util_queue_execute_func execute,
+                             util_queue_execute_func cleanup,
+                             const size_t job_size,
+                             enum util_queue_priority priority);
 void util_queue_drop_job(struct util_queue *queue,
                          struct util_queue_fence *fence);
+void util_queue_promote_job(struct util_queue *queue,
+                            struct util_queue_fence *fence);
+
+/**
+ * Wait for a job, after moving it ahead of the jobs of normal priority if it
+ * hasn't started yet, for when it's blocking something right now.
+ */
+static inline void
+util_queue_wait_job(struct util_queue *queue, struct util_queue_fence *fence)
+{
+   if (util_queue_fence_is_signalled(fence))
+      return;
+
+   util_queue_promote_job(queue, fence);
+   util_queue_fence_wait(fence);
+}
 
 void util_queue_finish(struct util_queue *queue);
 